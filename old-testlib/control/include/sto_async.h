@@ -2,6 +2,8 @@
 #define _STO_ASYNC_H_
 
 #include <spdk/stdinc.h>
+#include <spdk/thread.h>
+#include <spdk/log.h>
 #include <spdk/likely.h>
 
 typedef void (*sto_generic_cb)(void *cb_arg, int rc);
@@ -47,4 +49,53 @@ sto_generic_cpl_cb(void *priv, int rc)
 	sto_generic_call_cpl(priv, rc);
 }
 
+struct sto_generic_thread_cpl {
+	struct sto_generic_cpl cpl;
+	int rc;
+};
+
+static inline void
+sto_generic_thread_cpl_msg(void *ctx)
+{
+	struct sto_generic_thread_cpl *tcpl = ctx;
+
+	tcpl->cpl.cb_fn(tcpl->cpl.cb_arg, tcpl->rc);
+
+	free(tcpl);
+}
+
+/*
+ * Completes an operation on @thread, the thread it was started on,
+ * in place when that is the current one.
+ */
+static inline void
+sto_generic_call_on_thread(struct spdk_thread *thread, sto_generic_cb cb_fn, void *cb_arg, int rc)
+{
+	struct sto_generic_thread_cpl *tcpl;
+
+	if (thread == spdk_get_thread()) {
+		cb_fn(cb_arg, rc);
+		return;
+	}
+
+	tcpl = calloc(1, sizeof(*tcpl));
+	if (spdk_unlikely(!tcpl)) {
+		SPDK_ERRLOG("CRITICAL: Failed to alloc a completion for thread %s\n",
+			    spdk_thread_get_name(thread));
+		assert(0);
+		return;
+	}
+
+	tcpl->cpl.cb_fn = cb_fn;
+	tcpl->cpl.cb_arg = cb_arg;
+	tcpl->rc = rc;
+
+	if (spdk_unlikely(spdk_thread_send_msg(thread, sto_generic_thread_cpl_msg, tcpl))) {
+		SPDK_ERRLOG("CRITICAL: Failed to send a completion to thread %s\n",
+			    spdk_thread_get_name(thread));
+		free(tcpl);
+		assert(0);
+	}
+}
+
 #endif /* _STO_ASYNC_H_ */
@@ -1,11 +1,16 @@
 #ifndef _STO_CLIENT_H_
 #define _STO_CLIENT_H_
 
+#include <spdk/stdinc.h>
+
 struct spdk_json_write_ctx;
 struct spdk_jsonrpc_client_response;
 
 #define STO_LOCAL_SERVER_ADDR "/var/tmp/sto_server.sock"
 
+#define STO_CLIENT_DEFAULT_CONNS	4
+#define STO_CLIENT_MAX_CONNS		64
+
 typedef void (*sto_client_dump_params_t)(void *priv, struct spdk_json_write_ctx *w);
 typedef void (*sto_client_response_handler_t)(void *priv,
 					      struct spdk_jsonrpc_client_response *resp,
@@ -16,11 +21,53 @@ struct sto_client_args {
 	sto_client_response_handler_t response_handler;
 };
 
-int sto_client_connect(const char *addr, int addr_family);
+/*
+ * Opens @nr_conns persistent connections. Requests are pipelined over
+ * them, each one goes to the connection with the fewest in flight.
+ *
+ * A client belongs to the spdk_thread it is connected on and requests
+ * go through the client of the thread they are sent from. Other threads
+ * get their own with sto_client_thread_connect(), set up the same way,
+ * and close it before sto_client_close().
+ */
+int sto_client_connect(const char *addr, int addr_family, uint32_t nr_conns);
 void sto_client_close(void);
 
+int sto_client_thread_connect(void);
+void sto_client_thread_close(void);
+
 int sto_client_send(const char *method_name,
 		    void *params, sto_client_dump_params_t dump_params,
 		    struct sto_client_args *args);
 
+/*
+ * Optional binary framing channel, see sto_bin.h. Payload bytes travel
+ * unescaped next to the JSON params. @resp is NULL when @rc is set.
+ */
+struct sto_client_bin_response {
+	int status;
+	const char *payload;
+	uint32_t payload_len;
+};
+
+typedef void (*sto_client_bin_response_handler_t)(void *priv,
+						  struct sto_client_bin_response *resp,
+						  int rc);
+
+struct sto_client_bin_args {
+	void *priv;
+	sto_client_bin_response_handler_t response_handler;
+};
+
+int sto_client_bin_connect(const char *addr);
+/* Connects the calling thread if sto_client_bin_connect() negotiated, 0 otherwise */
+int sto_client_bin_thread_connect(void);
+/* Closes the binary client of the calling thread */
+void sto_client_bin_close(void);
+bool sto_client_bin_enabled(void);
+
+int sto_client_send_bin(uint16_t opcode, void *params, sto_client_dump_params_t dump_params,
+			const void *payload, uint32_t payload_len,
+			struct sto_client_bin_args *args);
+
 #endif /* _STO_CLIENT_H_ */
@@ -5,11 +5,12 @@
 #include <spdk/queue.h>
 
 struct sto_json_iter;
+struct sto_phash;
 
 struct sto_core_component {
 	const char *name;
 
-	const struct sto_shash *(*get_ops_map)(const char *object_name);
+	const struct sto_phash *(*get_ops_map)(const char *object_name, uint32_t len);
 	void (*init)(void);
 	void (*fini)(void);
 
@@ -18,9 +19,17 @@ struct sto_core_component {
 	TAILQ_ENTRY(sto_core_component) list;
 };
 
-struct sto_core_component *sto_core_component_find(const char *name, bool skip_internal);
+struct sto_core_component *sto_core_component_lookup(const char *name, uint32_t len,
+						     bool skip_internal);
+
+static inline struct sto_core_component *
+sto_core_component_find(const char *name, bool skip_internal)
+{
+	return sto_core_component_lookup(name, strlen(name), skip_internal);
+}
+
 void sto_core_add_component(struct sto_core_component *component);
-const struct sto_shash *sto_core_component_decode(const struct sto_json_iter *iter,
+const struct sto_phash *sto_core_component_decode(const struct sto_json_iter *iter,
 						  bool internal_user);
 
 typedef void (*sto_core_component_init_fn)(void *cb_arg, int rc);
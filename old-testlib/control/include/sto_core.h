@@ -8,7 +8,9 @@
 
 struct spdk_json_write_ctx;
 struct sto_core_req;
+struct sto_core_shard;
 struct spdk_json_val;
+struct spdk_thread;
 struct sto_req;
 
 typedef void (*sto_core_req_done_t)(struct sto_core_req *req);
@@ -31,21 +33,51 @@ struct sto_core_req {
 	void *priv;
 	sto_core_req_done_t done;
 
+	/* The thread the req was submitted on, done is called there */
+	struct spdk_thread *thread;
+
 	TAILQ_ENTRY(sto_core_req) list;
 
+	/* Hash of the object name requests with the same key are ordered by */
+	struct sto_core_shard *shard;
+	uint64_t key;
+	bool keyed;
+	bool key_held;
+	TAILQ_ENTRY(sto_core_req) key_list;
+
+	/* Time spent waiting in the core queue, in ticks */
+	uint64_t queue_ticks;
+	uint64_t queue_wait_ticks;
+
 	bool internal;
 };
 
+#define STO_CORE_DEFAULT_SHARDS	4
+#define STO_CORE_MAX_SHARDS	64
+
+struct sto_core_opts {
+	/* Spin pollers on the request queues instead of waking up on messages */
+	bool busy_poll;
+
+	/* Each shard is an spdk_thread with its own engine and server client */
+	uint32_t nr_shards;
+};
+
 typedef void (*sto_core_init_fn)(void *cb_arg, int rc);
 typedef void (*sto_core_fini_fn)(void *cb_arg);
 
-void sto_core_init(sto_core_init_fn cb_fn, void *cb_arg);
+void sto_core_opts_init(struct sto_core_opts *opts);
+
+void sto_core_init(const struct sto_core_opts *opts, sto_core_init_fn cb_fn, void *cb_arg);
 void sto_core_fini(sto_core_fini_fn cb_fn, void *cb_arg);
 
 const char *sto_core_req_state_name(enum sto_core_req_state state);
 
 void sto_core_req_free(struct sto_core_req *req);
 
+/* Core queue plus pipeline queue wait, not the time spent in the steps */
+uint64_t sto_core_req_queue_wait_us(struct sto_core_req *req);
+
 int sto_core_process(const struct spdk_json_val *params, sto_core_req_done_t done, void *priv);
 int sto_core_process_raw(const struct sto_json_head_raw *head,
 			 sto_core_req_done_t done, void *priv);
@@ -4,24 +4,37 @@
 #include <spdk/queue.h>
 #include <spdk/util.h>
 
-struct sto_hash_elem {
-	LIST_ENTRY(sto_hash_elem) list;
+struct sto_hash;
 
+struct sto_hash_elem {
 	const void *key;
 	uint32_t key_len;
+
+	/* Filled in by sto_hash_add() */
+	uint32_t hash;
+	struct sto_hash *ht;
 };
 
-struct sto_bucket_table;
+struct sto_hash_table;
 
+/*
+ * Open addressing (Robin Hood) table of element pointers. It doubles once
+ * it is 3/4 full: the old table is kept and drained a few slots at a time
+ * by the following adds and removes, lookups check both of them meanwhile.
+ */
 struct sto_hash {
 	uint32_t seed;
-	struct sto_bucket_table *tbl;
+	struct sto_hash_table *tbl;
+
+	struct sto_hash_table *old_tbl;
+	uint32_t migrate_pos;
 };
 
+/* Elements must not be added or removed while iterating */
 struct sto_hash_iter {
-	struct sto_bucket_table *tbl;
+	const struct sto_hash *ht;
+	struct sto_hash_table *tbl;
 	uint32_t slot;
-	struct sto_hash_elem *he;
 };
 
 struct sto_shash {
@@ -37,27 +50,25 @@ sto_hash_elem_init(struct sto_hash_elem *he, const void *key, uint32_t key_len)
 {
 	he->key = key;
 	he->key_len = key_len;
+	he->hash = 0;
+	he->ht = NULL;
 }
 
-static inline void
-sto_hash_elem_del(struct sto_hash_elem *he)
-{
-	LIST_REMOVE(he, list);
-}
+void sto_hash_elem_del(struct sto_hash_elem *he);
 
 int sto_hash_init(struct sto_hash *ht, uint32_t size);
 void sto_hash_destroy(struct sto_hash *ht);
 bool sto_hash_empty(struct sto_hash *ht);
 
-void sto_hash_add(struct sto_hash *ht, struct sto_hash_elem *he);
+int sto_hash_add(struct sto_hash *ht, struct sto_hash_elem *he);
 struct sto_hash_elem *sto_hash_lookup(const struct sto_hash *ht, const void *key, uint32_t key_len);
 
 static inline void
 sto_hash_iter_init(struct sto_hash_iter *iter, const struct sto_hash *ht)
 {
+	iter->ht = ht;
 	iter->tbl = ht->tbl;
 	iter->slot = 0;
-	iter->he = NULL;
 }
 
 struct sto_hash_elem *sto_hash_iter_next(struct sto_hash_iter *iter);
@@ -89,4 +100,46 @@ sto_shash_iter_init(struct sto_shash_iter *iter, const struct sto_shash *sht)
 
 void *sto_shash_iter_next(struct sto_shash_iter *iter);
 
+/*
+ * Perfect hash over a key set known up front, e.g. the op names
+ * of a table. A lookup hashes the key twice to get its only possible
+ * slot and does a single compare to reject unknown keys.
+ */
+struct sto_phash_key {
+	const void *key;
+	uint32_t key_len;
+	const void *value;
+};
+
+struct sto_phash_slot;
+
+struct sto_phash {
+	uint32_t bucket_mask;
+	uint32_t slot_mask;
+
+	uint32_t *seeds;
+	struct sto_phash_slot *slots;
+};
+
+int sto_phash_build(struct sto_phash *ph, const struct sto_phash_key *keys, uint32_t nr_keys);
+
+/*
+ * Builds @ph over the objects @next_fn walks through (it gets NULL for the
+ * first one and returns NULL past the last), each keyed by its @key_fn name.
+ */
+typedef const void *(*sto_phash_next_t)(const void *obj, void *ctx);
+typedef const char *(*sto_phash_key_t)(const void *obj);
+
+int sto_phash_build_from(struct sto_phash *ph, sto_phash_next_t next_fn,
+			 sto_phash_key_t key_fn, void *ctx);
+void sto_phash_destroy(struct sto_phash *ph);
+
+static inline bool
+sto_phash_built(const struct sto_phash *ph)
+{
+	return ph->slots != NULL;
+}
+
+const void *sto_phash_lookup(const struct sto_phash *ph, const void *key, uint32_t key_len);
+
 #endif /* _STO_HASH_H_ */
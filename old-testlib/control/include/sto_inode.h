@@ -15,6 +15,7 @@ enum sto_inode_type {
 
 struct sto_tree_node;
 struct sto_inode;
+struct sto_arena;
 
 typedef int (*sto_inode_read_t)(struct sto_inode *inode);
 typedef int (*sto_inode_read_done_t)(struct sto_inode *inode);
@@ -37,6 +38,9 @@ struct sto_inode {
 
 	struct sto_inode_ops *ops;
 	struct sto_tree_node *node;
+
+	/* Set if the inode and all it points to live in the tree arena */
+	struct sto_arena *arena;
 };
 
 static inline bool
@@ -80,8 +84,16 @@ sto_dir_inode(struct sto_inode *inode)
 	return SPDK_CONTAINEROF(inode, struct sto_dir_inode, inode);
 }
 
-struct sto_inode *sto_inode_create(const char *name, const char *path,
-				   uint32_t mode, ...);
+struct sto_inode *sto_inode_create(struct sto_arena *arena, const char *name,
+				   const char *path, uint32_t mode, ...);
+/*
+ * sto_inode_read() queues the inode on its tree walk unless there is
+ * nothing to read, the walk calls sto_inode_read_submit() when there is
+ * room for one more RPC.
+ */
 void sto_inode_read(struct sto_inode *inode);
+void sto_inode_read_submit(struct sto_inode *inode);
+
+int sto_file_inode_set_buf(struct sto_inode *inode, const char *buf, size_t len);
 
 #endif /* _STO_INODE_H_ */
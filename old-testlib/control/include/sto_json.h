@@ -61,6 +61,11 @@ const struct spdk_json_val *sto_json_iter_cut_tail(const struct sto_json_iter *i
 int sto_json_iter_decode_name(const struct sto_json_iter *iter, char **value);
 int sto_json_iter_decode_str(const struct sto_json_iter *iter, const char *name, char **value);
 
+/* Same as above, but point to the string in the parsed buffer instead of copying it */
+int sto_json_iter_name_val(const struct sto_json_iter *iter, const struct spdk_json_val **value);
+int sto_json_iter_str_val(const struct sto_json_iter *iter, const char *name,
+			  const struct spdk_json_val **value);
+
 struct sto_json_str_field {
 	char *name;
 	char *value;
@@ -81,12 +86,24 @@ struct sto_json_async_iter;
 typedef void (*sto_json_async_iterate_t)(struct sto_json_async_iter *iter);
 typedef struct spdk_json_val *(*sto_json_async_iter_next_t)(struct spdk_json_val *json,
 							    struct spdk_json_val *object);
-
+typedef bool (*sto_json_async_iter_barrier_t)(struct spdk_json_val *json,
+					      struct spdk_json_val *object);
+
+/*
+ * Up to @max_inflight objects are iterated at once, 0 or 1 keeps them
+ * strictly one after another. The iteration completes with the first
+ * error once the objects in flight are done, no new ones are started
+ * after it. An object for which @barrier_fn returns true waits for all
+ * the previous ones and runs alone.
+ */
 struct sto_json_async_iter_opts {
 	struct spdk_json_val *json;
 
 	sto_json_async_iterate_t iterate_fn;
 	sto_json_async_iter_next_t next_fn;
+	sto_json_async_iter_barrier_t barrier_fn;
+
+	uint32_t max_inflight;
 
 	void *priv;
 };
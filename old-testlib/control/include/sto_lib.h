@@ -231,9 +231,18 @@ struct sto_op_table {
 		.size = SPDK_COUNTOF(_ops),	\
 	}
 
-struct sto_shash;
+struct sto_phash;
 
-int sto_ops_map_init(const struct sto_shash *ops_map, const struct sto_op_table *op_table);
-const struct sto_ops *sto_ops_map_find(const struct sto_shash *ops_map, const char *op_name);
+int sto_ops_map_init(const struct sto_phash *ops_map, const struct sto_op_table *op_table);
+void sto_ops_map_destroy(const struct sto_phash *ops_map);
+
+const struct sto_ops *sto_ops_map_lookup(const struct sto_phash *ops_map,
+					 const char *op_name, uint32_t len);
+
+static inline const struct sto_ops *
+sto_ops_map_find(const struct sto_phash *ops_map, const char *op_name)
+{
+	return sto_ops_map_lookup(ops_map, op_name, strlen(op_name));
+}
 
 #endif /* _STO_LIB_H_ */
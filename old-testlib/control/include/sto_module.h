@@ -16,7 +16,7 @@ struct sto_module_ops {
 struct sto_module {
 	const char *name;
 
-	const struct sto_shash ops_map;
+	const struct sto_phash ops_map;
 	const struct sto_op_table *op_table;
 
 	struct sto_module_ops *ops;
@@ -12,11 +12,18 @@
 struct sto_pipeline_action;
 TAILQ_HEAD(sto_pipeline_action_list, sto_pipeline_action);
 
+struct sto_pipeline_action_hndl;
+struct sto_pipeline_step;
+struct sto_pipeline_parallel;
+
 typedef void (*sto_pipeline_ctx_deinit_t)(void *ctx);
 
 struct sto_pipeline_type {
 	void *ctx;
 	sto_pipeline_ctx_deinit_t ctx_deinit_fn;
+
+	/* ctx shares the allocation of the pipeline */
+	bool ctx_embedded;
 };
 
 struct sto_pipeline_engine;
@@ -32,24 +39,57 @@ struct sto_pipeline {
 	bool rollback;
 	bool auto_release;
 
-	struct sto_pipeline_action *cur_rollback;
+	/* The current step may continue inline, see pipeline_action() */
+	bool in_step;
+	bool step_done_inline;
+
+	/* Size of the block from sto_pipeline_alloc(), ctx included */
+	size_t alloc_size;
+
+	/*
+	 * Static steps are run in place from the properties by index, the
+	 * action queues only hold steps inserted at runtime and go first.
+	 */
+	const struct sto_pipeline_step *steps;
+	uint32_t step_idx;
+	bool step_started;
 
 	struct sto_pipeline_action_list action_queue;
 	struct sto_pipeline_action_list action_queue_todo;
-	struct sto_pipeline_action_list rollback_stack;
+
+	struct sto_pipeline_action_hndl *rollback_stack;
+	uint32_t rollback_cnt;
+	uint32_t rollback_size;
+	bool rollback_pending;
+
+	/* State of the parallel steps started, kept for their rollback */
+	struct sto_pipeline_parallel *parallel_list;
 
 	TAILQ_ENTRY(sto_pipeline) list;
 
+	/* Time spent waiting in the engine queue between steps, in ticks */
+	uint64_t queue_ticks;
+	uint64_t queue_wait_ticks;
+
 	sto_generic_cb cb_fn;
 	void *cb_arg;
+
+	/* The thread the pipeline was started on, cb_fn is called there */
+	struct spdk_thread *cb_thread;
 };
 
 typedef void (*sto_pl_action_basic_t)(struct sto_pipeline *pipe);
 typedef int (*sto_pl_action_constructor_t)(struct sto_pipeline *pipe);
 
+/* Returns the number of children of a parallel step or a negative errno */
+typedef int (*sto_pl_parallel_count_t)(struct sto_pipeline *pipe);
+typedef void (*sto_pl_parallel_child_t)(struct sto_pipeline *pipe, uint32_t idx,
+					sto_generic_cb cb_fn, void *cb_arg);
+
 enum sto_pipeline_step_type {
 	STO_PL_STEP_BASIC,
 	STO_PL_STEP_CONSTRUCTOR,
+	STO_PL_STEP_PARALLEL,
 	STO_PL_STEP_TERMINATOR,
 	STO_PL_STEP_CNT,
 };
@@ -68,6 +108,13 @@ struct sto_pipeline_step {
 			sto_pl_action_constructor_t rollback_fn;
 		} constructor;
 
+		struct {
+			sto_pl_parallel_count_t count_fn;
+			sto_pl_parallel_child_t child_fn;
+			sto_pl_parallel_child_t rollback_fn;
+			uint32_t max_inflight;
+		} parallel;
+
 		struct {
 		} terminator;
 	} u;
@@ -87,6 +134,20 @@ struct sto_pipeline_step {
 		.u.constructor.rollback_fn = _destructor_fn,		\
 	}
 
+/*
+ * Runs child_fn for every child, at most @_max_inflight at once (0 means
+ * no limit). The step completes with the first error once all children
+ * are done, after the children that succeeded have been rolled back.
+ */
+#define STO_PL_STEP_PARALLEL(_count_fn, _child_fn, _rollback_fn, _max_inflight)	\
+	{									\
+		.type = STO_PL_STEP_PARALLEL,					\
+		.u.parallel.count_fn = _count_fn,				\
+		.u.parallel.child_fn = _child_fn,				\
+		.u.parallel.rollback_fn = _rollback_fn,				\
+		.u.parallel.max_inflight = _max_inflight,			\
+	}
+
 #define STO_PL_STEP_TERMINATOR()		\
 	{					\
 		.type = STO_PL_STEP_TERMINATOR,	\
@@ -101,12 +162,24 @@ struct sto_pipeline_properties {
 
 TAILQ_HEAD(sto_pipeline_list, sto_pipeline);
 
+/*
+ * An engine wakes up on a thread message sent when its queue becomes
+ * non-empty, or spins a poller on the queue in busy poll mode.
+ */
 struct sto_pipeline_engine {
 	const char *name;
+	struct spdk_thread *thread;
 	struct spdk_poller *poller;
 	struct sto_pipeline_list pipeline_list;
+
+	bool busy_poll;
+	bool kicked;
+	bool destroying;
 };
 
+/* Applies to engines created afterwards */
+void sto_pipeline_set_busy_poll(bool busy_poll);
+
 struct sto_pipeline_engine *sto_pipeline_engine_create(const char *name);
 void sto_pipeline_engine_destroy(struct sto_pipeline_engine *engine);
 
@@ -115,10 +188,16 @@ void sto_pipeline_deinit(struct sto_pipeline *pipe);
 
 struct sto_pipeline *sto_pipeline_alloc(const struct sto_pipeline_properties *properties);
 void sto_pipeline_free(struct sto_pipeline *pipe);
+
+/* Has to be called on the engine thread */
 void sto_pipeline_run(struct sto_pipeline_engine *engine,
 		      struct sto_pipeline *pipe,
 		      sto_generic_cb cb_fn, void *cb_arg);
 
+/*
+ * May be called on any thread: the pipeline is allocated and run on the
+ * engine thread, @cb_fn is called back on the calling one.
+ */
 void sto_pipeline_alloc_and_run(struct sto_pipeline_engine *engine,
 				const struct sto_pipeline_properties *properties,
 				sto_generic_cb cb_fn, void *cb_arg,
@@ -156,6 +235,7 @@ sto_pipeline_step_done(void *cb_arg, int rc)
 	sto_pipeline_step_next(cb_arg, rc);
 }
 
+/* @steps are not copied and have to outlive the pipeline */
 int sto_pipeline_add_steps(struct sto_pipeline *pipe, const struct sto_pipeline_step *steps);
 
 int __sto_pipeline_insert_step(struct sto_pipeline *pipe, const struct sto_pipeline_step *step);
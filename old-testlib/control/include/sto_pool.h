@@ -0,0 +1,59 @@
+#ifndef _STO_POOL_H_
+#define _STO_POOL_H_
+
+#include <spdk/stdinc.h>
+
+/*
+ * Fixed-size object pool. Objects are carved out of slabs allocated on
+ * demand and kept for the lifetime of the process, freed objects go to
+ * a free list and are handed out again zeroed, like calloc() would.
+ *
+ * Not thread safe: a pool belongs to the thread that uses it. Pools
+ * shared by code running on several threads are declared __thread, and
+ * an object is put back on the thread it was taken on.
+ */
+struct sto_pool {
+	const char *name;
+	size_t obj_size;
+	uint32_t objs_per_slab;
+
+	void *free_list;
+
+	uint64_t nr_slabs;
+	uint64_t nr_used;
+};
+
+#define STO_POOL_DEFAULT_OBJS_PER_SLAB	64
+
+#define STO_POOL_INITIALIZER(_name, _obj_size)			\
+	{							\
+		.name = _name,					\
+		.obj_size = _obj_size,				\
+		.objs_per_slab = STO_POOL_DEFAULT_OBJS_PER_SLAB,\
+	}
+
+void *sto_pool_get(struct sto_pool *pool);
+void sto_pool_put(struct sto_pool *pool, void *obj);
+
+/*
+ * Power of two size classes for objects whose size is only known at
+ * runtime. Objects above the largest class go to calloc(), so callers
+ * have to pass the same size to sto_pool_set_put() they allocated with.
+ */
+#define STO_POOL_SET_MIN_SHIFT		7	/* 128 bytes */
+#define STO_POOL_SET_NR_CLASSES		6	/* up to 4KiB */
+
+struct sto_pool_set {
+	const char *name;
+	struct sto_pool pools[STO_POOL_SET_NR_CLASSES];
+};
+
+#define STO_POOL_SET_INITIALIZER(_name)	\
+	{				\
+		.name = _name,		\
+	}
+
+void *sto_pool_set_get(struct sto_pool_set *set, size_t size);
+void sto_pool_set_put(struct sto_pool_set *set, void *obj, size_t size);
+
+#endif /* _STO_POOL_H_ */
@@ -49,12 +49,12 @@ struct sto_req {
 	struct sto_req_type type;
 
 	struct sto_pipeline pipeline;
-};
 
-int sto_req_lib_init(void);
-void sto_req_lib_fini(void);
+	/* params and priv follow the struct in the same block */
+	size_t alloc_size;
+};
 
-void sto_req_run(struct sto_req *req);
+void sto_req_run(struct sto_req *req, struct sto_pipeline_engine *engine);
 
 static inline struct sto_req *
 sto_req_from_ctx(struct sto_req_context *req_ctx)
@@ -46,6 +46,45 @@ void sto_rpc_readfile_buf(const char *filepath, uint32_t size,
 			  sto_rpc_readfile_buf_complete cb_fn, void *cb_arg,
 			  char **buf);
 
+/*
+ * @buf is NUL-terminated and only valid until the callback returns.
+ * With the shm channel enabled it points straight into the slot the
+ * server read the file into, nothing is copied on the control side.
+ */
+typedef void (*sto_rpc_readfile_view_complete)(void *cb_arg, const char *buf, size_t len, int rc);
+
+void sto_rpc_readfile_view(const char *filepath, uint32_t size,
+			   sto_rpc_readfile_view_complete cb_fn, void *cb_arg);
+
 void sto_rpc_readlink(const char *filepath, sto_generic_cb cb_fn, void *cb_arg, char **buf);
 
+/*
+ * Batched variants: all entries go to the server in one RPC, executed
+ * in order or in parallel. The callback rc reports the RPC itself,
+ * per-entry results are stored in the entries which must stay valid
+ * until the callback is called.
+ */
+struct sto_rpc_writefile_entry {
+	const char *filepath;
+	int oflag;
+	char *buf;
+
+	int returncode;
+};
+
+void sto_rpc_multi_writefile(struct sto_rpc_writefile_entry *entries, size_t cnt, bool parallel,
+			     sto_generic_cb cb_fn, void *cb_arg);
+
+struct sto_rpc_readfile_entry {
+	const char *filepath;
+	uint32_t size;
+
+	/* Allocated on success, the caller frees it */
+	char *buf;
+	int returncode;
+};
+
+void sto_rpc_multi_readfile(struct sto_rpc_readfile_entry *entries, size_t cnt, bool parallel,
+			    sto_generic_cb cb_fn, void *cb_arg);
+
 #endif /* _STO_RPC_AIO_H_ */
@@ -6,24 +6,58 @@
 struct spdk_json_write_ctx;
 
 struct sto_dirent {
-	char *name;
+	const char *name;
 	uint32_t mode;
 };
 
-#define STO_DIRENT_MAX_CNT 256
-
+/*
+ * The names of all the entries are packed into one arena, the entries
+ * only keep the offset of their name. Both arrays grow as needed.
+ */
 struct sto_dirents {
-	struct sto_dirent dirents[STO_DIRENT_MAX_CNT];
-	size_t cnt;
+	struct {
+		uint32_t name_off;
+		uint32_t mode;
+	} *entries;
+	uint32_t cnt;
+	uint32_t capacity;
+
+	char *names;
+	uint32_t names_len;
+	uint32_t names_size;
 };
 
+static inline void
+sto_dirents_get(const struct sto_dirents *dirents, uint32_t i, struct sto_dirent *dirent)
+{
+	dirent->name = dirents->names + dirents->entries[i].name_off;
+	dirent->mode = dirents->entries[i].mode;
+}
+
+int sto_dirents_add(struct sto_dirents *dirents, const char *name, uint32_t name_len, uint32_t mode);
+
 struct sto_dirents_json_cfg {
 	const char *name;
 	const char **exclude_list;
 	uint32_t type;
 };
 
+/*
+ * A directory is read in pages of STO_RPC_READDIR_PAGE_SIZE entries.
+ * sto_rpc_readdir() collects all of them into @dirents and only fills
+ * the file type bits of the mode, which the server gets without a stat
+ * for every entry. sto_rpc_readdir_pages() gives the full mode and
+ * hands every page to @page_fn, freeing it before asking for the next
+ * one, so a huge directory is never held in memory at once. A non zero
+ * return from @page_fn stops the walk and is passed to @cb_fn.
+ */
+#define STO_RPC_READDIR_PAGE_SIZE	256
+
+typedef int (*sto_rpc_readdir_page_cb)(void *cb_arg, struct sto_dirents *dirents);
+
 void sto_rpc_readdir(const char *dirpath, sto_generic_cb cb_fn, void *cb_arg, struct sto_dirents *dirents);
+void sto_rpc_readdir_pages(const char *dirpath, sto_rpc_readdir_page_cb page_fn,
+			   sto_generic_cb cb_fn, void *cb_arg, struct sto_dirents *dirents);
 
 void sto_dirents_info_json(struct sto_dirents *dirents,
 			   struct sto_dirents_json_cfg *cfg, struct spdk_json_write_ctx *w);
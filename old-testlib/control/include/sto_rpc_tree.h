@@ -0,0 +1,15 @@
+#ifndef _STO_RPC_TREE_H_
+#define _STO_RPC_TREE_H_
+
+#include "sto_async.h"
+
+struct sto_tree_node;
+
+/*
+ * Fetches the whole subtree under @dirpath in a single server round trip
+ * and links it below @tree_root, which must already hold the root inode.
+ */
+void sto_rpc_tree(const char *dirpath, uint32_t depth, bool only_dirs,
+		  sto_generic_cb cb_fn, void *cb_arg, struct sto_tree_node *tree_root);
+
+#endif /* _STO_RPC_TREE_H_ */
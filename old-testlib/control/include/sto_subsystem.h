@@ -16,7 +16,7 @@ struct sto_subsystem {
 	const char *name;
 
 	const struct sto_op_table *op_table;
-	const struct sto_shash ops_map;
+	const struct sto_phash ops_map;
 
 	struct sto_subsystem_ops *ops;
 
@@ -7,6 +7,7 @@
 #include "sto_inode.h"
 
 struct sto_tree_node;
+struct sto_arena;
 
 typedef void (*sto_tree_info_json_t)(struct sto_tree_node *tree_root,
 				     struct spdk_json_write_ctx *w);
@@ -19,26 +20,54 @@ struct sto_tree_node {
 
 	struct sto_inode *inode;
 
+	/* Shared by the whole tree, NULL if it's built from the heap */
+	struct sto_arena *arena;
+
 	uint32_t level;
 
 	TAILQ_ENTRY(sto_tree_node) list;
 	TAILQ_HEAD(, sto_tree_node) childs;
 };
 
+enum sto_tree_order {
+	STO_TREE_ORDER_BFS,
+	STO_TREE_ORDER_DFS,
+};
+
 struct sto_tree_params {
 	uint32_t depth;
 	bool only_dirs;
+	uint32_t max_inflight;
+	enum sto_tree_order order;
 };
 
 typedef void (*sto_tree_complete)(void *cb_arg, struct sto_tree_node *tree_root, int rc);
-
-void sto_tree(const char *dirpath, uint32_t depth, bool only_dirs,
-	      sto_tree_complete cb_fn, void *cb_arg);
-
 typedef void (*sto_tree_buf_complete)(void *cb_arg, int rc);
 
-void sto_tree_buf(const char *dirpath, uint32_t depth, bool only_dirs,
-		  sto_tree_buf_complete cb_fn, void *cb_arg,
+/*
+ * With @use_arena the nodes, inodes, names, paths and file contents of
+ * the tree are carved out of one arena and sto_tree_free() releases it
+ * in one go instead of walking the tree. Such a tree is a read-only
+ * snapshot: nothing in it can be freed on its own.
+ *
+ * With max_inflight == 0 the server walks the subtree and sends it back
+ * in one response. Otherwise the tree is walked from the control side,
+ * a readdir or readfile per inode, with at most max_inflight of them
+ * sent at a time. The rest of the inodes wait in a queue which is taken
+ * in breadth first or depth first order. A server without the tree RPC
+ * is always walked the second way.
+ */
+struct sto_tree_opts {
+	const char *dirpath;
+	uint32_t depth;
+	bool only_dirs;
+	bool use_arena;
+	uint32_t max_inflight;
+	enum sto_tree_order order;
+};
+
+void sto_tree(const struct sto_tree_opts *opts, sto_tree_complete cb_fn, void *cb_arg);
+void sto_tree_buf(const struct sto_tree_opts *opts, sto_tree_buf_complete cb_fn, void *cb_arg,
 		  struct sto_tree_node *tree_root);
 
 void sto_tree_free(struct sto_tree_node *tree_root);
@@ -50,6 +79,9 @@ bool sto_tree_check_error(struct sto_tree_node *node);
 bool sto_tree_check_depth(struct sto_tree_node *node);
 struct sto_tree_params *sto_tree_params(struct sto_tree_node *node);
 
+void sto_tree_queue_node(struct sto_tree_node *node);
+void sto_tree_read_done(struct sto_tree_node *node);
+
 int sto_tree_add_inode(struct sto_tree_node *parent_node, struct sto_inode *inode);
 struct sto_tree_node *sto_tree_node_find(struct sto_tree_node *node, const char *path);
 struct sto_tree_node *sto_tree_node_resolv_lnk(struct sto_tree_node *lnk_node);
@@ -221,9 +221,14 @@ sto_tree_req_exec(struct sto_pipeline *pipe)
 	struct sto_req *req = sto_pipeline_get_priv(pipe);
 	struct sto_tree_req_priv *priv = sto_req_get_priv(req);
 	struct sto_tree_req_params *params = sto_req_get_params(req);
+	struct sto_tree_opts opts = {
+		.dirpath = params->dirpath,
+		.depth = params->depth,
+		.only_dirs = params->only_dirs,
+		.use_arena = true,
+	};
 
-	sto_tree_buf(params->dirpath, params->depth, params->only_dirs,
-		     sto_pipeline_step_done, pipe, &priv->tree_root);
+	sto_tree_buf(&opts, sto_pipeline_step_done, pipe, &priv->tree_root);
 }
 
 static void
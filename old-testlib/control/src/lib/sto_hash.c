@@ -8,10 +8,19 @@
 
 #include <rte_jhash.h>
 
-struct sto_bucket_table {
-	uint32_t nr_of_buckets;
+struct sto_hash_slot {
+	uint32_t hash;
+	/* Probe distance from the home slot plus one, 0 for an empty slot */
+	uint32_t dist;
+	struct sto_hash_elem *he;
+};
+
+struct sto_hash_table {
+	uint32_t size;
+	uint32_t mask;
+	uint32_t nr_used;
 
-	LIST_HEAD(, sto_hash_elem) buckets[];
+	struct sto_hash_slot slots[];
 };
 
 static inline uint32_t
@@ -37,63 +46,216 @@ roundup_pow_of_two(uint32_t x)
 	return 1UL << fls(x - 1);
 }
 
-/* Number of buckets is stored in uint32_t, so cap our result to 1U << 31 */
-#define STO_HASH_MAX_BUCKETS (1U << 31)
+/* Number of slots is stored in uint32_t, so cap our result to 1U << 31 */
+#define STO_HASH_MAX_SLOTS	(1U << 31)
+#define STO_HASH_MIN_SLOTS	8
+
+/* Slots of the old table moved by each add or remove while growing */
+#define STO_HASH_MIGRATE_STEP	16
 
 static uint32_t
-sto_hash_buckets(uint32_t size)
+sto_hash_slots(uint32_t size)
 {
 	uint64_t val = ((uint64_t) size * 4) / 3;
 
-	if (val >= STO_HASH_MAX_BUCKETS) {
-		return STO_HASH_MAX_BUCKETS;
+	if (val >= STO_HASH_MAX_SLOTS) {
+		return STO_HASH_MAX_SLOTS;
 	}
 
-	return roundup_pow_of_two(val);
+	return spdk_max(roundup_pow_of_two(val), STO_HASH_MIN_SLOTS);
 }
 
-static struct sto_bucket_table *
-bucket_table_alloc(uint32_t size)
+static inline bool
+sto_hash_table_overloaded(struct sto_hash_table *tbl)
 {
-	struct sto_bucket_table *tbl;
-	uint32_t nr_of_buckets, table_size;
-	uint32_t i;
+	return tbl->nr_used >= tbl->size - tbl->size / 4;
+}
 
-	nr_of_buckets = sto_hash_buckets(size);
+static struct sto_hash_table *
+sto_hash_table_alloc(uint32_t nr_slots)
+{
+	struct sto_hash_table *tbl;
+	size_t table_size;
 
-	table_size = sizeof(struct sto_bucket_table);
-	table_size += nr_of_buckets * sizeof(struct sto_hash_elem *);
+	table_size = sizeof(struct sto_hash_table);
+	table_size += (size_t) nr_slots * sizeof(struct sto_hash_slot);
 
 	tbl = calloc(1, table_size);
 	if (spdk_unlikely(!tbl)) {
-		SPDK_ERRLOG("Failed to allocate %u buckets: table_size=%u\n",
-			    nr_of_buckets, table_size);
+		SPDK_ERRLOG("Failed to allocate %u slots: table_size=%zu\n",
+			    nr_slots, table_size);
 		return NULL;
 	}
 
-	tbl->nr_of_buckets = nr_of_buckets;
-
-	for (i = 0; i < tbl->nr_of_buckets; i++) {
-		LIST_INIT(&tbl->buckets[i]);
-	}
+	tbl->size = nr_slots;
+	tbl->mask = nr_slots - 1;
 
 	return tbl;
 }
 
 static void
-bucket_table_free(struct sto_bucket_table *tbl)
+sto_hash_table_free(struct sto_hash_table *tbl)
 {
 	free(tbl);
 }
 
+static void
+sto_hash_table_insert(struct sto_hash_table *tbl, struct sto_hash_elem *he)
+{
+	struct sto_hash_slot cur = {
+		.hash = he->hash,
+		.dist = 1,
+		.he = he,
+	};
+	uint32_t idx = he->hash & tbl->mask;
+
+	/* Robin Hood: take the slot of an element closer to its home */
+	for (;; idx = (idx + 1) & tbl->mask, cur.dist++) {
+		struct sto_hash_slot *slot = &tbl->slots[idx];
+
+		if (!slot->dist) {
+			*slot = cur;
+			break;
+		}
+
+		if (slot->dist < cur.dist) {
+			struct sto_hash_slot tmp = *slot;
+
+			*slot = cur;
+			cur = tmp;
+		}
+	}
+
+	tbl->nr_used++;
+}
+
+static void
+sto_hash_table_remove(struct sto_hash_table *tbl, uint32_t idx)
+{
+	uint32_t next = (idx + 1) & tbl->mask;
+
+	/* Shift the following elements back instead of leaving a tombstone */
+	while (tbl->slots[next].dist > 1) {
+		tbl->slots[idx] = tbl->slots[next];
+		tbl->slots[idx].dist--;
+
+		idx = next;
+		next = (next + 1) & tbl->mask;
+	}
+
+	memset(&tbl->slots[idx], 0, sizeof(tbl->slots[idx]));
+
+	tbl->nr_used--;
+}
+
+static struct sto_hash_elem *
+sto_hash_table_lookup(struct sto_hash_table *tbl, uint32_t hash,
+		      const void *key, uint32_t key_len)
+{
+	uint32_t idx = hash & tbl->mask;
+	uint32_t dist;
+
+	for (dist = 1;; idx = (idx + 1) & tbl->mask, dist++) {
+		struct sto_hash_slot *slot = &tbl->slots[idx];
+		struct sto_hash_elem *he = slot->he;
+
+		/* The key would have displaced an element this close to its home */
+		if (slot->dist < dist) {
+			return NULL;
+		}
+
+		if (slot->hash == hash && he->key_len == key_len &&
+		    !memcmp(key, he->key, key_len)) {
+			return he;
+		}
+	}
+}
+
+static bool
+sto_hash_table_del(struct sto_hash_table *tbl, struct sto_hash_elem *he)
+{
+	uint32_t idx = he->hash & tbl->mask;
+	uint32_t dist;
+
+	for (dist = 1;; idx = (idx + 1) & tbl->mask, dist++) {
+		struct sto_hash_slot *slot = &tbl->slots[idx];
+
+		if (slot->dist < dist) {
+			return false;
+		}
+
+		if (slot->he == he) {
+			sto_hash_table_remove(tbl, idx);
+			return true;
+		}
+	}
+}
+
+static void
+sto_hash_migrate(struct sto_hash *ht, uint32_t nr_slots)
+{
+	struct sto_hash_table *old_tbl = ht->old_tbl;
+
+	if (!old_tbl) {
+		return;
+	}
+
+	/*
+	 * The slots before migrate_pos are empty, removing an element only
+	 * shifts the following ones back, so an occupied slot is moved until
+	 * it stays empty.
+	 */
+	while (nr_slots-- && old_tbl->nr_used) {
+		struct sto_hash_slot *slot = &old_tbl->slots[ht->migrate_pos];
+
+		if (!slot->dist) {
+			ht->migrate_pos++;
+			continue;
+		}
+
+		sto_hash_table_insert(ht->tbl, slot->he);
+		sto_hash_table_remove(old_tbl, ht->migrate_pos);
+	}
+
+	if (!old_tbl->nr_used) {
+		sto_hash_table_free(old_tbl);
+		ht->old_tbl = NULL;
+		ht->migrate_pos = 0;
+	}
+}
+
+static int
+sto_hash_grow(struct sto_hash *ht)
+{
+	struct sto_hash_table *tbl;
+
+	if (spdk_unlikely(ht->tbl->size == STO_HASH_MAX_SLOTS)) {
+		return -ENOSPC;
+	}
+
+	/* Adds outpace the migration only if the table was sized way too small */
+	sto_hash_migrate(ht, UINT32_MAX);
+
+	tbl = sto_hash_table_alloc(ht->tbl->size * 2);
+	if (spdk_unlikely(!tbl)) {
+		return -ENOMEM;
+	}
+
+	ht->old_tbl = ht->tbl;
+	ht->tbl = tbl;
+	ht->migrate_pos = 0;
+
+	return 0;
+}
+
 int
 sto_hash_init(struct sto_hash *ht, uint32_t size)
 {
-	ht->seed = 0;
+	memset(ht, 0, sizeof(*ht));
 
-	ht->tbl = bucket_table_alloc(size);
+	ht->tbl = sto_hash_table_alloc(sto_hash_slots(size));
 	if (spdk_unlikely(!ht->tbl)) {
-		SPDK_ERRLOG("Failed to allocate bucket table for size=%u\n", size);
+		SPDK_ERRLOG("Failed to allocate hash table for size=%u\n", size);
 		return -ENOMEM;
 	}
 
@@ -107,75 +269,100 @@ sto_hash_destroy(struct sto_hash *ht)
 		SPDK_ERRLOG("STO hashtable is not empty!!!\n");
 	}
 
-	bucket_table_free(ht->tbl);
+	sto_hash_table_free(ht->old_tbl);
+	sto_hash_table_free(ht->tbl);
 }
 
 bool
 sto_hash_empty(struct sto_hash *ht)
 {
-	struct sto_bucket_table *tbl = ht->tbl;
-	uint32_t i;
+	return !ht->tbl->nr_used && (!ht->old_tbl || !ht->old_tbl->nr_used);
+}
 
-	for (i = 0; i < tbl->nr_of_buckets; i++) {
-		if (!LIST_EMPTY(&tbl->buckets[i])) {
-			return false;
+static inline uint32_t
+sto_hash_key(const struct sto_hash *ht, const void *key, uint32_t key_len)
+{
+	return rte_jhash(key, key_len, ht->seed);
+}
+
+int
+sto_hash_add(struct sto_hash *ht, struct sto_hash_elem *he)
+{
+	int rc;
+
+	sto_hash_migrate(ht, STO_HASH_MIGRATE_STEP);
+
+	if (sto_hash_table_overloaded(ht->tbl)) {
+		rc = sto_hash_grow(ht);
+		/* Keep filling the current table while there is any room */
+		if (spdk_unlikely(rc && ht->tbl->nr_used == ht->tbl->size)) {
+			SPDK_ERRLOG("Failed to grow full hash table: size=%u, rc=%d\n",
+				    ht->tbl->size, rc);
+			return rc;
 		}
 	}
 
-	return true;
-}
+	he->hash = sto_hash_key(ht, he->key, he->key_len);
+	he->ht = ht;
 
-static inline uint32_t
-sto_hash_get_bucket_nr(const struct sto_hash *ht, const void *key, uint32_t key_len)
-{
-	uint32_t hash;
+	sto_hash_table_insert(ht->tbl, he);
 
-	hash = rte_jhash(key, key_len, ht->seed);
-	return hash & (ht->tbl->nr_of_buckets - 1);
+	return 0;
 }
 
 void
-sto_hash_add(struct sto_hash *ht, struct sto_hash_elem *he)
+sto_hash_elem_del(struct sto_hash_elem *he)
 {
-	uint32_t b;
+	struct sto_hash *ht = he->ht;
 
-	b = sto_hash_get_bucket_nr(ht, he->key, he->key_len);
-	LIST_INSERT_HEAD(&ht->tbl->buckets[b], he, list);
+	if (spdk_unlikely(!ht)) {
+		SPDK_ERRLOG("Hash element is not in a table\n");
+		assert(0);
+		return;
+	}
+
+	if (!sto_hash_table_del(ht->tbl, he)) {
+		bool found = ht->old_tbl && sto_hash_table_del(ht->old_tbl, he);
+
+		assert(found);
+		(void) found;
+	}
+
+	he->ht = NULL;
+
+	sto_hash_migrate(ht, STO_HASH_MIGRATE_STEP);
 }
 
 struct sto_hash_elem *
 sto_hash_lookup(const struct sto_hash *ht, const void *key, uint32_t key_len)
 {
-	struct sto_bucket_table *tbl = ht->tbl;
 	struct sto_hash_elem *he;
-	uint32_t b;
+	uint32_t hash;
 
-	b = sto_hash_get_bucket_nr(ht, key, key_len);
+	hash = sto_hash_key(ht, key, key_len);
 
-	LIST_FOREACH(he, &tbl->buckets[b], list) {
-		if (key_len != he->key_len) {
-			continue;
-		}
-
-		if (!memcmp(key, he->key, key_len)) {
-			return he;
-		}
+	he = sto_hash_table_lookup(ht->tbl, hash, key, key_len);
+	if (!he && ht->old_tbl) {
+		he = sto_hash_table_lookup(ht->old_tbl, hash, key, key_len);
 	}
 
-	return NULL;
+	return he;
 }
 
 struct sto_hash_elem *
 sto_hash_iter_next(struct sto_hash_iter *iter)
 {
-	struct sto_bucket_table *tbl = iter->tbl;
-	struct sto_hash_elem *he = iter->he;
+	while (iter->tbl) {
+		struct sto_hash_table *tbl = iter->tbl;
 
-	for (; iter->slot < tbl->nr_of_buckets; iter->slot++) {
-		he = !he ? LIST_FIRST(&tbl->buckets[iter->slot]) : LIST_NEXT(he, list);
-		if (he) {
-			return iter->he = he;
+		for (; iter->slot < tbl->size; iter->slot++) {
+			if (tbl->slots[iter->slot].dist) {
+				return tbl->slots[iter->slot++].he;
+			}
 		}
+
+		iter->tbl = tbl != iter->ht->old_tbl ? iter->ht->old_tbl : NULL;
+		iter->slot = 0;
 	}
 
 	return NULL;
@@ -193,6 +380,7 @@ static inline int
 sto_shash_add_entry(struct sto_shash *sht, const void *key, uint32_t key_len, const void *value)
 {
 	struct sto_shash_entry *entry;
+	int rc;
 
 	entry = calloc(1, sizeof(*entry));
 	if (spdk_unlikely(!entry)) {
@@ -203,7 +391,11 @@ sto_shash_add_entry(struct sto_shash *sht, const void *key, uint32_t key_len, co
 	sto_hash_elem_init(&entry->he, key, key_len);
 	entry->value = value;
 
-	sto_hash_add(&sht->ht, &entry->he);
+	rc = sto_hash_add(&sht->ht, &entry->he);
+	if (spdk_unlikely(rc)) {
+		free(entry);
+		return rc;
+	}
 
 	return 0;
 }
@@ -271,18 +463,42 @@ sto_shash_remove(struct sto_shash *sht, const void *key, uint32_t key_len)
 	sto_shash_remove_entry(entry);
 }
 
-void
-sto_shash_clear(struct sto_shash *sht)
+static void
+sto_hash_table_clear(struct sto_hash_table *tbl, void (*free_fn)(struct sto_hash_elem *he))
 {
-	struct sto_bucket_table *tbl = sht->ht.tbl;
-	struct sto_hash_elem *he, *tmp;
 	uint32_t i;
 
-	for (i = 0; i < tbl->nr_of_buckets; i++) {
-		LIST_FOREACH_SAFE(he, &tbl->buckets[i], list, tmp) {
-			sto_shash_remove_entry(STO_SHASH_ENTRY(he));
+	for (i = 0; i < tbl->size; i++) {
+		if (tbl->slots[i].dist) {
+			free_fn(tbl->slots[i].he);
 		}
 	}
+
+	memset(tbl->slots, 0, tbl->size * sizeof(tbl->slots[0]));
+	tbl->nr_used = 0;
+}
+
+static void
+sto_shash_free_entry(struct sto_hash_elem *he)
+{
+	free(STO_SHASH_ENTRY(he));
+}
+
+void
+sto_shash_clear(struct sto_shash *sht)
+{
+	struct sto_hash *ht = &sht->ht;
+
+	/* The entries are freed in place, there is no point to unlink them one by one */
+	sto_hash_table_clear(ht->tbl, sto_shash_free_entry);
+
+	if (ht->old_tbl) {
+		sto_hash_table_clear(ht->old_tbl, sto_shash_free_entry);
+
+		sto_hash_table_free(ht->old_tbl);
+		ht->old_tbl = NULL;
+		ht->migrate_pos = 0;
+	}
 }
 
 void *
@@ -297,3 +513,255 @@ sto_shash_iter_next(struct sto_shash_iter *iter)
 
 	return (void *) entry->value;
 }
+
+struct sto_phash_slot {
+	const void *key;
+	uint32_t key_len;
+	uint32_t hash;
+	const void *value;
+};
+
+/* Seeds tried per bucket before giving up, real key sets need a handful */
+#define STO_PHASH_MAX_SEED	(1U << 20)
+
+static inline uint32_t
+sto_phash_bucket_hash(const void *key, uint32_t key_len)
+{
+	return rte_jhash(key, key_len, 0);
+}
+
+static inline uint32_t
+sto_phash_slot_idx(const struct sto_phash *ph, const void *key, uint32_t key_len, uint32_t seed)
+{
+	return rte_jhash(key, key_len, seed) & ph->slot_mask;
+}
+
+static inline bool
+sto_phash_key_equal(const struct sto_phash_key *a, const struct sto_phash_key *b)
+{
+	return a->key_len == b->key_len && !memcmp(a->key, b->key, a->key_len);
+}
+
+struct sto_phash_bucket {
+	uint32_t idx;
+	uint32_t nr_keys;
+	uint32_t first;
+};
+
+static int
+sto_phash_bucket_cmp(const void *a, const void *b)
+{
+	const struct sto_phash_bucket *ba = a, *bb = b;
+
+	return (int) bb->nr_keys - (int) ba->nr_keys;
+}
+
+static int
+sto_phash_place_bucket(struct sto_phash *ph, const struct sto_phash_key *keys,
+		       const uint32_t *order, const struct sto_phash_bucket *bucket,
+		       uint32_t *slot_idx)
+{
+	uint32_t seed, i, j;
+
+	for (i = 0; i < bucket->nr_keys; i++) {
+		for (j = 0; j < i; j++) {
+			if (sto_phash_key_equal(&keys[order[bucket->first + i]],
+						&keys[order[bucket->first + j]])) {
+				SPDK_ERRLOG("Duplicate perfect hash key '%.*s'\n",
+					    (int) keys[order[bucket->first + i]].key_len,
+					    (const char *) keys[order[bucket->first + i]].key);
+				return -EEXIST;
+			}
+		}
+	}
+
+	/* Seed 0 is the bucket hash itself, so start from 1 */
+	for (seed = 1; seed < STO_PHASH_MAX_SEED; seed++) {
+		for (i = 0; i < bucket->nr_keys; i++) {
+			const struct sto_phash_key *k = &keys[order[bucket->first + i]];
+
+			slot_idx[i] = sto_phash_slot_idx(ph, k->key, k->key_len, seed);
+
+			if (ph->slots[slot_idx[i]].key) {
+				break;
+			}
+
+			for (j = 0; j < i; j++) {
+				if (slot_idx[j] == slot_idx[i]) {
+					break;
+				}
+			}
+
+			if (j < i) {
+				break;
+			}
+		}
+
+		if (i == bucket->nr_keys) {
+			break;
+		}
+	}
+
+	if (spdk_unlikely(seed == STO_PHASH_MAX_SEED)) {
+		SPDK_ERRLOG("Failed to find seed for perfect hash bucket of %u keys\n",
+			    bucket->nr_keys);
+		return -ENOSPC;
+	}
+
+	ph->seeds[bucket->idx] = seed;
+
+	for (i = 0; i < bucket->nr_keys; i++) {
+		const struct sto_phash_key *k = &keys[order[bucket->first + i]];
+		struct sto_phash_slot *slot = &ph->slots[slot_idx[i]];
+
+		slot->key = k->key;
+		slot->key_len = k->key_len;
+		slot->hash = sto_phash_bucket_hash(k->key, k->key_len);
+		slot->value = k->value;
+	}
+
+	return 0;
+}
+
+/*
+ * Hash and displace: keys are spread over buckets by their hash, then
+ * starting from the largest bucket every bucket gets the first seed that
+ * moves all its keys to free slots.
+ */
+int
+sto_phash_build(struct sto_phash *ph, const struct sto_phash_key *keys, uint32_t nr_keys)
+{
+	struct sto_phash_bucket *buckets = NULL;
+	uint32_t *order = NULL, *slot_idx = NULL;
+	uint32_t nr_buckets, nr_slots, i, pos;
+	int rc = -ENOMEM;
+
+	memset(ph, 0, sizeof(*ph));
+
+	/* Keep some room in the slots and about two keys per bucket */
+	nr_slots = roundup_pow_of_two(spdk_max(nr_keys + nr_keys / 4, 1U));
+	nr_buckets = roundup_pow_of_two(spdk_max(nr_keys / 2, 1U));
+
+	ph->slot_mask = nr_slots - 1;
+	ph->bucket_mask = nr_buckets - 1;
+
+	ph->seeds = calloc(nr_buckets, sizeof(*ph->seeds));
+	ph->slots = calloc(nr_slots, sizeof(*ph->slots));
+	buckets = calloc(nr_buckets, sizeof(*buckets));
+	order = calloc(spdk_max(nr_keys, 1U), sizeof(*order));
+	slot_idx = calloc(spdk_max(nr_keys, 1U), sizeof(*slot_idx));
+
+	if (spdk_unlikely(!ph->seeds || !ph->slots || !buckets || !order || !slot_idx)) {
+		SPDK_ERRLOG("Failed to alloc perfect hash for %u keys\n", nr_keys);
+		goto out;
+	}
+
+	for (i = 0; i < nr_buckets; i++) {
+		buckets[i].idx = i;
+	}
+
+	for (i = 0; i < nr_keys; i++) {
+		buckets[sto_phash_bucket_hash(keys[i].key, keys[i].key_len) & ph->bucket_mask].nr_keys++;
+	}
+
+	for (i = 0, pos = 0; i < nr_buckets; i++) {
+		buckets[i].first = pos;
+		pos += buckets[i].nr_keys;
+		buckets[i].nr_keys = 0;
+	}
+
+	for (i = 0; i < nr_keys; i++) {
+		struct sto_phash_bucket *b;
+
+		b = &buckets[sto_phash_bucket_hash(keys[i].key, keys[i].key_len) & ph->bucket_mask];
+		order[b->first + b->nr_keys++] = i;
+	}
+
+	qsort(buckets, nr_buckets, sizeof(*buckets), sto_phash_bucket_cmp);
+
+	for (i = 0; i < nr_buckets && buckets[i].nr_keys; i++) {
+		rc = sto_phash_place_bucket(ph, keys, order, &buckets[i], slot_idx);
+		if (spdk_unlikely(rc)) {
+			goto out;
+		}
+	}
+
+	rc = 0;
+
+out:
+	free(slot_idx);
+	free(order);
+	free(buckets);
+
+	if (spdk_unlikely(rc)) {
+		sto_phash_destroy(ph);
+	}
+
+	return rc;
+}
+
+int
+sto_phash_build_from(struct sto_phash *ph, sto_phash_next_t next_fn,
+		     sto_phash_key_t key_fn, void *ctx)
+{
+	struct sto_phash_key *keys;
+	uint32_t nr_keys = 0;
+	const void *obj;
+	int rc;
+
+	for (obj = next_fn(NULL, ctx); obj; obj = next_fn(obj, ctx)) {
+		nr_keys++;
+	}
+
+	keys = calloc(spdk_max(nr_keys, 1U), sizeof(*keys));
+	if (spdk_unlikely(!keys)) {
+		SPDK_ERRLOG("Failed to alloc %u perfect hash keys\n", nr_keys);
+		return -ENOMEM;
+	}
+
+	nr_keys = 0;
+
+	for (obj = next_fn(NULL, ctx); obj; obj = next_fn(obj, ctx)) {
+		keys[nr_keys].key = key_fn(obj);
+		keys[nr_keys].key_len = strlen(keys[nr_keys].key);
+		keys[nr_keys].value = obj;
+		nr_keys++;
+	}
+
+	rc = sto_phash_build(ph, keys, nr_keys);
+
+	free(keys);
+
+	return rc;
+}
+
+void
+sto_phash_destroy(struct sto_phash *ph)
+{
+	free(ph->seeds);
+	free(ph->slots);
+
+	memset(ph, 0, sizeof(*ph));
+}
+
+const void *
+sto_phash_lookup(const struct sto_phash *ph, const void *key, uint32_t key_len)
+{
+	const struct sto_phash_slot *slot;
+	uint32_t hash;
+
+	if (spdk_unlikely(!sto_phash_built(ph))) {
+		return NULL;
+	}
+
+	hash = sto_phash_bucket_hash(key, key_len);
+
+	slot = &ph->slots[sto_phash_slot_idx(ph, key, key_len, ph->seeds[hash & ph->bucket_mask])];
+
+	if (!slot->key || slot->hash != hash || slot->key_len != key_len ||
+	    memcmp(slot->key, key, key_len)) {
+		return NULL;
+	}
+
+	return slot->value;
+}
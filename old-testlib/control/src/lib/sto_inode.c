@@ -9,12 +9,13 @@
 #include "sto_rpc_aio.h"
 #include "sto_tree.h"
 #include "sto_rpc_readdir.h"
+#include "sto_arena.h"
 
 struct spdk_json_write_ctx;
 
-static struct sto_inode *sto_file_inode_create(void);
-static struct sto_inode *sto_dir_inode_create(void);
-static struct sto_inode *sto_lnk_inode_create(void);
+static struct sto_inode *sto_file_inode_create(struct sto_arena *arena);
+static struct sto_inode *sto_dir_inode_create(struct sto_arena *arena);
+static struct sto_inode *sto_lnk_inode_create(struct sto_arena *arena);
 
 static enum sto_inode_type
 sto_inode_type(uint32_t mode)
@@ -32,15 +33,9 @@ sto_inode_type(uint32_t mode)
 }
 
 static void
-sto_inode_get_ref(struct sto_inode *inode)
+sto_inode_read_end(struct sto_inode *inode)
 {
-	sto_tree_get_ref(inode->node);
-}
-
-static void
-sto_inode_put_ref(struct sto_inode *inode)
-{
-	sto_tree_put_ref(inode->node);
+	sto_tree_read_done(inode->node);
 }
 
 static void
@@ -61,8 +56,14 @@ sto_inode_check_tree_depth(struct sto_inode *inode)
 	return sto_tree_check_depth(inode->node);
 }
 
+static void *
+sto_inode_zalloc(struct sto_arena *arena, size_t size)
+{
+	return arena ? sto_arena_alloc(arena, size) : calloc(1, size);
+}
+
 struct sto_inode *
-sto_inode_create(const char *name, const char *path, uint32_t mode, ...)
+sto_inode_create(struct sto_arena *arena, const char *name, const char *path, uint32_t mode, ...)
 {
 	struct sto_inode *inode;
 	enum sto_inode_type type = sto_inode_type(mode);
@@ -70,32 +71,38 @@ sto_inode_create(const char *name, const char *path, uint32_t mode, ...)
 
 	switch (type) {
 	case STO_INODE_TYPE_FILE:
-		inode = sto_file_inode_create();
+		inode = sto_file_inode_create(arena);
 		break;
 	case STO_INODE_TYPE_DIR:
-		inode = sto_dir_inode_create();
+		inode = sto_dir_inode_create(arena);
 		break;
 	case STO_INODE_TYPE_LNK:
-		inode = sto_lnk_inode_create();
+		inode = sto_lnk_inode_create(arena);
 		break;
 	default:
 		SPDK_ERRLOG("Unsupported %d inode type\n", type);
 		return NULL;
 	}
 
-	inode->name = strdup(name);
+	if (spdk_unlikely(!inode)) {
+		return NULL;
+	}
+
+	inode->arena = arena;
+
+	inode->name = arena ? sto_arena_strdup(arena, name) : strdup(name);
 	if (spdk_unlikely(!inode->name)) {
 		SPDK_ERRLOG("Cann't allocate memory for inode name\n");
 		goto free_inode;
 	}
 
 	va_start(args, mode);
-	inode->path = spdk_vsprintf_alloc(path, args);
+	inode->path = arena ? sto_arena_vsprintf(arena, path, args) : spdk_vsprintf_alloc(path, args);
 	va_end(args);
 
 	if (spdk_unlikely(!inode->path)) {
 		SPDK_ERRLOG("Cann't allocate memory for inode path\n");
-		goto free_name;
+		goto free_inode;
 	}
 
 	inode->type = type;
@@ -103,9 +110,6 @@ sto_inode_create(const char *name, const char *path, uint32_t mode, ...)
 
 	return inode;
 
-free_name:
-	free((char *) inode->name);
-
 free_inode:
 	inode->ops->destroy(inode);
 
@@ -119,6 +123,27 @@ sto_inode_free(struct sto_inode *inode)
 	free(inode->path);
 }
 
+int
+sto_file_inode_set_buf(struct sto_inode *inode, const char *buf, size_t len)
+{
+	struct sto_file_inode *file_inode = sto_file_inode(inode);
+	char *new_buf;
+
+	new_buf = inode->arena ? sto_arena_strndup(inode->arena, buf, len) : strndup(buf, len);
+	if (spdk_unlikely(!new_buf)) {
+		SPDK_ERRLOG("Cann't allocate memory for %s inode buf\n", inode->path);
+		return -ENOMEM;
+	}
+
+	if (!inode->arena) {
+		free(file_inode->buf);
+	}
+
+	file_inode->buf = new_buf;
+
+	return 0;
+}
+
 static void
 sto_inode_read_done(void *priv, int rc)
 {
@@ -141,7 +166,7 @@ sto_inode_read_done(void *priv, int rc)
 	}
 
 out:
-	sto_inode_put_ref(inode);
+	sto_inode_read_end(inode);
 
 	return;
 
@@ -153,29 +178,58 @@ out_err:
 void
 sto_inode_read(struct sto_inode *inode)
 {
-	int rc;
-
 	if (sto_inode_write_only(inode)) {
 		return;
 	}
 
-	sto_inode_get_ref(inode);
+	if (inode->type == STO_INODE_TYPE_DIR && sto_inode_check_tree_depth(inode)) {
+		return;
+	}
+
+	sto_tree_queue_node(inode->node);
+}
+
+void
+sto_inode_read_submit(struct sto_inode *inode)
+{
+	int rc;
 
 	rc = inode->ops->read(inode);
 	if (spdk_unlikely(rc)) {
 		SPDK_ERRLOG("Failed to read %s inode\n", inode->path);
 		sto_inode_set_error(inode, rc);
-		sto_inode_put_ref(inode);
+		sto_inode_read_end(inode);
 	}
 }
 
+static void
+sto_file_inode_read_cpl(void *priv, int rc)
+{
+	struct sto_inode *inode = priv;
+	struct sto_file_inode *file_inode = sto_file_inode(inode);
+	char *buf = file_inode->buf;
+
+	/* The RPC hands out a malloc'ed buffer, move it next to the rest of the tree */
+	if (inode->arena && buf) {
+		file_inode->buf = NULL;
+
+		if (!rc) {
+			rc = sto_file_inode_set_buf(inode, buf, strlen(buf));
+		}
+
+		free(buf);
+	}
+
+	sto_inode_read_done(inode, rc);
+}
+
 static int
 sto_file_inode_read(struct sto_inode *inode)
 {
 	struct sto_file_inode *file_inode = sto_file_inode(inode);
 
 	sto_rpc_readfile_buf(inode->path, 0,
-			     sto_inode_read_done, inode,
+			     sto_file_inode_read_cpl, inode,
 			     &file_inode->buf);
 
 	return 0;
@@ -202,6 +256,10 @@ sto_file_inode_destroy(struct sto_inode *inode)
 {
 	struct sto_file_inode *file_inode = sto_file_inode(inode);
 
+	if (inode->arena) {
+		return;
+	}
+
 	sto_inode_free(inode);
 
 	free(file_inode->buf);
@@ -216,12 +274,12 @@ static struct sto_inode_ops sto_file_inode_ops = {
 };
 
 static struct sto_inode *
-sto_file_inode_create(void)
+sto_file_inode_create(struct sto_arena *arena)
 {
 	struct sto_file_inode *file_inode;
 	struct sto_inode *inode;
 
-	file_inode = calloc(1, sizeof(*file_inode));
+	file_inode = sto_inode_zalloc(arena, sizeof(*file_inode));
 	if (spdk_unlikely(!file_inode)) {
 		SPDK_ERRLOG("Failed to create file node\n");
 		return NULL;
@@ -244,7 +302,7 @@ sto_dir_inode_parse(struct sto_dirent *dirent, struct sto_tree_node *parent_node
 		return 0;
 	}
 
-	inode = sto_inode_create(dirent->name, "%s/%s",
+	inode = sto_inode_create(parent_node->arena, dirent->name, "%s/%s",
 				 dirent->mode, parent_node->inode->path, dirent->name);
 	if (spdk_unlikely(!inode)) {
 		SPDK_ERRLOG("Failed to allod inode\n");
@@ -265,50 +323,54 @@ free_inode:
 	return rc;
 }
 
+/* Childs are created page by page, the dirents never hold the whole dir */
 static int
-sto_dir_inode_read(struct sto_inode *inode)
+sto_dir_inode_read_page(void *priv, struct sto_dirents *dirents)
 {
-	struct sto_dir_inode *dir_inode = sto_dir_inode(inode);
+	struct sto_inode *inode = priv;
+	uint32_t i;
+	int rc;
 
-	if (sto_inode_check_tree_depth(inode)) {
-		sto_inode_put_ref(inode);
-		return 0;
+	if (spdk_unlikely(sto_inode_check_error(inode))) {
+		return -ECANCELED;
 	}
 
-	sto_rpc_readdir(inode->path, sto_inode_read_done, inode, &dir_inode->dirents);
+	for (i = 0; i < dirents->cnt; i++) {
+		struct sto_dirent dirent;
+
+		sto_dirents_get(dirents, i, &dirent);
+
+		rc = sto_dir_inode_parse(&dirent, inode->node);
+		if (spdk_unlikely(rc)) {
+			SPDK_ERRLOG("Failed to parse dirent\n");
+			return rc;
+		}
+	}
 
 	return 0;
 }
 
 static int
-sto_dir_inode_read_done(struct sto_inode *inode)
+sto_dir_inode_read(struct sto_inode *inode)
 {
 	struct sto_dir_inode *dir_inode = sto_dir_inode(inode);
-	struct sto_dirents *dirents = &dir_inode->dirents;
-	struct sto_tree_node *node, *parent_node;
-	size_t i;
-	int rc = 0;
 
-	parent_node = inode->node;
+	sto_rpc_readdir_pages(inode->path, sto_dir_inode_read_page,
+			      sto_inode_read_done, inode, &dir_inode->dirents);
 
-	for (i = 0; i < dirents->cnt; i++) {
-		struct sto_dirent *dirent = &dirents->dirents[i];
+	return 0;
+}
 
-		rc = sto_dir_inode_parse(dirent, parent_node);
-		if (spdk_unlikely(rc)) {
-			SPDK_ERRLOG("Failed to parse dirent\n");
-			goto out;
-		}
-	}
+static int
+sto_dir_inode_read_done(struct sto_inode *inode)
+{
+	struct sto_tree_node *node;
 
-	TAILQ_FOREACH(node, &parent_node->childs, list) {
+	TAILQ_FOREACH(node, &inode->node->childs, list) {
 		sto_inode_read(node->inode);
 	}
 
-out:
-	sto_dirents_free(dirents);
-
-	return rc;
+	return 0;
 }
 
 static void
@@ -322,9 +384,13 @@ sto_dir_inode_destroy(struct sto_inode *inode)
 {
 	struct sto_dir_inode *dir_inode = sto_dir_inode(inode);
 
-	sto_inode_free(inode);
-
 	sto_dirents_free(&dir_inode->dirents);
+
+	if (inode->arena) {
+		return;
+	}
+
+	sto_inode_free(inode);
 	free(dir_inode);
 }
 
@@ -336,12 +402,12 @@ static struct sto_inode_ops sto_dir_inode_ops = {
 };
 
 static struct sto_inode *
-sto_dir_inode_create(void)
+sto_dir_inode_create(struct sto_arena *arena)
 {
 	struct sto_dir_inode *dir_inode;
 	struct sto_inode *inode;
 
-	dir_inode = calloc(1, sizeof(*dir_inode));
+	dir_inode = sto_inode_zalloc(arena, sizeof(*dir_inode));
 	if (spdk_unlikely(!dir_inode)) {
 		SPDK_ERRLOG("Failed to create dir node\n");
 		return NULL;
@@ -358,7 +424,7 @@ sto_lnk_inode_read(struct sto_inode *inode)
 {
 	struct sto_file_inode *file_inode = sto_file_inode(inode);
 
-	sto_rpc_readlink(inode->path, sto_inode_read_done, inode, &file_inode->buf);
+	sto_rpc_readlink(inode->path, sto_file_inode_read_cpl, inode, &file_inode->buf);
 
 	return 0;
 }
@@ -371,12 +437,12 @@ static struct sto_inode_ops sto_lnk_inode_ops = {
 };
 
 static struct sto_inode *
-sto_lnk_inode_create(void)
+sto_lnk_inode_create(struct sto_arena *arena)
 {
 	struct sto_file_inode *file_inode;
 	struct sto_inode *inode;
 
-	file_inode = calloc(1, sizeof(*file_inode));
+	file_inode = sto_inode_zalloc(arena, sizeof(*file_inode));
 	if (spdk_unlikely(!file_inode)) {
 		SPDK_ERRLOG("Failed to create lnk node\n");
 		return NULL;
@@ -184,9 +184,10 @@ sto_ops_param_type_name(enum sto_ops_param_type type)
 	return (type < STO_OPS_PARAM_TYPE_CNT) ? ops_param_type_name[type] : "Unknown";
 }
 
-static struct sto_json_head_raw g_json_head_raw;
-static struct sto_json_head_raw g_json_module_head_raw;
-static struct sto_json_head_raw g_json_subsystem_head_raw;
+/* Filled in and consumed right away, by whichever thread submits a req */
+static __thread struct sto_json_head_raw g_json_head_raw;
+static __thread struct sto_json_head_raw g_json_module_head_raw;
+static __thread struct sto_json_head_raw g_json_subsystem_head_raw;
 
 static void
 json_head_raw_init(struct sto_json_head_raw *head,
@@ -349,37 +350,46 @@ sto_ops_params_free(const struct sto_ops_params_properties *properties, void *op
 	free(ops_params);
 }
 
+static const void *
+ops_map_next(const void *obj, void *ctx)
+{
+	const struct sto_op_table *op_table = ctx;
+	const struct sto_ops *op = obj;
+
+	op = !op ? op_table->ops : op + 1;
+
+	return op < op_table->ops + op_table->size ? op : NULL;
+}
+
+static const char *
+ops_map_key(const void *obj)
+{
+	const struct sto_ops *op = obj;
+
+	return op->name;
+}
+
 int
-sto_ops_map_init(const struct sto_shash *ops_map, const struct sto_op_table *op_table)
+sto_ops_map_init(const struct sto_phash *ops_map, const struct sto_op_table *op_table)
 {
-	size_t i;
 	int rc;
 
-	rc = sto_shash_init((struct sto_shash *) ops_map, op_table->size);
+	rc = sto_phash_build_from((struct sto_phash *) ops_map, ops_map_next, ops_map_key,
+				  (void *) op_table);
 	if (spdk_unlikely(rc)) {
 		SPDK_ERRLOG("Failed to init ops map, rc=%d\n", rc);
-		return rc;
 	}
 
-	for (i = 0; i < op_table->size; i++) {
-		const struct sto_ops *op = &op_table->ops[i];
-
-		rc = sto_shash_add((struct sto_shash *) ops_map, op->name, strlen(op->name), op);
-		if (spdk_unlikely(rc)) {
-			SPDK_ERRLOG("Failed to add '%s' op to ops map\n", op->name);
-			goto failed;
-		}
-	}
-
-	return 0;
-
-failed:
-	sto_shash_destroy((struct sto_shash *) ops_map);
-
 	return rc;
 }
 
-static inline const struct sto_shash *
+void
+sto_ops_map_destroy(const struct sto_phash *ops_map)
+{
+	sto_phash_destroy((struct sto_phash *) ops_map);
+}
+
+static inline const struct sto_phash *
 get_ops_map(const char *component_name, const char *object_name)
 {
 	const struct sto_core_component *component;
@@ -389,24 +399,24 @@ get_ops_map(const char *component_name, const char *object_name)
 		return NULL;
 	}
 
-	return component->get_ops_map(object_name);
+	return component->get_ops_map(object_name, strlen(object_name));
 }
 
 const struct sto_ops *
-sto_ops_map_find(const struct sto_shash *ops_map, const char *op_name)
+sto_ops_map_lookup(const struct sto_phash *ops_map, const char *op_name, uint32_t len)
 {
-	const struct sto_shash *alias_ops_map;
+	const struct sto_phash *alias_ops_map;
 	const struct sto_ops *op;
 
-	op = sto_shash_lookup(ops_map, op_name, strlen(op_name));
+	op = sto_phash_lookup(ops_map, op_name, len);
 
 	while (op && op->type == STO_OPS_TYPE_ALIAS) {
 		alias_ops_map = get_ops_map(op->component_name, op->object_name);
-		if (spdk_unlikely(!ops_map)) {
+		if (spdk_unlikely(IS_ERR_OR_NULL(alias_ops_map))) {
 			return NULL;
 		}
 
-		op = sto_shash_lookup(alias_ops_map, op->name, strlen(op->name));
+		op = sto_phash_lookup(alias_ops_map, op->name, strlen(op->name));
 	}
 
 	return op;
@@ -2,17 +2,21 @@
 
 #include <spdk/stdinc.h>
 #include <spdk/thread.h>
+#include <spdk/env.h>
 #include <spdk/log.h>
 #include <spdk/likely.h>
 #include <spdk/queue.h>
 
 #include "sto_async.h"
+#include "sto_pool.h"
 
-#define STO_PL_ACTION_POLL_PERIOD	1000 /* 1ms */
+static bool g_sto_pipeline_busy_poll;
 
 enum sto_pipeline_action_type {
 	STO_PL_ACTION_BASIC,
 	STO_PL_ACTION_CONSTRUCTOR,
+	STO_PL_ACTION_PARALLEL,
+	STO_PL_ACTION_PARALLEL_ROLLBACK,
 	STO_PL_ACTION_CNT,
 };
 
@@ -26,90 +30,142 @@ struct sto_pipeline_action_hndl {
 		struct {
 			sto_pl_action_constructor_t fn;
 		} constructor;
+
+		struct {
+			sto_pl_parallel_count_t count_fn;
+			sto_pl_parallel_child_t child_fn;
+			sto_pl_parallel_child_t rollback_fn;
+			uint32_t max_inflight;
+		} parallel;
+
+		struct {
+			struct sto_pipeline_parallel *par;
+		} parallel_rollback;
 	} u;
 };
 
+struct sto_pipeline_parallel_child {
+	struct sto_pipeline_parallel *par;
+	uint32_t idx;
+	bool done;
+};
+
+struct sto_pipeline_parallel {
+	struct sto_pipeline *pipe;
+
+	sto_pl_parallel_child_t child_fn;
+	sto_pl_parallel_child_t rollback_fn;
+	uint32_t max_inflight;
+
+	uint32_t nr_children;
+	uint32_t next_idx;
+	uint32_t nr_inflight;
+	uint32_t nr_failed;
+	int rc;
+
+	bool rollback;
+	bool launching;
+
+	struct sto_pipeline_parallel *next;
+
+	struct sto_pipeline_parallel_child children[];
+};
+
+/*
+ * Only steps injected at runtime get an action, the static steps
+ * of a pipeline are executed straight from the properties.
+ */
 struct sto_pipeline_action {
 	struct sto_pipeline_action_hndl hndl;
-	struct sto_pipeline_action *rollback;
 
-	struct sto_pipeline *pipe;
+	struct sto_pipeline_action_hndl rollback;
+	bool has_rollback;
 
 	TAILQ_ENTRY(sto_pipeline_action) list;
 };
 
-static struct sto_pipeline_action *
-pipeline_action_alloc(struct sto_pipeline *pipe, struct sto_pipeline_action_hndl *hndl)
-{
-	struct sto_pipeline_action *action;
+#define STO_PL_ROLLBACK_STACK_MIN_SIZE	8
 
-	action = calloc(1, sizeof(*action));
-	if (spdk_unlikely(!action)) {
-		SPDK_ERRLOG("Failed to alloc action\n");
-		return NULL;
-	}
-
-	action->hndl = *hndl;
-	action->pipe = pipe;
+/* Steps completed in a row before the pipe goes back to the engine queue */
+#define STO_PL_INLINE_STEPS_MAX		64
 
-	return action;
-}
+/*
+ * Engines run on several threads, each one gets its own pools. Actions
+ * and pipelines are freed on the engine thread they were taken on.
+ */
+static __thread struct sto_pool g_pipeline_action_pool =
+	STO_POOL_INITIALIZER("pipeline action", sizeof(struct sto_pipeline_action));
 
-static void pipeline_action_free(struct sto_pipeline_action *action);
+/* Pipelines from sto_pipeline_alloc() together with their ctx */
+static __thread struct sto_pool_set g_pipeline_pool_set = STO_POOL_SET_INITIALIZER("pipeline");
 
-static struct sto_pipeline_action *
-pipeline_action_create(struct sto_pipeline *pipe, const struct sto_pipeline_step *step)
+static int
+pipeline_step_parse(const struct sto_pipeline_step *step, struct sto_pipeline_action_hndl *hndl,
+		    struct sto_pipeline_action_hndl *rollback, bool *has_rollback)
 {
-	struct sto_pipeline_action *action;
-	struct sto_pipeline_action_hndl hndl = {}, rollback_hndl = {}, *rollback_hndl_ptr = NULL;
+	*has_rollback = false;
 
 	switch (step->type) {
 	case STO_PL_STEP_BASIC:
-		hndl.type = STO_PL_ACTION_BASIC;
-		hndl.u.basic.fn = step->u.basic.action_fn;
+		hndl->type = STO_PL_ACTION_BASIC;
+		hndl->u.basic.fn = step->u.basic.action_fn;
 
 		if (step->u.basic.rollback_fn) {
-			rollback_hndl.type = STO_PL_ACTION_BASIC;
-			rollback_hndl.u.basic.fn = step->u.basic.rollback_fn;
+			rollback->type = STO_PL_ACTION_BASIC;
+			rollback->u.basic.fn = step->u.basic.rollback_fn;
 
-			rollback_hndl_ptr = &rollback_hndl;
+			*has_rollback = true;
 		}
 		break;
 	case STO_PL_STEP_CONSTRUCTOR:
-		hndl.type = STO_PL_ACTION_CONSTRUCTOR;
-		hndl.u.constructor.fn = step->u.constructor.action_fn;
+		hndl->type = STO_PL_ACTION_CONSTRUCTOR;
+		hndl->u.constructor.fn = step->u.constructor.action_fn;
 
 		if (step->u.constructor.rollback_fn) {
-			rollback_hndl.type = STO_PL_ACTION_CONSTRUCTOR;
-			rollback_hndl.u.constructor.fn = step->u.constructor.rollback_fn;
+			rollback->type = STO_PL_ACTION_CONSTRUCTOR;
+			rollback->u.constructor.fn = step->u.constructor.rollback_fn;
 
-			rollback_hndl_ptr = &rollback_hndl;
+			*has_rollback = true;
 		}
 		break;
+	case STO_PL_STEP_PARALLEL:
+		/* The rollback needs the state of the children, it is set on start */
+		hndl->type = STO_PL_ACTION_PARALLEL;
+		hndl->u.parallel.count_fn = step->u.parallel.count_fn;
+		hndl->u.parallel.child_fn = step->u.parallel.child_fn;
+		hndl->u.parallel.rollback_fn = step->u.parallel.rollback_fn;
+		hndl->u.parallel.max_inflight = step->u.parallel.max_inflight;
+		break;
 	default:
 		SPDK_ERRLOG("Failed to process pipeline step with typed %d\n",
 			    step->type);
-		return NULL;
+		return -EINVAL;
 	}
 
-	action = pipeline_action_alloc(pipe, &hndl);
+	return 0;
+}
+
+static struct sto_pipeline_action *
+pipeline_action_create(const struct sto_pipeline_step *step)
+{
+	struct sto_pipeline_action *action;
+	int rc;
+
+	action = sto_pool_get(&g_pipeline_action_pool);
 	if (spdk_unlikely(!action)) {
 		SPDK_ERRLOG("Failed to alloc action for step\n");
 		return NULL;
 	}
 
-	if (rollback_hndl_ptr) {
-		action->rollback = pipeline_action_alloc(pipe, rollback_hndl_ptr);
-		if (spdk_unlikely(!action->rollback)) {
-			SPDK_ERRLOG("Failed to alloc rollback for step\n");
-			goto free_action;
-		}
+	rc = pipeline_step_parse(step, &action->hndl, &action->rollback, &action->has_rollback);
+	if (spdk_unlikely(rc)) {
+		goto free_action;
 	}
 
 	return action;
 
 free_action:
-	pipeline_action_free(action);
+	sto_pool_put(&g_pipeline_action_pool, action);
 
 	return NULL;
 }
@@ -117,90 +173,369 @@ free_action:
 static void
 pipeline_action_free(struct sto_pipeline_action *action)
 {
-	if (action->rollback) {
-		pipeline_action_free(action->rollback);
-		action->rollback = NULL;
+	sto_pool_put(&g_pipeline_action_pool, action);
+}
+
+static int
+pipeline_rollback_stack_grow(struct sto_pipeline *pipe)
+{
+	struct sto_pipeline_action_hndl *stack;
+	uint32_t size;
+
+	size = spdk_max(pipe->rollback_size * 2, STO_PL_ROLLBACK_STACK_MIN_SIZE);
+
+	stack = realloc(pipe->rollback_stack, size * sizeof(*stack));
+	if (spdk_unlikely(!stack)) {
+		SPDK_ERRLOG("Failed to grow rollback stack to %u entries\n", size);
+		return -ENOMEM;
 	}
 
-	free(action);
+	pipe->rollback_stack = stack;
+	pipe->rollback_size = size;
+
+	return 0;
 }
 
-static void
-pipeline_action_manage_rollback(struct sto_pipeline_action *action)
+/*
+ * The rollback of a step is kept pending right above the top of the
+ * stack and is only pushed once the next step starts, so a failed step
+ * is never rolled back itself.
+ */
+static int
+pipeline_manage_rollback(struct sto_pipeline *pipe, const struct sto_pipeline_action_hndl *rollback)
 {
-	struct sto_pipeline *pipe = action->pipe;
+	int rc;
 
 	if (spdk_likely(pipe->rollback)) {
-		return;
+		return 0;
 	}
 
-	if (pipe->cur_rollback) {
-		TAILQ_INSERT_HEAD(&pipe->rollback_stack, pipe->cur_rollback, list);
-		pipe->cur_rollback = NULL;
+	if (pipe->rollback_pending) {
+		pipe->rollback_cnt++;
+		pipe->rollback_pending = false;
 	}
 
-	if (action->rollback) {
-		pipe->cur_rollback = action->rollback;
-		action->rollback = NULL;
+	if (!rollback) {
+		return 0;
 	}
+
+	if (pipe->rollback_cnt == pipe->rollback_size) {
+		rc = pipeline_rollback_stack_grow(pipe);
+		if (spdk_unlikely(rc)) {
+			return rc;
+		}
+	}
+
+	pipe->rollback_stack[pipe->rollback_cnt] = *rollback;
+	pipe->rollback_pending = true;
+
+	return 0;
+}
+
+static void pipeline_parallel_kick(struct sto_pipeline_parallel *par);
+
+static struct sto_pipeline_parallel_child *
+pipeline_parallel_next_child(struct sto_pipeline_parallel *par)
+{
+	struct sto_pipeline_parallel_child *child;
+
+	while (par->next_idx < par->nr_children) {
+		child = &par->children[par->next_idx];
+
+		if (!par->rollback) {
+			/* Do not start new children after a failure */
+			if (par->rc) {
+				return NULL;
+			}
+
+			par->next_idx++;
+			return child;
+		}
+
+		par->next_idx++;
+
+		if (child->done) {
+			return child;
+		}
+	}
+
+	return NULL;
 }
 
 static void
-pipeline_basic_action_execute(struct sto_pipeline_action *action)
+pipeline_parallel_child_done(void *cb_arg, int rc)
 {
-	struct sto_pipeline *pipe = action->pipe;
+	struct sto_pipeline_parallel_child *child = cb_arg;
+	struct sto_pipeline_parallel *par = child->par;
 
-	pipeline_action_manage_rollback(action);
+	assert(par->nr_inflight);
+	par->nr_inflight--;
 
-	action->hndl.u.basic.fn(pipe);
+	if (!par->rollback) {
+		if (spdk_unlikely(rc)) {
+			if (!par->rc) {
+				par->rc = rc;
+			}
 
-	pipeline_action_free(action);
+			par->nr_failed++;
+		} else {
+			child->done = true;
+		}
+	} else {
+		if (spdk_unlikely(rc)) {
+			SPDK_ERRLOG("Failed to roll back child %u of pipeline %p, rc=%d\n",
+				    child->idx, par->pipe, rc);
+		}
+
+		child->done = false;
+	}
+
+	pipeline_parallel_kick(par);
 }
 
 static void
-pipeline_constructor_action_execute(struct sto_pipeline_action *action)
+pipeline_parallel_start_rollback(struct sto_pipeline_parallel *par)
 {
-	struct sto_pipeline *pipe = action->pipe;
-	int rc = 0;
+	par->rollback = true;
+	par->next_idx = 0;
 
-	pipeline_action_manage_rollback(action);
+	pipeline_parallel_kick(par);
+}
 
-	rc = action->hndl.u.constructor.fn(pipe);
+static void
+pipeline_parallel_finish(struct sto_pipeline_parallel *par)
+{
+	if (par->rc && !par->rollback) {
+		SPDK_ERRLOG("%u of %u children of pipeline %p failed, rc=%d\n",
+			    par->nr_failed, par->nr_children, par->pipe, par->rc);
 
-	switch (rc) {
-	case 0:
-		TAILQ_INSERT_HEAD(&pipe->action_queue, action, list);
-		break;
-	case STO_PL_CONSTRUCTOR_FINISHED:
-		rc = 0;
-		/* fallthrough */
-	default:
-		pipeline_action_free(action);
-		sto_pipeline_step_next(pipe, rc);
-		break;
-	};
+		if (par->rollback_fn) {
+			pipeline_parallel_start_rollback(par);
+			return;
+		}
+	}
+
+	/* A rollback from the pipeline rollback stack completes with 0 */
+	sto_pipeline_step_next(par->pipe, par->rc);
+}
+
+/*
+ * Children may complete synchronously from child_fn, so completions that
+ * come in while launching only account and leave the loop to go on.
+ */
+static void
+pipeline_parallel_kick(struct sto_pipeline_parallel *par)
+{
+	struct sto_pipeline_parallel_child *child;
+	sto_pl_parallel_child_t fn;
+
+	if (par->launching) {
+		return;
+	}
+
+	par->launching = true;
+
+	fn = par->rollback ? par->rollback_fn : par->child_fn;
+
+	while (!par->max_inflight || par->nr_inflight < par->max_inflight) {
+		child = pipeline_parallel_next_child(par);
+		if (!child) {
+			break;
+		}
+
+		par->nr_inflight++;
+
+		fn(par->pipe, child->idx, pipeline_parallel_child_done, child);
+	}
+
+	par->launching = false;
+
+	if (!par->nr_inflight) {
+		pipeline_parallel_finish(par);
+	}
+}
+
+static int pipeline_manage_rollback(struct sto_pipeline *pipe,
+				    const struct sto_pipeline_action_hndl *rollback);
+
+static void
+pipeline_parallel_start(struct sto_pipeline *pipe, const struct sto_pipeline_action_hndl *hndl)
+{
+	struct sto_pipeline_action_hndl rollback = {};
+	struct sto_pipeline_parallel *par;
+	int nr_children, rc;
+	uint32_t i;
+
+	nr_children = hndl->u.parallel.count_fn(pipe);
+	if (nr_children <= 0) {
+		sto_pipeline_step_next(pipe, nr_children);
+		return;
+	}
+
+	par = calloc(1, sizeof(*par) + nr_children * sizeof(par->children[0]));
+	if (spdk_unlikely(!par)) {
+		SPDK_ERRLOG("Failed to alloc parallel step for %d children\n", nr_children);
+		sto_pipeline_step_next(pipe, -ENOMEM);
+		return;
+	}
+
+	par->pipe = pipe;
+	par->child_fn = hndl->u.parallel.child_fn;
+	par->rollback_fn = hndl->u.parallel.rollback_fn;
+	par->max_inflight = hndl->u.parallel.max_inflight;
+	par->nr_children = nr_children;
+
+	for (i = 0; i < par->nr_children; i++) {
+		par->children[i].par = par;
+		par->children[i].idx = i;
+	}
+
+	par->next = pipe->parallel_list;
+	pipe->parallel_list = par;
+
+	if (par->rollback_fn) {
+		rollback.type = STO_PL_ACTION_PARALLEL_ROLLBACK;
+		rollback.u.parallel_rollback.par = par;
+
+		rc = pipeline_manage_rollback(pipe, &rollback);
+		if (spdk_unlikely(rc)) {
+			sto_pipeline_step_next(pipe, rc);
+			return;
+		}
+	}
+
+	pipeline_parallel_kick(par);
 }
 
 static void
-pipeline_action_execute(struct sto_pipeline_action *action)
+pipeline_parallel_list_free(struct sto_pipeline *pipe)
+{
+	struct sto_pipeline_parallel *par;
+
+	while ((par = pipe->parallel_list) != NULL) {
+		assert(!par->nr_inflight);
+
+		pipe->parallel_list = par->next;
+		free(par);
+	}
+}
+
+/* Returns true if a constructor has to be called once again */
+static bool
+pipeline_hndl_execute(struct sto_pipeline *pipe, const struct sto_pipeline_action_hndl *hndl)
 {
-	switch (action->hndl.type) {
+	int rc;
+
+	switch (hndl->type) {
 	case STO_PL_ACTION_BASIC:
-		pipeline_basic_action_execute(action);
+		hndl->u.basic.fn(pipe);
 		break;
 	case STO_PL_ACTION_CONSTRUCTOR:
-		pipeline_constructor_action_execute(action);
+		rc = hndl->u.constructor.fn(pipe);
+
+		switch (rc) {
+		case 0:
+			return true;
+		case STO_PL_CONSTRUCTOR_FINISHED:
+			rc = 0;
+			/* fallthrough */
+		default:
+			sto_pipeline_step_next(pipe, rc);
+			break;
+		};
+		break;
+	case STO_PL_ACTION_PARALLEL:
+		pipeline_parallel_start(pipe, hndl);
+		break;
+	case STO_PL_ACTION_PARALLEL_ROLLBACK:
+		pipeline_parallel_start_rollback(hndl->u.parallel_rollback.par);
 		break;
 	default:
 		SPDK_ERRLOG("Invalid type of action %d for pipeline %p\n",
-			    action->hndl.type, action->pipe);
+			    hndl->type, pipe);
 		assert(0);
 		break;
 	};
+
+	return false;
+}
+
+static bool
+pipeline_step_execute(struct sto_pipeline *pipe, const struct sto_pipeline_action_hndl *hndl,
+		      const struct sto_pipeline_action_hndl *rollback)
+{
+	int rc;
+
+	rc = pipeline_manage_rollback(pipe, rollback);
+	if (spdk_unlikely(rc)) {
+		sto_pipeline_step_next(pipe, rc);
+		return false;
+	}
+
+	return pipeline_hndl_execute(pipe, hndl);
+}
+
+static void
+pipeline_action_execute(struct sto_pipeline *pipe, struct sto_pipeline_action *action)
+{
+	TAILQ_REMOVE(&pipe->action_queue, action, list);
+
+	if (pipeline_step_execute(pipe, &action->hndl,
+				  action->has_rollback ? &action->rollback : NULL)) {
+		action->has_rollback = false;
+		TAILQ_INSERT_HEAD(&pipe->action_queue, action, list);
+		return;
+	}
+
+	pipeline_action_free(action);
+}
+
+static void
+pipeline_static_step_execute(struct sto_pipeline *pipe)
+{
+	const struct sto_pipeline_step *step = &pipe->steps[pipe->step_idx];
+	struct sto_pipeline_action_hndl hndl, rollback;
+	bool has_rollback, started;
+	int rc;
+
+	rc = pipeline_step_parse(step, &hndl, &rollback, &has_rollback);
+	if (spdk_unlikely(rc)) {
+		sto_pipeline_step_next(pipe, rc);
+		return;
+	}
+
+	started = pipe->step_started;
+
+	pipe->step_idx++;
+	pipe->step_started = false;
+
+	if (pipeline_step_execute(pipe, &hndl, has_rollback && !started ? &rollback : NULL)) {
+		pipe->step_idx--;
+		pipe->step_started = true;
+	}
+}
+
+static void
+pipeline_rollback_execute(struct sto_pipeline *pipe)
+{
+	struct sto_pipeline_action_hndl *rollback;
+
+	rollback = &pipe->rollback_stack[--pipe->rollback_cnt];
+
+	/* Nothing is pushed while rolling back, so the entry stays valid */
+	if (pipeline_hndl_execute(pipe, rollback)) {
+		pipe->rollback_cnt++;
+	}
 }
 
 static int pipeline_action_poll(void *ctx);
 
+void
+sto_pipeline_set_busy_poll(bool busy_poll)
+{
+	g_sto_pipeline_busy_poll = busy_poll;
+}
+
 struct sto_pipeline_engine *
 sto_pipeline_engine_create(const char *name)
 {
@@ -218,11 +553,16 @@ sto_pipeline_engine_create(const char *name)
 		goto free_engine;
 	}
 
-	engine->poller = SPDK_POLLER_REGISTER(pipeline_action_poll, engine, STO_PL_ACTION_POLL_PERIOD);
-	if (spdk_unlikely(!engine->poller)) {
-		SPDK_ERRLOG("Cann't register the STO pipeline engine %s poller\n",
-			    engine->name);
-		goto free_name;
+	engine->thread = spdk_get_thread();
+	engine->busy_poll = g_sto_pipeline_busy_poll;
+
+	if (engine->busy_poll) {
+		engine->poller = SPDK_POLLER_REGISTER(pipeline_action_poll, engine, 0);
+		if (spdk_unlikely(!engine->poller)) {
+			SPDK_ERRLOG("Cann't register the STO pipeline engine %s poller\n",
+				    engine->name);
+			goto free_name;
+		}
 	}
 
 	TAILQ_INIT(&engine->pipeline_list);
@@ -238,22 +578,40 @@ free_engine:
 	return NULL;
 }
 
+static void
+pipeline_engine_free(struct sto_pipeline_engine *engine)
+{
+	free((char *) engine->name);
+	free(engine);
+}
+
 void
 sto_pipeline_engine_destroy(struct sto_pipeline_engine *engine)
 {
 	spdk_poller_unregister(&engine->poller);
-	free((char *) engine->name);
-	free(engine);
+
+	/* A pending kick still refers to the engine, it frees it instead */
+	if (engine->kicked) {
+		engine->destroying = true;
+		return;
+	}
+
+	pipeline_engine_free(engine);
 }
 
 static void pipeline_type_deinit(struct sto_pipeline_type *type);
 
 static int
-pipeline_type_init(struct sto_pipeline_type *type, const struct sto_pipeline_properties *properties)
+pipeline_type_init(struct sto_pipeline_type *type, const struct sto_pipeline_properties *properties,
+		   void *ctx)
 {
 	int rc = 0;
 
-	if (properties->ctx_size) {
+	if (ctx) {
+		type->ctx = ctx;
+		type->ctx_embedded = true;
+		type->ctx_deinit_fn = properties->ctx_deinit_fn;
+	} else if (properties->ctx_size) {
 		type->ctx = calloc(1, properties->ctx_size);
 		if (spdk_unlikely(!type->ctx)) {
 			SPDK_ERRLOG("Failed to alloc pipeline type ctx\n");
@@ -280,24 +638,26 @@ pipeline_type_deinit(struct sto_pipeline_type *type)
 			type->ctx_deinit_fn(type->ctx);
 		}
 
-		free(type->ctx);
+		if (!type->ctx_embedded) {
+			free(type->ctx);
+		}
 	}
 }
 
-int
-sto_pipeline_init(struct sto_pipeline *pipe, const struct sto_pipeline_properties *properties)
+static int
+pipeline_init(struct sto_pipeline *pipe, const struct sto_pipeline_properties *properties,
+	      void *ctx)
 {
 	int rc;
 
 	TAILQ_INIT(&pipe->action_queue);
 	TAILQ_INIT(&pipe->action_queue_todo);
-	TAILQ_INIT(&pipe->rollback_stack);
 
 	if (!properties) {
 		goto out;
 	}
 
-	rc = pipeline_type_init(&pipe->type, properties);
+	rc = pipeline_type_init(&pipe->type, properties, ctx);
 	if (spdk_unlikely(rc)) {
 		SPDK_ERRLOG("Failed to init STO pipeline\n");
 		return rc;
@@ -313,6 +673,12 @@ out:
 	return 0;
 }
 
+int
+sto_pipeline_init(struct sto_pipeline *pipe, const struct sto_pipeline_properties *properties)
+{
+	return pipeline_init(pipe, properties, NULL);
+}
+
 static void pipeline_action_list_free(struct sto_pipeline_action_list *actions);
 
 void
@@ -320,28 +686,32 @@ sto_pipeline_deinit(struct sto_pipeline *pipe)
 {
 	pipeline_type_deinit(&pipe->type);
 
-	if (pipe->cur_rollback) {
-		pipeline_action_free(pipe->cur_rollback);
-	}
-
 	pipeline_action_list_free(&pipe->action_queue);
 	pipeline_action_list_free(&pipe->action_queue_todo);
-	pipeline_action_list_free(&pipe->rollback_stack);
+
+	free(pipe->rollback_stack);
+
+	pipeline_parallel_list_free(pipe);
 }
 
 struct sto_pipeline *
 sto_pipeline_alloc(const struct sto_pipeline_properties *properties)
 {
+	size_t pipe_size = SPDK_ALIGN_CEIL(sizeof(struct sto_pipeline), 16);
+	size_t alloc_size = pipe_size + properties->ctx_size;
 	struct sto_pipeline *pipe;
 	int rc;
 
-	pipe = calloc(1, sizeof(*pipe));
+	pipe = sto_pool_set_get(&g_pipeline_pool_set, alloc_size);
 	if (spdk_unlikely(!pipe)) {
 		SPDK_ERRLOG("Failed to alloc STO pipeline\n");
 		return NULL;
 	}
 
-	rc = sto_pipeline_init(pipe, properties);
+	pipe->alloc_size = alloc_size;
+
+	rc = pipeline_init(pipe, properties,
+			   properties->ctx_size ? (char *) pipe + pipe_size : NULL);
 	if (spdk_unlikely(rc)) {
 		SPDK_ERRLOG("Failed to init pipeline\n");
 		goto free_pipeline;
@@ -361,48 +731,135 @@ void
 sto_pipeline_free(struct sto_pipeline *pipe)
 {
 	sto_pipeline_deinit(pipe);
-	free(pipe);
+	sto_pool_set_put(&g_pipeline_pool_set, pipe, pipe->alloc_size);
 }
 
-void
-sto_pipeline_run(struct sto_pipeline_engine *engine,
-		 struct sto_pipeline *pipe,
-		 sto_generic_cb cb_fn, void *cb_arg)
+static void
+pipeline_run(struct sto_pipeline_engine *engine, struct sto_pipeline *pipe,
+	     sto_generic_cb cb_fn, void *cb_arg, struct spdk_thread *cb_thread)
 {
 	pipe->engine = engine;
 	pipe->cb_fn = cb_fn;
 	pipe->cb_arg = cb_arg;
+	pipe->cb_thread = cb_thread;
+
+	pipe->queue_wait_ticks = 0;
 
 	sto_pipeline_step_start(pipe);
 }
 
+void
+sto_pipeline_run(struct sto_pipeline_engine *engine,
+		 struct sto_pipeline *pipe,
+		 sto_generic_cb cb_fn, void *cb_arg)
+{
+	assert(engine->thread == spdk_get_thread());
+
+	pipeline_run(engine, pipe, cb_fn, cb_arg, engine->thread);
+}
+
+struct pipeline_alloc_and_run_ctx {
+	struct sto_pipeline_engine *engine;
+	const struct sto_pipeline_properties *properties;
+	void *priv;
+
+	sto_generic_cb cb_fn;
+	void *cb_arg;
+	struct spdk_thread *cb_thread;
+};
+
+static void
+pipeline_alloc_and_run(struct pipeline_alloc_and_run_ctx *ctx)
+{
+	struct sto_pipeline *pipe;
+
+	pipe = sto_pipeline_alloc(ctx->properties);
+	if (spdk_unlikely(!pipe)) {
+		sto_generic_call_on_thread(ctx->cb_thread, ctx->cb_fn, ctx->cb_arg, -ENOMEM);
+		return;
+	}
+
+	sto_pipeline_set_priv(pipe, ctx->priv);
+
+	pipeline_run(ctx->engine, pipe, ctx->cb_fn, ctx->cb_arg, ctx->cb_thread);
+}
+
+static void
+pipeline_alloc_and_run_msg(void *arg)
+{
+	struct pipeline_alloc_and_run_ctx *ctx = arg;
+
+	pipeline_alloc_and_run(ctx);
+	free(ctx);
+}
+
 void
 sto_pipeline_alloc_and_run(struct sto_pipeline_engine *engine,
 			   const struct sto_pipeline_properties *properties,
 			   sto_generic_cb cb_fn, void *cb_arg,
 			   void *priv)
 {
-	struct sto_pipeline *pipe;
+	struct pipeline_alloc_and_run_ctx local_ctx = {
+		.engine = engine,
+		.properties = properties,
+		.priv = priv,
+		.cb_fn = cb_fn,
+		.cb_arg = cb_arg,
+		.cb_thread = spdk_get_thread(),
+	};
+	struct pipeline_alloc_and_run_ctx *ctx;
+	int rc;
 
-	pipe = sto_pipeline_alloc(properties);
-	if (spdk_unlikely(!pipe)) {
+	if (local_ctx.cb_thread == engine->thread) {
+		pipeline_alloc_and_run(&local_ctx);
+		return;
+	}
+
+	ctx = malloc(sizeof(*ctx));
+	if (spdk_unlikely(!ctx)) {
+		SPDK_ERRLOG("Failed to alloc a run message for engine %s\n", engine->name);
 		cb_fn(cb_arg, -ENOMEM);
 		return;
 	}
 
-	sto_pipeline_set_priv(pipe, priv);
+	*ctx = local_ctx;
 
-	sto_pipeline_run(engine, pipe, cb_fn, cb_arg);
+	rc = spdk_thread_send_msg(engine->thread, pipeline_alloc_and_run_msg, ctx);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to send a pipeline to engine %s, rc=%d\n", engine->name, rc);
+		free(ctx);
+		cb_fn(cb_arg, rc);
+	}
 }
 
 static void
 pipeline_done(struct sto_pipeline *pipe)
 {
-	pipe->cb_fn(pipe->cb_arg, pipe->returncode);
+	sto_generic_cb cb_fn = pipe->cb_fn;
+	void *cb_arg = pipe->cb_arg;
+	struct spdk_thread *cb_thread;
+	int rc = pipe->returncode;
+
+	if (pipe->cb_thread == spdk_get_thread()) {
+		cb_fn(cb_arg, rc);
 
-	if (pipe->auto_release) {
-		sto_pipeline_free(pipe);
+		if (pipe->auto_release) {
+			sto_pipeline_free(pipe);
+		}
+
+		return;
 	}
+
+	/*
+	 * Only sto_pipeline_alloc_and_run() crosses threads. The pipe goes
+	 * back to the pool of this thread before the caller hears of it.
+	 */
+	assert(pipe->auto_release);
+
+	cb_thread = pipe->cb_thread;
+	sto_pipeline_free(pipe);
+
+	sto_generic_call_on_thread(cb_thread, cb_fn, cb_arg, rc);
 }
 
 static void
@@ -420,20 +877,18 @@ pipeline_action_list_free(struct sto_pipeline_action_list *actions)
 int
 sto_pipeline_add_steps(struct sto_pipeline *pipe, const struct sto_pipeline_step *steps)
 {
-	const struct sto_pipeline_step *step;
-
-	for (step = steps; step && step->type != STO_PL_STEP_TERMINATOR; step++) {
-		struct sto_pipeline_action *action;
-
-		action = pipeline_action_create(pipe, step);
-		if (spdk_unlikely(!action)) {
-			SPDK_ERRLOG("Failed to create action\n");
-			return -ENOMEM;
-		}
+	if (!steps || steps->type == STO_PL_STEP_TERMINATOR) {
+		return 0;
+	}
 
-		TAILQ_INSERT_TAIL(&pipe->action_queue, action, list);
+	if (spdk_unlikely(pipe->steps)) {
+		SPDK_ERRLOG("Pipeline %p already has static steps\n", pipe);
+		return -EEXIST;
 	}
 
+	pipe->steps = steps;
+	pipe->step_idx = 0;
+
 	return 0;
 }
 
@@ -442,7 +897,7 @@ __sto_pipeline_insert_step(struct sto_pipeline *pipe, const struct sto_pipeline_
 {
 	struct sto_pipeline_action *action;
 
-	action = pipeline_action_create(pipe, step);
+	action = pipeline_action_create(step);
 	if (spdk_unlikely(!action)) {
 		return -ENOMEM;
 	}
@@ -452,24 +907,10 @@ __sto_pipeline_insert_step(struct sto_pipeline *pipe, const struct sto_pipeline_
 	return 0;
 }
 
-static inline struct sto_pipeline_action *
-pipeline_next_action(struct sto_pipeline *pipe)
+static inline bool
+pipeline_has_static_step(struct sto_pipeline *pipe)
 {
-	struct sto_pipeline_action_list *actions;
-	struct sto_pipeline_action *action = NULL;
-
-	if (spdk_likely(!pipe->rollback)) {
-		actions = &pipe->action_queue;
-	} else {
-		actions = &pipe->rollback_stack;
-	}
-
-	if (!TAILQ_EMPTY(actions)) {
-		action = TAILQ_FIRST(actions);
-		TAILQ_REMOVE(actions, action, list);
-	}
-
-	return action;
+	return pipe->steps && pipe->steps[pipe->step_idx].type != STO_PL_STEP_TERMINATOR;
 }
 
 static void
@@ -500,7 +941,7 @@ pipeline_action_finish(struct sto_pipeline *pipe)
 	pipe->returncode = pipe->error;
 	pipe->error = 0;
 
-	if (!TAILQ_EMPTY(&pipe->rollback_stack)) {
+	if (pipe->rollback_cnt) {
 		pipe->rollback = true;
 		sto_pipeline_step_next(pipe, 0);
 		return;
@@ -510,27 +951,53 @@ done:
 	pipeline_done(pipe);
 }
 
+/*
+ * Trampoline over the steps of a pipe: a step that calls
+ * sto_pipeline_step_next() before returning is followed by the next one
+ * right away, only steps completing later go through the engine queue.
+ */
 static void
 pipeline_action(struct sto_pipeline *pipe)
 {
 	struct sto_pipeline_action *action;
+	uint32_t nr_inline = 0;
 
-	if (spdk_unlikely(pipe->error)) {
-		goto finish;
-	}
+	while (true) {
+		if (spdk_unlikely(pipe->error)) {
+			goto finish;
+		}
 
-	action = pipeline_next_action(pipe);
-	if (!action) {
-		goto finish;
-	}
+		pipe->in_step = nr_inline < STO_PL_INLINE_STEPS_MAX;
+		pipe->step_done_inline = false;
+
+		if (spdk_unlikely(pipe->rollback)) {
+			if (!pipe->rollback_cnt) {
+				goto finish;
+			}
+
+			pipeline_rollback_execute(pipe);
+		} else if ((action = TAILQ_FIRST(&pipe->action_queue)) != NULL) {
+			pipeline_action_execute(pipe, action);
+		} else if (pipeline_has_static_step(pipe)) {
+			pipeline_static_step_execute(pipe);
+		} else {
+			goto finish;
+		}
 
-	pipeline_action_execute(action);
+		pipe->in_step = false;
 
-	pipeline_check_actions_todo(pipe);
+		pipeline_check_actions_todo(pipe);
 
-	return;
+		if (!pipe->step_done_inline) {
+			return;
+		}
+
+		nr_inline++;
+	}
 
 finish:
+	pipe->in_step = false;
+
 	pipeline_action_finish(pipe);
 }
 
@@ -540,6 +1007,7 @@ pipeline_action_poll(void *ctx)
 	struct sto_pipeline_engine *engine = ctx;
 	struct sto_pipeline_list pipeline_list = TAILQ_HEAD_INITIALIZER(pipeline_list);
 	struct sto_pipeline *pipeline, *tmp;
+	uint64_t now;
 
 	if (TAILQ_EMPTY(&engine->pipeline_list)) {
 		return SPDK_POLLER_IDLE;
@@ -547,20 +1015,64 @@ pipeline_action_poll(void *ctx)
 
 	TAILQ_SWAP(&pipeline_list, &engine->pipeline_list, sto_pipeline, list);
 
+	now = spdk_get_ticks();
+
 	TAILQ_FOREACH_SAFE(pipeline, &pipeline_list, list, tmp) {
 		TAILQ_REMOVE(&pipeline_list, pipeline, list);
 
+		pipeline->queue_wait_ticks += now - pipeline->queue_ticks;
+
 		pipeline_action(pipeline);
 	}
 
 	return SPDK_POLLER_BUSY;
 }
 
+static void
+pipeline_action_kick(void *ctx)
+{
+	struct sto_pipeline_engine *engine = ctx;
+
+	if (spdk_unlikely(engine->destroying)) {
+		pipeline_engine_free(engine);
+		return;
+	}
+
+	/* Pipelines queued while processing send a new kick */
+	engine->kicked = false;
+
+	pipeline_action_poll(engine);
+}
+
 void
 sto_pipeline_step_next(struct sto_pipeline *pipe, int rc)
 {
 	struct sto_pipeline_engine *engine = pipe->engine;
+	int ret;
 
 	pipe->error = rc;
+
+	if (pipe->in_step) {
+		pipe->in_step = false;
+		pipe->step_done_inline = true;
+		return;
+	}
+
+	pipe->queue_ticks = spdk_get_ticks();
+
 	TAILQ_INSERT_TAIL(&engine->pipeline_list, pipe, list);
+
+	if (engine->busy_poll || engine->kicked) {
+		return;
+	}
+
+	ret = spdk_thread_send_msg(engine->thread, pipeline_action_kick, engine);
+	if (spdk_unlikely(ret)) {
+		SPDK_ERRLOG("CRITICAL: Failed to kick the STO pipeline engine %s, rc=%d\n",
+			    engine->name, ret);
+		assert(0);
+		return;
+	}
+
+	engine->kicked = true;
 }
@@ -0,0 +1,128 @@
+#include "sto_pool.h"
+
+#include <spdk/stdinc.h>
+#include <spdk/log.h>
+#include <spdk/likely.h>
+#include <spdk/util.h>
+
+#define STO_POOL_OBJ_ALIGN	16
+
+static inline size_t
+sto_pool_obj_size(struct sto_pool *pool)
+{
+	return SPDK_ALIGN_CEIL(spdk_max(pool->obj_size, sizeof(void *)), STO_POOL_OBJ_ALIGN);
+}
+
+static int
+sto_pool_grow(struct sto_pool *pool)
+{
+	size_t obj_size = sto_pool_obj_size(pool);
+	char *slab;
+	uint32_t i;
+
+	slab = aligned_alloc(STO_POOL_OBJ_ALIGN, obj_size * pool->objs_per_slab);
+	if (spdk_unlikely(!slab)) {
+		SPDK_ERRLOG("Failed to alloc slab for %s pool: obj_size=%zu\n",
+			    pool->name, obj_size);
+		return -ENOMEM;
+	}
+
+	/* Link the objects so that they are handed out in address order */
+	for (i = pool->objs_per_slab; i > 0; i--) {
+		void **obj = (void **) (slab + (i - 1) * obj_size);
+
+		*obj = pool->free_list;
+		pool->free_list = obj;
+	}
+
+	pool->nr_slabs++;
+
+	return 0;
+}
+
+void *
+sto_pool_get(struct sto_pool *pool)
+{
+	void **obj;
+
+	if (spdk_unlikely(!pool->free_list)) {
+		if (sto_pool_grow(pool)) {
+			return NULL;
+		}
+	}
+
+	obj = pool->free_list;
+	pool->free_list = *obj;
+
+	pool->nr_used++;
+
+	memset(obj, 0, pool->obj_size);
+
+	return obj;
+}
+
+void
+sto_pool_put(struct sto_pool *pool, void *obj)
+{
+	void **head = obj;
+
+	if (!obj) {
+		return;
+	}
+
+	assert(pool->nr_used);
+	pool->nr_used--;
+
+	*head = pool->free_list;
+	pool->free_list = head;
+}
+
+static struct sto_pool *
+sto_pool_set_class(struct sto_pool_set *set, size_t size)
+{
+	struct sto_pool *pool;
+	uint32_t cls = 0;
+
+	while (size > (1UL << (STO_POOL_SET_MIN_SHIFT + cls))) {
+		if (++cls == STO_POOL_SET_NR_CLASSES) {
+			return NULL;
+		}
+	}
+
+	pool = &set->pools[cls];
+
+	if (spdk_unlikely(!pool->obj_size)) {
+		pool->name = set->name;
+		pool->obj_size = 1UL << (STO_POOL_SET_MIN_SHIFT + cls);
+		pool->objs_per_slab = STO_POOL_DEFAULT_OBJS_PER_SLAB;
+	}
+
+	return pool;
+}
+
+void *
+sto_pool_set_get(struct sto_pool_set *set, size_t size)
+{
+	struct sto_pool *pool;
+
+	pool = sto_pool_set_class(set, size);
+	if (!pool) {
+		return calloc(1, size);
+	}
+
+	return sto_pool_get(pool);
+}
+
+void
+sto_pool_set_put(struct sto_pool_set *set, void *obj, size_t size)
+{
+	struct sto_pool *pool;
+
+	pool = sto_pool_set_class(set, size);
+	if (!pool) {
+		free(obj);
+		return;
+	}
+
+	sto_pool_put(pool, obj);
+}
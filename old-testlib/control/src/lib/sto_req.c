@@ -8,67 +8,54 @@
 #include "sto_core.h"
 #include "sto_lib.h"
 #include "sto_pipeline.h"
+#include "sto_pool.h"
 
 struct sto_json_iter;
 
-static struct sto_pipeline_engine *g_req_engine;
+#define STO_REQ_ALIGN	16
 
-static void sto_req_type_deinit(struct sto_req_type *type);
+/*
+ * A req comes in one block: struct sto_req, then params, then priv.
+ * Reqs are parsed and freed on the core shard thread they run on.
+ */
+static __thread struct sto_pool_set g_req_pool_set = STO_POOL_SET_INITIALIZER("STO req");
 
-static int
-sto_req_type_init(struct sto_req_type *type, const struct sto_req_properties *properties)
+static size_t
+sto_req_alloc_size(const struct sto_req_properties *properties)
 {
-	int rc = 0;
+	return SPDK_ALIGN_CEIL(sizeof(struct sto_req), STO_REQ_ALIGN) +
+	       SPDK_ALIGN_CEIL(properties->params_size, STO_REQ_ALIGN) +
+	       properties->priv_size;
+}
 
+static void
+sto_req_type_init(struct sto_req_type *type, const struct sto_req_properties *properties,
+		  char *buf)
+{
 	if (properties->params_size) {
-		type->params = calloc(1, properties->params_size);
-		if (spdk_unlikely(!type->params)) {
-			SPDK_ERRLOG("Failed to alloc req type params\n");
-			rc = -ENOMEM;
-			goto error;
-		}
-
+		type->params = buf;
 		type->params_deinit_fn = properties->params_deinit_fn;
+
+		buf += SPDK_ALIGN_CEIL(properties->params_size, STO_REQ_ALIGN);
 	}
 
 	if (properties->priv_size) {
-		type->priv = calloc(1, properties->priv_size);
-		if (spdk_unlikely(!type->priv)) {
-			SPDK_ERRLOG("Failed to alloc req type priv\n");
-			rc = -ENOMEM;
-			goto error;
-		}
-
+		type->priv = buf;
 		type->priv_deinit_fn = properties->priv_deinit_fn;
 	}
 
 	type->response = properties->response;
-
-	return 0;
-
-error:
-	sto_req_type_deinit(type);
-
-	return rc;
 }
 
 static void
 sto_req_type_deinit(struct sto_req_type *type)
 {
-	if (type->params) {
-		if (type->params_deinit_fn) {
-			type->params_deinit_fn(type->params);
-		}
-
-		free(type->params);
+	if (type->params && type->params_deinit_fn) {
+		type->params_deinit_fn(type->params);
 	}
 
-	if (type->priv) {
-		if (type->priv_deinit_fn) {
-			type->priv_deinit_fn(type->priv);
-		}
-
-		free(type->priv);
+	if (type->priv && type->priv_deinit_fn) {
+		type->priv_deinit_fn(type->priv);
 	}
 }
 
@@ -107,20 +94,20 @@ sto_req_type_parse_params(struct sto_req_type *type,
 struct sto_req *
 sto_req_alloc(const struct sto_req_properties *properties)
 {
+	size_t alloc_size = sto_req_alloc_size(properties);
 	struct sto_req *req;
 	int rc;
 
-	req = calloc(1, sizeof(*req));
+	req = sto_pool_set_get(&g_req_pool_set, alloc_size);
 	if (spdk_unlikely(!req)) {
 		SPDK_ERRLOG("Failed to alloc STO req\n");
 		return NULL;
 	}
 
-	rc = sto_req_type_init(&req->type, properties);
-	if (spdk_unlikely(rc)) {
-		SPDK_ERRLOG("Failed to init STO req\n");
-		goto free_req;
-	}
+	req->alloc_size = alloc_size;
+
+	sto_req_type_init(&req->type, properties,
+			  (char *) req + SPDK_ALIGN_CEIL(sizeof(*req), STO_REQ_ALIGN));
 
 	rc = sto_pipeline_init(&req->pipeline, NULL);
 	if (spdk_unlikely(rc)) {
@@ -150,13 +137,13 @@ sto_req_free(struct sto_req *req)
 	sto_pipeline_deinit(&req->pipeline);
 	sto_req_type_deinit(&req->type);
 
-	free(req);
+	sto_pool_set_put(&g_req_pool_set, req, req->alloc_size);
 }
 
 void
-sto_req_run(struct sto_req *req)
+sto_req_run(struct sto_req *req, struct sto_pipeline_engine *engine)
 {
-	sto_pipeline_run(g_req_engine, &req->pipeline, sto_req_done, req);
+	sto_pipeline_run(engine, &req->pipeline, sto_req_done, req);
 }
 
 static void
@@ -176,21 +163,3 @@ sto_req_core_submit(struct sto_req *req, sto_core_req_done_t done,
 {
 	return sto_core_process_raw(head, done ?: sto_req_core_done, req);
 }
-
-int
-sto_req_lib_init(void)
-{
-	g_req_engine = sto_pipeline_engine_create("STO req");
-	if (spdk_unlikely(!g_req_engine)) {
-		SPDK_ERRLOG("Cann't create the STO req engine\n");
-		return -ENOMEM;
-	}
-
-	return 0;
-}
-
-void
-sto_req_lib_fini(void)
-{
-	sto_pipeline_engine_destroy(g_req_engine);
-}
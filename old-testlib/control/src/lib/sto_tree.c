@@ -8,6 +8,8 @@
 #include <spdk/queue.h>
 
 #include "sto_inode.h"
+#include "sto_rpc_tree.h"
+#include "sto_arena.h"
 
 struct spdk_json_write_ctx;
 
@@ -49,25 +51,31 @@ tree_call_cpl(struct tree_cpl *cpl, int rc)
 	};
 }
 
+/* Ring of nodes waiting to be read, a deque so it serves both orders */
+struct sto_tree_queue {
+	struct sto_tree_node **nodes;
+	uint32_t head;
+	uint32_t cnt;
+	uint32_t size;
+};
+
 struct sto_tree_cmd {
 	struct sto_tree_node *tree_root;
 	struct sto_tree_params params;
 	struct tree_cpl cpl;
 
+	struct sto_tree_queue queue;
+	uint32_t nr_inflight;
+	bool dispatching;
+
 	int returncode;
 	uint32_t refcnt;
 };
 
-struct sto_tree_cmd_opts {
-	const char *dirpath;
-	uint32_t depth;
-	bool only_dirs;
-};
-
-static int sto_tree_init(struct sto_tree_node *tree_root, const char *dirpath);
+static int sto_tree_init(struct sto_tree_node *tree_root, const char *dirpath, bool use_arena);
 
 static int
-tree_cmd_init(struct sto_tree_cmd *cmd, struct sto_tree_cmd_opts *opts)
+tree_cmd_init(struct sto_tree_cmd *cmd, const struct sto_tree_opts *opts)
 {
 	struct tree_cpl *cpl = &cmd->cpl;
 	struct sto_tree_node *tree_root;
@@ -85,7 +93,7 @@ tree_cmd_init(struct sto_tree_cmd *cmd, struct sto_tree_cmd_opts *opts)
 		return -EINVAL;
 	};
 
-	rc = sto_tree_init(tree_root, opts->dirpath);
+	rc = sto_tree_init(tree_root, opts->dirpath, opts->use_arena);
 	if (spdk_unlikely(rc)) {
 		SPDK_ERRLOG("Failed to init root node\n");
 		return rc;
@@ -96,12 +104,14 @@ tree_cmd_init(struct sto_tree_cmd *cmd, struct sto_tree_cmd_opts *opts)
 
 	cmd->params.depth = opts->depth;
 	cmd->params.only_dirs = opts->only_dirs;
+	cmd->params.max_inflight = opts->max_inflight;
+	cmd->params.order = opts->order;
 
 	return 0;
 }
 
 static struct sto_tree_cmd *
-sto_tree_cmd_alloc(struct sto_tree_cmd_opts *opts, struct tree_cpl *cpl)
+sto_tree_cmd_alloc(const struct sto_tree_opts *opts, struct tree_cpl *cpl)
 {
 	struct sto_tree_cmd *cmd;
 	int rc;
@@ -131,15 +141,59 @@ free_cmd:
 static void
 sto_tree_cmd_free(struct sto_tree_cmd *cmd)
 {
+	assert(!cmd->queue.cnt);
+
 	cmd->tree_root->priv = NULL;
+	free(cmd->queue.nodes);
 	free(cmd);
 }
 
+static struct sto_tree_cmd *sto_tree_cmd(struct sto_tree_node *node);
+
+/* Per-inode reads kept in flight when the server has no tree RPC */
+#define STO_TREE_FALLBACK_MAX_INFLIGHT	32
+
+static void
+sto_tree_cmd_run_done(void *cb_arg, int rc)
+{
+	struct sto_tree_node *tree_root = cb_arg;
+	struct sto_tree_cmd *cmd = sto_tree_cmd(tree_root);
+
+	if (rc == -ENOTSUP) {
+		/* An older server, walk the tree from here without stampeding it */
+		cmd->params.max_inflight = STO_TREE_FALLBACK_MAX_INFLIGHT;
+		sto_inode_read(tree_root->inode);
+		sto_tree_put_ref(tree_root);
+		return;
+	}
+
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to read tree, rc=%d\n", rc);
+		sto_tree_set_error(tree_root, rc);
+	}
+
+	sto_tree_put_ref(tree_root);
+}
+
 static void
 sto_tree_cmd_run(struct sto_tree_cmd *cmd)
 {
 	struct sto_tree_node *tree_root = cmd->tree_root;
-	sto_inode_read(tree_root->inode);
+
+	sto_tree_get_ref(tree_root);
+
+	if (cmd->params.max_inflight) {
+		sto_inode_read(tree_root->inode);
+		sto_tree_put_ref(tree_root);
+		return;
+	}
+
+	/*
+	 * The server walks the whole subtree and sends it back in one
+	 * response instead of a readdir/readfile round trip per inode
+	 */
+	sto_rpc_tree(tree_root->inode->path, cmd->params.depth, cmd->params.only_dirs,
+		     sto_tree_cmd_run_done, tree_root, tree_root);
 }
 
 static struct sto_tree_cmd *
@@ -148,6 +202,135 @@ sto_tree_cmd(struct sto_tree_node *node)
 	return node->priv;
 }
 
+#define STO_TREE_QUEUE_MIN_SIZE	64
+
+static int
+sto_tree_queue_grow(struct sto_tree_queue *queue)
+{
+	uint32_t size = spdk_max(queue->size * 2, STO_TREE_QUEUE_MIN_SIZE);
+	struct sto_tree_node **nodes;
+	uint32_t i;
+
+	nodes = calloc(size, sizeof(*nodes));
+	if (spdk_unlikely(!nodes)) {
+		SPDK_ERRLOG("Failed to grow tree queue up to %u\n", size);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < queue->cnt; i++) {
+		nodes[i] = queue->nodes[(queue->head + i) % queue->size];
+	}
+
+	free(queue->nodes);
+
+	queue->nodes = nodes;
+	queue->head = 0;
+	queue->size = size;
+
+	return 0;
+}
+
+static int
+sto_tree_queue_push(struct sto_tree_queue *queue, struct sto_tree_node *node)
+{
+	int rc;
+
+	if (queue->cnt == queue->size) {
+		rc = sto_tree_queue_grow(queue);
+		if (spdk_unlikely(rc)) {
+			return rc;
+		}
+	}
+
+	queue->nodes[(queue->head + queue->cnt) % queue->size] = node;
+	queue->cnt++;
+
+	return 0;
+}
+
+static struct sto_tree_node *
+sto_tree_queue_pop(struct sto_tree_queue *queue, enum sto_tree_order order)
+{
+	struct sto_tree_node *node;
+
+	assert(queue->cnt);
+
+	if (order == STO_TREE_ORDER_DFS) {
+		/* The last queued are the childs of the last read dir */
+		return queue->nodes[(queue->head + --queue->cnt) % queue->size];
+	}
+
+	node = queue->nodes[queue->head];
+
+	queue->head = (queue->head + 1) % queue->size;
+	queue->cnt--;
+
+	return node;
+}
+
+/*
+ * Every queued node holds a tree reference, which goes over to its read
+ * once the node is submitted. After an error the queue is just drained.
+ */
+static void
+sto_tree_dispatch(struct sto_tree_cmd *cmd)
+{
+	struct sto_tree_node *tree_root = cmd->tree_root;
+
+	/* Reads that fail right away complete from inside the loop below */
+	if (cmd->dispatching) {
+		return;
+	}
+
+	cmd->dispatching = true;
+	sto_tree_get_ref(tree_root);
+
+	while (cmd->queue.cnt && (cmd->returncode || cmd->nr_inflight < cmd->params.max_inflight)) {
+		struct sto_tree_node *node = sto_tree_queue_pop(&cmd->queue, cmd->params.order);
+
+		if (cmd->returncode) {
+			sto_tree_put_ref(node);
+			continue;
+		}
+
+		cmd->nr_inflight++;
+		sto_inode_read_submit(node->inode);
+	}
+
+	cmd->dispatching = false;
+	sto_tree_put_ref(tree_root);
+}
+
+void
+sto_tree_queue_node(struct sto_tree_node *node)
+{
+	struct sto_tree_cmd *cmd = sto_tree_cmd(node);
+	int rc;
+
+	rc = sto_tree_queue_push(&cmd->queue, node);
+	if (spdk_unlikely(rc)) {
+		sto_tree_set_error(node, rc);
+		return;
+	}
+
+	sto_tree_get_ref(node);
+
+	sto_tree_dispatch(cmd);
+}
+
+void
+sto_tree_read_done(struct sto_tree_node *node)
+{
+	struct sto_tree_cmd *cmd = sto_tree_cmd(node);
+
+	assert(cmd->nr_inflight > 0);
+	cmd->nr_inflight--;
+
+	sto_tree_dispatch(cmd);
+
+	sto_tree_put_ref(node);
+}
+
 void
 sto_tree_get_ref(struct sto_tree_node *node)
 {
@@ -221,16 +404,17 @@ sto_tree_node_add_inode(struct sto_tree_node *node, struct sto_inode *inode)
 }
 
 static struct sto_tree_node *
-sto_tree_node_alloc(void)
+sto_tree_node_alloc(struct sto_arena *arena)
 {
 	struct sto_tree_node *node;
 
-	node = calloc(1, sizeof(*node));
+	node = arena ? sto_arena_alloc(arena, sizeof(*node)) : calloc(1, sizeof(*node));
 	if (spdk_unlikely(!node)) {
 		SPDK_ERRLOG("Failed to alloc node\n");
 		return NULL;
 	}
 
+	node->arena = arena;
 	TAILQ_INIT(&node->childs);
 
 	return node;
@@ -241,7 +425,7 @@ sto_tree_add_inode(struct sto_tree_node *parent_node, struct sto_inode *inode)
 {
 	struct sto_tree_node *node;
 
-	node = sto_tree_node_alloc();
+	node = sto_tree_node_alloc(parent_node->arena);
 	if (spdk_unlikely(!node)) {
 		SPDK_ERRLOG("Failed to alloc node\n");
 		return -ENOMEM;
@@ -318,17 +502,29 @@ sto_tree_node_free(struct sto_tree_node *node)
 	free(node);
 }
 
+#define STO_TREE_ARENA_CHUNK_SIZE	(64 * 1024)
+
 static int
-sto_tree_init(struct sto_tree_node *tree_root, const char *dirpath)
+sto_tree_init(struct sto_tree_node *tree_root, const char *dirpath, bool use_arena)
 {
 	struct sto_inode *inode;
 	uint32_t mode = S_IRWXU | S_IFDIR;
 
 	memset(tree_root, 0, sizeof(*tree_root));
 
-	inode = sto_inode_create("root", dirpath, mode);
+	if (use_arena) {
+		tree_root->arena = sto_arena_create(STO_TREE_ARENA_CHUNK_SIZE);
+		if (spdk_unlikely(!tree_root->arena)) {
+			SPDK_ERRLOG("Cann't allocate arena for tree\n");
+			return -ENOMEM;
+		}
+	}
+
+	inode = sto_inode_create(tree_root->arena, "root", dirpath, mode);
 	if (spdk_unlikely(!inode)) {
 		SPDK_ERRLOG("Cann't allocate memory for root node\n");
+		sto_arena_destroy(tree_root->arena);
+		tree_root->arena = NULL;
 		return -ENOMEM;
 	}
 
@@ -347,6 +543,17 @@ sto_tree_free(struct sto_tree_node *tree_root)
 	struct sto_tree_node *parent = tree_root;
 	struct sto_tree_node *next_node;
 
+	if (tree_root->arena) {
+		/* Only the root node itself is outside of the arena */
+		__sto_tree_node_free(tree_root);
+		sto_arena_destroy(tree_root->arena);
+
+		tree_root->arena = NULL;
+		TAILQ_INIT(&tree_root->childs);
+
+		return;
+	}
+
 	while (parent != NULL) {
 		if (!TAILQ_EMPTY(&parent->childs)) {
 			next_node = TAILQ_FIRST(&parent->childs);
@@ -413,7 +620,7 @@ sto_tree_info_json(struct sto_tree_node *tree_root, struct spdk_json_write_ctx *
 }
 
 static int
-tree(struct sto_tree_cmd_opts *opts, struct tree_cpl *cpl)
+tree(const struct sto_tree_opts *opts, struct tree_cpl *cpl)
 {
 	struct sto_tree_cmd *cmd;
 
@@ -429,22 +636,16 @@ tree(struct sto_tree_cmd_opts *opts, struct tree_cpl *cpl)
 }
 
 void
-sto_tree(const char *dirpath, uint32_t depth, bool only_dirs,
-	 sto_tree_complete cb_fn, void *cb_arg)
+sto_tree(const struct sto_tree_opts *opts, sto_tree_complete cb_fn, void *cb_arg)
 {
 	struct tree_cpl cpl = {};
-	struct sto_tree_cmd_opts opts = {
-		.dirpath = dirpath,
-		.depth = depth,
-		.only_dirs = only_dirs,
-	};
 	int rc;
 
 	cpl.type = TREE_TYPE_BASIC;
 	cpl.u.basic.cb_fn = cb_fn;
 	cpl.cb_arg = cb_arg;
 
-	rc = tree(&opts, &cpl);
+	rc = tree(opts, &cpl);
 	if (spdk_unlikely(rc)) {
 		SPDK_ERRLOG("tree() failed\n");
 		tree_call_cpl(&cpl, rc);
@@ -455,16 +656,10 @@ sto_tree(const char *dirpath, uint32_t depth, bool only_dirs,
 }
 
 void
-sto_tree_buf(const char *dirpath, uint32_t depth, bool only_dirs,
-	     sto_tree_buf_complete cb_fn, void *cb_arg,
+sto_tree_buf(const struct sto_tree_opts *opts, sto_tree_buf_complete cb_fn, void *cb_arg,
 	     struct sto_tree_node *tree_root)
 {
 	struct tree_cpl cpl = {};
-	struct sto_tree_cmd_opts opts = {
-		.dirpath = dirpath,
-		.depth = depth,
-		.only_dirs = only_dirs,
-	};
 	int rc;
 
 	cpl.type = TREE_TYPE_WITH_BUF;
@@ -472,7 +667,7 @@ sto_tree_buf(const char *dirpath, uint32_t depth, bool only_dirs,
 	cpl.cb_arg = cb_arg;
 	cpl.u.with_buf.tree_root = tree_root;
 
-	rc = tree(&opts, &cpl);
+	rc = tree(opts, &cpl);
 	if (spdk_unlikely(rc)) {
 		SPDK_ERRLOG("tree() failed\n");
 		tree_call_cpl(&cpl, rc);
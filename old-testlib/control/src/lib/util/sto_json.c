@@ -5,6 +5,7 @@
 #include <spdk/likely.h>
 #include <spdk/json.h>
 #include <spdk/string.h>
+#include <spdk/util.h>
 
 #include "sto_err.h"
 #include "sto_async.h"
@@ -267,6 +268,62 @@ sto_json_iter_decode_str(const struct sto_json_iter *iter, const char *name, cha
 	return 0;
 }
 
+static inline bool
+sto_json_val_is_str(const struct spdk_json_val *val)
+{
+	return val->type == SPDK_JSON_VAL_STRING || val->type == SPDK_JSON_VAL_NAME;
+}
+
+int
+sto_json_iter_name_val(const struct sto_json_iter *iter, const struct spdk_json_val **value)
+{
+	const struct spdk_json_val *values;
+
+	values = sto_json_iter_ptr(iter);
+
+	if (!values) {
+		SPDK_ERRLOG("Zero length JSON object iter\n");
+		return -EINVAL;
+	}
+
+	if (!sto_json_val_is_str(&values[0])) {
+		SPDK_ERRLOG("JSON object name is not a string\n");
+		return -EDOM;
+	}
+
+	*value = &values[0];
+
+	return 0;
+}
+
+int
+sto_json_iter_str_val(const struct sto_json_iter *iter, const char *name,
+		      const struct spdk_json_val **value)
+{
+	const struct spdk_json_val *values;
+
+	if (iter->len < 2) {
+		SPDK_ERRLOG("JSON iter length < 2: %d\n", iter->len);
+		return -EINVAL;
+	}
+
+	values = sto_json_iter_ptr(iter);
+
+	if (!spdk_json_strequal(&values[0], name)) {
+		SPDK_ERRLOG("JSON object name doesn't correspond to %s\n", name);
+		return -ENOENT;
+	}
+
+	if (!sto_json_val_is_str(&values[1])) {
+		SPDK_ERRLOG("JSON object %s is not a string\n", name);
+		return -EDOM;
+	}
+
+	*value = &values[1];
+
+	return 0;
+}
+
 int
 sto_json_iter_decode_str_field(const struct sto_json_iter *iter,
 			       struct sto_json_str_field *field)
@@ -293,25 +350,50 @@ sto_json_iter_decode_str_field(const struct sto_json_iter *iter,
 	return 0;
 }
 
+struct json_async_iter_ctx;
+
+/* One per element in flight, this is what iterate_fn gets */
 struct sto_json_async_iter {
+	struct json_async_iter_ctx *ctx;
+
+	struct spdk_json_val *object;
+	bool barrier;
+
+	struct sto_json_async_iter *next_free;
+};
+
+struct json_async_iter_ctx {
 	struct sto_json_async_iter_opts opts;
 
+	/* The last object returned by next_fn */
 	struct spdk_json_val *object;
+	/* Fetched but held back by a barrier */
+	struct spdk_json_val *pending;
+
+	uint32_t nr_inflight;
+	int rc;
+
+	bool stopped;
+	bool barrier;
+	bool launching;
 
 	sto_generic_cb cb_fn;
 	void *cb_arg;
+
+	struct sto_json_async_iter *free_iters;
+	struct sto_json_async_iter iters[];
 };
 
 struct spdk_json_val *
 sto_json_async_iter_get_json(struct sto_json_async_iter *iter)
 {
-	return iter->opts.json;
+	return iter->ctx->opts.json;
 }
 
 void *
 sto_json_async_iter_get_priv(struct sto_json_async_iter *iter)
 {
-	return iter->opts.priv;
+	return iter->ctx->opts.priv;
 }
 
 struct spdk_json_val *
@@ -320,51 +402,135 @@ sto_json_async_iter_get_object(struct sto_json_async_iter *iter)
 	return iter->object;
 }
 
+static bool
+json_async_iter_can_launch(struct json_async_iter_ctx *ctx)
+{
+	return !ctx->rc && !ctx->stopped && !ctx->barrier && ctx->free_iters;
+}
+
+/*
+ * iterate_fn may complete synchronously, completions that come in while
+ * launching only account and leave the loop to go on, so a long array
+ * does not recurse.
+ */
+static void
+json_async_iter_kick(struct json_async_iter_ctx *ctx)
+{
+	struct sto_json_async_iter_opts *opts = &ctx->opts;
+	struct sto_json_async_iter *iter;
+	bool barrier;
+
+	if (ctx->launching) {
+		return;
+	}
+
+	ctx->launching = true;
+
+	while (json_async_iter_can_launch(ctx)) {
+		if (!ctx->pending) {
+			ctx->pending = opts->next_fn(opts->json, ctx->object);
+			if (!ctx->pending) {
+				ctx->stopped = true;
+				break;
+			}
+
+			ctx->object = ctx->pending;
+		}
+
+		barrier = opts->barrier_fn && opts->barrier_fn(opts->json, ctx->pending);
+		if (barrier && ctx->nr_inflight) {
+			break;
+		}
+
+		iter = ctx->free_iters;
+		ctx->free_iters = iter->next_free;
+
+		iter->object = ctx->pending;
+		iter->barrier = barrier;
+
+		ctx->pending = NULL;
+		ctx->barrier = barrier;
+		ctx->nr_inflight++;
+
+		opts->iterate_fn(iter);
+	}
+
+	ctx->launching = false;
+
+	if (!ctx->nr_inflight && (ctx->stopped || ctx->rc)) {
+		ctx->cb_fn(ctx->cb_arg, ctx->rc);
+		free(ctx);
+	}
+}
+
 void
 sto_json_async_iter_start(struct sto_json_async_iter_opts *opts,
 			  sto_generic_cb cb_fn, void *cb_arg)
 {
-	struct sto_json_async_iter *iter;
+	struct json_async_iter_ctx *ctx;
+	uint32_t max_inflight, i;
+
+	max_inflight = spdk_max(opts->max_inflight, 1);
 
-	iter = calloc(1, sizeof(*iter));
-	if (spdk_unlikely(!iter)) {
+	ctx = calloc(1, sizeof(*ctx) + max_inflight * sizeof(ctx->iters[0]));
+	if (spdk_unlikely(!ctx)) {
 		SPDK_ERRLOG("Failed to create SCST json dev iter\n");
 		cb_fn(cb_arg, -ENOMEM);
 		return;
 	}
 
-	iter->opts = *opts;
+	ctx->opts = *opts;
+
+	ctx->cb_fn = cb_fn;
+	ctx->cb_arg = cb_arg;
+
+	for (i = max_inflight; i > 0; i--) {
+		struct sto_json_async_iter *iter = &ctx->iters[i - 1];
+
+		iter->ctx = ctx;
+		iter->next_free = ctx->free_iters;
+		ctx->free_iters = iter;
+	}
+
+	json_async_iter_kick(ctx);
+}
+
+static void
+json_async_iter_done(struct sto_json_async_iter *iter, int rc)
+{
+	struct json_async_iter_ctx *ctx = iter->ctx;
+
+	assert(ctx->nr_inflight);
+
+	if (rc && !ctx->rc) {
+		ctx->rc = rc;
+	}
+
+	if (iter->barrier) {
+		ctx->barrier = false;
+	}
 
-	iter->cb_fn = cb_fn;
-	iter->cb_arg = cb_arg;
+	iter->object = NULL;
+	iter->next_free = ctx->free_iters;
+	ctx->free_iters = iter;
 
-	sto_json_async_iter_next(iter, 0);
+	ctx->nr_inflight--;
+
+	json_async_iter_kick(ctx);
 }
 
 void
 sto_json_async_iter_finish(struct sto_json_async_iter *iter, int rc)
 {
-	iter->cb_fn(iter->cb_arg, rc);
-	free(iter);
+	iter->ctx->stopped = true;
+
+	json_async_iter_done(iter, rc);
 }
 
 void
 sto_json_async_iter_next(struct sto_json_async_iter *iter, int rc)
 {
-	struct sto_json_async_iter_opts *opts = &iter->opts;
-
-	if (rc) {
-		sto_json_async_iter_finish(iter, rc);
-		return;
-	}
-
-	iter->object = opts->next_fn(opts->json, iter->object);
-	if (!iter->object) {
-		sto_json_async_iter_finish(iter, 0);
-		return;
-	}
-
-	opts->iterate_fn(iter);
+	json_async_iter_done(iter, rc);
 }
 
 struct spdk_json_val *
@@ -2,9 +2,10 @@
 #include <spdk/event.h>
 #include <spdk/log.h>
 #include <spdk/likely.h>
+#include <spdk/string.h>
 #include <sto_server.h>
-
-#include <sto_server.h>
+#include <sto_bin.h>
+#include <sto_shm.h>
 
 #include "sto_control.h"
 #include "sto_version.h"
@@ -13,6 +14,33 @@
 #include "sto_err.h"
 
 static bool g_control_initialized;
+static struct sto_server_opts g_server_opts;
+static bool g_control_bin_framing;
+static uint32_t g_control_rpc_conns = STO_CLIENT_DEFAULT_CONNS;
+static struct sto_core_opts g_core_opts;
+
+enum control_long_opt {
+	CONTROL_OPT_EXEC_WORKERS = 0x1000,
+	CONTROL_OPT_EXEC_QUEUE_SIZE,
+	CONTROL_OPT_RPC_FRAMING,
+	CONTROL_OPT_RPC_CONNS,
+	CONTROL_OPT_SHM_SLOTS,
+	CONTROL_OPT_SHM_SLOT_SIZE,
+	CONTROL_OPT_BUSY_POLL,
+	CONTROL_OPT_CORE_SHARDS,
+};
+
+static const struct option g_control_long_opts[] = {
+	{"exec-workers", required_argument, NULL, CONTROL_OPT_EXEC_WORKERS},
+	{"exec-queue-size", required_argument, NULL, CONTROL_OPT_EXEC_QUEUE_SIZE},
+	{"rpc-framing", required_argument, NULL, CONTROL_OPT_RPC_FRAMING},
+	{"rpc-conns", required_argument, NULL, CONTROL_OPT_RPC_CONNS},
+	{"shm-slots", required_argument, NULL, CONTROL_OPT_SHM_SLOTS},
+	{"shm-slot-size", required_argument, NULL, CONTROL_OPT_SHM_SLOT_SIZE},
+	{"busy-poll", no_argument, NULL, CONTROL_OPT_BUSY_POLL},
+	{"core-shards", required_argument, NULL, CONTROL_OPT_CORE_SHARDS},
+	{NULL, 0, NULL, 0},
+};
 
 bool
 sto_control_is_initialized(void)
@@ -26,6 +54,20 @@ sto_control_is_initialized(void)
 static void
 control_usage(void)
 {
+	printf(" --exec-workers <num>      number of server exec workers (default %d)\n",
+	       STO_EXEC_DEFAULT_WORKERS);
+	printf(" --exec-queue-size <num>   server exec queue size (default %d)\n",
+	       STO_EXEC_DEFAULT_QUEUE_SIZE);
+	printf(" --rpc-framing <json|binary> framing towards the server (default json)\n");
+	printf(" --rpc-conns <num>         JSON-RPC connections to the server (default %d, max %d)\n",
+	       STO_CLIENT_DEFAULT_CONNS, STO_CLIENT_MAX_CONNS);
+	printf(" --shm-slots <num>         shared memory slots for file reads, 0 disables (default %d)\n",
+	       STO_SHM_DEFAULT_NR_SLOTS);
+	printf(" --shm-slot-size <bytes>   size of a shared memory slot (default %d)\n",
+	       STO_SHM_DEFAULT_SLOT_SIZE);
+	printf(" --busy-poll               spin on the request queues instead of waking up on demand\n");
+	printf(" --core-shards <num>       request threads, keyed by object name (default %d, max %d)\n",
+	       STO_CORE_DEFAULT_SHARDS, STO_CORE_MAX_SHARDS);
 }
 
 /*
@@ -34,6 +76,80 @@ control_usage(void)
 static int
 control_parse_arg(int ch, char *arg)
 {
+	long long val;
+
+	switch (ch) {
+	case CONTROL_OPT_EXEC_WORKERS:
+	case CONTROL_OPT_EXEC_QUEUE_SIZE:
+		val = spdk_strtoll(arg, 10);
+		if (val <= 0 || val > UINT16_MAX) {
+			fprintf(stderr, "Invalid value %s\n", arg);
+			return -EINVAL;
+		}
+
+		if (ch == CONTROL_OPT_EXEC_WORKERS) {
+			g_server_opts.exec_opts.nr_workers = val;
+		} else {
+			g_server_opts.exec_opts.queue_size = val;
+		}
+
+		break;
+	case CONTROL_OPT_RPC_FRAMING:
+		if (!strcmp(arg, "binary")) {
+			g_control_bin_framing = true;
+		} else if (strcmp(arg, "json")) {
+			fprintf(stderr, "Invalid framing %s\n", arg);
+			return -EINVAL;
+		}
+
+		break;
+	case CONTROL_OPT_RPC_CONNS:
+		val = spdk_strtoll(arg, 10);
+		if (val <= 0 || val > STO_CLIENT_MAX_CONNS) {
+			fprintf(stderr, "Invalid value %s\n", arg);
+			return -EINVAL;
+		}
+
+		g_control_rpc_conns = val;
+
+		break;
+	case CONTROL_OPT_SHM_SLOTS:
+		val = spdk_strtoll(arg, 10);
+		if (val < 0 || val > UINT16_MAX) {
+			fprintf(stderr, "Invalid value %s\n", arg);
+			return -EINVAL;
+		}
+
+		g_server_opts.shm_nr_slots = val;
+
+		break;
+	case CONTROL_OPT_SHM_SLOT_SIZE:
+		val = spdk_strtoll(arg, 10);
+		if (val < 4096 || val > STO_BIN_MAX_FRAME_SIZE) {
+			fprintf(stderr, "Invalid value %s\n", arg);
+			return -EINVAL;
+		}
+
+		g_server_opts.shm_slot_size = val;
+
+		break;
+	case CONTROL_OPT_BUSY_POLL:
+		g_core_opts.busy_poll = true;
+		break;
+	case CONTROL_OPT_CORE_SHARDS:
+		val = spdk_strtoll(arg, 10);
+		if (val <= 0 || val > STO_CORE_MAX_SHARDS) {
+			fprintf(stderr, "Invalid value %s\n", arg);
+			return -EINVAL;
+		}
+
+		g_core_opts.nr_shards = val;
+
+		break;
+	default:
+		return -EINVAL;
+	}
+
 	return 0;
 }
 
@@ -65,14 +181,21 @@ control_start(void *arg1)
 {
 	int rc = 0;
 
-	rc = sto_client_connect(STO_LOCAL_SERVER_ADDR, AF_UNIX);
+	rc = sto_client_connect(STO_LOCAL_SERVER_ADDR, AF_UNIX, g_control_rpc_conns);
 	if (rc < 0) {
 		SPDK_ERRLOG("sto_client_connect() failed, rc=%d\n", rc);
 		spdk_app_stop(rc);
 		return;
 	}
 
-	sto_core_init(control_core_init_done, NULL);
+	if (g_control_bin_framing) {
+		rc = sto_client_bin_connect(STO_LOCAL_SERVER_BIN_ADDR);
+		if (rc < 0) {
+			SPDK_NOTICELOG("Binary framing is not negotiated, stay on JSON-RPC, rc=%d\n", rc);
+		}
+	}
+
+	sto_core_init(&g_core_opts, control_core_init_done, NULL);
 }
 
 static void
@@ -80,6 +203,7 @@ control_core_fini_done(void *cb_arg)
 {
 	int rc = PTR_ERR(cb_arg);
 
+	sto_client_bin_close();
 	sto_client_close();
 
 	spdk_app_stop(rc);
@@ -103,25 +227,28 @@ main(int argc, char **argv)
 	struct spdk_app_opts opts = {};
 	int rc = 0;
 
-	rc = sto_server_start();
-	if (spdk_unlikely(rc)) {
-		SPDK_ERRLOG("Failed to start server, rc=%d\n", rc);
-		return rc;
-	}
-
 	/* Set default values in opts structure. */
 	spdk_app_opts_init(&opts, sizeof(opts));
 	opts.name = "control";
 
+	sto_server_opts_init(&g_server_opts);
+	sto_core_opts_init(&g_core_opts);
+
 	/*
 	 * Parse built-in SPDK command line parameters as well
 	 * as our custom one(s).
 	 */
-	if ((rc = spdk_app_parse_args(argc, argv, &opts, "", NULL, control_parse_arg,
-				      control_usage)) != SPDK_APP_PARSE_ARGS_SUCCESS) {
+	if ((rc = spdk_app_parse_args(argc, argv, &opts, "", g_control_long_opts,
+				      control_parse_arg, control_usage)) != SPDK_APP_PARSE_ARGS_SUCCESS) {
 		exit(rc);
 	}
 
+	rc = sto_server_start(&g_server_opts);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to start server, rc=%d\n", rc);
+		return rc;
+	}
+
 	opts.shutdown_cb = control_shutdown_cb;
 
 	/*
@@ -7,6 +7,9 @@
 #include <spdk/json.h>
 #include <spdk/jsonrpc.h>
 
+#include <sto_bin.h>
+#include <sto_shm.h>
+
 #include "sto_client.h"
 #include "sto_async.h"
 
@@ -97,6 +100,33 @@ sto_rpc_writefile_info_json(void *priv, struct spdk_json_write_ctx *w)
 	spdk_json_write_object_end(w);
 }
 
+static void
+sto_rpc_writefile_bin_resp_handler(void *priv, struct sto_client_bin_response *resp, int rc)
+{
+	struct sto_rpc_writefile_cmd *cmd = priv;
+
+	if (spdk_likely(!rc)) {
+		rc = resp->status;
+	}
+
+	cmd->cb_fn(cmd->cb_arg, rc);
+	sto_rpc_writefile_cmd_free(cmd);
+}
+
+/* With binary framing the buffer goes as a raw payload, not as a param */
+static void
+sto_rpc_writefile_bin_info_json(void *priv, struct spdk_json_write_ctx *w)
+{
+	struct sto_rpc_writefile_params *params = priv;
+
+	spdk_json_write_object_begin(w);
+
+	spdk_json_write_named_string(w, "filepath", params->filepath);
+	spdk_json_write_named_int32(w, "oflag", params->oflag);
+
+	spdk_json_write_object_end(w);
+}
+
 static int
 sto_rpc_writefile_cmd_run(struct sto_rpc_writefile_cmd *cmd,
 			  struct sto_rpc_writefile_params *params)
@@ -106,6 +136,16 @@ sto_rpc_writefile_cmd_run(struct sto_rpc_writefile_cmd *cmd,
 		.response_handler = sto_rpc_writefile_resp_handler,
 	};
 
+	if (sto_client_bin_enabled()) {
+		struct sto_client_bin_args bin_args = {
+			.priv = cmd,
+			.response_handler = sto_rpc_writefile_bin_resp_handler,
+		};
+
+		return sto_client_send_bin(STO_BIN_OP_WRITEFILE, params, sto_rpc_writefile_bin_info_json,
+					   params->buf, strlen(params->buf), &bin_args);
+	}
+
 	return sto_client_send("writefile", params, sto_rpc_writefile_info_json, &args);
 }
 
@@ -145,9 +185,28 @@ free_cmd:
 	return;
 }
 
+static int
+sto_rpc_bin_payload_dup(struct sto_client_bin_response *resp, char **buf)
+{
+	*buf = malloc(resp->payload_len + 1);
+	if (spdk_unlikely(!*buf)) {
+		SPDK_ERRLOG("Failed to alloc buf: size=%u\n", resp->payload_len);
+		return -ENOMEM;
+	}
+
+	memcpy(*buf, resp->payload, resp->payload_len);
+	(*buf)[resp->payload_len] = '\0';
+
+	return 0;
+}
+
 struct rpc_readfile_info {
 	int returncode;
 	char **buf;
+
+	/* Set instead of buf when the server answers through a shm slot */
+	uint64_t shm_off;
+	uint64_t shm_len;
 };
 
 static int
@@ -160,18 +219,22 @@ rpc_readfile_buf_decode(const struct spdk_json_val *val, void *out)
 
 static const struct spdk_json_object_decoder rpc_readfile_info_decoders[] = {
 	{"returncode", offsetof(struct rpc_readfile_info, returncode), spdk_json_decode_int32},
-	{"buf", offsetof(struct rpc_readfile_info, buf), rpc_readfile_buf_decode},
+	{"buf", offsetof(struct rpc_readfile_info, buf), rpc_readfile_buf_decode, true},
+	{"shm_off", offsetof(struct rpc_readfile_info, shm_off), spdk_json_decode_uint64, true},
+	{"shm_len", offsetof(struct rpc_readfile_info, shm_len), spdk_json_decode_uint64, true},
 };
 
 struct rpc_readfile_params {
 	const char *filepath;
 	uint32_t size;
+	bool shm;
 };
 
 enum rpc_readfile_type {
 	RPC_READFILE_TYPE_NONE,
 	RPC_READFILE_TYPE_BASIC,
 	RPC_READFILE_TYPE_WITH_BUF,
+	RPC_READFILE_TYPE_VIEW,
 };
 
 struct rpc_readfile_cpl {
@@ -188,6 +251,14 @@ struct rpc_readfile_cpl {
 			sto_rpc_readfile_buf_complete cb_fn;
 			char **buf;
 		} with_buf;
+
+		struct {
+			sto_rpc_readfile_view_complete cb_fn;
+			/* Either a decoded copy or a shm slot, released after cb_fn */
+			char *buf;
+			char *slot;
+			size_t len;
+		} view;
 	} u;
 };
 
@@ -201,6 +272,14 @@ rpc_readfile_call_cpl(struct rpc_readfile_cpl *cpl, int rc)
 	case RPC_READFILE_TYPE_WITH_BUF:
 		cpl->u.with_buf.cb_fn(cpl->cb_arg, rc);
 		break;
+	case RPC_READFILE_TYPE_VIEW:
+		if (cpl->u.view.slot) {
+			cpl->u.view.cb_fn(cpl->cb_arg, cpl->u.view.slot, cpl->u.view.len, rc);
+		} else {
+			cpl->u.view.cb_fn(cpl->cb_arg, cpl->u.view.buf,
+					  cpl->u.view.buf ? strlen(cpl->u.view.buf) : 0, rc);
+		}
+		break;
 	default:
 		assert(0);
 	};
@@ -223,6 +302,9 @@ rpc_readfile_cmd_init(struct rpc_readfile_cmd *cmd)
 	case RPC_READFILE_TYPE_WITH_BUF:
 		cmd->buf = cpl->u.with_buf.buf;
 		break;
+	case RPC_READFILE_TYPE_VIEW:
+		cmd->buf = &cpl->u.view.buf;
+		break;
 	default:
 		SPDK_ERRLOG("Got unsupported readfile type (%d)\n", cpl->type);
 		return -EINVAL;
@@ -268,30 +350,93 @@ rpc_readfile_cmd_free(struct rpc_readfile_cmd *cmd)
 static void
 rpc_readfile_cmd_complete(struct rpc_readfile_cmd *cmd, int rc)
 {
-	rpc_readfile_call_cpl(&cmd->cpl, rc);
+	struct rpc_readfile_cpl *cpl = &cmd->cpl;
+
+	rpc_readfile_call_cpl(cpl, rc);
+
+	if (cpl->type == RPC_READFILE_TYPE_VIEW) {
+		free(cpl->u.view.buf);
+
+		if (cpl->u.view.slot) {
+			sto_shm_free(cpl->u.view.slot);
+		}
+	}
+
 	rpc_readfile_cmd_free(cmd);
 }
 
+/*
+ * A view is handed the slot itself, everybody else expects a buffer
+ * it can free(), so the payload is copied out once and the slot is
+ * given back right away. On a failed response the slot is only given
+ * back.
+ */
+static int
+rpc_readfile_shm_get(struct rpc_readfile_cmd *cmd, uint64_t off, uint64_t len, int rc)
+{
+	char *slot;
+
+	slot = sto_shm_ptr(off, len);
+	if (spdk_unlikely(!slot)) {
+		SPDK_ERRLOG("Got invalid shm slot for STO RPC readfile cmd\n");
+		return rc ?: -EINVAL;
+	}
+
+	if (spdk_unlikely(rc)) {
+		sto_shm_free(slot);
+		return rc;
+	}
+
+	if (cmd->cpl.type == RPC_READFILE_TYPE_VIEW) {
+		cmd->cpl.u.view.slot = slot;
+		cmd->cpl.u.view.len = len;
+		return 0;
+	}
+
+	*cmd->buf = malloc(len + 1);
+	if (spdk_unlikely(!*cmd->buf)) {
+		SPDK_ERRLOG("Failed to alloc buf for shm payload: len=%" PRIu64 "\n", len);
+		sto_shm_free(slot);
+		return -ENOMEM;
+	}
+
+	memcpy(*cmd->buf, slot, len);
+	(*cmd->buf)[len] = '\0';
+
+	sto_shm_free(slot);
+
+	return 0;
+}
+
 static void
 rpc_readfile_resp_handler(void *priv, struct spdk_jsonrpc_client_response *resp, int rc)
 {
 	struct rpc_readfile_cmd *cmd = priv;
 	struct rpc_readfile_info info = {
 		.buf = cmd->buf,
+		.shm_off = UINT64_MAX,
 	};
 
+	/*
+	 * Without a response the slot offset is unknown, the server
+	 * reclaims the slot once its lease runs out (STO_SHM_SLOT_LEASE_SEC).
+	 */
 	if (spdk_unlikely(rc)) {
 		goto out;
 	}
 
+	/* The decoder keeps going past a bad field, so shm_off is set whenever it is valid */
 	if (spdk_json_decode_object(resp->result, rpc_readfile_info_decoders,
 				    SPDK_COUNTOF(rpc_readfile_info_decoders), &info)) {
 		SPDK_ERRLOG("Failed to decode response for STO RPC readfile cmd\n");
 		rc = -ENOMEM;
-		goto out;
+	} else {
+		rc = info.returncode;
 	}
 
-	rc = info.returncode;
+	if (info.shm_off != UINT64_MAX) {
+		rc = rpc_readfile_shm_get(cmd, info.shm_off, info.shm_len, rc);
+	}
 
 out:
 	rpc_readfile_cmd_complete(cmd, rc);
@@ -307,9 +452,28 @@ rpc_readfile_info_json(void *priv, struct spdk_json_write_ctx *w)
 	spdk_json_write_named_string(w, "filepath", params->filepath);
 	spdk_json_write_named_uint32(w, "size", params->size);
 
+	if (params->shm) {
+		spdk_json_write_named_bool(w, "shm", true);
+	}
+
 	spdk_json_write_object_end(w);
 }
 
+static void
+rpc_readfile_bin_resp_handler(void *priv, struct sto_client_bin_response *resp, int rc)
+{
+	struct rpc_readfile_cmd *cmd = priv;
+
+	if (spdk_unlikely(rc)) {
+		goto out;
+	}
+
+	rc = resp->status ?: sto_rpc_bin_payload_dup(resp, cmd->buf);
+
+out:
+	rpc_readfile_cmd_complete(cmd, rc);
+}
+
 static int
 rpc_readfile_cmd_run(struct rpc_readfile_cmd *cmd, struct rpc_readfile_params *params)
 {
@@ -318,6 +482,19 @@ rpc_readfile_cmd_run(struct rpc_readfile_cmd *cmd, struct rpc_readfile_params *p
 		.response_handler = rpc_readfile_resp_handler,
 	};
 
+	if (sto_client_bin_enabled()) {
+		struct sto_client_bin_args bin_args = {
+			.priv = cmd,
+			.response_handler = rpc_readfile_bin_resp_handler,
+		};
+
+		return sto_client_send_bin(STO_BIN_OP_READFILE, params, rpc_readfile_info_json,
+					   NULL, 0, &bin_args);
+	}
+
+	/* The binary framing already carries raw bytes, shm only pays off for JSON */
+	params->shm = sto_shm_enabled();
+
 	return sto_client_send("readfile", params, rpc_readfile_info_json, &args);
 }
 
@@ -399,6 +576,31 @@ sto_rpc_readfile_buf(const char *filepath, uint32_t size,
 	return;
 }
 
+void
+sto_rpc_readfile_view(const char *filepath, uint32_t size,
+		      sto_rpc_readfile_view_complete cb_fn, void *cb_arg)
+{
+	struct rpc_readfile_cpl cpl = {};
+	struct rpc_readfile_params params = {
+		.filepath = filepath,
+		.size = size,
+	};
+	int rc;
+
+	cpl.type = RPC_READFILE_TYPE_VIEW;
+	cpl.u.view.cb_fn = cb_fn;
+	cpl.cb_arg = cb_arg;
+
+	rc = rpc_readfile(&cpl, &params);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("rpc_readfile() failed\n");
+		rpc_readfile_call_cpl(&cpl, rc);
+		return;
+	}
+
+	return;
+}
+
 struct sto_rpc_readlink_info {
 	int returncode;
 	char **buf;
@@ -494,6 +696,22 @@ sto_rpc_readlink_info_json(void *priv, struct spdk_json_write_ctx *w)
 	spdk_json_write_object_end(w);
 }
 
+static void
+sto_rpc_readlink_bin_resp_handler(void *priv, struct sto_client_bin_response *resp, int rc)
+{
+	struct sto_rpc_readlink_cmd *cmd = priv;
+
+	if (spdk_unlikely(rc)) {
+		goto out;
+	}
+
+	rc = resp->status ?: sto_rpc_bin_payload_dup(resp, cmd->buf);
+
+out:
+	cmd->cb_fn(cmd->cb_arg, rc);
+	sto_rpc_readlink_cmd_free(cmd);
+}
+
 static int
 sto_rpc_readlink_cmd_run(struct sto_rpc_readlink_cmd *cmd, struct sto_rpc_readlink_params *params)
 {
@@ -502,6 +720,16 @@ sto_rpc_readlink_cmd_run(struct sto_rpc_readlink_cmd *cmd, struct sto_rpc_readli
 		.response_handler = sto_rpc_readlink_resp_handler,
 	};
 
+	if (sto_client_bin_enabled()) {
+		struct sto_client_bin_args bin_args = {
+			.priv = cmd,
+			.response_handler = sto_rpc_readlink_bin_resp_handler,
+		};
+
+		return sto_client_send_bin(STO_BIN_OP_READLINK, params, sto_rpc_readlink_info_json,
+					   NULL, 0, &bin_args);
+	}
+
 	return sto_client_send("readlink", params, sto_rpc_readlink_info_json, &args);
 }
 
@@ -539,3 +767,257 @@ free_cmd:
 
 	return;
 }
+
+/*
+ * multi_writefile and multi_readfile only differ in how an entry is
+ * sent and how its result comes back, the rest is shared.
+ */
+struct sto_rpc_multi_file_type {
+	const char *method;
+	size_t entry_size;
+
+	void (*entry_json)(const void *entry, struct spdk_json_write_ctx *w);
+
+	const char *results_name;
+	/* Decodes one result into the entry at @result_offset */
+	spdk_json_decode_fn result_decode;
+	size_t result_offset;
+};
+
+struct sto_rpc_multi_file_params {
+	const struct sto_rpc_multi_file_type *type;
+	void *entries;
+	size_t cnt;
+	bool parallel;
+};
+
+struct sto_rpc_multi_file_cmd {
+	const struct sto_rpc_multi_file_type *type;
+	void *entries;
+	size_t cnt;
+
+	void *cb_arg;
+	sto_generic_cb cb_fn;
+};
+
+static struct sto_rpc_multi_file_cmd *
+sto_rpc_multi_file_cmd_alloc(const struct sto_rpc_multi_file_type *type, void *entries, size_t cnt)
+{
+	struct sto_rpc_multi_file_cmd *cmd;
+
+	cmd = calloc(1, sizeof(*cmd));
+	if (spdk_unlikely(!cmd)) {
+		SPDK_ERRLOG("Cann't allocate memory for STO RPC %s cmd\n", type->method);
+		return NULL;
+	}
+
+	cmd->type = type;
+	cmd->entries = entries;
+	cmd->cnt = cnt;
+
+	return cmd;
+}
+
+static void
+sto_rpc_multi_file_cmd_init_cb(struct sto_rpc_multi_file_cmd *cmd,
+			       sto_generic_cb cb_fn, void *cb_arg)
+{
+	cmd->cb_fn = cb_fn;
+	cmd->cb_arg = cb_arg;
+}
+
+static void
+sto_rpc_multi_file_cmd_free(struct sto_rpc_multi_file_cmd *cmd)
+{
+	free(cmd);
+}
+
+static int
+sto_rpc_multi_file_results_decode(struct sto_rpc_multi_file_cmd *cmd,
+				  struct spdk_json_val *result)
+{
+	const struct sto_rpc_multi_file_type *type = cmd->type;
+	struct spdk_json_val *results;
+	size_t cnt;
+	int rc;
+
+	rc = spdk_json_find_array(result, type->results_name, NULL, &results);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Could not find `%s` in %s response\n",
+			    type->results_name, type->method);
+		return rc;
+	}
+
+	rc = spdk_json_decode_array(results, type->result_decode,
+				    (char *) cmd->entries + type->result_offset,
+				    cmd->cnt, &cnt, type->entry_size);
+	if (spdk_unlikely(rc || cnt != cmd->cnt)) {
+		SPDK_ERRLOG("Failed to decode %zu %s results\n", cmd->cnt, type->method);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void
+sto_rpc_multi_file_resp_handler(void *priv, struct spdk_jsonrpc_client_response *resp, int rc)
+{
+	struct sto_rpc_multi_file_cmd *cmd = priv;
+
+	if (spdk_unlikely(rc)) {
+		goto out;
+	}
+
+	if (sto_rpc_multi_file_results_decode(cmd, resp->result)) {
+		SPDK_ERRLOG("Failed to decode response for STO RPC %s cmd\n", cmd->type->method);
+		rc = -ENOMEM;
+		goto out;
+	}
+
+out:
+	cmd->cb_fn(cmd->cb_arg, rc);
+	sto_rpc_multi_file_cmd_free(cmd);
+}
+
+static void
+sto_rpc_multi_file_info_json(void *priv, struct spdk_json_write_ctx *w)
+{
+	struct sto_rpc_multi_file_params *params = priv;
+	const struct sto_rpc_multi_file_type *type = params->type;
+	size_t i;
+
+	spdk_json_write_object_begin(w);
+
+	spdk_json_write_named_array_begin(w, "entries");
+
+	for (i = 0; i < params->cnt; i++) {
+		spdk_json_write_object_begin(w);
+
+		type->entry_json((char *) params->entries + i * type->entry_size, w);
+
+		spdk_json_write_object_end(w);
+	}
+
+	spdk_json_write_array_end(w);
+
+	spdk_json_write_named_bool(w, "parallel", params->parallel);
+
+	spdk_json_write_object_end(w);
+}
+
+static int
+sto_rpc_multi_file_cmd_run(struct sto_rpc_multi_file_cmd *cmd,
+			   struct sto_rpc_multi_file_params *params)
+{
+	struct sto_client_args args = {
+		.priv = cmd,
+		.response_handler = sto_rpc_multi_file_resp_handler,
+	};
+
+	return sto_client_send(cmd->type->method, params, sto_rpc_multi_file_info_json, &args);
+}
+
+static void
+sto_rpc_multi_file(const struct sto_rpc_multi_file_type *type, void *entries, size_t cnt,
+		   bool parallel, sto_generic_cb cb_fn, void *cb_arg)
+{
+	struct sto_rpc_multi_file_cmd *cmd;
+	struct sto_rpc_multi_file_params params = {
+		.type = type,
+		.entries = entries,
+		.cnt = cnt,
+		.parallel = parallel,
+	};
+	int rc;
+
+	if (spdk_unlikely(!cnt)) {
+		cb_fn(cb_arg, 0);
+		return;
+	}
+
+	cmd = sto_rpc_multi_file_cmd_alloc(type, entries, cnt);
+	if (spdk_unlikely(!cmd)) {
+		SPDK_ERRLOG("Failed to allocate RPC %s cmd\n", type->method);
+		cb_fn(cb_arg, -ENOMEM);
+		return;
+	}
+
+	sto_rpc_multi_file_cmd_init_cb(cmd, cb_fn, cb_arg);
+
+	rc = sto_rpc_multi_file_cmd_run(cmd, &params);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to run RPC %s cmd, rc=%d\n", type->method, rc);
+		goto free_cmd;
+	}
+
+	return;
+
+free_cmd:
+	sto_rpc_multi_file_cmd_free(cmd);
+
+	cb_fn(cb_arg, rc);
+	return;
+}
+
+static void
+sto_rpc_multi_writefile_entry_json(const void *entry_ptr, struct spdk_json_write_ctx *w)
+{
+	const struct sto_rpc_writefile_entry *entry = entry_ptr;
+
+	spdk_json_write_named_string(w, "filepath", entry->filepath);
+	spdk_json_write_named_int32(w, "oflag", entry->oflag);
+	spdk_json_write_named_string(w, "buf", entry->buf);
+}
+
+static const struct sto_rpc_multi_file_type sto_rpc_multi_writefile_type = {
+	.method = "multi_writefile",
+	.entry_size = sizeof(struct sto_rpc_writefile_entry),
+	.entry_json = sto_rpc_multi_writefile_entry_json,
+	.results_name = "returncodes",
+	.result_decode = spdk_json_decode_int32,
+	.result_offset = offsetof(struct sto_rpc_writefile_entry, returncode),
+};
+
+void
+sto_rpc_multi_writefile(struct sto_rpc_writefile_entry *entries, size_t cnt, bool parallel,
+			sto_generic_cb cb_fn, void *cb_arg)
+{
+	sto_rpc_multi_file(&sto_rpc_multi_writefile_type, entries, cnt, parallel, cb_fn, cb_arg);
+}
+
+static void
+sto_rpc_multi_readfile_entry_json(const void *entry_ptr, struct spdk_json_write_ctx *w)
+{
+	const struct sto_rpc_readfile_entry *entry = entry_ptr;
+
+	spdk_json_write_named_string(w, "filepath", entry->filepath);
+	spdk_json_write_named_uint32(w, "size", entry->size);
+}
+
+static const struct spdk_json_object_decoder sto_rpc_multi_readfile_result_decoders[] = {
+	{"returncode", offsetof(struct sto_rpc_readfile_entry, returncode), spdk_json_decode_int32},
+	{"buf", offsetof(struct sto_rpc_readfile_entry, buf), spdk_json_decode_string},
+};
+
+static int
+sto_rpc_multi_readfile_result_decode(const struct spdk_json_val *val, void *out)
+{
+	return spdk_json_decode_object(val, sto_rpc_multi_readfile_result_decoders,
+				       SPDK_COUNTOF(sto_rpc_multi_readfile_result_decoders), out);
+}
+
+static const struct sto_rpc_multi_file_type sto_rpc_multi_readfile_type = {
+	.method = "multi_readfile",
+	.entry_size = sizeof(struct sto_rpc_readfile_entry),
+	.entry_json = sto_rpc_multi_readfile_entry_json,
+	.results_name = "results",
+	.result_decode = sto_rpc_multi_readfile_result_decode,
+	.result_offset = 0,
+};
+
+void
+sto_rpc_multi_readfile(struct sto_rpc_readfile_entry *entries, size_t cnt, bool parallel,
+		       sto_generic_cb cb_fn, void *cb_arg)
+{
+	sto_rpc_multi_file(&sto_rpc_multi_readfile_type, entries, cnt, parallel, cb_fn, cb_arg);
+}
@@ -13,75 +13,166 @@
 
 struct spdk_json_write_ctx;
 
-static const struct spdk_json_object_decoder sto_dirent_decoders[] = {
-	{"name", offsetof(struct sto_dirent, name), spdk_json_decode_string},
-	{"mode", offsetof(struct sto_dirent, mode), spdk_json_decode_uint32},
-};
+#define STO_DIRENTS_MIN_CAPACITY	16
+#define STO_DIRENTS_MIN_NAMES_SIZE	256
 
 static int
-sto_dirent_decode(const struct spdk_json_val *val, void *out)
+sto_dirents_grow(struct sto_dirents *dirents, uint32_t name_len)
 {
-	struct sto_dirent *dirent = out;
+	if (dirents->cnt == dirents->capacity) {
+		uint32_t capacity = spdk_max(dirents->capacity * 2, STO_DIRENTS_MIN_CAPACITY);
+		void *entries;
+
+		entries = realloc(dirents->entries, capacity * sizeof(*dirents->entries));
+		if (spdk_unlikely(!entries)) {
+			SPDK_ERRLOG("Failed to grow dirents up to %u\n", capacity);
+			return -ENOMEM;
+		}
+
+		dirents->entries = entries;
+		dirents->capacity = capacity;
+	}
+
+	if (dirents->names_size - dirents->names_len <= name_len) {
+		uint32_t names_size = spdk_max(dirents->names_size, STO_DIRENTS_MIN_NAMES_SIZE);
+		char *names;
+
+		while (names_size - dirents->names_len <= name_len) {
+			names_size *= 2;
+		}
+
+		names = realloc(dirents->names, names_size);
+		if (spdk_unlikely(!names)) {
+			SPDK_ERRLOG("Failed to grow dirent names up to %u\n", names_size);
+			return -ENOMEM;
+		}
+
+		dirents->names = names;
+		dirents->names_size = names_size;
+	}
 
-	return spdk_json_decode_object(val, sto_dirent_decoders,
-				       SPDK_COUNTOF(sto_dirent_decoders), dirent);
+	return 0;
 }
 
-static int
-sto_dirents_decode(const struct spdk_json_val *val, void *out)
+int
+sto_dirents_add(struct sto_dirents *dirents, const char *name, uint32_t name_len, uint32_t mode)
 {
-	struct sto_dirents *dirents = *(struct sto_dirents **) out;
+	int rc;
 
-	return spdk_json_decode_array(val, sto_dirent_decode, dirents->dirents,
-				      STO_DIRENT_MAX_CNT, &dirents->cnt, sizeof(struct sto_dirent));
+	rc = sto_dirents_grow(dirents, name_len);
+	if (spdk_unlikely(rc)) {
+		return rc;
+	}
+
+	dirents->entries[dirents->cnt].name_off = dirents->names_len;
+	dirents->entries[dirents->cnt].mode = mode;
+	dirents->cnt++;
+
+	memcpy(dirents->names + dirents->names_len, name, name_len);
+	dirents->names_len += name_len;
+	dirents->names[dirents->names_len++] = '\0';
+
+	return 0;
 }
 
-static void
-sto_dirent_free(struct sto_dirent *dirent)
+struct sto_dirent_json {
+	const struct spdk_json_val *name;
+	uint32_t mode;
+};
+
+static int
+sto_dirent_decode_name(const struct spdk_json_val *val, void *out)
 {
-	free(dirent->name);
+	const struct spdk_json_val **name = out;
+
+	/* The name goes to the arena as C string, so it can't have a NUL inside */
+	if (val->type != SPDK_JSON_VAL_STRING || memchr(val->start, '\0', val->len)) {
+		return -EINVAL;
+	}
+
+	*name = val;
+
+	return 0;
 }
 
-void
-sto_dirents_free(struct sto_dirents *dirents)
+static const struct spdk_json_object_decoder sto_dirent_decoders[] = {
+	{"name", offsetof(struct sto_dirent_json, name), sto_dirent_decode_name},
+	{"mode", offsetof(struct sto_dirent_json, mode), spdk_json_decode_uint32},
+};
+
+static int
+sto_dirents_decode(const struct spdk_json_val *val, void *out)
 {
-	size_t i;
+	struct sto_dirents *dirents = *(struct sto_dirents **) out;
+	uint32_t i;
+	int rc;
 
-	if (spdk_unlikely(!dirents->cnt)) {
-		return;
+	if (val->type != SPDK_JSON_VAL_ARRAY_BEGIN) {
+		return -EINVAL;
 	}
 
-	for (i = 0; i < dirents->cnt; i++) {
-		sto_dirent_free(&dirents->dirents[i]);
+	for (i = 1; i <= val->len; i += 1 + spdk_json_val_len(&val[i])) {
+		struct sto_dirent_json dirent = {};
+
+		if (spdk_json_decode_object(&val[i], sto_dirent_decoders,
+					    SPDK_COUNTOF(sto_dirent_decoders), &dirent)) {
+			return -EINVAL;
+		}
+
+		rc = sto_dirents_add(dirents, dirent.name->start, dirent.name->len, dirent.mode);
+		if (spdk_unlikely(rc)) {
+			return rc;
+		}
 	}
 
+	return 0;
+}
+
+void
+sto_dirents_free(struct sto_dirents *dirents)
+{
+	free(dirents->entries);
+	free(dirents->names);
+
 	memset(dirents, 0, sizeof(*dirents));
 }
 
 struct sto_rpc_readdir_info {
 	int returncode;
 	struct sto_dirents *dirents;
+	uint64_t cursor;
+	bool eof;
 };
 
 static const struct spdk_json_object_decoder sto_rpc_readdir_info_decoders[] = {
 	{"returncode", offsetof(struct sto_rpc_readdir_info, returncode), spdk_json_decode_int32},
 	{"dirents", offsetof(struct sto_rpc_readdir_info, dirents), sto_dirents_decode},
+	{"cursor", offsetof(struct sto_rpc_readdir_info, cursor), spdk_json_decode_uint64, true},
+	{"eof", offsetof(struct sto_rpc_readdir_info, eof), spdk_json_decode_bool, true},
 };
 
 struct sto_rpc_readdir_params {
 	const char *dirpath;
 	bool skip_hidden;
+	bool type_only;
+	uint64_t cursor;
+	uint32_t max_entries;
 };
 
 struct sto_rpc_readdir_cmd {
+	char *dirpath;
+	bool type_only;
+	uint64_t cursor;
+
 	struct sto_dirents *dirents;
+	sto_rpc_readdir_page_cb page_fn;
 
 	void *cb_arg;
 	sto_generic_cb cb_fn;
 };
 
 static struct sto_rpc_readdir_cmd *
-sto_rpc_readdir_cmd_alloc(void)
+sto_rpc_readdir_cmd_alloc(const char *dirpath)
 {
 	struct sto_rpc_readdir_cmd *cmd;
 
@@ -91,6 +182,13 @@ sto_rpc_readdir_cmd_alloc(void)
 		return NULL;
 	}
 
+	cmd->dirpath = strdup(dirpath);
+	if (spdk_unlikely(!cmd->dirpath)) {
+		SPDK_ERRLOG("Cann't allocate memory for dirpath: %s\n", dirpath);
+		free(cmd);
+		return NULL;
+	}
+
 	return cmd;
 }
 
@@ -104,16 +202,21 @@ sto_rpc_readdir_cmd_init_cb(struct sto_rpc_readdir_cmd *cmd, sto_generic_cb cb_f
 static void
 sto_rpc_readdir_cmd_free(struct sto_rpc_readdir_cmd *cmd)
 {
+	free(cmd->dirpath);
 	free(cmd);
 }
 
+static int sto_rpc_readdir_cmd_run(struct sto_rpc_readdir_cmd *cmd);
+
 static void
 sto_rpc_readdir_resp_handler(void *priv, struct spdk_jsonrpc_client_response *resp, int rc)
 {
 	struct sto_rpc_readdir_cmd *cmd = priv;
 	struct sto_dirents *dirents = cmd->dirents;
 	struct sto_rpc_readdir_info info = {
-		.dirents = dirents
+		.dirents = dirents,
+		/* Servers without paging send the whole directory at once */
+		.eof = true,
 	};
 
 	if (spdk_unlikely(rc)) {
@@ -128,8 +231,37 @@ sto_rpc_readdir_resp_handler(void *priv, struct spdk_jsonrpc_client_response *re
 	}
 
 	rc = info.returncode;
+	if (spdk_unlikely(rc)) {
+		goto out;
+	}
+
+	if (cmd->page_fn) {
+		rc = cmd->page_fn(cmd->cb_arg, dirents);
+		sto_dirents_free(dirents);
+
+		if (spdk_unlikely(rc)) {
+			goto out;
+		}
+	}
+
+	if (!info.eof) {
+		cmd->cursor = info.cursor;
+
+		rc = sto_rpc_readdir_cmd_run(cmd);
+		if (spdk_unlikely(rc)) {
+			SPDK_ERRLOG("Failed to submit readdir for the next page, rc=%d\n", rc);
+			goto out;
+		}
+
+		return;
+	}
 
 out:
+	/* A page that failed to decode never reached page_fn, drop what's in it */
+	if (cmd->page_fn) {
+		sto_dirents_free(dirents);
+	}
+
 	cmd->cb_fn(cmd->cb_arg, rc);
 
 	sto_rpc_readdir_cmd_free(cmd);
@@ -144,43 +276,52 @@ sto_rpc_readdir_info_json(void *priv, struct spdk_json_write_ctx *w)
 
 	spdk_json_write_named_string(w, "dirpath", params->dirpath);
 	spdk_json_write_named_bool(w, "skip_hidden", params->skip_hidden);
+	spdk_json_write_named_bool(w, "type_only", params->type_only);
+	spdk_json_write_named_uint64(w, "cursor", params->cursor);
+	spdk_json_write_named_uint32(w, "max_entries", params->max_entries);
 
 	spdk_json_write_object_end(w);
 }
 
 static int
-sto_rpc_readdir_cmd_run(struct sto_rpc_readdir_cmd *cmd, struct sto_rpc_readdir_params *params)
+sto_rpc_readdir_cmd_run(struct sto_rpc_readdir_cmd *cmd)
 {
+	struct sto_rpc_readdir_params params = {
+		.dirpath = cmd->dirpath,
+		.skip_hidden = true,
+		.type_only = cmd->type_only,
+		.cursor = cmd->cursor,
+		.max_entries = STO_RPC_READDIR_PAGE_SIZE,
+	};
 	struct sto_client_args args = {
 		.priv = cmd,
 		.response_handler = sto_rpc_readdir_resp_handler,
 	};
 
-	return sto_client_send("readdir", params, sto_rpc_readdir_info_json, &args);
+	return sto_client_send("readdir", &params, sto_rpc_readdir_info_json, &args);
 }
 
-void
-sto_rpc_readdir(const char *dirpath, sto_generic_cb cb_fn, void *cb_arg, struct sto_dirents *dirents)
+static void
+sto_rpc_readdir_start(const char *dirpath, bool type_only, sto_rpc_readdir_page_cb page_fn,
+		      sto_generic_cb cb_fn, void *cb_arg, struct sto_dirents *dirents)
 {
 	struct sto_rpc_readdir_cmd *cmd;
-	struct sto_rpc_readdir_params params = {
-		.dirpath = dirpath,
-		.skip_hidden = true,
-	};
 	int rc;
 
-	cmd = sto_rpc_readdir_cmd_alloc();
+	cmd = sto_rpc_readdir_cmd_alloc(dirpath);
 	if (spdk_unlikely(!cmd)) {
 		SPDK_ERRLOG("Failed to alloc memory for readdir cmd\n");
 		cb_fn(cb_arg, -ENOMEM);
 		return;
 	}
 
+	cmd->type_only = type_only;
 	cmd->dirents = dirents;
+	cmd->page_fn = page_fn;
 
 	sto_rpc_readdir_cmd_init_cb(cmd, cb_fn, cb_arg);
 
-	rc = sto_rpc_readdir_cmd_run(cmd, &params);
+	rc = sto_rpc_readdir_cmd_run(cmd);
 	if (spdk_unlikely(rc)) {
 		SPDK_ERRLOG("Failed to submit readdir, rc=%d\n", rc);
 		goto free_cmd;
@@ -195,6 +336,19 @@ free_cmd:
 	return;
 }
 
+void
+sto_rpc_readdir_pages(const char *dirpath, sto_rpc_readdir_page_cb page_fn,
+		      sto_generic_cb cb_fn, void *cb_arg, struct sto_dirents *dirents)
+{
+	sto_rpc_readdir_start(dirpath, false, page_fn, cb_fn, cb_arg, dirents);
+}
+
+void
+sto_rpc_readdir(const char *dirpath, sto_generic_cb cb_fn, void *cb_arg, struct sto_dirents *dirents)
+{
+	sto_rpc_readdir_start(dirpath, true, NULL, cb_fn, cb_arg, dirents);
+}
+
 void
 sto_dirents_info_json(struct sto_dirents *dirents,
 		      struct sto_dirents_json_cfg *cfg, struct spdk_json_write_ctx *w)
@@ -206,17 +360,19 @@ sto_dirents_info_json(struct sto_dirents *dirents,
 	spdk_json_write_named_array_begin(w, cfg->name);
 
 	for (i = 0; i < dirents->cnt; i++) {
-		struct sto_dirent *dirent = &dirents->dirents[i];
+		struct sto_dirent dirent;
+
+		sto_dirents_get(dirents, i, &dirent);
 
-		if (sto_find_match_str(dirent->name, cfg->exclude_list)) {
+		if (sto_find_match_str(dirent.name, cfg->exclude_list)) {
 			continue;
 		}
 
-		if (cfg->type && ((dirent->mode & S_IFMT) != cfg->type)) {
+		if (cfg->type && ((dirent.mode & S_IFMT) != cfg->type)) {
 			continue;
 		}
 
-		spdk_json_write_string(w, dirent->name);
+		spdk_json_write_string(w, dirent.name);
 	}
 
 	spdk_json_write_array_end(w);
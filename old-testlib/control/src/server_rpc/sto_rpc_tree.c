@@ -0,0 +1,272 @@
+#include "sto_rpc_tree.h"
+
+#include <spdk/stdinc.h>
+#include <spdk/log.h>
+#include <spdk/likely.h>
+#include <spdk/util.h>
+#include <spdk/json.h>
+#include <spdk/jsonrpc.h>
+
+#include "sto_client.h"
+#include "sto_async.h"
+#include "sto_inode.h"
+#include "sto_tree.h"
+
+struct spdk_json_write_ctx;
+
+static int
+sto_rpc_tree_array_decode(const struct spdk_json_val *val, void *out)
+{
+	const struct spdk_json_val **array = out;
+
+	if (val->type != SPDK_JSON_VAL_ARRAY_BEGIN) {
+		return -EINVAL;
+	}
+
+	*array = val;
+
+	return 0;
+}
+
+/* File contents are copied once, straight to where the inode keeps them */
+static int
+sto_rpc_tree_buf_decode(const struct spdk_json_val *val, void *out)
+{
+	const struct spdk_json_val **buf = out;
+
+	if (val->type != SPDK_JSON_VAL_STRING) {
+		return -EINVAL;
+	}
+
+	*buf = val;
+
+	return 0;
+}
+
+struct sto_rpc_tree_node_info {
+	char *name;
+	uint32_t mode;
+	const struct spdk_json_val *buf;
+	const struct spdk_json_val *childs;
+};
+
+static const struct spdk_json_object_decoder sto_rpc_tree_node_info_decoders[] = {
+	{"name", offsetof(struct sto_rpc_tree_node_info, name), spdk_json_decode_string},
+	{"mode", offsetof(struct sto_rpc_tree_node_info, mode), spdk_json_decode_uint32},
+	{"buf", offsetof(struct sto_rpc_tree_node_info, buf), sto_rpc_tree_buf_decode, true},
+	{"childs", offsetof(struct sto_rpc_tree_node_info, childs), sto_rpc_tree_array_decode, true},
+};
+
+static int sto_rpc_tree_add_childs(struct sto_tree_node *parent, const struct spdk_json_val *array);
+
+static int
+sto_rpc_tree_add_node(struct sto_tree_node *parent, const struct spdk_json_val *val)
+{
+	struct sto_rpc_tree_node_info info = {};
+	struct sto_inode *inode;
+	int rc = 0;
+
+	if (spdk_json_decode_object(val, sto_rpc_tree_node_info_decoders,
+				    SPDK_COUNTOF(sto_rpc_tree_node_info_decoders), &info)) {
+		SPDK_ERRLOG("Failed to decode tree node info\n");
+		return -EINVAL;
+	}
+
+	inode = sto_inode_create(parent->arena, info.name, "%s/%s", info.mode,
+				 parent->inode->path, info.name);
+	if (spdk_unlikely(!inode)) {
+		SPDK_ERRLOG("Failed to alloc inode\n");
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	if (info.buf && (inode->type == STO_INODE_TYPE_FILE || inode->type == STO_INODE_TYPE_LNK)) {
+		rc = sto_file_inode_set_buf(inode, info.buf->start, info.buf->len);
+		if (spdk_unlikely(rc)) {
+			goto destroy_inode;
+		}
+	}
+
+	rc = sto_tree_add_inode(parent, inode);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to add inode, rc=%d\n", rc);
+		goto destroy_inode;
+	}
+
+	if (inode->type == STO_INODE_TYPE_DIR && info.childs) {
+		rc = sto_rpc_tree_add_childs(inode->node, info.childs);
+	}
+
+out:
+	spdk_json_free_object(sto_rpc_tree_node_info_decoders,
+			      SPDK_COUNTOF(sto_rpc_tree_node_info_decoders), &info);
+
+	return rc;
+
+destroy_inode:
+	inode->ops->destroy(inode);
+	goto out;
+}
+
+static int
+sto_rpc_tree_add_childs(struct sto_tree_node *parent, const struct spdk_json_val *array)
+{
+	struct spdk_json_val *it;
+	int rc;
+
+	for (it = spdk_json_array_first((struct spdk_json_val *) array); it != NULL; it = spdk_json_next(it)) {
+		rc = sto_rpc_tree_add_node(parent, it);
+		if (spdk_unlikely(rc)) {
+			return rc;
+		}
+	}
+
+	return 0;
+}
+
+struct sto_rpc_tree_info {
+	int returncode;
+	const struct spdk_json_val *tree;
+};
+
+static const struct spdk_json_object_decoder sto_rpc_tree_info_decoders[] = {
+	{"returncode", offsetof(struct sto_rpc_tree_info, returncode), spdk_json_decode_int32},
+	{"tree", offsetof(struct sto_rpc_tree_info, tree), sto_rpc_tree_array_decode},
+};
+
+struct sto_rpc_tree_params {
+	const char *dirpath;
+	uint32_t depth;
+	bool only_dirs;
+};
+
+struct sto_rpc_tree_cmd {
+	struct sto_tree_node *tree_root;
+
+	void *cb_arg;
+	sto_generic_cb cb_fn;
+};
+
+static struct sto_rpc_tree_cmd *
+sto_rpc_tree_cmd_alloc(void)
+{
+	struct sto_rpc_tree_cmd *cmd;
+
+	cmd = calloc(1, sizeof(*cmd));
+	if (spdk_unlikely(!cmd)) {
+		SPDK_ERRLOG("Cann't allocate memory for STO tree cmd\n");
+		return NULL;
+	}
+
+	return cmd;
+}
+
+static void
+sto_rpc_tree_cmd_init_cb(struct sto_rpc_tree_cmd *cmd, sto_generic_cb cb_fn, void *cb_arg)
+{
+	cmd->cb_fn = cb_fn;
+	cmd->cb_arg = cb_arg;
+}
+
+static void
+sto_rpc_tree_cmd_free(struct sto_rpc_tree_cmd *cmd)
+{
+	free(cmd);
+}
+
+static void
+sto_rpc_tree_resp_handler(void *priv, struct spdk_jsonrpc_client_response *resp, int rc)
+{
+	struct sto_rpc_tree_cmd *cmd = priv;
+	struct sto_rpc_tree_info info = {};
+
+	if (spdk_unlikely(rc)) {
+		goto out;
+	}
+
+	if (spdk_json_decode_object(resp->result, sto_rpc_tree_info_decoders,
+				    SPDK_COUNTOF(sto_rpc_tree_info_decoders), &info)) {
+		SPDK_ERRLOG("Failed to decode tree info\n");
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	rc = info.returncode;
+	if (spdk_unlikely(rc)) {
+		goto out;
+	}
+
+	rc = sto_rpc_tree_add_childs(cmd->tree_root, info.tree);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to build tree, rc=%d\n", rc);
+		goto out;
+	}
+
+out:
+	cmd->cb_fn(cmd->cb_arg, rc);
+
+	sto_rpc_tree_cmd_free(cmd);
+}
+
+static void
+sto_rpc_tree_info_json(void *priv, struct spdk_json_write_ctx *w)
+{
+	struct sto_rpc_tree_params *params = priv;
+
+	spdk_json_write_object_begin(w);
+
+	spdk_json_write_named_string(w, "dirpath", params->dirpath);
+	spdk_json_write_named_uint32(w, "depth", params->depth);
+	spdk_json_write_named_bool(w, "only_dirs", params->only_dirs);
+
+	spdk_json_write_object_end(w);
+}
+
+static int
+sto_rpc_tree_cmd_run(struct sto_rpc_tree_cmd *cmd, struct sto_rpc_tree_params *params)
+{
+	struct sto_client_args args = {
+		.priv = cmd,
+		.response_handler = sto_rpc_tree_resp_handler,
+	};
+
+	return sto_client_send("tree", params, sto_rpc_tree_info_json, &args);
+}
+
+void
+sto_rpc_tree(const char *dirpath, uint32_t depth, bool only_dirs,
+	     sto_generic_cb cb_fn, void *cb_arg, struct sto_tree_node *tree_root)
+{
+	struct sto_rpc_tree_cmd *cmd;
+	struct sto_rpc_tree_params params = {
+		.dirpath = dirpath,
+		.depth = depth,
+		.only_dirs = only_dirs,
+	};
+	int rc;
+
+	cmd = sto_rpc_tree_cmd_alloc();
+	if (spdk_unlikely(!cmd)) {
+		SPDK_ERRLOG("Failed to alloc memory for tree cmd\n");
+		cb_fn(cb_arg, -ENOMEM);
+		return;
+	}
+
+	cmd->tree_root = tree_root;
+
+	sto_rpc_tree_cmd_init_cb(cmd, cb_fn, cb_arg);
+
+	rc = sto_rpc_tree_cmd_run(cmd, &params);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to submit tree, rc=%d\n", rc);
+		goto free_cmd;
+	}
+
+	return;
+
+free_cmd:
+	sto_rpc_tree_cmd_free(cmd);
+	cb_fn(cb_arg, rc);
+
+	return;
+}
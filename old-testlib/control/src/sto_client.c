@@ -1,5 +1,7 @@
 #include "sto_client.h"
 
+#include <sys/epoll.h>
+
 #include <spdk/stdinc.h>
 #include <spdk/thread.h>
 #include <spdk/log.h>
@@ -13,28 +15,61 @@
 #include "sto_json.h"
 #include "sto_err.h"
 #include "sto_hash.h"
+#include "sto_client_thread.h"
 
-#define STO_JSONRPC_CLIENT_MAX_CONNS	64
 #define STO_JSONRPC_CLIENT_POLL_PERIOD	100
+#define STO_JSONRPC_CLIENT_REQ_MAP_SIZE	64
+#define STO_JSONRPC_CLIENT_RX_MIN_SIZE	4096
+#define STO_JSONRPC_CLIENT_MIN_VALUES	64
+
+struct sto_jsonrpc_client_tx {
+	char *buf;
+	size_t len;
+	size_t off;
 
-struct sto_jsonrpc_client_entry {
-	struct spdk_jsonrpc_client *rpc_client;
-	TAILQ_ENTRY(sto_jsonrpc_client_entry) list;
+	TAILQ_ENTRY(sto_jsonrpc_client_tx) list;
+};
+
+/*
+ * A persistent connection to the server. Any number of requests may be
+ * outstanding on it, the server answers them as they complete and the
+ * responses are matched back to their requests by id.
+ */
+struct sto_jsonrpc_client_conn {
+	struct sto_jsonrpc_client *client;
+
+	int fd;
+	bool pollout;
+
+	uint32_t nr_inflight;
+	TAILQ_HEAD(, sto_jsonrpc_client_req) reqs;
+
+	TAILQ_HEAD(, sto_jsonrpc_client_tx) tx_list;
+
+	char *rx_buf;
+	size_t rx_len;
+	size_t rx_size;
+
+	struct spdk_json_val *values;
+	size_t values_cnt;
 };
 
 struct sto_jsonrpc_client {
 	const char *addr;
 	int addr_family;
 
-	struct sto_jsonrpc_client_entry entries_arr[STO_JSONRPC_CLIENT_MAX_CONNS];
+	int epfd;
 
-	TAILQ_HEAD(, sto_jsonrpc_client_entry) free_entries;
-	TAILQ_HEAD(, sto_jsonrpc_client_entry) entries;
+	struct sto_jsonrpc_client_conn *conns;
+	uint32_t nr_conns;
 
 	int req_id;
 	struct sto_hash req_map;
+	uint32_t nr_inflight;
 
-	TAILQ_HEAD(, sto_jsonrpc_client_req) req_busy_list;
+	/* sto_client_close() may be called from a response handler */
+	bool in_poll;
+	bool closing;
 
 	struct spdk_poller *poller;
 };
@@ -45,14 +80,17 @@ struct sto_jsonrpc_client_req {
 	struct sto_hash_elem he;
 	TAILQ_ENTRY(sto_jsonrpc_client_req) list;
 
-	struct spdk_jsonrpc_client_request *request;
+	struct sto_jsonrpc_client_conn *conn;
 
 	void *priv;
 	sto_client_response_handler_t response_handler;
 };
 
+/* The client of sto_client_connect(), the other threads copy its settings */
 static struct sto_jsonrpc_client *g_sto_jsonrpc_client;
 
+static struct sto_client_thread_map g_sto_jsonrpc_clients = STO_CLIENT_THREAD_MAP_INITIALIZER;
+
 static inline int
 jsonrpc_client_next_id(struct sto_jsonrpc_client *client)
 {
@@ -60,35 +98,137 @@ jsonrpc_client_next_id(struct sto_jsonrpc_client *client)
 }
 
 static void
-__jsonrpc_client_send_req(struct sto_jsonrpc_client *client,
-			  struct sto_jsonrpc_client_entry *entry,
-			  struct sto_jsonrpc_client_req *req)
+jsonrpc_client_free_req(struct sto_jsonrpc_client_req *req)
 {
-	sto_hash_add(&client->req_map, &req->he);
+	free(req);
+}
 
-	spdk_jsonrpc_client_send_request(entry->rpc_client, req->request);
-	req->request = NULL;
+static void
+jsonrpc_client_req_done(struct sto_jsonrpc_client_req *req,
+			struct spdk_jsonrpc_client_response *response, int rc)
+{
+	struct sto_jsonrpc_client_conn *conn = req->conn;
+
+	sto_hash_elem_del(&req->he);
+	TAILQ_REMOVE(&conn->reqs, req, list);
+
+	conn->nr_inflight--;
+	conn->client->nr_inflight--;
+
+	req->response_handler(req->priv, response, rc);
+
+	jsonrpc_client_free_req(req);
 }
 
-static bool
-jsonrpc_client_check_busy_list(struct sto_jsonrpc_client *client,
-			       struct sto_jsonrpc_client_entry *entry)
+static void
+jsonrpc_client_conn_free_tx(struct sto_jsonrpc_client_conn *conn)
+{
+	struct sto_jsonrpc_client_tx *tx, *tmp;
+
+	TAILQ_FOREACH_SAFE(tx, &conn->tx_list, list, tmp) {
+		TAILQ_REMOVE(&conn->tx_list, tx, list);
+		free(tx->buf);
+		free(tx);
+	}
+}
+
+/* Every request in flight on a broken connection fails, the others keep going */
+static void
+jsonrpc_client_conn_fail(struct sto_jsonrpc_client_conn *conn, int rc)
 {
 	struct sto_jsonrpc_client_req *req;
 
-	if (TAILQ_EMPTY(&client->req_busy_list)) {
-		return false;
+	if (conn->fd != -1) {
+		epoll_ctl(conn->client->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+		close(conn->fd);
+		conn->fd = -1;
+	}
+
+	jsonrpc_client_conn_free_tx(conn);
+
+	while ((req = TAILQ_FIRST(&conn->reqs)) != NULL) {
+		jsonrpc_client_req_done(req, NULL, rc);
+	}
+
+	free(conn->rx_buf);
+	conn->rx_buf = NULL;
+	conn->rx_len = conn->rx_size = 0;
+
+	free(conn->values);
+	conn->values = NULL;
+	conn->values_cnt = 0;
+}
+
+static int
+jsonrpc_client_conn_update_events(struct sto_jsonrpc_client_conn *conn)
+{
+	struct epoll_event event = {};
+	bool pollout = !TAILQ_EMPTY(&conn->tx_list);
+
+	if (pollout == conn->pollout) {
+		return 0;
+	}
+
+	event.events = EPOLLIN | (pollout ? EPOLLOUT : 0);
+	event.data.ptr = conn;
+
+	if (epoll_ctl(conn->client->epfd, EPOLL_CTL_MOD, conn->fd, &event) == -1) {
+		return -errno;
 	}
 
-	req = TAILQ_FIRST(&client->req_busy_list);
-	TAILQ_REMOVE(&client->req_busy_list, req, list);
+	conn->pollout = pollout;
+
+	return 0;
+}
+
+static int
+jsonrpc_client_conn_flush(struct sto_jsonrpc_client_conn *conn)
+{
+	struct sto_jsonrpc_client_tx *tx;
+
+	while ((tx = TAILQ_FIRST(&conn->tx_list)) != NULL) {
+		ssize_t ret;
+
+		ret = send(conn->fd, tx->buf + tx->off, tx->len - tx->off, MSG_NOSIGNAL);
+		if (ret == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
 
-	__jsonrpc_client_send_req(client, entry, req);
+			return -errno;
+		}
+
+		tx->off += ret;
+		if (tx->off < tx->len) {
+			continue;
+		}
+
+		TAILQ_REMOVE(&conn->tx_list, tx, list);
+		free(tx->buf);
+		free(tx);
+	}
 
-	return true;
+	return 0;
 }
 
-static void jsonrpc_client_free_req(struct sto_jsonrpc_client_req *req);
+static int
+jsonrpc_client_capture_val(const struct spdk_json_val *val, void *out)
+{
+	*(const struct spdk_json_val **) out = val;
+
+	return 0;
+}
+
+static const struct spdk_json_object_decoder jsonrpc_client_response_decoders[] = {
+	{"jsonrpc", offsetof(struct spdk_jsonrpc_client_response, version), jsonrpc_client_capture_val},
+	{"id", offsetof(struct spdk_jsonrpc_client_response, id), jsonrpc_client_capture_val, true},
+	{"result", offsetof(struct spdk_jsonrpc_client_response, result), jsonrpc_client_capture_val, true},
+	{"error", offsetof(struct spdk_jsonrpc_client_response, error), jsonrpc_client_capture_val, true},
+};
 
 static inline struct sto_jsonrpc_client_req *
 jsonrpc_client_get_req(struct sto_jsonrpc_client *client, int id)
@@ -103,177 +243,340 @@ jsonrpc_client_get_req(struct sto_jsonrpc_client *client, int id)
 	return SPDK_CONTAINEROF(he, struct sto_jsonrpc_client_req, he);
 }
 
+/* Callers tell an older server that lacks a method apart from a failure */
+static int
+jsonrpc_client_error_rc(struct spdk_json_val *error)
+{
+	struct spdk_json_val *code;
+	int32_t val;
+
+	if (spdk_json_find(error, "code", NULL, &code, SPDK_JSON_VAL_NUMBER) ||
+	    spdk_json_decode_int32(code, &val)) {
+		return -EFAULT;
+	}
+
+	return val == SPDK_JSONRPC_ERROR_METHOD_NOT_FOUND ? -ENOTSUP : -EFAULT;
+}
+
 static void
-jsonrpc_client_response(struct sto_jsonrpc_client *client,
-			struct spdk_jsonrpc_client_response *response)
+jsonrpc_client_response(struct sto_jsonrpc_client *client, struct spdk_json_val *values)
 {
+	struct spdk_jsonrpc_client_response response = {};
 	struct sto_jsonrpc_client_req *req;
-	int id, rc;
+	int id, rc = 0;
 
-	rc = spdk_json_decode_int32(response->id, &id);
-	if (spdk_unlikely(rc)) {
-		SPDK_ERRLOG("CRITICAL: Failed to decode RPC req ID, rc=%d\n!!!", rc);
+	if (spdk_json_decode_object(values, jsonrpc_client_response_decoders,
+				    SPDK_COUNTOF(jsonrpc_client_response_decoders), &response)) {
+		SPDK_ERRLOG("CRITICAL: Failed to decode RPC response\n");
 		return;
 	}
 
-	/* Check for error response */
-	if (response->error != NULL) {
-		sto_json_print("Client response error", response->error);
-		rc = -EFAULT;
+	if (spdk_unlikely(!response.id || spdk_json_decode_int32(response.id, &id))) {
+		SPDK_ERRLOG("CRITICAL: Failed to decode RPC req ID\n");
+		return;
 	}
 
 	req = jsonrpc_client_get_req(client, id);
-	assert(req);
-
-	sto_hash_elem_del(&req->he);
+	if (spdk_unlikely(!req)) {
+		SPDK_ERRLOG("CRITICAL: Got response for unknown RPC req ID %d\n", id);
+		return;
+	}
 
-	req->response_handler(req->priv, response, rc);
+	/* Check for error response */
+	if (response.error != NULL) {
+		sto_json_print("Client response error", response.error);
+		rc = jsonrpc_client_error_rc(response.error);
+	}
 
-	jsonrpc_client_free_req(req);
+	jsonrpc_client_req_done(req, &response, rc);
 }
 
-static void
-jsonrpc_client_check_response(struct sto_jsonrpc_client *client,
-			      struct sto_jsonrpc_client_entry *entry)
+static int
+jsonrpc_client_conn_values_reserve(struct sto_jsonrpc_client_conn *conn, size_t cnt)
 {
-	struct spdk_jsonrpc_client_response *response;
-	int rc = 0;
+	struct spdk_json_val *values;
 
-	rc = spdk_jsonrpc_client_poll(entry->rpc_client, 0);
-	if (rc == 0 || rc == -ENOTCONN) {
-		/* No response yet */
-		return;
+	if (conn->values_cnt >= cnt) {
+		return 0;
 	}
 
-	if (rc < 0) {
-		SPDK_ERRLOG("CRITICAL: spdk_jsonrpc_client_poll return ERROR, rc=%d\n", rc);
-		/* TODO: What should we do? */
-		assert(false);
-		return;
+	cnt = spdk_max(cnt, spdk_max(conn->values_cnt * 2, STO_JSONRPC_CLIENT_MIN_VALUES));
+
+	values = realloc(conn->values, cnt * sizeof(*values));
+	if (spdk_unlikely(!values)) {
+		return -ENOMEM;
 	}
 
-	response = spdk_jsonrpc_client_get_response(entry->rpc_client);
-	assert(response);
+	conn->values = values;
+	conn->values_cnt = cnt;
+
+	return 0;
+}
+
+/*
+ * Responses are back to back JSON objects, each one is parsed twice:
+ * first to count its values and then in place, as the SPDK client does.
+ */
+static int
+jsonrpc_client_conn_process(struct sto_jsonrpc_client_conn *conn)
+{
+	struct sto_jsonrpc_client *client = conn->client;
+	size_t off = 0;
+
+	while (off < conn->rx_len && conn->fd != -1) {
+		char *start = conn->rx_buf + off;
+		size_t len = conn->rx_len - off;
+		void *end;
+		ssize_t cnt;
+		int rc;
+
+		cnt = spdk_json_parse(start, len, NULL, 0, &end, 0);
+		if (cnt == SPDK_JSON_PARSE_INCOMPLETE) {
+			break;
+		}
 
-	jsonrpc_client_response(client, response);
+		if (spdk_unlikely(cnt <= 0)) {
+			SPDK_ERRLOG("Failed to parse RPC response, rc=%zd\n", cnt);
+			return -EPROTO;
+		}
 
-	spdk_jsonrpc_client_free_response(response);
+		rc = jsonrpc_client_conn_values_reserve(conn, cnt);
+		if (spdk_unlikely(rc)) {
+			return rc;
+		}
 
-	if (jsonrpc_client_check_busy_list(client, entry)) {
-		return;
+		if (spdk_json_parse(start, len, conn->values, cnt, &end,
+				    SPDK_JSON_PARSE_FLAG_DECODE_IN_PLACE) != cnt) {
+			SPDK_ERRLOG("Failed to parse RPC response values\n");
+			return -EPROTO;
+		}
+
+		off = (char *) end - conn->rx_buf;
+
+		jsonrpc_client_response(client, conn->values);
 	}
 
-	TAILQ_REMOVE(&client->entries, entry, list);
-	TAILQ_INSERT_HEAD(&client->free_entries, entry, list);
+	if (off && conn->fd != -1) {
+		memmove(conn->rx_buf, conn->rx_buf + off, conn->rx_len - off);
+		conn->rx_len -= off;
+	}
+
+	return 0;
 }
 
 static int
-jsonrpc_client_poll(void *ctx)
+jsonrpc_client_conn_rx_reserve(struct sto_jsonrpc_client_conn *conn)
 {
-	struct sto_jsonrpc_client *client = ctx;
-	struct sto_jsonrpc_client_entry *entry, *tmp;
+	size_t size;
+	char *rx_buf;
 
-	if (TAILQ_EMPTY(&client->entries)) {
-		return SPDK_POLLER_IDLE;
+	if (conn->rx_size - conn->rx_len >= STO_JSONRPC_CLIENT_RX_MIN_SIZE / 2) {
+		return 0;
 	}
 
-	TAILQ_FOREACH_SAFE(entry, &client->entries, list, tmp) {
-		jsonrpc_client_check_response(client, entry);
+	size = spdk_max(conn->rx_size * 2, STO_JSONRPC_CLIENT_RX_MIN_SIZE);
+
+	rx_buf = realloc(conn->rx_buf, size);
+	if (spdk_unlikely(!rx_buf)) {
+		return -ENOMEM;
 	}
 
-	return SPDK_POLLER_BUSY;
+	conn->rx_buf = rx_buf;
+	conn->rx_size = size;
+
+	return 0;
 }
 
-static struct spdk_jsonrpc_client_request *
-__alloc_jsonrpc_client_request(const char *method_name, int id,
-			       void *params, sto_client_dump_params_t dump_params)
+static int
+jsonrpc_client_conn_recv(struct sto_jsonrpc_client_conn *conn)
 {
-	struct spdk_jsonrpc_client_request *request;
-	struct spdk_json_write_ctx *w;
+	int rc;
 
-	request = spdk_jsonrpc_client_create_request();
-	if (spdk_unlikely(!request)) {
-		SPDK_ERRLOG("Failed to create jsonrpc client request\n");
-		return NULL;
+	while (conn->fd != -1) {
+		ssize_t ret;
+
+		rc = jsonrpc_client_conn_rx_reserve(conn);
+		if (spdk_unlikely(rc)) {
+			return rc;
+		}
+
+		ret = recv(conn->fd, conn->rx_buf + conn->rx_len,
+			   conn->rx_size - conn->rx_len, 0);
+		if (ret == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+
+			return -errno;
+		}
+
+		if (!ret) {
+			return -ECONNRESET;
+		}
+
+		conn->rx_len += ret;
+
+		rc = jsonrpc_client_conn_process(conn);
+		if (spdk_unlikely(rc)) {
+			return rc;
+		}
 	}
 
-	w = spdk_jsonrpc_begin_request(request, id, method_name);
-	if (!w) {
-		spdk_jsonrpc_client_free_request(request);
-		return NULL;
+	return 0;
+}
+
+static void
+jsonrpc_client_conn_poll(struct sto_jsonrpc_client_conn *conn, uint32_t events)
+{
+	int rc = 0;
+
+	if (events & EPOLLOUT) {
+		rc = jsonrpc_client_conn_flush(conn);
 	}
 
-	if (dump_params) {
-		spdk_json_write_name(w, "params");
-		dump_params(params, w);
+	if (!rc && (events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+		rc = jsonrpc_client_conn_recv(conn);
 	}
 
-	spdk_jsonrpc_end_request(request, w);
+	if (!rc && conn->fd != -1) {
+		rc = jsonrpc_client_conn_update_events(conn);
+	}
 
-	return request;
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("STO jsonrpc client connection failed, rc=%d\n", rc);
+		jsonrpc_client_conn_fail(conn, rc);
+	}
 }
 
-static struct sto_jsonrpc_client_req *
-jsonrpc_client_create_req(struct sto_jsonrpc_client *client,
-			  const char *method_name, void *params,
-			  sto_client_dump_params_t dump_params)
+static void sto_jsonrpc_client_close(struct sto_jsonrpc_client *client);
+
+/* Only sockets reported by epoll are touched, idle connections cost nothing */
+static int
+jsonrpc_client_poll(void *ctx)
 {
-	struct sto_jsonrpc_client_req *req;
+	struct sto_jsonrpc_client *client = ctx;
+	struct epoll_event events[STO_CLIENT_MAX_CONNS];
+	int i, n;
 
-	req = calloc(1, sizeof(*req));
-	if (spdk_unlikely(!req)) {
-		SPDK_ERRLOG("Cann't allocate memory for a RPC req\n");
-		return NULL;
+	if (!client->nr_inflight) {
+		return SPDK_POLLER_IDLE;
 	}
 
-	req->id = client->req_id = jsonrpc_client_next_id(client);
+	n = epoll_wait(client->epfd, events, SPDK_COUNTOF(events), 0);
+	if (n <= 0) {
+		if (spdk_unlikely(n == -1 && errno != EINTR)) {
+			SPDK_ERRLOG("epoll_wait() failed: %s\n", spdk_strerror(errno));
+		}
 
-	sto_hash_elem_init(&req->he, &req->id, sizeof(req->id));
+		return SPDK_POLLER_IDLE;
+	}
 
-	req->request = __alloc_jsonrpc_client_request(method_name, req->id, params, dump_params);
-	if (spdk_unlikely(!req->request)) {
-		SPDK_ERRLOG("Failed to create jsonrpc client request\n");
-		goto free_req;
+	client->in_poll = true;
+
+	for (i = 0; i < n; i++) {
+		struct sto_jsonrpc_client_conn *conn = events[i].data.ptr;
+
+		if (conn->fd == -1 || client->closing) {
+			continue;
+		}
+
+		jsonrpc_client_conn_poll(conn, events[i].events);
 	}
 
-	return req;
+	client->in_poll = false;
 
-free_req:
-	free(req);
+	if (client->closing) {
+		sto_jsonrpc_client_close(client);
+	}
 
-	return NULL;
+	return SPDK_POLLER_BUSY;
 }
 
-static void
-jsonrpc_client_req_init_cb(struct sto_jsonrpc_client_req *req,
-			   sto_client_response_handler_t response_handler, void *priv)
+struct jsonrpc_client_wbuf {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+static int
+jsonrpc_client_wbuf_write_cb(void *cb_ctx, const void *data, size_t size)
 {
-	req->response_handler = response_handler;
-	req->priv = priv;
+	struct jsonrpc_client_wbuf *wbuf = cb_ctx;
+
+	if (wbuf->len + size > wbuf->size) {
+		size_t new_size = spdk_max(wbuf->size * 2, wbuf->len + size);
+		char *buf;
+
+		buf = realloc(wbuf->buf, new_size);
+		if (spdk_unlikely(!buf)) {
+			return -ENOMEM;
+		}
+
+		wbuf->buf = buf;
+		wbuf->size = new_size;
+	}
+
+	memcpy(wbuf->buf + wbuf->len, data, size);
+	wbuf->len += size;
+
+	return 0;
 }
 
-static void
-jsonrpc_client_free_req(struct sto_jsonrpc_client_req *req)
+static int
+jsonrpc_client_build_request(struct jsonrpc_client_wbuf *wbuf, const char *method_name, int id,
+			     void *params, sto_client_dump_params_t dump_params)
 {
-	free(req);
+	struct spdk_json_write_ctx *w;
+
+	w = spdk_json_write_begin(jsonrpc_client_wbuf_write_cb, wbuf, 0);
+	if (spdk_unlikely(!w)) {
+		return -ENOMEM;
+	}
+
+	spdk_json_write_object_begin(w);
+
+	spdk_json_write_named_string(w, "jsonrpc", "2.0");
+	spdk_json_write_named_int32(w, "id", id);
+	spdk_json_write_named_string(w, "method", method_name);
+
+	if (dump_params) {
+		spdk_json_write_name(w, "params");
+		dump_params(params, w);
+	}
+
+	spdk_json_write_object_end(w);
+
+	return spdk_json_write_end(w) ? -ENOMEM : 0;
 }
 
-static void
-jsonrpc_client_send_req(struct sto_jsonrpc_client *client,
-			struct sto_jsonrpc_client_req *req)
+/* Least loaded live connection, so one slow request does not hold up the rest */
+static struct sto_jsonrpc_client_conn *
+jsonrpc_client_pick_conn(struct sto_jsonrpc_client *client)
 {
-	struct sto_jsonrpc_client_entry *entry;
+	struct sto_jsonrpc_client_conn *best = NULL;
+	uint32_t i;
 
-	entry = TAILQ_FIRST(&client->free_entries);
-	if (!entry) {
-		TAILQ_INSERT_TAIL(&client->req_busy_list, req, list);
-		return;
-	}
+	for (i = 0; i < client->nr_conns; i++) {
+		struct sto_jsonrpc_client_conn *conn = &client->conns[i];
 
-	__jsonrpc_client_send_req(client, entry, req);
+		if (conn->fd == -1) {
+			continue;
+		}
+
+		if (!best || conn->nr_inflight < best->nr_inflight) {
+			best = conn;
+		}
+
+		if (!best->nr_inflight) {
+			break;
+		}
+	}
 
-	TAILQ_REMOVE(&client->free_entries, entry, list);
-	TAILQ_INSERT_TAIL(&client->entries, entry, list);
+	return best;
 }
 
 int
@@ -281,25 +584,173 @@ sto_client_send(const char *method_name, void *params,
 		sto_client_dump_params_t dump_params,
 		struct sto_client_args *args)
 {
-	struct sto_jsonrpc_client *client;
+	struct sto_jsonrpc_client *client = sto_client_thread_map_get(&g_sto_jsonrpc_clients);
+	struct jsonrpc_client_wbuf wbuf = {};
+	struct sto_jsonrpc_client_conn *conn;
 	struct sto_jsonrpc_client_req *req;
+	struct sto_jsonrpc_client_tx *tx;
+	int rc;
 
 	if (spdk_unlikely(!method_name)) {
 		SPDK_ERRLOG("Method name is not set\n");
 		return -EINVAL;
 	}
 
-	client = g_sto_jsonrpc_client;
+	if (spdk_unlikely(!client)) {
+		SPDK_ERRLOG("STO client is not connected on thread %s\n",
+			    spdk_thread_get_name(spdk_get_thread()));
+		return -ENOTCONN;
+	}
+
+	conn = jsonrpc_client_pick_conn(client);
+	if (spdk_unlikely(!conn)) {
+		SPDK_ERRLOG("No live STO client connection for `%s` RPC req\n", method_name);
+		return -ENOTCONN;
+	}
 
-	req = jsonrpc_client_create_req(client, method_name, params, dump_params);
+	req = calloc(1, sizeof(*req));
 	if (spdk_unlikely(!req)) {
-		SPDK_ERRLOG("Failed to alloc `%s` RPC req\n", method_name);
+		SPDK_ERRLOG("Cann't allocate memory for a RPC req\n");
 		return -ENOMEM;
 	}
 
-	jsonrpc_client_req_init_cb(req, args->response_handler, args->priv);
+	tx = calloc(1, sizeof(*tx));
+	if (spdk_unlikely(!tx)) {
+		SPDK_ERRLOG("Cann't allocate memory for a RPC req buffer\n");
+		rc = -ENOMEM;
+		goto free_req;
+	}
+
+	req->id = client->req_id = jsonrpc_client_next_id(client);
+	req->conn = conn;
+	req->response_handler = args->response_handler;
+	req->priv = args->priv;
+
+	rc = jsonrpc_client_build_request(&wbuf, method_name, req->id, params, dump_params);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to build `%s` RPC req, rc=%d\n", method_name, rc);
+		goto free_tx;
+	}
+
+	tx->buf = wbuf.buf;
+	tx->len = wbuf.len;
+
+	sto_hash_elem_init(&req->he, &req->id, sizeof(req->id));
+	sto_hash_add(&client->req_map, &req->he);
+	TAILQ_INSERT_TAIL(&conn->reqs, req, list);
 
-	jsonrpc_client_send_req(client, req);
+	conn->nr_inflight++;
+	client->nr_inflight++;
+
+	TAILQ_INSERT_TAIL(&conn->tx_list, tx, list);
+
+	/*
+	 * Errors are left to the poller: epoll reports the broken socket and
+	 * the request fails through its handler with the rest of the connection.
+	 */
+	if (!jsonrpc_client_conn_flush(conn)) {
+		jsonrpc_client_conn_update_events(conn);
+	}
+
+	return 0;
+
+free_tx:
+	free(wbuf.buf);
+	free(tx);
+
+free_req:
+	jsonrpc_client_free_req(req);
+
+	return rc;
+}
+
+static int
+jsonrpc_client_sockaddr(const char *addr, int addr_family,
+			struct sockaddr_storage *ss, socklen_t *len)
+{
+	struct addrinfo hints = {}, *res;
+	char *buf, *host, *port;
+	int rc;
+
+	if (addr_family == AF_UNIX) {
+		struct sockaddr_un *sun = (struct sockaddr_un *) ss;
+
+		sun->sun_family = AF_UNIX;
+
+		if (snprintf(sun->sun_path, sizeof(sun->sun_path), "%s", addr) >=
+		    (int) sizeof(sun->sun_path)) {
+			SPDK_ERRLOG("RPC address %s is too long\n", addr);
+			return -EINVAL;
+		}
+
+		*len = sizeof(*sun);
+
+		return 0;
+	}
+
+	/* host:port, the host may be a bracketed IPv6 address */
+	buf = strdup(addr);
+	if (spdk_unlikely(!buf)) {
+		return -ENOMEM;
+	}
+
+	rc = spdk_parse_ip_addr(buf, &host, &port);
+	if (rc || !port) {
+		SPDK_ERRLOG("Invalid RPC address %s\n", addr);
+		rc = -EINVAL;
+		goto out;
+	}
+
+	hints.ai_family = addr_family;
+	hints.ai_socktype = SOCK_STREAM;
+
+	rc = getaddrinfo(host, port, &hints, &res);
+	if (rc) {
+		SPDK_ERRLOG("Unable to look up RPC address %s: %s\n", addr, gai_strerror(rc));
+		rc = -EINVAL;
+		goto out;
+	}
+
+	memcpy(ss, res->ai_addr, res->ai_addrlen);
+	*len = res->ai_addrlen;
+
+	freeaddrinfo(res);
+
+out:
+	free(buf);
+
+	return rc;
+}
+
+static int
+jsonrpc_client_conn_open(struct sto_jsonrpc_client_conn *conn,
+			 const struct sockaddr_storage *ss, socklen_t len)
+{
+	struct sto_jsonrpc_client *client = conn->client;
+	struct epoll_event event = {
+		.events = EPOLLIN,
+		.data.ptr = conn,
+	};
+
+	conn->fd = socket(client->addr_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (conn->fd == -1) {
+		SPDK_ERRLOG("Failed to create RPC socket: %s\n", spdk_strerror(errno));
+		return -errno;
+	}
+
+	if (connect(conn->fd, (const struct sockaddr *) ss, len) == -1) {
+		SPDK_ERRLOG("Failed to connect to %s: %s\n", client->addr, spdk_strerror(errno));
+		return -errno;
+	}
+
+	if (fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK) == -1) {
+		return -errno;
+	}
+
+	if (epoll_ctl(client->epfd, EPOLL_CTL_ADD, conn->fd, &event) == -1) {
+		SPDK_ERRLOG("Failed to add RPC socket to epoll: %s\n", spdk_strerror(errno));
+		return -errno;
+	}
 
 	return 0;
 }
@@ -309,22 +760,38 @@ static void jsonrpc_client_close(struct sto_jsonrpc_client *client);
 static int
 jsonrpc_client_connect(struct sto_jsonrpc_client *client)
 {
-	int i;
+	struct sockaddr_storage ss = {};
+	socklen_t len;
+	uint32_t i;
+	int rc;
 
-	TAILQ_INIT(&client->free_entries);
-	TAILQ_INIT(&client->entries);
+	rc = jsonrpc_client_sockaddr(client->addr, client->addr_family, &ss, &len);
+	if (spdk_unlikely(rc)) {
+		return rc;
+	}
 
-	for (i = 0; i < STO_JSONRPC_CLIENT_MAX_CONNS; i++) {
-		struct sto_jsonrpc_client_entry *entry = &client->entries_arr[i];
+	client->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (client->epfd == -1) {
+		SPDK_ERRLOG("epoll_create1() failed: %s\n", spdk_strerror(errno));
+		return -errno;
+	}
+
+	for (i = 0; i < client->nr_conns; i++) {
+		struct sto_jsonrpc_client_conn *conn = &client->conns[i];
+
+		conn->client = client;
+		conn->fd = -1;
 
-		entry->rpc_client = spdk_jsonrpc_client_connect(client->addr, client->addr_family);
-		if (spdk_unlikely(!entry->rpc_client)) {
-			SPDK_ERRLOG("spdk_jsonrpc_client_connect() failed: %s\n", spdk_strerror(errno));
+		TAILQ_INIT(&conn->reqs);
+		TAILQ_INIT(&conn->tx_list);
+	}
+
+	for (i = 0; i < client->nr_conns; i++) {
+		rc = jsonrpc_client_conn_open(&client->conns[i], &ss, len);
+		if (spdk_unlikely(rc)) {
 			jsonrpc_client_close(client);
-			return -errno;
+			return rc;
 		}
-
-		TAILQ_INSERT_TAIL(&client->free_entries, entry, list);
 	}
 
 	return 0;
@@ -333,25 +800,29 @@ jsonrpc_client_connect(struct sto_jsonrpc_client *client)
 static void
 jsonrpc_client_close(struct sto_jsonrpc_client *client)
 {
-	int i;
-
-	for (i = 0; i < STO_JSONRPC_CLIENT_MAX_CONNS; i++) {
-		struct sto_jsonrpc_client_entry *entry = &client->entries_arr[i];
+	uint32_t i;
 
-		if (spdk_unlikely(!entry->rpc_client)) {
-			break;
-		}
+	for (i = 0; i < client->nr_conns; i++) {
+		jsonrpc_client_conn_fail(&client->conns[i], -ECONNRESET);
+	}
 
-		spdk_jsonrpc_client_close(entry->rpc_client);
+	if (client->epfd != -1) {
+		close(client->epfd);
+		client->epfd = -1;
 	}
 }
 
 static struct sto_jsonrpc_client *
-sto_jsonrpc_client_connect(const char *addr, int addr_family)
+sto_jsonrpc_client_connect(const char *addr, int addr_family, uint32_t nr_conns)
 {
 	struct sto_jsonrpc_client *client;
 	int rc;
 
+	if (!nr_conns || nr_conns > STO_CLIENT_MAX_CONNS) {
+		SPDK_ERRLOG("Invalid number of jsonrpc client connections %u\n", nr_conns);
+		return ERR_PTR(-EINVAL);
+	}
+
 	client = calloc(1, sizeof(*client));
 	if (spdk_unlikely(!client)) {
 		SPDK_ERRLOG("Failed to alloc jsonrpc client: addr[%s] family[%d]\n",
@@ -359,22 +830,32 @@ sto_jsonrpc_client_connect(const char *addr, int addr_family)
 		return ERR_PTR(-ENOMEM);
 	}
 
+	client->epfd = -1;
+
 	client->addr = strdup(addr);
 	if (spdk_unlikely(!client->addr)) {
 		SPDK_ERRLOG("Cannot allocate memory for addr %s\n", addr);
-		return ERR_PTR(-ENOMEM);
+		rc = -ENOMEM;
+		goto free_client;
 	}
 
 	client->addr_family = addr_family;
 
-	rc = sto_hash_init(&client->req_map, STO_JSONRPC_CLIENT_MAX_CONNS);
-	if (spdk_unlikely(rc)) {
-		SPDK_ERRLOG("Failed to create cmd map\n");
+	client->conns = calloc(nr_conns, sizeof(*client->conns));
+	if (spdk_unlikely(!client->conns)) {
+		SPDK_ERRLOG("Cannot allocate memory for %u connections\n", nr_conns);
 		rc = -ENOMEM;
 		goto free_addr;
 	}
 
-	TAILQ_INIT(&client->req_busy_list);
+	client->nr_conns = nr_conns;
+
+	rc = sto_hash_init(&client->req_map, STO_JSONRPC_CLIENT_REQ_MAP_SIZE);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to create cmd map\n");
+		rc = -ENOMEM;
+		goto free_conns;
+	}
 
 	rc = jsonrpc_client_connect(client);
 	if (spdk_unlikely(rc)) {
@@ -389,8 +870,8 @@ sto_jsonrpc_client_connect(const char *addr, int addr_family)
 		goto close_client;
 	}
 
-	SPDK_NOTICELOG("STO jsonrpc client connect: addr[%s] family[%d]\n",
-		       client->addr, client->addr_family);
+	SPDK_NOTICELOG("STO jsonrpc client connect: addr[%s] family[%d] conns[%u]\n",
+		       client->addr, client->addr_family, client->nr_conns);
 
 	return client;
 
@@ -400,38 +881,71 @@ close_client:
 free_req_map:
 	sto_hash_destroy(&client->req_map);
 
+free_conns:
+	free(client->conns);
+
 free_addr:
 	free((char *) client->addr);
 
+free_client:
+	free(client);
+
 	return ERR_PTR(rc);
 }
 
 static void
 sto_jsonrpc_client_close(struct sto_jsonrpc_client *client)
 {
+	if (client->in_poll) {
+		client->closing = true;
+		return;
+	}
+
 	spdk_poller_unregister(&client->poller);
 	jsonrpc_client_close(client);
 	sto_hash_destroy(&client->req_map);
+	free(client->conns);
 	free((char *) client->addr);
 	free(client);
 }
 
+static int
+sto_client_thread_add(struct sto_jsonrpc_client *client)
+{
+	int rc;
+
+	rc = sto_client_thread_map_add(&g_sto_jsonrpc_clients, client);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("FAILED: Cann't add STO client for thread %s, rc=%d\n",
+			    spdk_thread_get_name(spdk_get_thread()), rc);
+		sto_jsonrpc_client_close(client);
+	}
+
+	return rc;
+}
+
 int
-sto_client_connect(const char *addr, int addr_family)
+sto_client_connect(const char *addr, int addr_family, uint32_t nr_conns)
 {
 	struct sto_jsonrpc_client *client;
+	int rc;
 
 	if (g_sto_jsonrpc_client) {
 		SPDK_ERRLOG("FAILED: STO client has already been initialized\n");
 		return -EINVAL;
 	}
 
-	client = sto_jsonrpc_client_connect(addr, addr_family);
+	client = sto_jsonrpc_client_connect(addr, addr_family, nr_conns);
 	if (IS_ERR(client)) {
 		SPDK_ERRLOG("Failed to alloc STO jsonrpc client\n");
 		return PTR_ERR(client);
 	}
 
+	rc = sto_client_thread_add(client);
+	if (spdk_unlikely(rc)) {
+		return rc;
+	}
+
 	g_sto_jsonrpc_client = client;
 
 	return 0;
@@ -447,5 +961,41 @@ sto_client_close(void)
 		return;
 	}
 
+	g_sto_jsonrpc_client = NULL;
+
+	sto_client_thread_map_del(&g_sto_jsonrpc_clients);
 	sto_jsonrpc_client_close(client);
 }
+
+int
+sto_client_thread_connect(void)
+{
+	struct sto_jsonrpc_client *main_client = g_sto_jsonrpc_client;
+	struct sto_jsonrpc_client *client;
+
+	if (!main_client) {
+		SPDK_ERRLOG("FAILED: STO client has not been initialized yet\n");
+		return -ENOTCONN;
+	}
+
+	client = sto_jsonrpc_client_connect(main_client->addr, main_client->addr_family,
+					    main_client->nr_conns);
+	if (IS_ERR(client)) {
+		SPDK_ERRLOG("Failed to alloc STO jsonrpc client for thread %s\n",
+			    spdk_thread_get_name(spdk_get_thread()));
+		return PTR_ERR(client);
+	}
+
+	return sto_client_thread_add(client);
+}
+
+void
+sto_client_thread_close(void)
+{
+	struct sto_jsonrpc_client *client;
+
+	client = sto_client_thread_map_del(&g_sto_jsonrpc_clients);
+	if (client) {
+		sto_jsonrpc_client_close(client);
+	}
+}
@@ -0,0 +1,618 @@
+#include "sto_client.h"
+
+#include <spdk/stdinc.h>
+#include <spdk/thread.h>
+#include <spdk/log.h>
+#include <spdk/likely.h>
+#include <spdk/string.h>
+#include <spdk/json.h>
+#include <spdk/queue.h>
+#include <spdk/util.h>
+
+#include <sto_bin.h>
+
+#include "sto_hash.h"
+#include "sto_client_thread.h"
+
+#define STO_CLIENT_BIN_POLL_PERIOD	100
+#define STO_CLIENT_BIN_REQ_MAP_SIZE	64
+#define STO_CLIENT_BIN_RX_MIN_SIZE	4096
+#define STO_CLIENT_BIN_HELLO_TIMEOUT_S	1
+
+struct sto_client_bin_req {
+	uint32_t id;
+
+	struct sto_hash_elem he;
+	TAILQ_ENTRY(sto_client_bin_req) list;
+
+	void *priv;
+	sto_client_bin_response_handler_t response_handler;
+};
+
+struct sto_client_bin_tx {
+	char *buf;
+	size_t len;
+	size_t off;
+
+	TAILQ_ENTRY(sto_client_bin_tx) list;
+};
+
+struct sto_client_bin {
+	int fd;
+
+	uint32_t req_id;
+	struct sto_hash req_map;
+	TAILQ_HEAD(, sto_client_bin_req) reqs;
+
+	TAILQ_HEAD(, sto_client_bin_tx) tx_list;
+
+	char *rx_buf;
+	size_t rx_len;
+	size_t rx_size;
+
+	struct spdk_poller *poller;
+};
+
+/* Set once sto_client_bin_connect() negotiated, the other threads connect there too */
+static char g_sto_client_bin_addr[sizeof(((struct sockaddr_un *) NULL)->sun_path)];
+
+static struct sto_client_thread_map g_sto_client_bins = STO_CLIENT_THREAD_MAP_INITIALIZER;
+
+bool
+sto_client_bin_enabled(void)
+{
+	return sto_client_thread_map_get(&g_sto_client_bins) != NULL;
+}
+
+struct client_bin_wbuf {
+	char *buf;
+	size_t len;
+	size_t size;
+};
+
+static int
+client_bin_wbuf_write_cb(void *cb_ctx, const void *data, size_t size)
+{
+	struct client_bin_wbuf *wbuf = cb_ctx;
+
+	if (wbuf->len + size > wbuf->size) {
+		size_t new_size = spdk_max(wbuf->size * 2, wbuf->len + size);
+		char *buf;
+
+		buf = realloc(wbuf->buf, new_size);
+		if (spdk_unlikely(!buf)) {
+			return -ENOMEM;
+		}
+
+		wbuf->buf = buf;
+		wbuf->size = new_size;
+	}
+
+	memcpy(wbuf->buf + wbuf->len, data, size);
+	wbuf->len += size;
+
+	return 0;
+}
+
+/* The frame header is reserved up front so params and payload are appended in place */
+static int
+client_bin_build_frame(struct client_bin_wbuf *wbuf, uint16_t opcode, uint32_t id,
+		       void *params, sto_client_dump_params_t dump_params,
+		       const void *payload, uint32_t payload_len)
+{
+	struct sto_bin_hdr hdr = {};
+	struct spdk_json_write_ctx *w;
+	uint32_t params_len;
+	int rc;
+
+	rc = client_bin_wbuf_write_cb(wbuf, &hdr, sizeof(hdr));
+	if (spdk_unlikely(rc)) {
+		return rc;
+	}
+
+	if (dump_params) {
+		w = spdk_json_write_begin(client_bin_wbuf_write_cb, wbuf, 0);
+		if (spdk_unlikely(!w)) {
+			return -ENOMEM;
+		}
+
+		dump_params(params, w);
+
+		if (spdk_unlikely(spdk_json_write_end(w))) {
+			return -ENOMEM;
+		}
+	}
+
+	params_len = wbuf->len - sizeof(hdr);
+
+	if (payload_len) {
+		rc = client_bin_wbuf_write_cb(wbuf, payload, payload_len);
+		if (spdk_unlikely(rc)) {
+			return rc;
+		}
+	}
+
+	sto_bin_hdr_init(&hdr, opcode, id, 0, params_len, payload_len);
+	memcpy(wbuf->buf, &hdr, sizeof(hdr));
+
+	return 0;
+}
+
+static void
+client_bin_fail_all(struct sto_client_bin *client, int rc)
+{
+	struct sto_client_bin_req *req, *tmp;
+
+	TAILQ_FOREACH_SAFE(req, &client->reqs, list, tmp) {
+		TAILQ_REMOVE(&client->reqs, req, list);
+		sto_hash_elem_del(&req->he);
+
+		req->response_handler(req->priv, NULL, rc);
+		free(req);
+	}
+}
+
+static void
+client_bin_free_tx(struct sto_client_bin *client)
+{
+	struct sto_client_bin_tx *tx, *tmp;
+
+	TAILQ_FOREACH_SAFE(tx, &client->tx_list, list, tmp) {
+		TAILQ_REMOVE(&client->tx_list, tx, list);
+		free(tx->buf);
+		free(tx);
+	}
+}
+
+static void
+client_bin_destroy(struct sto_client_bin *client)
+{
+	spdk_poller_unregister(&client->poller);
+
+	if (client->fd != -1) {
+		close(client->fd);
+	}
+
+	client_bin_fail_all(client, -ECONNRESET);
+	client_bin_free_tx(client);
+
+	sto_hash_destroy(&client->req_map);
+
+	free(client->rx_buf);
+	free(client);
+}
+
+/*
+ * On a broken connection every in-flight request fails and later ones
+ * go through JSON-RPC again, the server stays reachable over its socket
+ */
+static void
+client_bin_disconnect(struct sto_client_bin *client, int rc)
+{
+	SPDK_ERRLOG("Binary framing connection failed, fall back to JSON-RPC, rc=%d\n", rc);
+
+	sto_client_thread_map_del(&g_sto_client_bins);
+	client_bin_destroy(client);
+}
+
+static int
+client_bin_flush(struct sto_client_bin *client)
+{
+	struct sto_client_bin_tx *tx;
+
+	while ((tx = TAILQ_FIRST(&client->tx_list)) != NULL) {
+		ssize_t ret;
+
+		ret = send(client->fd, tx->buf + tx->off, tx->len - tx->off, MSG_NOSIGNAL);
+		if (ret == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+
+			return -errno;
+		}
+
+		tx->off += ret;
+		if (tx->off < tx->len) {
+			continue;
+		}
+
+		TAILQ_REMOVE(&client->tx_list, tx, list);
+		free(tx->buf);
+		free(tx);
+	}
+
+	return 0;
+}
+
+static void
+client_bin_response(struct sto_client_bin *client, const struct sto_bin_hdr *hdr, char *data)
+{
+	struct sto_client_bin_response resp = {
+		.status = hdr->status,
+		.payload = data + hdr->params_len,
+		.payload_len = hdr->payload_len,
+	};
+	struct sto_client_bin_req *req;
+	struct sto_hash_elem *he;
+
+	he = sto_hash_lookup(&client->req_map, &hdr->id, sizeof(hdr->id));
+	if (spdk_unlikely(!he)) {
+		SPDK_ERRLOG("CRITICAL: Got binary response for unknown req ID %u\n", hdr->id);
+		return;
+	}
+
+	req = SPDK_CONTAINEROF(he, struct sto_client_bin_req, he);
+
+	sto_hash_elem_del(&req->he);
+	TAILQ_REMOVE(&client->reqs, req, list);
+
+	req->response_handler(req->priv, &resp, 0);
+
+	free(req);
+}
+
+static int
+client_bin_process(struct sto_client_bin *client)
+{
+	size_t off = 0;
+
+	while (client->rx_len - off >= sizeof(struct sto_bin_hdr)) {
+		struct sto_bin_hdr hdr;
+		size_t frame_len;
+
+		memcpy(&hdr, client->rx_buf + off, sizeof(hdr));
+
+		if (spdk_unlikely(!sto_bin_hdr_valid(&hdr))) {
+			SPDK_ERRLOG("Got invalid binary frame header\n");
+			return -EPROTO;
+		}
+
+		frame_len = sizeof(hdr) + hdr.params_len + hdr.payload_len;
+		if (client->rx_len - off < frame_len) {
+			break;
+		}
+
+		client_bin_response(client, &hdr, client->rx_buf + off + sizeof(hdr));
+
+		off += frame_len;
+	}
+
+	if (off) {
+		memmove(client->rx_buf, client->rx_buf + off, client->rx_len - off);
+		client->rx_len -= off;
+	}
+
+	return 0;
+}
+
+static int
+client_bin_rx_reserve(struct sto_client_bin *client)
+{
+	size_t need = STO_CLIENT_BIN_RX_MIN_SIZE;
+	char *rx_buf;
+
+	if (client->rx_len >= sizeof(struct sto_bin_hdr)) {
+		struct sto_bin_hdr hdr;
+
+		memcpy(&hdr, client->rx_buf, sizeof(hdr));
+		need = spdk_max(need, sizeof(hdr) + hdr.params_len + hdr.payload_len);
+	}
+
+	if (client->rx_size - client->rx_len >= STO_CLIENT_BIN_RX_MIN_SIZE / 2 &&
+	    client->rx_size >= need) {
+		return 0;
+	}
+
+	need = spdk_max(need, client->rx_size * 2);
+
+	rx_buf = realloc(client->rx_buf, need);
+	if (spdk_unlikely(!rx_buf)) {
+		return -ENOMEM;
+	}
+
+	client->rx_buf = rx_buf;
+	client->rx_size = need;
+
+	return 0;
+}
+
+static int
+client_bin_recv(struct sto_client_bin *client)
+{
+	int rc;
+
+	for (;;) {
+		ssize_t ret;
+
+		rc = client_bin_rx_reserve(client);
+		if (spdk_unlikely(rc)) {
+			return rc;
+		}
+
+		ret = read(client->fd, client->rx_buf + client->rx_len,
+			   client->rx_size - client->rx_len);
+		if (ret == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+
+			return -errno;
+		}
+
+		if (!ret) {
+			return -ECONNRESET;
+		}
+
+		client->rx_len += ret;
+
+		rc = client_bin_process(client);
+		if (spdk_unlikely(rc)) {
+			return rc;
+		}
+	}
+}
+
+static int
+client_bin_poll(void *ctx)
+{
+	struct sto_client_bin *client = ctx;
+	int rc;
+
+	if (TAILQ_EMPTY(&client->reqs)) {
+		return SPDK_POLLER_IDLE;
+	}
+
+	rc = client_bin_flush(client);
+	if (spdk_likely(!rc)) {
+		rc = client_bin_recv(client);
+	}
+
+	if (spdk_unlikely(rc)) {
+		client_bin_disconnect(client, rc);
+	}
+
+	return SPDK_POLLER_BUSY;
+}
+
+int
+sto_client_send_bin(uint16_t opcode, void *params, sto_client_dump_params_t dump_params,
+		    const void *payload, uint32_t payload_len,
+		    struct sto_client_bin_args *args)
+{
+	struct sto_client_bin *client = sto_client_thread_map_get(&g_sto_client_bins);
+	struct client_bin_wbuf wbuf = {};
+	struct sto_client_bin_req *req;
+	struct sto_client_bin_tx *tx;
+	int rc;
+
+	if (spdk_unlikely(!client)) {
+		return -ENOTCONN;
+	}
+
+	req = calloc(1, sizeof(*req));
+	if (spdk_unlikely(!req)) {
+		SPDK_ERRLOG("Cann't allocate memory for a binary req\n");
+		return -ENOMEM;
+	}
+
+	tx = calloc(1, sizeof(*tx));
+	if (spdk_unlikely(!tx)) {
+		SPDK_ERRLOG("Cann't allocate memory for a binary frame\n");
+		rc = -ENOMEM;
+		goto free_req;
+	}
+
+	req->id = ++client->req_id;
+	req->priv = args->priv;
+	req->response_handler = args->response_handler;
+
+	rc = client_bin_build_frame(&wbuf, opcode, req->id, params, dump_params,
+				    payload, payload_len);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to build binary frame, rc=%d\n", rc);
+		goto free_tx;
+	}
+
+	tx->buf = wbuf.buf;
+	tx->len = wbuf.len;
+
+	sto_hash_elem_init(&req->he, &req->id, sizeof(req->id));
+	sto_hash_add(&client->req_map, &req->he);
+	TAILQ_INSERT_TAIL(&client->reqs, req, list);
+
+	TAILQ_INSERT_TAIL(&client->tx_list, tx, list);
+
+	/*
+	 * Most frames fit the socket buffer, the poller only finishes the rest.
+	 * A send error is left to the poller as well, it fails the request
+	 * through its handler together with the others in flight.
+	 */
+	client_bin_flush(client);
+
+	return 0;
+
+free_tx:
+	free(wbuf.buf);
+	free(tx);
+
+free_req:
+	free(req);
+
+	return rc;
+}
+
+static int
+client_bin_hello(int fd)
+{
+	char table[STO_BIN_OPCODE_TABLE_MAX_LEN];
+	struct timeval tv = {
+		.tv_sec = STO_CLIENT_BIN_HELLO_TIMEOUT_S,
+	};
+	struct sto_bin_hdr hdr;
+	char frame[sizeof(hdr) + sizeof(table)];
+	ssize_t ret;
+	int len;
+
+	len = sto_bin_opcode_table_str(table, sizeof(table));
+	if (spdk_unlikely(len < 0)) {
+		return -EINVAL;
+	}
+
+	sto_bin_hdr_init(&hdr, STO_BIN_OP_HELLO, 0, 0, 0, len);
+
+	memcpy(frame, &hdr, sizeof(hdr));
+	memcpy(frame + sizeof(hdr), table, len);
+
+	if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == -1 ||
+	    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == -1) {
+		return -errno;
+	}
+
+	ret = send(fd, frame, sizeof(hdr) + len, MSG_NOSIGNAL);
+	if (ret != (ssize_t) (sizeof(hdr) + len)) {
+		return ret == -1 ? -errno : -EIO;
+	}
+
+	ret = recv(fd, &hdr, sizeof(hdr), MSG_WAITALL);
+	if (ret != sizeof(hdr)) {
+		return ret == -1 ? -errno : -EIO;
+	}
+
+	if (!sto_bin_hdr_valid(&hdr) || hdr.opcode != STO_BIN_OP_HELLO) {
+		return -EPROTO;
+	}
+
+	return hdr.status;
+}
+
+static int
+client_bin_connect(const char *addr)
+{
+	struct sto_client_bin *client;
+	struct sockaddr_un sun = {
+		.sun_family = AF_UNIX,
+	};
+	int rc;
+
+	if (sto_client_bin_enabled()) {
+		SPDK_ERRLOG("FAILED: STO binary client has already been initialized\n");
+		return -EINVAL;
+	}
+
+	if (snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", addr) >= (int) sizeof(sun.sun_path)) {
+		SPDK_ERRLOG("Binary framing address %s is too long\n", addr);
+		return -EINVAL;
+	}
+
+	client = calloc(1, sizeof(*client));
+	if (spdk_unlikely(!client)) {
+		SPDK_ERRLOG("Failed to alloc binary client\n");
+		return -ENOMEM;
+	}
+
+	TAILQ_INIT(&client->reqs);
+	TAILQ_INIT(&client->tx_list);
+
+	rc = sto_hash_init(&client->req_map, STO_CLIENT_BIN_REQ_MAP_SIZE);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to create binary req map\n");
+		free(client);
+		return rc;
+	}
+
+	client->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (client->fd == -1) {
+		rc = -errno;
+		SPDK_ERRLOG("Failed to create binary socket: %s\n", spdk_strerror(errno));
+		goto destroy;
+	}
+
+	if (connect(client->fd, (struct sockaddr *) &sun, sizeof(sun)) == -1) {
+		rc = -errno;
+		SPDK_ERRLOG("Failed to connect to %s: %s\n", addr, spdk_strerror(errno));
+		goto destroy;
+	}
+
+	/* Done blocking so that the negotiation result is known before any request */
+	rc = client_bin_hello(client->fd);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Server refused binary framing, rc=%d\n", rc);
+		goto destroy;
+	}
+
+	if (fcntl(client->fd, F_SETFL, fcntl(client->fd, F_GETFL) | O_NONBLOCK) == -1) {
+		rc = -errno;
+		goto destroy;
+	}
+
+	client->poller = SPDK_POLLER_REGISTER(client_bin_poll, client, STO_CLIENT_BIN_POLL_PERIOD);
+	if (spdk_unlikely(!client->poller)) {
+		SPDK_ERRLOG("Cann't register the STO binary client poller\n");
+		rc = -ENOMEM;
+		goto destroy;
+	}
+
+	rc = sto_client_thread_map_add(&g_sto_client_bins, client);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Cann't add STO binary client for thread %s, rc=%d\n",
+			    spdk_thread_get_name(spdk_get_thread()), rc);
+		goto destroy;
+	}
+
+	SPDK_NOTICELOG("STO binary client connect: addr[%s] thread[%s]\n",
+		       addr, spdk_thread_get_name(spdk_get_thread()));
+
+	return 0;
+
+destroy:
+	client_bin_destroy(client);
+
+	return rc;
+}
+
+int
+sto_client_bin_connect(const char *addr)
+{
+	int rc;
+
+	rc = client_bin_connect(addr);
+	if (spdk_unlikely(rc)) {
+		return rc;
+	}
+
+	snprintf(g_sto_client_bin_addr, sizeof(g_sto_client_bin_addr), "%s", addr);
+
+	return 0;
+}
+
+void
+sto_client_bin_close(void)
+{
+	struct sto_client_bin *client;
+
+	client = sto_client_thread_map_del(&g_sto_client_bins);
+	if (!client) {
+		return;
+	}
+
+	client_bin_destroy(client);
+}
+
+int
+sto_client_bin_thread_connect(void)
+{
+	if (!g_sto_client_bin_addr[0]) {
+		return 0;
+	}
+
+	return client_bin_connect(g_sto_client_bin_addr);
+}
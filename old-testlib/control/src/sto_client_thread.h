@@ -0,0 +1,112 @@
+#ifndef _STO_CLIENT_THREAD_H_
+#define _STO_CLIENT_THREAD_H_
+
+#include <spdk/stdinc.h>
+#include <spdk/thread.h>
+
+/* The app thread and every core shard */
+#define STO_CLIENT_MAX_THREADS	128
+
+/*
+ * A client and its poller belong to the spdk_thread it was connected on,
+ * so every thread sending requests has a client of its own. The map is
+ * only changed when a thread connects or closes, requests look up the
+ * client of the thread they are sent from.
+ */
+struct sto_client_thread_map {
+	pthread_mutex_t lock;
+
+	struct {
+		struct spdk_thread *thread;
+		void *client;
+	} slots[STO_CLIENT_MAX_THREADS];
+};
+
+#define STO_CLIENT_THREAD_MAP_INITIALIZER		\
+	{						\
+		.lock = PTHREAD_MUTEX_INITIALIZER,	\
+	}
+
+static inline int
+sto_client_thread_map_find(struct sto_client_thread_map *map, struct spdk_thread *thread)
+{
+	int i;
+
+	for (i = 0; i < STO_CLIENT_MAX_THREADS; i++) {
+		if (map->slots[i].thread == thread) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static inline void *
+sto_client_thread_map_get(struct sto_client_thread_map *map)
+{
+	void *client = NULL;
+	int i;
+
+	pthread_mutex_lock(&map->lock);
+
+	i = sto_client_thread_map_find(map, spdk_get_thread());
+	if (i >= 0) {
+		client = map->slots[i].client;
+	}
+
+	pthread_mutex_unlock(&map->lock);
+
+	return client;
+}
+
+static inline int
+sto_client_thread_map_add(struct sto_client_thread_map *map, void *client)
+{
+	struct spdk_thread *thread = spdk_get_thread();
+	int i, rc = 0;
+
+	pthread_mutex_lock(&map->lock);
+
+	if (sto_client_thread_map_find(map, thread) >= 0) {
+		rc = -EEXIST;
+		goto out;
+	}
+
+	i = sto_client_thread_map_find(map, NULL);
+	if (i < 0) {
+		rc = -ENOSPC;
+		goto out;
+	}
+
+	map->slots[i].thread = thread;
+	map->slots[i].client = client;
+
+out:
+	pthread_mutex_unlock(&map->lock);
+
+	return rc;
+}
+
+/* Returns the client the current thread had */
+static inline void *
+sto_client_thread_map_del(struct sto_client_thread_map *map)
+{
+	void *client = NULL;
+	int i;
+
+	pthread_mutex_lock(&map->lock);
+
+	i = sto_client_thread_map_find(map, spdk_get_thread());
+	if (i >= 0) {
+		client = map->slots[i].client;
+
+		map->slots[i].thread = NULL;
+		map->slots[i].client = NULL;
+	}
+
+	pthread_mutex_unlock(&map->lock);
+
+	return client;
+}
+
+#endif /* _STO_CLIENT_THREAD_H_ */
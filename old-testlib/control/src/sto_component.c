@@ -7,10 +7,14 @@
 
 #include "sto_json.h"
 #include "sto_err.h"
+#include "sto_hash.h"
 
 TAILQ_HEAD(sto_component_list, sto_core_component);
 static struct sto_component_list g_components = TAILQ_HEAD_INITIALIZER(g_components);
 
+/* Built once all the components have registered, see sto_core_component_init() */
+static struct sto_phash g_component_map;
+
 static struct sto_core_component *g_next_component;
 
 static bool g_components_initialized = false;
@@ -30,16 +34,12 @@ sto_core_add_component(struct sto_core_component *component)
 }
 
 static struct sto_core_component *
-_core_component_find(struct sto_component_list *list, const char *name, bool skip_internal)
+_core_component_find(struct sto_component_list *list, const char *name, uint32_t len)
 {
 	struct sto_core_component *component;
 
 	TAILQ_FOREACH(component, list, list) {
-		if (skip_internal && component->internal) {
-			continue;
-		}
-
-		if (!strcmp(name, component->name)) {
+		if (strlen(component->name) == len && !memcmp(name, component->name, len)) {
 			return component;
 		}
 	}
@@ -48,9 +48,44 @@ _core_component_find(struct sto_component_list *list, const char *name, bool ski
 }
 
 struct sto_core_component *
-sto_core_component_find(const char *name, bool skip_internal)
+sto_core_component_lookup(const char *name, uint32_t len, bool skip_internal)
+{
+	struct sto_core_component *component;
+
+	if (spdk_likely(sto_phash_built(&g_component_map))) {
+		component = (struct sto_core_component *) sto_phash_lookup(&g_component_map, name, len);
+	} else {
+		component = _core_component_find(&g_components, name, len);
+	}
+
+	if (!component || (skip_internal && component->internal)) {
+		return NULL;
+	}
+
+	return component;
+}
+
+static const void *
+core_component_map_next(const void *obj, void *ctx)
 {
-	return _core_component_find(&g_components, name, skip_internal);
+	const struct sto_core_component *component = obj;
+
+	return !component ? TAILQ_FIRST(&g_components) : TAILQ_NEXT(component, list);
+}
+
+static const char *
+core_component_map_key(const void *obj)
+{
+	const struct sto_core_component *component = obj;
+
+	return component->name;
+}
+
+static int
+core_component_map_build(void)
+{
+	return sto_phash_build_from(&g_component_map, core_component_map_next,
+				    core_component_map_key, NULL);
 }
 
 static inline struct sto_core_component *
@@ -98,9 +133,18 @@ sto_core_component_init_next(int rc)
 void
 sto_core_component_init(sto_core_component_init_fn cb_fn, void *cb_arg)
 {
+	int rc;
+
 	g_component_start_fn = cb_fn;
 	g_component_start_arg = cb_arg;
 
+	rc = core_component_map_build();
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to build core component map, rc=%d\n", rc);
+		cb_fn(cb_arg, rc);
+		return;
+	}
+
 	sto_core_component_init_next(0);
 }
 
@@ -131,6 +175,8 @@ sto_core_component_fini_next(void)
 		g_next_component = TAILQ_PREV(g_next_component, sto_component_list, list);
 	}
 
+	sto_phash_destroy(&g_component_map);
+
 	g_component_stop_fn(g_component_stop_arg);
 
 	return;
@@ -148,46 +194,36 @@ sto_core_component_fini(sto_core_component_fini_fn cb_fn, void *cb_arg)
 static const struct sto_core_component *
 core_component_parse(const struct sto_json_iter *iter, bool internal_user)
 {
-	struct sto_core_component *component;
-	char *component_name = NULL;
+	const struct spdk_json_val *name;
 	int rc;
 
-	rc = sto_json_iter_decode_name(iter, &component_name);
+	rc = sto_json_iter_name_val(iter, &name);
 	if (spdk_unlikely(rc)) {
 		SPDK_ERRLOG("Failed to decode component name, rc=%d\n", rc);
 		return ERR_PTR(rc);
 	}
 
-	component = sto_core_component_find(component_name, !internal_user);
-
-	free(component_name);
-
-	return component;
+	return sto_core_component_lookup(name->start, name->len, !internal_user);
 }
 
-const struct sto_shash *
+const struct sto_phash *
 sto_core_component_decode(const struct sto_json_iter *iter, bool internal_user)
 {
-	const struct sto_shash *ops_map;
 	const struct sto_core_component *component;
-	char *object_name = NULL;
+	const struct spdk_json_val *object_name;
 	int rc = 0;
 
 	component = core_component_parse(iter, internal_user);
-	if (spdk_unlikely(!component)) {
+	if (IS_ERR_OR_NULL(component)) {
 		SPDK_ERRLOG("Failed to find component\n");
 		return ERR_PTR(-EINVAL);
 	}
 
-	rc = sto_json_iter_decode_str(iter, component->name, &object_name);
+	rc = sto_json_iter_str_val(iter, component->name, &object_name);
 	if (rc) {
 		SPDK_ERRLOG("Failed to decode subsystem for rc=%d\n", rc);
 		return ERR_PTR(rc);
 	}
 
-	ops_map = component->get_ops_map(object_name);
-
-	free(object_name);
-
-	return ops_map;
+	return component->get_ops_map(object_name->start, object_name->len);
 }
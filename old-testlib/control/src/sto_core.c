@@ -2,6 +2,7 @@
 
 #include <spdk/stdinc.h>
 #include <spdk/thread.h>
+#include <spdk/env.h>
 #include <spdk/json.h>
 #include <spdk/log.h>
 #include <spdk/likely.h>
@@ -13,16 +14,79 @@
 #include "sto_req.h"
 #include "sto_err.h"
 #include "sto_lib.h"
+#include "sto_pool.h"
+#include "sto_pipeline.h"
+#include "sto_client.h"
 
 struct spdk_json_write_ctx;
-struct sto_shash;
-
-#define STO_CORE_REQ_POLL_PERIOD	1000 /* 1ms */
+struct sto_phash;
+
+TAILQ_HEAD(sto_core_req_list, sto_core_req);
+
+/*
+ * Requests are spread over shards, each one an spdk_thread with its own
+ * queue, pipeline engine for sto_req and server client. A request goes
+ * to the shard picked by the SCST object it names: requests with the
+ * same key execute one after another in arrival order, the others run
+ * concurrently on all shards. SCST state itself stays on the thread of
+ * the SCST engine, the shards only reach it through that engine.
+ *
+ * A shard queue is driven by a thread message sent when it becomes
+ * non-empty, so an idle shard costs nothing and a queued request runs
+ * on the next reactor iteration. With busy_poll a poller spins on the
+ * queue instead.
+ */
+struct sto_core_shard {
+	uint32_t id;
+
+	struct spdk_thread *thread;
+	struct spdk_poller *poller;
+	bool kicked;
+
+	struct sto_pipeline_engine *engine;
+
+	struct sto_core_req_list req_list;
+
+	/* Keyed requests executing and waiting for their key to be released */
+	struct sto_core_req_list active_list;
+	struct sto_core_req_list wait_list;
+
+	/* Result of the last start or stop on the shard thread */
+	int rc;
+};
 
-static struct spdk_poller *g_sto_core_req_poller;
+typedef void (*sto_core_shards_done_t)(int rc);
+
+static struct sto_core_shard *g_sto_core_shards;
+static uint32_t g_sto_core_nr_shards;
+static uint32_t g_sto_core_next_shard;
+static bool g_sto_core_busy_poll;
+
+/* The thread sto_core_init() runs on, shards report back to it */
+static struct spdk_thread *g_sto_core_thread;
+static sto_core_shards_done_t g_sto_core_shards_done;
+static uint32_t g_sto_core_shards_pending;
+static int g_sto_core_shards_rc;
+
+static sto_core_init_fn g_sto_core_init_fn;
+static void *g_sto_core_init_arg;
+static int g_sto_core_init_rc;
+
+static sto_core_fini_fn g_sto_core_fini_fn;
+static void *g_sto_core_fini_arg;
+
+/* Params naming the object a request works on, the most specific first */
+static const char *const g_sto_core_key_names[] = {
+	"device",
+	"target",
+	"group",
+	"dgrp",
+	"tgrp",
+};
 
-static TAILQ_HEAD(sto_core_req_list, sto_core_req) g_sto_core_req_list =
-	TAILQ_HEAD_INITIALIZER(g_sto_core_req_list);
+/* Taken and put back on the thread a request is submitted on */
+static __thread struct sto_pool g_sto_core_req_pool =
+	STO_POOL_INITIALIZER("core req", sizeof(struct sto_core_req));
 
 
 static const char *const sto_core_req_state_names[] = {
@@ -48,30 +112,141 @@ static void sto_core_process_req(struct sto_core_req *core_req);
 static int
 sto_core_req_poll(void *ctx)
 {
+	struct sto_core_shard *shard = ctx;
 	struct sto_core_req_list core_req_list = TAILQ_HEAD_INITIALIZER(core_req_list);
 	struct sto_core_req *core_req, *tmp;
+	uint64_t now;
 
-	if (TAILQ_EMPTY(&g_sto_core_req_list)) {
+	if (TAILQ_EMPTY(&shard->req_list)) {
 		return SPDK_POLLER_IDLE;
 	}
 
-	TAILQ_SWAP(&core_req_list, &g_sto_core_req_list, sto_core_req, list);
+	TAILQ_SWAP(&core_req_list, &shard->req_list, sto_core_req, list);
+
+	now = spdk_get_ticks();
 
 	TAILQ_FOREACH_SAFE(core_req, &core_req_list, list, tmp) {
 		TAILQ_REMOVE(&core_req_list, core_req, list);
 
+		core_req->queue_wait_ticks += now - core_req->queue_ticks;
+
 		sto_core_process_req(core_req);
 	}
 
 	return SPDK_POLLER_BUSY;
 }
 
+static void
+sto_core_req_kick(void *ctx)
+{
+	struct sto_core_shard *shard = ctx;
+
+	/* Requests queued while processing send a new kick */
+	shard->kicked = false;
+
+	sto_core_req_poll(shard);
+}
+
+/* FNV-1a */
+static uint64_t
+sto_core_key_hash(const char *key, size_t len)
+{
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (uint8_t) key[i];
+		hash *= 0x100000001b3ULL;
+	}
+
+	return hash;
+}
+
+static bool
+sto_core_req_decode_key(const struct spdk_json_val *params, uint64_t *key)
+{
+	const struct spdk_json_val *val;
+	struct sto_json_iter iter;
+	size_t i;
+
+	if (!params || params->type != SPDK_JSON_VAL_OBJECT_BEGIN) {
+		return false;
+	}
+
+	for (i = 0; i < SPDK_COUNTOF(g_sto_core_key_names); i++) {
+		STO_JSON_FOREACH(val, params, &iter) {
+			if (val[1].type == SPDK_JSON_VAL_STRING &&
+			    spdk_json_strequal(val, g_sto_core_key_names[i])) {
+				*key = sto_core_key_hash(val[1].start, val[1].len);
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+static struct sto_core_shard *
+sto_core_current_shard(void)
+{
+	struct spdk_thread *thread = spdk_get_thread();
+	uint32_t i;
+
+	for (i = 0; i < g_sto_core_nr_shards; i++) {
+		if (g_sto_core_shards[i].thread == thread) {
+			return &g_sto_core_shards[i];
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Internal requests are issued by a request which is already executing
+ * and may hold the same key, so they are never ordered by key and stay
+ * on the shard they come from.
+ */
+static void
+sto_core_req_assign_shard(struct sto_core_req *core_req)
+{
+	uint32_t idx;
+
+	if (core_req->internal) {
+		core_req->shard = sto_core_current_shard();
+		if (core_req->shard) {
+			return;
+		}
+	} else if (sto_core_req_decode_key(core_req->params, &core_req->key)) {
+		core_req->keyed = true;
+		core_req->shard = &g_sto_core_shards[core_req->key % g_sto_core_nr_shards];
+		return;
+	}
+
+	idx = __atomic_fetch_add(&g_sto_core_next_shard, 1, __ATOMIC_RELAXED);
+
+	core_req->shard = &g_sto_core_shards[idx % g_sto_core_nr_shards];
+}
+
+static bool
+sto_core_req_list_has_key(struct sto_core_req_list *list, uint64_t key)
+{
+	struct sto_core_req *core_req;
+
+	TAILQ_FOREACH(core_req, list, key_list) {
+		if (core_req->key == key) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
 static struct sto_core_req *
 sto_core_req_alloc(const struct spdk_json_val *params, bool internal)
 {
 	struct sto_core_req *core_req;
 
-	core_req = calloc(1, sizeof(*core_req));
+	core_req = sto_pool_get(&g_sto_core_req_pool);
 	if (spdk_unlikely(!core_req)) {
 		SPDK_ERRLOG("Cann't allocate memory for core req\n");
 		return NULL;
@@ -91,23 +266,118 @@ sto_core_req_init_cb(struct sto_core_req *core_req, sto_core_req_done_t done, vo
 	core_req->priv = priv;
 }
 
+/* Only called on the shard thread */
 static void
 sto_core_queue_req(struct sto_core_req *core_req)
 {
-	TAILQ_INSERT_TAIL(&g_sto_core_req_list, core_req, list);
+	struct sto_core_shard *shard = core_req->shard;
+	int rc;
+
+	core_req->queue_ticks = spdk_get_ticks();
+
+	TAILQ_INSERT_TAIL(&shard->req_list, core_req, list);
+
+	if (g_sto_core_busy_poll || shard->kicked) {
+		return;
+	}
+
+	rc = spdk_thread_send_msg(shard->thread, sto_core_req_kick, shard);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("CRITICAL: Failed to kick the STO core shard %u queue, rc=%d\n",
+			    shard->id, rc);
+		assert(0);
+		return;
+	}
+
+	shard->kicked = true;
 }
 
 static void
+sto_core_submit_req_msg(void *ctx)
+{
+	sto_core_queue_req(ctx);
+}
+
+static int
 sto_core_submit_req(struct sto_core_req *core_req)
 {
+	struct sto_core_shard *shard;
+
+	core_req->thread = spdk_get_thread();
+
+	sto_core_req_assign_shard(core_req);
+
+	shard = core_req->shard;
+
+	if (shard->thread == core_req->thread) {
+		sto_core_queue_req(core_req);
+		return 0;
+	}
+
+	return spdk_thread_send_msg(shard->thread, sto_core_submit_req_msg, core_req);
+}
+
+/* Requests enter the shard in order, so the key is taken in that order too */
+static void
+sto_core_req_queue_exec(struct sto_core_req *core_req)
+{
+	struct sto_core_shard *shard = core_req->shard;
+
+	sto_core_req_set_state(core_req, STO_CORE_REQ_STATE_EXEC);
+
+	if (!core_req->keyed) {
+		sto_core_queue_req(core_req);
+		return;
+	}
+
+	if (sto_core_req_list_has_key(&shard->active_list, core_req->key) ||
+	    sto_core_req_list_has_key(&shard->wait_list, core_req->key)) {
+		TAILQ_INSERT_TAIL(&shard->wait_list, core_req, key_list);
+		return;
+	}
+
+	TAILQ_INSERT_TAIL(&shard->active_list, core_req, key_list);
+	core_req->key_held = true;
+
 	sto_core_queue_req(core_req);
 }
 
+static void
+sto_core_req_release_key(struct sto_core_req *core_req)
+{
+	struct sto_core_shard *shard = core_req->shard;
+	struct sto_core_req *waiter;
+
+	if (!core_req->key_held) {
+		return;
+	}
+
+	TAILQ_REMOVE(&shard->active_list, core_req, key_list);
+	core_req->key_held = false;
+
+	TAILQ_FOREACH(waiter, &shard->wait_list, key_list) {
+		if (waiter->key == core_req->key) {
+			break;
+		}
+	}
+
+	if (!waiter) {
+		return;
+	}
+
+	TAILQ_REMOVE(&shard->wait_list, waiter, key_list);
+	TAILQ_INSERT_TAIL(&shard->active_list, waiter, key_list);
+	waiter->key_held = true;
+
+	sto_core_queue_req(waiter);
+}
+
 static int
 core_process(const struct spdk_json_val *params, sto_core_req_done_t done,
 	     void *priv, bool internal)
 {
 	struct sto_core_req *req;
+	int rc;
 
 	req = sto_core_req_alloc(params, internal);
 	if (spdk_unlikely(!req)) {
@@ -117,7 +387,13 @@ core_process(const struct spdk_json_val *params, sto_core_req_done_t done,
 
 	sto_core_req_init_cb(req, done, priv);
 
-	sto_core_submit_req(req);
+	rc = sto_core_submit_req(req);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to submit STO req to core shard %u, rc=%d\n",
+			    req->shard->id, rc);
+		sto_pool_put(&g_sto_core_req_pool, req);
+		return rc;
+	}
 
 	return 0;
 }
@@ -135,6 +411,9 @@ struct sto_core_ctx {
 	void *user_priv;
 };
 
+static __thread struct sto_pool g_sto_core_ctx_pool =
+	STO_POOL_INITIALIZER("core ctx", sizeof(struct sto_core_ctx));
+
 static void sto_core_ctx_free(struct sto_core_ctx *ctx);
 
 static int
@@ -159,7 +438,7 @@ sto_core_ctx_alloc(const struct sto_json_head_raw *head,
 	struct sto_core_ctx *ctx;
 	int rc;
 
-	ctx = calloc(1, sizeof(*ctx));
+	ctx = sto_pool_get(&g_sto_core_ctx_pool);
 	if (spdk_unlikely(!ctx)) {
 		SPDK_ERRLOG("Failed to alloc component context\n");
 		return NULL;
@@ -177,7 +456,7 @@ sto_core_ctx_alloc(const struct sto_json_head_raw *head,
 	return ctx;
 
 free_ctx:
-	free(ctx);
+	sto_pool_put(&g_sto_core_ctx_pool, ctx);
 
 	return NULL;
 }
@@ -186,7 +465,7 @@ static void
 sto_core_ctx_free(struct sto_core_ctx *ctx)
 {
 	sto_json_ctx_destroy(&ctx->json_ctx);
-	free(ctx);
+	sto_pool_put(&g_sto_core_ctx_pool, ctx);
 }
 
 static void
@@ -240,28 +519,25 @@ sto_core_req_init_req_ctx(struct sto_core_req *core_req, struct sto_req_context
 }
 
 static const struct sto_ops *
-sto_core_decode_ops(const struct sto_shash *ops_map,
+sto_core_decode_ops(const struct sto_phash *ops_map,
 		    const struct sto_json_iter *iter)
 {
+	const struct spdk_json_val *op_name;
 	const struct sto_ops *op;
-	char *op_name = NULL;
 	int rc = 0;
 
-	rc = sto_json_iter_decode_str(iter, "op", &op_name);
+	rc = sto_json_iter_str_val(iter, "op", &op_name);
 	if (rc) {
 		SPDK_ERRLOG("Failed to decode op, rc=%d\n", rc);
 		return ERR_PTR(rc);
 	}
 
-	op = sto_ops_map_find(ops_map, op_name);
+	op = sto_ops_map_lookup(ops_map, op_name->start, op_name->len);
 	if (!op) {
-		SPDK_ERRLOG("Failed to find op %s\n", op_name);
-		free(op_name);
+		SPDK_ERRLOG("Failed to find op %.*s\n", (int) op_name->len, (char *) op_name->start);
 		return ERR_PTR(-EINVAL);
 	}
 
-	free(op_name);
-
 	return op;
 }
 
@@ -291,7 +567,7 @@ static int
 sto_core_req_parse(struct sto_core_req *core_req)
 {
 	struct sto_json_iter iter;
-	const struct sto_shash *ops_map;
+	const struct sto_phash *ops_map;
 	const struct sto_ops *op;
 	struct sto_req_context *req_ctx;
 	int rc = 0;
@@ -305,7 +581,7 @@ sto_core_req_parse(struct sto_core_req *core_req)
 	ops_map = sto_core_component_decode(&iter, core_req->internal);
 	if (IS_ERR_OR_NULL(ops_map)) {
 		SPDK_ERRLOG("Failed to decode component: req[%p]\n", core_req);
-		return IS_ERR(op) ? (int) PTR_ERR(op) : -ENOENT;
+		return IS_ERR(ops_map) ? (int) PTR_ERR(ops_map) : -ENOENT;
 	}
 
 	if (!sto_json_iter_next(&iter)) {
@@ -332,8 +608,7 @@ sto_core_req_parse(struct sto_core_req *core_req)
 
 	sto_core_req_init_req_ctx(core_req, req_ctx);
 
-	sto_core_req_set_state(core_req, STO_CORE_REQ_STATE_EXEC);
-	sto_core_queue_req(core_req);
+	sto_core_req_queue_exec(core_req);
 
 	return rc;
 }
@@ -352,15 +627,37 @@ sto_core_req_exec(struct sto_core_req *core_req)
 {
 	struct sto_req *req = sto_req_from_ctx(core_req->req_ctx);
 
-	sto_req_run(req);
+	sto_req_run(req, core_req->shard->engine);
 }
 
 static void
-sto_core_req_done(struct sto_core_req *core_req)
+sto_core_req_done_msg(void *ctx)
 {
+	struct sto_core_req *core_req = ctx;
+
 	core_req->done(core_req);
 }
 
+static void
+sto_core_req_done(struct sto_core_req *core_req)
+{
+	int rc;
+
+	sto_core_req_release_key(core_req);
+
+	if (core_req->thread == spdk_get_thread()) {
+		core_req->done(core_req);
+		return;
+	}
+
+	rc = spdk_thread_send_msg(core_req->thread, sto_core_req_done_msg, core_req);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("CRITICAL: Failed to complete core req (%p) on its thread, rc=%d\n",
+			    core_req, rc);
+		assert(0);
+	}
+}
+
 void
 sto_core_req_response(struct sto_core_req *core_req, struct spdk_json_write_ctx *w)
 {
@@ -368,6 +665,8 @@ sto_core_req_response(struct sto_core_req *core_req, struct spdk_json_write_ctx
 	struct sto_err_context *err = &core_req->err_ctx;
 
 	SPDK_ERRLOG("req[%p] end response: rc=%d\n", core_req, err->rc);
+	SPDK_DEBUGLOG(sto_core, "req[%p] queue_wait=%" PRIu64 "us\n",
+		      core_req, sto_core_req_queue_wait_us(core_req));
 
 	if (err->rc) {
 		sto_status_failed(w, err);
@@ -380,17 +679,56 @@ sto_core_req_response(struct sto_core_req *core_req, struct spdk_json_write_ctx
 	return;
 }
 
+uint64_t
+sto_core_req_queue_wait_us(struct sto_core_req *core_req)
+{
+	uint64_t ticks = core_req->queue_wait_ticks;
+
+	if (core_req->req_ctx) {
+		struct sto_req *req = sto_req_from_ctx(core_req->req_ctx);
+
+		ticks += req->pipeline.queue_wait_ticks;
+	}
+
+	return ticks * SPDK_SEC_TO_USEC / spdk_get_ticks_hz();
+}
+
+static void
+sto_core_req_free_req_msg(void *ctx)
+{
+	sto_req_free(ctx);
+}
+
+/* The req was parsed on the shard thread and goes back to the pool there */
+static void
+sto_core_shard_free_req(struct sto_core_shard *shard, struct sto_req *req)
+{
+	int rc;
+
+	if (shard->thread == spdk_get_thread()) {
+		sto_req_free(req);
+		return;
+	}
+
+	rc = spdk_thread_send_msg(shard->thread, sto_core_req_free_req_msg, req);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("CRITICAL: Failed to free req (%p) on core shard %u, rc=%d\n",
+			    req, shard->id, rc);
+		assert(0);
+	}
+}
+
 void
 sto_core_req_free(struct sto_core_req *core_req)
 {
 	if (core_req->req_ctx) {
 		struct sto_req *req = sto_req_from_ctx(core_req->req_ctx);
 
-		sto_req_free(req);
+		sto_core_shard_free_req(core_req->shard, req);
 		core_req->req_ctx = NULL;
 	}
 
-	free(core_req);
+	sto_pool_put(&g_sto_core_req_pool, core_req);
 }
 
 static void
@@ -425,36 +763,246 @@ sto_core_process_req(struct sto_core_req *core_req)
 }
 
 void
-sto_core_init(sto_core_init_fn cb_fn, void *cb_arg)
+sto_core_opts_init(struct sto_core_opts *opts)
+{
+	memset(opts, 0, sizeof(*opts));
+
+	opts->nr_shards = STO_CORE_DEFAULT_SHARDS;
+}
+
+static void
+sto_core_shard_reported(void *ctx)
+{
+	struct sto_core_shard *shard = ctx;
+
+	if (shard->rc && !g_sto_core_shards_rc) {
+		g_sto_core_shards_rc = shard->rc;
+	}
+
+	if (--g_sto_core_shards_pending) {
+		return;
+	}
+
+	g_sto_core_shards_done(g_sto_core_shards_rc);
+}
+
+static void
+sto_core_shard_report(struct sto_core_shard *shard, int rc)
+{
+	shard->rc = rc;
+
+	rc = spdk_thread_send_msg(g_sto_core_thread, sto_core_shard_reported, shard);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("CRITICAL: Core shard %u failed to report back, rc=%d\n",
+			    shard->id, rc);
+		assert(0);
+	}
+}
+
+/* Runs @fn on every shard thread, @done once all of them have reported */
+static void
+sto_core_shards_foreach(spdk_msg_fn fn, sto_core_shards_done_t done)
+{
+	uint32_t i;
+	int rc;
+
+	if (!g_sto_core_nr_shards) {
+		done(0);
+		return;
+	}
+
+	g_sto_core_shards_done = done;
+	g_sto_core_shards_pending = g_sto_core_nr_shards;
+	g_sto_core_shards_rc = 0;
+
+	for (i = 0; i < g_sto_core_nr_shards; i++) {
+		struct sto_core_shard *shard = &g_sto_core_shards[i];
+
+		rc = spdk_thread_send_msg(shard->thread, fn, shard);
+		if (spdk_unlikely(rc)) {
+			SPDK_ERRLOG("Failed to send a message to core shard %u, rc=%d\n",
+				    shard->id, rc);
+			shard->rc = rc;
+			sto_core_shard_reported(shard);
+		}
+	}
+}
+
+static void
+sto_core_shard_start(void *ctx)
 {
+	struct sto_core_shard *shard = ctx;
+	char name[32];
 	int rc;
 
-	g_sto_core_req_poller = SPDK_POLLER_REGISTER(sto_core_req_poll, NULL, STO_CORE_REQ_POLL_PERIOD);
-	if (spdk_unlikely(!g_sto_core_req_poller)) {
-		SPDK_ERRLOG("Cann't register the STO core req poller\n");
+	snprintf(name, sizeof(name), "STO req %u", shard->id);
+
+	shard->engine = sto_pipeline_engine_create(name);
+	if (spdk_unlikely(!shard->engine)) {
+		SPDK_ERRLOG("Cann't create the STO req engine for core shard %u\n", shard->id);
 		rc = -ENOMEM;
-		goto out_err;
+		goto out;
+	}
+
+	if (g_sto_core_busy_poll) {
+		shard->poller = SPDK_POLLER_REGISTER(sto_core_req_poll, shard, 0);
+		if (spdk_unlikely(!shard->poller)) {
+			SPDK_ERRLOG("Cann't register the STO core shard %u poller\n", shard->id);
+			rc = -ENOMEM;
+			goto out;
+		}
+	}
+
+	rc = sto_client_thread_connect();
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to connect STO client for core shard %u, rc=%d\n",
+			    shard->id, rc);
+		goto out;
 	}
 
-	rc = sto_req_lib_init();
+	rc = sto_client_bin_thread_connect();
 	if (spdk_unlikely(rc)) {
-		SPDK_ERRLOG("sto_req_lib_init() failed, rc=%d\n", rc);
-		goto out_err;
+		SPDK_NOTICELOG("Binary framing is not negotiated for core shard %u, "
+			       "stay on JSON-RPC, rc=%d\n", shard->id, rc);
+		rc = 0;
 	}
 
-	sto_core_component_init(cb_fn, cb_arg);
+out:
+	sto_core_shard_report(shard, rc);
+}
 
-	return;
+static void
+sto_core_shard_stop(void *ctx)
+{
+	struct sto_core_shard *shard = ctx;
+
+	spdk_poller_unregister(&shard->poller);
+
+	if (shard->engine) {
+		sto_pipeline_engine_destroy(shard->engine);
+		shard->engine = NULL;
+	}
+
+	sto_client_bin_close();
+	sto_client_thread_close();
+
+	spdk_thread_exit(shard->thread);
+
+	sto_core_shard_report(shard, 0);
+}
+
+static int
+sto_core_shards_create(uint32_t nr_shards)
+{
+	char name[32];
+	uint32_t i;
+
+	g_sto_core_shards = calloc(nr_shards, sizeof(*g_sto_core_shards));
+	if (spdk_unlikely(!g_sto_core_shards)) {
+		SPDK_ERRLOG("Cann't allocate memory for %u core shards\n", nr_shards);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nr_shards; i++) {
+		struct sto_core_shard *shard = &g_sto_core_shards[i];
+
+		shard->id = i;
+
+		TAILQ_INIT(&shard->req_list);
+		TAILQ_INIT(&shard->active_list);
+		TAILQ_INIT(&shard->wait_list);
+
+		snprintf(name, sizeof(name), "sto_core_%u", i);
+
+		shard->thread = spdk_thread_create(name, NULL);
+		if (spdk_unlikely(!shard->thread)) {
+			SPDK_ERRLOG("Cann't create the thread of core shard %u\n", i);
+			return -ENOMEM;
+		}
+
+		/* Only the shards with a thread are stopped */
+		g_sto_core_nr_shards++;
+	}
+
+	return 0;
+}
+
+static void
+sto_core_shards_free(void)
+{
+	free(g_sto_core_shards);
+
+	g_sto_core_shards = NULL;
+	g_sto_core_nr_shards = 0;
+}
+
+static void
+sto_core_shards_init_failed(int rc)
+{
+	sto_core_shards_free();
+
+	g_sto_core_init_fn(g_sto_core_init_arg, g_sto_core_init_rc);
+}
+
+static void
+sto_core_shards_started(int rc)
+{
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to start core shards, rc=%d\n", rc);
+		g_sto_core_init_rc = rc;
+		sto_core_shards_foreach(sto_core_shard_stop, sto_core_shards_init_failed);
+		return;
+	}
+
+	sto_core_component_init(g_sto_core_init_fn, g_sto_core_init_arg);
+}
+
+void
+sto_core_init(const struct sto_core_opts *opts, sto_core_init_fn cb_fn, void *cb_arg)
+{
+	int rc;
+
+	g_sto_core_thread = spdk_get_thread();
+	g_sto_core_busy_poll = opts->busy_poll;
 
-out_err:
-	cb_fn(cb_arg, rc);
+	g_sto_core_init_fn = cb_fn;
+	g_sto_core_init_arg = cb_arg;
+
+	sto_pipeline_set_busy_poll(opts->busy_poll);
+
+	rc = sto_core_shards_create(spdk_max(opts->nr_shards, 1));
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to create core shards, rc=%d\n", rc);
+		g_sto_core_init_rc = rc;
+		sto_core_shards_foreach(sto_core_shard_stop, sto_core_shards_init_failed);
+		return;
+	}
+
+	sto_core_shards_foreach(sto_core_shard_start, sto_core_shards_started);
+}
+
+static void
+sto_core_shards_stopped(int rc)
+{
+	sto_core_shards_free();
+
+	g_sto_core_fini_fn(g_sto_core_fini_arg);
+}
+
+/* The components may still issue requests while they stop */
+static void
+sto_core_component_fini_done(void *cb_arg)
+{
+	sto_core_shards_foreach(sto_core_shard_stop, sto_core_shards_stopped);
 }
 
 void
 sto_core_fini(sto_core_fini_fn cb_fn, void *cb_arg)
 {
-	sto_req_lib_fini();
-	spdk_poller_unregister(&g_sto_core_req_poller);
+	g_sto_core_fini_fn = cb_fn;
+	g_sto_core_fini_arg = cb_arg;
 
-	sto_core_component_fini(cb_fn, cb_arg);
+	sto_core_component_fini(sto_core_component_fini_done, NULL);
 }
+
+SPDK_LOG_REGISTER_COMPONENT(sto_core)
@@ -18,6 +18,9 @@ typedef void (*sto_module_fini_fn)(void *cb_arg);
 
 static struct sto_module *g_next_module;
 
+/* Name lookup, built when the module component is initialized */
+static struct sto_phash g_module_map;
+
 static bool g_modules_initialized = false;
 static bool g_modules_init_interrupted = false;
 
@@ -35,23 +38,55 @@ sto_add_module(struct sto_module *module)
 }
 
 static struct sto_module *
-_module_find(struct sto_module_list *list, const char *name)
+_module_find(struct sto_module_list *list, const char *name, uint32_t len)
 {
-	struct sto_module *module;
+	struct sto_module *iter;
 
-	TAILQ_FOREACH(module, list, list) {
-		if (!strcmp(name, module->name)) {
-			return module;
+	TAILQ_FOREACH(iter, list, list) {
+		if (strlen(iter->name) == len && !memcmp(name, iter->name, len)) {
+			return iter;
 		}
 	}
 
 	return NULL;
 }
 
+static struct sto_module *
+module_lookup(const char *name, uint32_t len)
+{
+	if (spdk_likely(sto_phash_built(&g_module_map))) {
+		return (struct sto_module *) sto_phash_lookup(&g_module_map, name, len);
+	}
+
+	return _module_find(&g_modules, name, len);
+}
+
 struct sto_module *
 sto_module_find(const char *name)
 {
-	return _module_find(&g_modules, name);
+	return module_lookup(name, strlen(name));
+}
+
+static const void *
+module_map_next(const void *obj, void *ctx)
+{
+	const struct sto_module *module = obj;
+
+	return !module ? TAILQ_FIRST(&g_modules) : TAILQ_NEXT(module, list);
+}
+
+static const char *
+module_map_key(const void *obj)
+{
+	const struct sto_module *module = obj;
+
+	return module->name;
+}
+
+static int
+module_map_build(void)
+{
+	return sto_phash_build_from(&g_module_map, module_map_next, module_map_key, NULL);
 }
 
 static inline struct sto_module *
@@ -129,7 +164,7 @@ sto_module_fini_next(void)
 	}
 
 	while (g_next_module) {
-		sto_shash_destroy((struct sto_shash *) &g_next_module->ops_map);
+		sto_ops_map_destroy(&g_next_module->ops_map);
 
 		if (g_next_module->ops && g_next_module->ops->fini) {
 			g_next_module->ops->fini();
@@ -144,14 +179,14 @@ sto_module_fini_next(void)
 	return;
 }
 
-static const struct sto_shash *
-module_get_ops_map(const char *object_name)
+static const struct sto_phash *
+module_get_ops_map(const char *object_name, uint32_t len)
 {
 	struct sto_module *module;
 
-	module = sto_module_find(object_name);
+	module = module_lookup(object_name, len);
 	if (spdk_unlikely(!module)) {
-		SPDK_ERRLOG("Failed to find module %s\n", object_name);
+		SPDK_ERRLOG("Failed to find module %.*s\n", (int) len, object_name);
 		return ERR_PTR(-EINVAL);
 	}
 
@@ -167,15 +202,26 @@ module_init_done(void *cb_arg, int rc)
 static void
 module_init(void)
 {
+	int rc;
+
 	g_module_start_fn = module_init_done;
 	g_module_start_arg = NULL;
 
+	rc = module_map_build();
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to build module map, rc=%d\n", rc);
+		sto_core_component_init_next(rc);
+		return;
+	}
+
 	sto_module_init_next(0);
 }
 
 static void
 module_fini_done(void *cb_arg)
 {
+	sto_phash_destroy(&g_module_map);
+
 	sto_core_component_fini_next();
 }
 
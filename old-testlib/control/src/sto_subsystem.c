@@ -18,6 +18,9 @@ typedef void (*sto_subsystem_fini_fn)(void *cb_arg);
 
 static struct sto_subsystem *g_next_subsystem;
 
+/* Name lookup, built when the subsystem component is initialized */
+static struct sto_phash g_subsystem_map;
+
 static bool g_subsystems_initialized = false;
 static bool g_subsystems_init_interrupted = false;
 
@@ -35,12 +38,12 @@ sto_add_subsystem(struct sto_subsystem *subsystem)
 }
 
 static struct sto_subsystem *
-_subsystem_find(struct sto_subsystem_list *list, const char *name)
+_subsystem_find(struct sto_subsystem_list *list, const char *name, uint32_t len)
 {
 	struct sto_subsystem *iter;
 
 	TAILQ_FOREACH(iter, list, list) {
-		if (!strcmp(name, iter->name)) {
+		if (strlen(iter->name) == len && !memcmp(name, iter->name, len)) {
 			return iter;
 		}
 	}
@@ -48,10 +51,42 @@ _subsystem_find(struct sto_subsystem_list *list, const char *name)
 	return NULL;
 }
 
+static struct sto_subsystem *
+subsystem_lookup(const char *name, uint32_t len)
+{
+	if (spdk_likely(sto_phash_built(&g_subsystem_map))) {
+		return (struct sto_subsystem *) sto_phash_lookup(&g_subsystem_map, name, len);
+	}
+
+	return _subsystem_find(&g_subsystems, name, len);
+}
+
 struct sto_subsystem *
 sto_subsystem_find(const char *name)
 {
-	return _subsystem_find(&g_subsystems, name);
+	return subsystem_lookup(name, strlen(name));
+}
+
+static const void *
+subsystem_map_next(const void *obj, void *ctx)
+{
+	const struct sto_subsystem *subsystem = obj;
+
+	return !subsystem ? TAILQ_FIRST(&g_subsystems) : TAILQ_NEXT(subsystem, list);
+}
+
+static const char *
+subsystem_map_key(const void *obj)
+{
+	const struct sto_subsystem *subsystem = obj;
+
+	return subsystem->name;
+}
+
+static int
+subsystem_map_build(void)
+{
+	return sto_phash_build_from(&g_subsystem_map, subsystem_map_next, subsystem_map_key, NULL);
 }
 
 static inline struct sto_subsystem *
@@ -129,7 +164,7 @@ sto_subsystem_fini_next(void)
 	}
 
 	while (g_next_subsystem) {
-		sto_shash_destroy((struct sto_shash *) &g_next_subsystem->ops_map);
+		sto_ops_map_destroy(&g_next_subsystem->ops_map);
 
 		if (g_next_subsystem->ops && g_next_subsystem->ops->fini) {
 			g_next_subsystem->ops->fini();
@@ -144,14 +179,14 @@ sto_subsystem_fini_next(void)
 	return;
 }
 
-static const struct sto_shash *
-subsystem_get_ops_map(const char *object_name)
+static const struct sto_phash *
+subsystem_get_ops_map(const char *object_name, uint32_t len)
 {
 	struct sto_subsystem *subsystem;
 
-	subsystem = sto_subsystem_find(object_name);
+	subsystem = subsystem_lookup(object_name, len);
 	if (spdk_unlikely(!subsystem)) {
-		SPDK_ERRLOG("Failed to find subsystem %s\n", object_name);
+		SPDK_ERRLOG("Failed to find subsystem %.*s\n", (int) len, object_name);
 		return ERR_PTR(-EINVAL);
 	}
 
@@ -167,15 +202,26 @@ subsystem_init_done(void *cb_arg, int rc)
 static void
 subsystem_init(void)
 {
+	int rc;
+
 	g_subsystem_start_fn = subsystem_init_done;
 	g_subsystem_start_arg = NULL;
 
+	rc = subsystem_map_build();
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to build subsystem map, rc=%d\n", rc);
+		sto_core_component_init_next(rc);
+		return;
+	}
+
 	sto_subsystem_init_next(0);
 }
 
 static void
 subsystem_fini_done(void *cb_arg)
 {
+	sto_phash_destroy(&g_subsystem_map);
+
 	sto_core_component_fini_next();
 }
 
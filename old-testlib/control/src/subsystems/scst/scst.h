@@ -37,6 +37,8 @@ void scst_ini_group_del(struct scst_ini_group_params *params, sto_generic_cb cb_
 
 struct scst_lun_params {
 	uint32_t lun_id;
+	/* lun_add picks the lowest free id and stores it in lun_id */
+	bool lun_id_auto;
 	char *driver_name;
 	char *target_name;
 	char *ini_group_name;
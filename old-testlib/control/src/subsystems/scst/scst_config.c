@@ -14,6 +14,13 @@
 #include "sto_rpc_aio.h"
 #include "sto_tree.h"
 
+/*
+ * Objects on the same level of the restored config (handlers, devices of
+ * a handler, drivers, targets of a driver, ini groups of a target) do not
+ * depend on each other, so each level is restored this many at a time.
+ */
+#define SCST_JSON_RESTORE_MAX_INFLIGHT	16
+
 struct scst_json_ctx {
 	struct sto_json_ctx json;
 };
@@ -396,6 +403,10 @@ out:
 void
 scst_dumps_json(sto_generic_cb cb_fn, void *cb_arg, struct sto_json_ctx *json)
 {
+	struct sto_tree_opts opts = {
+		.dirpath = SCST_ROOT,
+		.use_arena = true,
+	};
 	struct dumps_json_ctx *ctx;
 
 	ctx = calloc(1, sizeof(*ctx));
@@ -410,7 +421,7 @@ scst_dumps_json(sto_generic_cb cb_fn, void *cb_arg, struct sto_json_ctx *json)
 	ctx->cb_fn = cb_fn;
 	ctx->cb_arg = cb_arg;
 
-	sto_tree(SCST_ROOT, 0, false, dumps_json, ctx);
+	sto_tree(&opts, dumps_json, ctx);
 }
 
 static void
@@ -1121,9 +1132,10 @@ handler_restore_devices_step(struct sto_pipeline *pipe)
 {
 	struct handler_restore_ctx *ctx = sto_pipeline_get_ctx(pipe);
 	struct sto_json_async_iter_opts opts = {
-		.json = sto_json_async_iter_get_object(sto_pipeline_get_priv(pipe)),
+		.json = sto_pipeline_get_priv(pipe),
 		.iterate_fn = device_restore_json,
 		.next_fn = device_json_iter_next,
+		.max_inflight = SCST_JSON_RESTORE_MAX_INFLIGHT,
 		.priv = ctx->available_params,
 	};
 
@@ -1157,7 +1169,7 @@ static void
 handler_read_available_attrs_step(struct sto_pipeline *pipe)
 {
 	struct handler_restore_ctx *ctx = sto_pipeline_get_ctx(pipe);
-	struct spdk_json_val *handler = sto_json_async_iter_get_object(sto_pipeline_get_priv(pipe));
+	struct spdk_json_val *handler = sto_pipeline_get_priv(pipe);
 	const char *mgmt_path = NULL;
 
 	mgmt_path = handler_parse_mgmt_path(handler);
@@ -1184,23 +1196,64 @@ static const struct sto_pipeline_properties handler_restore_json_properties = {
 	},
 };
 
-static void
-handler_restore_json(struct sto_json_async_iter *iter)
+struct scst_restore_json_ctx {
+	struct spdk_json_val **handlers;
+	struct spdk_json_val **drivers;
+};
+
+static inline void
+scst_restore_json_ctx_deinit(void *ctx_ptr)
 {
-	scst_pipeline(scst_get_instance(), &handler_restore_json_properties,
-		      sto_json_async_iterate_done, iter, iter);
+	struct scst_restore_json_ctx *ctx = ctx_ptr;
+
+	free(ctx->handlers);
+	free(ctx->drivers);
+}
+
+static int
+restore_json_collect(struct spdk_json_val *json, sto_json_async_iter_next_t next_fn,
+		     struct spdk_json_val ***objects)
+{
+	struct spdk_json_val *object = NULL;
+	int nr_objects = 0, i = 0;
+
+	while ((object = next_fn(json, object)) != NULL) {
+		nr_objects++;
+	}
+
+	if (!nr_objects) {
+		return 0;
+	}
+
+	*objects = calloc(nr_objects, sizeof(**objects));
+	if (spdk_unlikely(!*objects)) {
+		SPDK_ERRLOG("Failed to alloc %d JSON objects to restore\n", nr_objects);
+		return -ENOMEM;
+	}
+
+	while ((object = next_fn(json, object)) != NULL) {
+		(*objects)[i++] = object;
+	}
+
+	return nr_objects;
+}
+
+static int
+handler_list_restore_json_count(struct sto_pipeline *pipe)
+{
+	struct scst_restore_json_ctx *ctx = sto_pipeline_get_ctx(pipe);
+
+	return restore_json_collect(sto_pipeline_get_priv(pipe), handler_json_iter_next,
+				    &ctx->handlers);
 }
 
 static void
-handler_list_restore_json_step(struct sto_pipeline *pipe)
+handler_restore_json(struct sto_pipeline *pipe, uint32_t idx, sto_generic_cb cb_fn, void *cb_arg)
 {
-	struct sto_json_async_iter_opts opts = {
-		.json = sto_pipeline_get_priv(pipe),
-		.iterate_fn = handler_restore_json,
-		.next_fn = handler_json_iter_next,
-	};
+	struct scst_restore_json_ctx *ctx = sto_pipeline_get_ctx(pipe);
 
-	sto_json_async_iter_start(&opts, sto_pipeline_step_done, pipe);
+	scst_pipeline(scst_get_instance(), &handler_restore_json_properties,
+		      cb_fn, cb_arg, ctx->handlers[idx]);
 }
 
 struct ini_group_restore_ctx {
@@ -1266,6 +1319,358 @@ out:
 	ini_group_restore_json_done(ctx, rc);
 }
 
+/*
+ * LUNs of a target and of all its ini groups are written to their mgmt
+ * files with a single multi_writefile request.
+ */
+static char *lun_available_attrs[] = {"read_only", NULL};
+
+struct lun_restore {
+	char *ini_group_name;
+	char *device_name;
+	uint32_t lun_id;
+};
+
+struct lun_list_restore_ctx {
+	struct scst_target_params params;
+
+	struct lun_restore *luns;
+	struct sto_rpc_writefile_entry *entries;
+	size_t cnt;
+
+	struct sto_json_async_iter *iter;
+};
+
+static void
+lun_list_restore_ctx_free(struct lun_list_restore_ctx *ctx)
+{
+	size_t i;
+
+	for (i = 0; i < ctx->cnt; i++) {
+		free(ctx->luns[i].ini_group_name);
+		free(ctx->luns[i].device_name);
+
+		free((char *) ctx->entries[i].filepath);
+		free(ctx->entries[i].buf);
+	}
+
+	free(ctx->luns);
+	free(ctx->entries);
+
+	scst_target_params_deinit(&ctx->params);
+	free(ctx);
+}
+
+static struct spdk_json_val *
+lun_list_json_first(struct spdk_json_val *object)
+{
+	struct spdk_json_val *luns;
+
+	if (!object || spdk_json_find_array(object, "luns", NULL, &luns)) {
+		return NULL;
+	}
+
+	return spdk_json_array_first(luns);
+}
+
+static size_t
+lun_list_json_count(struct spdk_json_val *object)
+{
+	struct spdk_json_val *lun;
+	size_t cnt = 0;
+
+	for (lun = lun_list_json_first(object); lun; lun = spdk_json_next(lun)) {
+		cnt++;
+	}
+
+	return cnt;
+}
+
+static int
+lun_restore_json_decode(struct spdk_json_val *lun_json, struct lun_restore *lun,
+			char **attributes)
+{
+	struct spdk_json_val *values, *device;
+	char *lun_id_str = NULL;
+	long long lun_id;
+	int rc = 0;
+
+	if (spdk_json_decode_string(spdk_json_object_first(lun_json), &lun_id_str)) {
+		SPDK_ERRLOG("Failed to decode LUN id\n");
+		return -EINVAL;
+	}
+
+	lun_id = spdk_strtoll(lun_id_str, 10);
+	if (spdk_unlikely(lun_id < 0 || lun_id > UINT32_MAX)) {
+		SPDK_ERRLOG("Invalid LUN id %s\n", lun_id_str);
+		rc = -EINVAL;
+		goto out;
+	}
+
+	lun->lun_id = lun_id;
+
+	values = sto_json_value(spdk_json_object_first(lun_json));
+
+	if (!values || spdk_json_find(values, "device", NULL, &device, SPDK_JSON_VAL_STRING) ||
+			spdk_json_decode_string(device, &lun->device_name)) {
+		SPDK_ERRLOG("Failed to decode LUN %s device\n", lun_id_str);
+		rc = -EINVAL;
+		goto out;
+	}
+
+	*attributes = scst_parse_attrs(values, lun_available_attrs);
+	if (IS_ERR(*attributes)) {
+		SPDK_ERRLOG("Failed to parse LUN %s attributes\n", lun_id_str);
+		rc = PTR_ERR(*attributes);
+		*attributes = NULL;
+		goto out;
+	}
+
+out:
+	free(lun_id_str);
+
+	return rc;
+}
+
+static int
+lun_restore_entry_init(struct lun_list_restore_ctx *ctx, struct lun_restore *lun,
+		       const char *attributes)
+{
+	struct sto_rpc_writefile_entry *entry = &ctx->entries[ctx->cnt];
+
+	entry->filepath = scst_target_lun_mgmt_path(ctx->params.driver_name,
+						    ctx->params.target_name,
+						    lun->ini_group_name);
+	if (spdk_unlikely(!entry->filepath)) {
+		SPDK_ERRLOG("Failed to alloc LUN mgmt path\n");
+		return -ENOMEM;
+	}
+
+	if (attributes) {
+		entry->buf = spdk_sprintf_alloc("add %s %u %s", lun->device_name,
+						lun->lun_id, attributes);
+	} else {
+		entry->buf = spdk_sprintf_alloc("add %s %u", lun->device_name, lun->lun_id);
+	}
+
+	if (spdk_unlikely(!entry->buf)) {
+		SPDK_ERRLOG("Failed to alloc LUN add cmd\n");
+		free((char *) entry->filepath);
+		entry->filepath = NULL;
+		return -ENOMEM;
+	}
+
+	ctx->luns[ctx->cnt++] = *lun;
+
+	return 0;
+}
+
+static int
+lun_restore_collect(struct lun_list_restore_ctx *ctx, struct spdk_json_val *lun_json,
+		    const char *ini_group_name)
+{
+	struct lun_restore lun = {};
+	char *attributes = NULL;
+	int rc;
+
+	rc = lun_restore_json_decode(lun_json, &lun, &attributes);
+	if (spdk_unlikely(rc)) {
+		goto out_err;
+	}
+
+	if (scst_find_lun(scst_get_instance(), ctx->params.driver_name,
+			  ctx->params.target_name, ini_group_name, lun.lun_id)) {
+		SPDK_ERRLOG("LUN %u has been alredy restored\n", lun.lun_id);
+		goto out_err;
+	}
+
+	if (ini_group_name) {
+		lun.ini_group_name = strdup(ini_group_name);
+		if (spdk_unlikely(!lun.ini_group_name)) {
+			SPDK_ERRLOG("Failed to alloc LUN ini group name\n");
+			rc = -ENOMEM;
+			goto out_err;
+		}
+	}
+
+	rc = lun_restore_entry_init(ctx, &lun, attributes);
+	if (spdk_unlikely(rc)) {
+		goto out_err;
+	}
+
+	free(attributes);
+
+	return 0;
+
+out_err:
+	free(lun.ini_group_name);
+	free(lun.device_name);
+	free(attributes);
+
+	return rc;
+}
+
+static int
+lun_list_restore_collect(struct lun_list_restore_ctx *ctx, struct spdk_json_val *object,
+			 const char *ini_group_name)
+{
+	struct spdk_json_val *lun_json;
+	int rc;
+
+	for (lun_json = lun_list_json_first(object); lun_json; lun_json = spdk_json_next(lun_json)) {
+		rc = lun_restore_collect(ctx, lun_json, ini_group_name);
+		if (spdk_unlikely(rc)) {
+			return rc;
+		}
+	}
+
+	return 0;
+}
+
+static int
+lun_list_restore_json_init(struct lun_list_restore_ctx *ctx, struct spdk_json_val *target)
+{
+	struct spdk_json_val *target_values, *ini_groups = NULL, *group;
+	size_t max_cnt;
+	int rc;
+
+	target_values = sto_json_value(spdk_json_object_first(target));
+
+	max_cnt = lun_list_json_count(target_values);
+
+	if (target_values && !spdk_json_find_array(target_values, "ini_groups", NULL, &ini_groups)) {
+		for (group = spdk_json_array_first(ini_groups); group; group = spdk_json_next(group)) {
+			max_cnt += lun_list_json_count(sto_json_value(spdk_json_object_first(group)));
+		}
+	}
+
+	if (!max_cnt) {
+		return 0;
+	}
+
+	ctx->luns = calloc(max_cnt, sizeof(*ctx->luns));
+	ctx->entries = calloc(max_cnt, sizeof(*ctx->entries));
+	if (spdk_unlikely(!ctx->luns || !ctx->entries)) {
+		SPDK_ERRLOG("Failed to alloc %zu LUNs to restore\n", max_cnt);
+		return -ENOMEM;
+	}
+
+	rc = lun_list_restore_collect(ctx, target_values, NULL);
+	if (spdk_unlikely(rc)) {
+		return rc;
+	}
+
+	if (!ini_groups) {
+		return 0;
+	}
+
+	for (group = spdk_json_array_first(ini_groups); group; group = spdk_json_next(group)) {
+		char *ini_group_name = NULL;
+
+		if (spdk_json_decode_string(spdk_json_object_first(group), &ini_group_name)) {
+			SPDK_ERRLOG("Failed to decode `ini_group_name`\n");
+			return -EINVAL;
+		}
+
+		rc = lun_list_restore_collect(ctx, sto_json_value(spdk_json_object_first(group)),
+					      ini_group_name);
+
+		free(ini_group_name);
+
+		if (spdk_unlikely(rc)) {
+			return rc;
+		}
+	}
+
+	return 0;
+}
+
+static void
+lun_list_restore_json_done(void *cb_arg, int rc)
+{
+	struct lun_list_restore_ctx *ctx = cb_arg;
+	size_t i;
+
+	if (spdk_unlikely(rc)) {
+		goto out;
+	}
+
+	/* Track every LUN that made it to SCST, the first failure is reported */
+	for (i = 0; i < ctx->cnt; i++) {
+		struct lun_restore *lun = &ctx->luns[i];
+		int lun_rc = ctx->entries[i].returncode;
+
+		if (!lun_rc) {
+			lun_rc = scst_add_lun(scst_get_instance(), ctx->params.driver_name,
+					      ctx->params.target_name, lun->ini_group_name,
+					      lun->device_name, lun->lun_id);
+		}
+
+		if (spdk_unlikely(lun_rc)) {
+			SPDK_ERRLOG("Failed to restore LUN %u of device %s, rc=%d\n",
+				    lun->lun_id, lun->device_name, lun_rc);
+			rc = rc ?: lun_rc;
+		}
+	}
+
+out:
+	sto_json_async_iter_next(ctx->iter, rc);
+
+	lun_list_restore_ctx_free(ctx);
+}
+
+static void
+lun_list_restore_json(struct sto_json_async_iter *iter)
+{
+	struct spdk_json_val *driver, *target;
+	struct lun_list_restore_ctx *ctx;
+	int rc = 0;
+
+	driver = sto_json_async_iter_get_json(iter);
+	target = sto_json_async_iter_get_object(iter);
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (spdk_unlikely(!ctx)) {
+		SPDK_ERRLOG("Failed to alloc ctx for LUN list restore\n");
+		sto_json_async_iter_next(iter, -ENOMEM);
+		return;
+	}
+
+	ctx->iter = iter;
+
+	rc = decode_target_params(driver, target, &ctx->params);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to decode target params\n");
+		goto out_err;
+	}
+
+	rc = lun_list_restore_json_init(ctx, target);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to collect LUNs to restore, rc=%d\n", rc);
+		goto out_err;
+	}
+
+	sto_rpc_multi_writefile(ctx->entries, ctx->cnt, true, lun_list_restore_json_done, ctx);
+
+	return;
+
+out_err:
+	lun_list_restore_json_done(ctx, rc);
+}
+
+static void
+ini_group_list_restore_json_done(void *cb_arg, int rc)
+{
+	struct sto_json_async_iter *iter = cb_arg;
+
+	if (spdk_unlikely(rc)) {
+		sto_json_async_iter_next(iter, rc);
+		return;
+	}
+
+	lun_list_restore_json(iter);
+}
+
 static void
 ini_group_list_restore_json(struct sto_json_async_iter *iter)
 {
@@ -1273,10 +1678,11 @@ ini_group_list_restore_json(struct sto_json_async_iter *iter)
 		.json = sto_json_async_iter_get_object(iter),
 		.iterate_fn = ini_group_restore_json,
 		.next_fn = ini_group_json_iter_next,
+		.max_inflight = SCST_JSON_RESTORE_MAX_INFLIGHT,
 		.priv = iter,
 	};
 
-	sto_json_async_iter_start(&opts, sto_json_async_iterate_done, iter);
+	sto_json_async_iter_start(&opts, ini_group_list_restore_json_done, iter);
 }
 
 struct target_restore_ctx {
@@ -1341,34 +1747,38 @@ out_err:
 	target_restore_json_done(ctx, rc);
 }
 
-static void
-driver_restore_json(struct sto_json_async_iter *iter)
+static int
+driver_list_restore_json_count(struct sto_pipeline *pipe)
 {
-	struct sto_json_async_iter_opts opts = {
-		.json = sto_json_async_iter_get_object(iter),
-		.iterate_fn = target_restore_json,
-		.next_fn = target_json_iter_next,
-	};
+	struct scst_restore_json_ctx *ctx = sto_pipeline_get_ctx(pipe);
 
-	sto_json_async_iter_start(&opts, sto_json_async_iterate_done, iter);
+	return restore_json_collect(sto_pipeline_get_priv(pipe), driver_json_iter_next,
+				    &ctx->drivers);
 }
 
 static void
-driver_list_restore_json_step(struct sto_pipeline *pipe)
+driver_restore_json(struct sto_pipeline *pipe, uint32_t idx, sto_generic_cb cb_fn, void *cb_arg)
 {
+	struct scst_restore_json_ctx *ctx = sto_pipeline_get_ctx(pipe);
 	struct sto_json_async_iter_opts opts = {
-		.json = sto_pipeline_get_priv(pipe),
-		.iterate_fn = driver_restore_json,
-		.next_fn = driver_json_iter_next,
+		.json = ctx->drivers[idx],
+		.iterate_fn = target_restore_json,
+		.next_fn = target_json_iter_next,
+		.max_inflight = SCST_JSON_RESTORE_MAX_INFLIGHT,
 	};
 
-	sto_json_async_iter_start(&opts, sto_pipeline_step_done, pipe);
+	sto_json_async_iter_start(&opts, cb_fn, cb_arg);
 }
 
 static const struct sto_pipeline_properties scst_restore_json_properties = {
+	.ctx_size = sizeof(struct scst_restore_json_ctx),
+	.ctx_deinit_fn = scst_restore_json_ctx_deinit,
+
 	.steps = {
-		STO_PL_STEP(handler_list_restore_json_step, NULL),
-		STO_PL_STEP(driver_list_restore_json_step, NULL),
+		STO_PL_STEP_PARALLEL(handler_list_restore_json_count, handler_restore_json,
+				     NULL, SCST_JSON_RESTORE_MAX_INFLIGHT),
+		STO_PL_STEP_PARALLEL(driver_list_restore_json_count, driver_restore_json,
+				     NULL, SCST_JSON_RESTORE_MAX_INFLIGHT),
 		STO_PL_STEP_TERMINATOR(),
 	},
 };
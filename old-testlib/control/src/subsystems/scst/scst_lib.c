@@ -1,8 +1,10 @@
 #include <spdk/stdinc.h>
 #include <spdk/likely.h>
+#include <spdk/thread.h>
 #include <spdk/log.h>
 #include <spdk/string.h>
 #include <spdk/json.h>
+#include <spdk/util.h>
 
 #include "scst_lib.h"
 
@@ -33,9 +35,12 @@ static void scst_ini_group_destroy(struct scst_ini_group *ini_group);
 
 static struct scst_lun *scst_lun_alloc(struct scst_device *device, uint32_t lun_id);
 static void scst_lun_free(struct scst_lun *lun);
-static struct scst_lun *scst_lun_list_find(struct scst_lun_list *lun_list, uint32_t lun_id);
-static int scst_lun_list_add(struct scst_lun_list *lun_list, struct scst_device *device, uint32_t lun_id);
-static int scst_lun_list_remove(struct scst_lun_list *lun_list, uint32_t lun_id);
+static void scst_lun_table_init(struct scst_lun_table *table);
+static void scst_lun_table_deinit(struct scst_lun_table *table);
+static struct scst_lun *scst_lun_table_find(struct scst_lun_table *table, uint32_t lun_id);
+static int scst_lun_table_free_id(struct scst_lun_table *table, uint32_t *lun_id);
+static int scst_lun_table_add(struct scst_lun_table *table, struct scst_device *device, uint32_t lun_id);
+static int scst_lun_table_remove(struct scst_lun_table *table, uint32_t lun_id);
 
 static void scst_put_device_handler(struct scst_device_handler *handler);
 
@@ -63,6 +68,8 @@ scst_device_handler_alloc(struct scst *scst, const char *handler_name)
 
 	TAILQ_INIT(&handler->device_list);
 
+	sto_hash_elem_init(&handler->he, handler->name, strlen(handler->name));
+
 	return handler;
 
 out_err:
@@ -171,10 +178,21 @@ scst_target_driver_alloc(struct scst *scst, const char *driver_name)
 
 	TAILQ_INIT(&driver->target_list);
 
+#define SCST_TARGET_LOOKUP_MAP_SIZE 64
+	if (spdk_unlikely(sto_hash_init(&driver->target_lookup_map, SCST_TARGET_LOOKUP_MAP_SIZE))) {
+		SPDK_ERRLOG("Failed to initialize target lookup map for driver %s\n", driver_name);
+		goto free_name;
+	}
+
+	sto_hash_elem_init(&driver->he, driver->name, strlen(driver->name));
+
 	return driver;
 
+free_name:
+	free((char *) driver->name);
+
 out_err:
-	scst_target_driver_free(driver);
+	free(driver);
 
 	return NULL;
 }
@@ -182,6 +200,7 @@ out_err:
 static void
 scst_target_driver_free(struct scst_target_driver *driver)
 {
+	sto_hash_destroy(&driver->target_lookup_map);
 	free((char *) driver->name);
 	free(driver);
 }
@@ -199,15 +218,14 @@ scst_target_driver_destroy(struct scst_target_driver *driver)
 static struct scst_target *
 scst_target_driver_find(struct scst_target_driver *driver, const char *target_name)
 {
-	struct scst_target *target;
+	struct sto_hash_elem *he;
 
-	TAILQ_FOREACH(target, &driver->target_list, list) {
-		if (!strcmp(target_name, target->name)) {
-			return target;
-		}
+	he = sto_hash_lookup(&driver->target_lookup_map, target_name, strlen(target_name));
+	if (!he) {
+		return NULL;
 	}
 
-	return NULL;
+	return SPDK_CONTAINEROF(he, struct scst_target, he);
 }
 
 struct scst_target_driver *
@@ -235,13 +253,24 @@ scst_target_alloc(struct scst_target_driver *driver, const char *name)
 
 	target->driver = driver;
 
-	TAILQ_INIT(&target->lun_list);
+	scst_lun_table_init(&target->lun_table);
 	TAILQ_INIT(&target->group_list);
 
+#define SCST_GROUP_LOOKUP_MAP_SIZE 16
+	if (spdk_unlikely(sto_hash_init(&target->group_lookup_map, SCST_GROUP_LOOKUP_MAP_SIZE))) {
+		SPDK_ERRLOG("Failed to initialize ini group lookup map for target %s\n", name);
+		goto free_name;
+	}
+
+	sto_hash_elem_init(&target->he, target->name, strlen(target->name));
+
 	return target;
 
+free_name:
+	free((char *) target->name);
+
 out_err:
-	scst_target_free(target);
+	free(target);
 
 	return NULL;
 }
@@ -249,6 +278,8 @@ out_err:
 static void
 scst_target_free(struct scst_target *target)
 {
+	scst_lun_table_deinit(&target->lun_table);
+	sto_hash_destroy(&target->group_lookup_map);
 	free((char *) target->name);
 	free(target);
 }
@@ -260,6 +291,7 @@ scst_target_destroy(struct scst_target *target)
 	struct scst_ini_group *ini_group, *tmp;
 
 	TAILQ_REMOVE(&driver->target_list, target, list);
+	sto_hash_elem_del(&target->he);
 
 	scst_put_target_driver(driver);
 
@@ -279,21 +311,21 @@ scst_target_next(struct scst_target_driver *driver, struct scst_target *target)
 static struct scst_ini_group *
 scst_target_find_ini_group(struct scst_target *target, const char *ini_group_name)
 {
-	struct scst_ini_group *ini_group;
+	struct sto_hash_elem *he;
 
-	TAILQ_FOREACH(ini_group, &target->group_list, list) {
-		if (!strcmp(ini_group_name, ini_group->name)) {
-			return ini_group;
-		}
+	he = sto_hash_lookup(&target->group_lookup_map, ini_group_name, strlen(ini_group_name));
+	if (!he) {
+		return NULL;
 	}
 
-	return NULL;
+	return SPDK_CONTAINEROF(he, struct scst_ini_group, he);
 }
 
 static int
 scst_target_add_ini_group(struct scst_target *target, const char *ini_group_name)
 {
 	struct scst_ini_group *ini_group;
+	int rc;
 
 	if (scst_target_find_ini_group(target, ini_group_name)) {
 		SPDK_ERRLOG("ini group `%s` has arleady been in target `%s`\n",
@@ -308,6 +340,14 @@ scst_target_add_ini_group(struct scst_target *target, const char *ini_group_name
 		return -ENOMEM;
 	}
 
+	rc = sto_hash_add(&target->group_lookup_map, &ini_group->he);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to index ini group `%s`, rc=%d\n",
+			    ini_group_name, rc);
+		scst_ini_group_free(ini_group);
+		return rc;
+	}
+
 	TAILQ_INSERT_TAIL(&target->group_list, ini_group, list);
 
 	SPDK_ERRLOG("SCST ini_group %s target [%s] was added\n",
@@ -336,19 +376,19 @@ scst_target_remove_ini_group(struct scst_target *target, const char *ini_group_n
 static inline struct scst_lun *
 scst_target_find_lun(struct scst_target *target, uint32_t lun_id)
 {
-	return scst_lun_list_find(&target->lun_list, lun_id);
+	return scst_lun_table_find(&target->lun_table, lun_id);
 }
 
 static inline int
 scst_target_add_lun(struct scst_target *target, struct scst_device *device, uint32_t lun_id)
 {
-	return scst_lun_list_add(&target->lun_list, device, lun_id);
+	return scst_lun_table_add(&target->lun_table, device, lun_id);
 }
 
 static inline int
 scst_target_remove_lun(struct scst_target *target, uint32_t lun_id)
 {
-	return scst_lun_list_remove(&target->lun_list, lun_id);
+	return scst_lun_table_remove(&target->lun_table, lun_id);
 }
 
 static struct scst_ini_group *
@@ -370,7 +410,9 @@ scst_ini_group_alloc(struct scst_target *target, const char *name)
 
 	ini_group->target = target;
 
-	TAILQ_INIT(&ini_group->lun_list);
+	scst_lun_table_init(&ini_group->lun_table);
+
+	sto_hash_elem_init(&ini_group->he, ini_group->name, strlen(ini_group->name));
 
 	return ini_group;
 
@@ -383,6 +425,7 @@ out_err:
 static void
 scst_ini_group_free(struct scst_ini_group *ini_group)
 {
+	scst_lun_table_deinit(&ini_group->lun_table);
 	free((char *) ini_group->name);
 	free(ini_group);
 }
@@ -393,6 +436,7 @@ scst_ini_group_destroy(struct scst_ini_group *ini_group)
 	struct scst_target *target = ini_group->target;
 
 	TAILQ_REMOVE(&target->group_list, ini_group, list);
+	sto_hash_elem_del(&ini_group->he);
 
 	scst_ini_group_free(ini_group);
 }
@@ -406,19 +450,19 @@ scst_ini_group_next(struct scst_target *target, struct scst_ini_group *ini_group
 static inline struct scst_lun *
 scst_ini_group_find_lun(struct scst_ini_group *group, uint32_t lun_id)
 {
-	return scst_lun_list_find(&group->lun_list, lun_id);
+	return scst_lun_table_find(&group->lun_table, lun_id);
 }
 
 static inline int
 scst_ini_group_add_lun(struct scst_ini_group *group, struct scst_device *device, uint32_t lun_id)
 {
-	return scst_lun_list_add(&group->lun_list, device, lun_id);
+	return scst_lun_table_add(&group->lun_table, device, lun_id);
 }
 
 static inline int
 scst_ini_group_remove_lun(struct scst_ini_group *group, uint32_t lun_id)
 {
-	return scst_lun_list_remove(&group->lun_list, lun_id);
+	return scst_lun_table_remove(&group->lun_table, lun_id);
 }
 
 static struct scst_lun *
@@ -445,37 +489,152 @@ scst_lun_free(struct scst_lun *lun)
 	free(lun);
 }
 
+static void
+scst_lun_table_init(struct scst_lun_table *table)
+{
+	memset(table, 0, sizeof(*table));
+}
+
+static void
+scst_lun_table_deinit(struct scst_lun_table *table)
+{
+	uint32_t i;
+
+	for (i = 0; i < table->size; i++) {
+		scst_lun_free(table->luns[i]);
+	}
+
+	free(table->luns);
+	free(table->used);
+
+	scst_lun_table_init(table);
+}
+
 static struct scst_lun *
-scst_lun_list_find(struct scst_lun_list *lun_list, uint32_t lun_id)
+scst_lun_table_find(struct scst_lun_table *table, uint32_t lun_id)
 {
-	struct scst_lun *lun;
+	return lun_id < table->size ? table->luns[lun_id] : NULL;
+}
+
+#define SCST_LUN_TABLE_WORD_BITS	64
+
+static inline uint32_t
+scst_lun_table_nr_words(uint32_t size)
+{
+	return SPDK_CEIL_DIV(size, SCST_LUN_TABLE_WORD_BITS);
+}
+
+static inline void
+scst_lun_table_set_used(struct scst_lun_table *table, uint32_t lun_id, bool used)
+{
+	uint64_t mask = 1ULL << (lun_id % SCST_LUN_TABLE_WORD_BITS);
+
+	if (used) {
+		table->used[lun_id / SCST_LUN_TABLE_WORD_BITS] |= mask;
+	} else {
+		table->used[lun_id / SCST_LUN_TABLE_WORD_BITS] &= ~mask;
+	}
+}
+
+static int
+scst_lun_table_grow(struct scst_lun_table *table, uint32_t lun_id)
+{
+	uint32_t nr_words, old_nr_words;
+	struct scst_lun **luns;
+	uint64_t *used;
+	uint32_t size;
+
+	size = spdk_max(table->size, 16U);
+	while (size <= lun_id) {
+		size *= 2;
+	}
 
-	TAILQ_FOREACH(lun, lun_list, list) {
-		if (lun_id == lun->id) {
-			return lun;
+	size = spdk_min(size, SCST_LUN_ID_MAX + 1);
+
+	luns = realloc(table->luns, size * sizeof(*luns));
+	if (spdk_unlikely(!luns)) {
+		SPDK_ERRLOG("Failed to grow LUN table up to %u\n", size);
+		return -ENOMEM;
+	}
+
+	memset(luns + table->size, 0, (size - table->size) * sizeof(*luns));
+	table->luns = luns;
+
+	nr_words = scst_lun_table_nr_words(size);
+	old_nr_words = scst_lun_table_nr_words(table->size);
+
+	used = realloc(table->used, nr_words * sizeof(*used));
+	if (spdk_unlikely(!used)) {
+		SPDK_ERRLOG("Failed to grow LUN bitmap up to %u\n", size);
+		return -ENOMEM;
+	}
+
+	memset(used + old_nr_words, 0, (nr_words - old_nr_words) * sizeof(*used));
+	table->used = used;
+
+	table->size = size;
+
+	return 0;
+}
+
+static int
+scst_lun_table_free_id(struct scst_lun_table *table, uint32_t *lun_id)
+{
+	uint32_t nr_words = scst_lun_table_nr_words(table->size);
+	uint32_t i, id = nr_words * SCST_LUN_TABLE_WORD_BITS;
+
+	/* Ids past the end of the bitmap are all free */
+	for (i = table->free_hint / SCST_LUN_TABLE_WORD_BITS; i < nr_words; i++) {
+		if (~table->used[i]) {
+			id = i * SCST_LUN_TABLE_WORD_BITS + __builtin_ctzll(~table->used[i]);
+			break;
 		}
 	}
 
-	return NULL;
+	if (spdk_unlikely(id > SCST_LUN_ID_MAX)) {
+		SPDK_ERRLOG("No free lun id left, max is %u\n", SCST_LUN_ID_MAX);
+		return -ENOSPC;
+	}
+
+	table->free_hint = id;
+	*lun_id = id;
+
+	return 0;
 }
 
 static int
-scst_lun_list_add(struct scst_lun_list *lun_list, struct scst_device *device, uint32_t lun_id)
+scst_lun_table_add(struct scst_lun_table *table, struct scst_device *device, uint32_t lun_id)
 {
 	struct scst_lun *lun;
+	int rc;
+
+	if (spdk_unlikely(lun_id > SCST_LUN_ID_MAX)) {
+		SPDK_ERRLOG("lun `%u` is out of range, max is %u\n", lun_id, SCST_LUN_ID_MAX);
+		return -EINVAL;
+	}
 
-	if (scst_lun_list_find(lun_list, lun_id)) {
+	if (scst_lun_table_find(table, lun_id)) {
 		SPDK_ERRLOG("lun `%u` has arleady presented in SCST\n", lun_id);
 		return -EEXIST;
 	}
 
+	if (lun_id >= table->size) {
+		rc = scst_lun_table_grow(table, lun_id);
+		if (spdk_unlikely(rc)) {
+			return rc;
+		}
+	}
+
 	lun = scst_lun_alloc(device, lun_id);
 	if (spdk_unlikely(!lun)) {
 		SPDK_ERRLOG("Failed to alloc lun `%u`\n", lun_id);
 		return -ENOMEM;
 	}
 
-	TAILQ_INSERT_TAIL(lun_list, lun, list);
+	table->luns[lun_id] = lun;
+	table->nr_luns++;
+
+	scst_lun_table_set_used(table, lun_id, true);
 
 	SPDK_ERRLOG("LUN %u device[%s] was added\n", lun_id, device->name);
 
@@ -483,17 +642,21 @@ scst_lun_list_add(struct scst_lun_list *lun_list, struct scst_device *device, ui
 }
 
 static int
-scst_lun_list_remove(struct scst_lun_list *lun_list, uint32_t lun_id)
+scst_lun_table_remove(struct scst_lun_table *table, uint32_t lun_id)
 {
 	struct scst_lun *lun;
 
-	lun = scst_lun_list_find(lun_list, lun_id);
+	lun = scst_lun_table_find(table, lun_id);
 	if (spdk_unlikely(!lun)) {
 		SPDK_ERRLOG("lun `%u` has not been presented in SCST\n", lun_id);
 		return -ENOENT;
 	}
 
-	TAILQ_REMOVE(lun_list, lun, list);
+	table->luns[lun_id] = NULL;
+	table->nr_luns--;
+
+	scst_lun_table_set_used(table, lun_id, false);
+	table->free_hint = spdk_min(table->free_hint, lun_id);
 
 	scst_lun_free(lun);
 
@@ -533,11 +696,41 @@ scst_create(void)
 		goto destroy_engine;
 	}
 
+#define SCST_OBJ_LOCK_MAP_SIZE 64
+	rc = sto_hash_init(&scst->obj_lock_map, SCST_OBJ_LOCK_MAP_SIZE);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to initialize SCST object lock map\n");
+		goto destroy_device_lookup_map;
+	}
+
+#define SCST_HANDLER_LOOKUP_MAP_SIZE 16
+	rc = sto_hash_init(&scst->handler_lookup_map, SCST_HANDLER_LOOKUP_MAP_SIZE);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to initialize SCST handler lookup map\n");
+		goto destroy_obj_lock_map;
+	}
+
+#define SCST_DRIVER_LOOKUP_MAP_SIZE 16
+	rc = sto_hash_init(&scst->driver_lookup_map, SCST_DRIVER_LOOKUP_MAP_SIZE);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to initialize SCST driver lookup map\n");
+		goto destroy_handler_lookup_map;
+	}
+
 	TAILQ_INIT(&scst->handler_list);
 	TAILQ_INIT(&scst->driver_list);
 
 	return scst;
 
+destroy_handler_lookup_map:
+	sto_hash_destroy(&scst->handler_lookup_map);
+
+destroy_obj_lock_map:
+	sto_hash_destroy(&scst->obj_lock_map);
+
+destroy_device_lookup_map:
+	sto_hash_destroy(&scst->device_lookup_map);
+
 destroy_engine:
 	sto_pipeline_engine_destroy(scst->engine);
 
@@ -576,6 +769,9 @@ scst_destroy(struct scst *scst)
 	scst_destroy_drivers(scst);
 	scst_destroy_handlers(scst);
 
+	sto_hash_destroy(&scst->driver_lookup_map);
+	sto_hash_destroy(&scst->handler_lookup_map);
+	sto_hash_destroy(&scst->obj_lock_map);
 	sto_hash_destroy(&scst->device_lookup_map);
 	sto_pipeline_engine_destroy(scst->engine);
 	free((char *) scst->config_path);
@@ -589,6 +785,303 @@ scst_pipeline(struct scst *scst, const struct sto_pipeline_properties *propertie
 	sto_pipeline_alloc_and_run(scst->engine, properties, cb_fn, cb_arg, priv);
 }
 
+typedef void (*scst_obj_lock_cb)(void *cb_arg);
+
+struct scst_obj_lock_waiter {
+	scst_obj_lock_cb cb_fn;
+	void *cb_arg;
+
+	TAILQ_ENTRY(scst_obj_lock_waiter) list;
+};
+
+/* Exists while the key is held, the waiters get it in FIFO order */
+struct scst_obj_lock {
+	char *key;
+
+	TAILQ_HEAD(, scst_obj_lock_waiter) waiters;
+
+	struct sto_hash_elem he;
+};
+
+static struct scst_obj_lock *
+scst_obj_lock_find(struct scst *scst, const char *key)
+{
+	struct sto_hash_elem *he;
+
+	he = sto_hash_lookup(&scst->obj_lock_map, key, strlen(key));
+	if (!he) {
+		return NULL;
+	}
+
+	return SPDK_CONTAINEROF(he, struct scst_obj_lock, he);
+}
+
+static int
+scst_obj_lock(struct scst *scst, const char *key, scst_obj_lock_cb cb_fn, void *cb_arg)
+{
+	struct scst_obj_lock_waiter *waiter;
+	struct scst_obj_lock *lock;
+	int rc;
+
+	lock = scst_obj_lock_find(scst, key);
+	if (lock) {
+		waiter = calloc(1, sizeof(*waiter));
+		if (spdk_unlikely(!waiter)) {
+			SPDK_ERRLOG("Failed to alloc waiter for SCST object %s\n", key);
+			return -ENOMEM;
+		}
+
+		waiter->cb_fn = cb_fn;
+		waiter->cb_arg = cb_arg;
+
+		TAILQ_INSERT_TAIL(&lock->waiters, waiter, list);
+
+		return 0;
+	}
+
+	lock = calloc(1, sizeof(*lock));
+	if (spdk_unlikely(!lock)) {
+		SPDK_ERRLOG("Failed to alloc lock for SCST object %s\n", key);
+		return -ENOMEM;
+	}
+
+	lock->key = strdup(key);
+	if (spdk_unlikely(!lock->key)) {
+		SPDK_ERRLOG("Failed to strdup SCST object key %s\n", key);
+		free(lock);
+		return -ENOMEM;
+	}
+
+	TAILQ_INIT(&lock->waiters);
+
+	sto_hash_elem_init(&lock->he, lock->key, strlen(lock->key));
+
+	rc = sto_hash_add(&scst->obj_lock_map, &lock->he);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to index lock for SCST object %s, rc=%d\n", key, rc);
+		free(lock->key);
+		free(lock);
+		return rc;
+	}
+
+	cb_fn(cb_arg);
+
+	return 0;
+}
+
+static void
+scst_obj_unlock(struct scst *scst, const char *key)
+{
+	struct scst_obj_lock_waiter *waiter;
+	struct scst_obj_lock *lock;
+
+	lock = scst_obj_lock_find(scst, key);
+	if (spdk_unlikely(!lock)) {
+		SPDK_ERRLOG("SCST object %s is not locked\n", key);
+		assert(0);
+		return;
+	}
+
+	waiter = TAILQ_FIRST(&lock->waiters);
+	if (waiter) {
+		TAILQ_REMOVE(&lock->waiters, waiter, list);
+
+		waiter->cb_fn(waiter->cb_arg);
+		free(waiter);
+
+		return;
+	}
+
+	sto_hash_elem_del(&lock->he);
+
+	free(lock->key);
+	free(lock);
+}
+
+void
+scst_op_keys_deinit(struct scst_op_keys *keys)
+{
+	int i;
+
+	free(keys->key);
+	keys->key = NULL;
+
+	for (i = 0; i < SCST_OP_MAX_DEPS; i++) {
+		free(keys->deps[i]);
+		keys->deps[i] = NULL;
+	}
+}
+
+/*
+ * The op takes its place in the queue of its own key as soon as it is
+ * submitted, so ops on one object run in the order they came in, even
+ * if an earlier one is still waiting for its dependencies. The pipeline
+ * starts once the deps have drained and the op holds its own key.
+ */
+struct scst_keyed_op {
+	struct scst *scst;
+	const struct sto_pipeline_properties *properties;
+	void *priv;
+
+	struct scst_op_keys keys;
+	int dep_idx;
+
+	bool key_locked;
+	bool deps_drained;
+	int rc;
+
+	sto_generic_cb cb_fn;
+	void *cb_arg;
+	struct spdk_thread *cb_thread;
+};
+
+static void
+scst_keyed_op_free(struct scst_keyed_op *op)
+{
+	scst_op_keys_deinit(&op->keys);
+	free(op);
+}
+
+static void
+scst_keyed_op_done(void *cb_arg, int rc)
+{
+	struct scst_keyed_op *op = cb_arg;
+
+	scst_obj_unlock(op->scst, op->keys.key);
+
+	sto_generic_call_on_thread(op->cb_thread, op->cb_fn, op->cb_arg, rc);
+
+	scst_keyed_op_free(op);
+}
+
+static void
+scst_keyed_op_run(struct scst_keyed_op *op)
+{
+	if (!op->key_locked || !op->deps_drained) {
+		return;
+	}
+
+	if (spdk_unlikely(op->rc)) {
+		scst_keyed_op_done(op, op->rc);
+		return;
+	}
+
+	scst_pipeline(op->scst, op->properties, scst_keyed_op_done, op, op->priv);
+}
+
+static void
+scst_keyed_op_key_locked(void *cb_arg)
+{
+	struct scst_keyed_op *op = cb_arg;
+
+	op->key_locked = true;
+
+	scst_keyed_op_run(op);
+}
+
+static void scst_keyed_op_wait_deps(struct scst_keyed_op *op);
+
+/* A dependency is only waited for, it is released right away */
+static void
+scst_keyed_op_dep_locked(void *cb_arg)
+{
+	struct scst_keyed_op *op = cb_arg;
+
+	scst_obj_unlock(op->scst, op->keys.deps[op->dep_idx++]);
+
+	scst_keyed_op_wait_deps(op);
+}
+
+static void
+scst_keyed_op_wait_deps(struct scst_keyed_op *op)
+{
+	int rc;
+
+	if (op->dep_idx < SCST_OP_MAX_DEPS && op->keys.deps[op->dep_idx]) {
+		rc = scst_obj_lock(op->scst, op->keys.deps[op->dep_idx],
+				   scst_keyed_op_dep_locked, op);
+		if (spdk_likely(!rc)) {
+			return;
+		}
+
+		/* The own key is already queued, so fail once it's handed over */
+		op->rc = rc;
+	}
+
+	op->deps_drained = true;
+
+	scst_keyed_op_run(op);
+}
+
+static void
+scst_keyed_op_start(struct scst_keyed_op *op)
+{
+	int rc;
+
+	rc = scst_obj_lock(op->scst, op->keys.key, scst_keyed_op_key_locked, op);
+	if (spdk_unlikely(rc)) {
+		sto_generic_call_on_thread(op->cb_thread, op->cb_fn, op->cb_arg, rc);
+		scst_keyed_op_free(op);
+		return;
+	}
+
+	scst_keyed_op_wait_deps(op);
+}
+
+static void
+scst_keyed_op_start_msg(void *ctx)
+{
+	scst_keyed_op_start(ctx);
+}
+
+/*
+ * The object locks are SCST state as well, so an op submitted from
+ * another thread takes them on the engine thread and is called back
+ * on its own one.
+ */
+void
+scst_pipeline_keyed(struct scst *scst, const struct sto_pipeline_properties *properties,
+		    struct scst_op_keys *keys, sto_generic_cb cb_fn, void *cb_arg, void *priv)
+{
+	struct scst_keyed_op *op;
+	int rc;
+
+	if (spdk_unlikely(!keys->key)) {
+		SPDK_ERRLOG("Failed to alloc SCST object key\n");
+		scst_op_keys_deinit(keys);
+		cb_fn(cb_arg, -ENOMEM);
+		return;
+	}
+
+	op = calloc(1, sizeof(*op));
+	if (spdk_unlikely(!op)) {
+		SPDK_ERRLOG("Failed to alloc SCST keyed op\n");
+		scst_op_keys_deinit(keys);
+		cb_fn(cb_arg, -ENOMEM);
+		return;
+	}
+
+	op->scst = scst;
+	op->properties = properties;
+	op->priv = priv;
+	op->keys = *keys;
+	op->cb_fn = cb_fn;
+	op->cb_arg = cb_arg;
+	op->cb_thread = spdk_get_thread();
+
+	if (op->cb_thread == scst->engine->thread) {
+		scst_keyed_op_start(op);
+		return;
+	}
+
+	rc = spdk_thread_send_msg(scst->engine->thread, scst_keyed_op_start_msg, op);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to send SCST keyed op to the engine thread, rc=%d\n", rc);
+		cb_fn(cb_arg, rc);
+		scst_keyed_op_free(op);
+	}
+}
+
 static char *
 scst_available_attrs_line(char **lines, const char *prefix)
 {
@@ -669,7 +1162,7 @@ struct read_available_attrs_ctx {
 };
 
 static void
-read_available_attrs_done(void *priv, char *buf, int rc)
+read_available_attrs_done(void *priv, const char *buf, size_t len, int rc)
 {
 	struct read_available_attrs_ctx *ctx = priv;
 
@@ -688,8 +1181,6 @@ read_available_attrs_done(void *priv, char *buf, int rc)
 out:
 	ctx->cb_fn(ctx->cb_arg, rc);
 	free(ctx);
-
-	free(buf);
 }
 
 void
@@ -710,7 +1201,7 @@ scst_read_available_attrs(const char *mgmt_path, const char *prefix,
 	ctx->prefix = prefix;
 	ctx->available_attrs = available_attrs;
 
-	sto_rpc_readfile(mgmt_path, 0, read_available_attrs_done, ctx);
+	sto_rpc_readfile_view(mgmt_path, 0, read_available_attrs_done, ctx);
 }
 
 void
@@ -860,6 +1351,11 @@ out:
 void
 scst_read_attrs(const char *dirpath, scst_read_attrs_done_t cb_fn, void *cb_arg)
 {
+	struct sto_tree_opts opts = {
+		.dirpath = dirpath,
+		.depth = 1,
+		.use_arena = true,
+	};
 	struct read_attrs_ctx *ctx;
 
 	ctx = calloc(1, sizeof(*ctx));
@@ -872,21 +1368,20 @@ scst_read_attrs(const char *dirpath, scst_read_attrs_done_t cb_fn, void *cb_arg)
 	ctx->cb_fn = cb_fn;
 	ctx->cb_arg = cb_arg;
 
-	sto_tree(dirpath, 1, false, read_attrs_done, ctx);
+	sto_tree(&opts, read_attrs_done, ctx);
 }
 
 static struct scst_device_handler *
 scst_find_device_handler(struct scst *scst, const char *handler_name)
 {
-	struct scst_device_handler *handler;
+	struct sto_hash_elem *he;
 
-	TAILQ_FOREACH(handler, &scst->handler_list, list) {
-		if (!strcmp(handler_name, handler->name)) {
-			return handler;
-		}
+	he = sto_hash_lookup(&scst->handler_lookup_map, handler_name, strlen(handler_name));
+	if (!he) {
+		return NULL;
 	}
 
-	return NULL;
+	return SPDK_CONTAINEROF(he, struct scst_device_handler, he);
 }
 
 static struct scst_device_handler *
@@ -903,6 +1398,13 @@ scst_get_device_handler(struct scst *scst, const char *handler_name)
 			return NULL;
 		}
 
+		if (spdk_unlikely(sto_hash_add(&scst->handler_lookup_map, &handler->he))) {
+			SPDK_ERRLOG("Failed to index %s handler\n",
+				    handler_name);
+			scst_device_handler_free(handler);
+			return NULL;
+		}
+
 		TAILQ_INSERT_TAIL(&scst->handler_list, handler, list);
 	}
 
@@ -921,6 +1423,7 @@ scst_put_device_handler(struct scst_device_handler *handler)
 
 	if (ref_cnt == 0) {
 		TAILQ_REMOVE(&scst->handler_list, handler, list);
+		sto_hash_elem_del(&handler->he);
 		scst_device_handler_free(handler);
 	}
 }
@@ -943,6 +1446,7 @@ scst_add_device(struct scst *scst, const char *handler_name, const char *device_
 {
 	struct scst_device_handler *handler;
 	struct scst_device *device;
+	int rc;
 
 	if (scst_find_device(scst, device_name)) {
 		SPDK_ERRLOG("SCST device %s is already exist\n", device_name);
@@ -958,22 +1462,30 @@ scst_add_device(struct scst *scst, const char *handler_name, const char *device_
 	device = scst_device_alloc(handler, device_name);
 	if (spdk_unlikely(!device)) {
 		SPDK_ERRLOG("Failed to alloc %s SCST device\n", device_name);
+		rc = -ENOMEM;
 		goto put_handler;
 	}
 
-	TAILQ_INSERT_TAIL(&handler->device_list, device, list);
+	rc = sto_hash_add(&scst->device_lookup_map, &device->he);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to index %s SCST device, rc=%d\n", device_name, rc);
+		goto free_device;
+	}
 
-	sto_hash_add(&scst->device_lookup_map, &device->he);
+	TAILQ_INSERT_TAIL(&handler->device_list, device, list);
 
 	SPDK_ERRLOG("SCST device %s handler [%s] was added\n",
 		    device->name, handler->name);
 
 	return 0;
 
+free_device:
+	scst_device_free(device);
+
 put_handler:
 	scst_put_device_handler(handler);
 
-	return -ENOMEM;
+	return rc;
 }
 
 int
@@ -996,15 +1508,14 @@ scst_remove_device(struct scst *scst, const char *device_name)
 static struct scst_target_driver *
 scst_find_target_driver(struct scst *scst, const char *driver_name)
 {
-	struct scst_target_driver *driver;
+	struct sto_hash_elem *he;
 
-	TAILQ_FOREACH(driver, &scst->driver_list, list) {
-		if (!strcmp(driver_name, driver->name)) {
-			return driver;
-		}
+	he = sto_hash_lookup(&scst->driver_lookup_map, driver_name, strlen(driver_name));
+	if (!he) {
+		return NULL;
 	}
 
-	return NULL;
+	return SPDK_CONTAINEROF(he, struct scst_target_driver, he);
 }
 
 static struct scst_target_driver *
@@ -1021,6 +1532,13 @@ scst_get_target_driver(struct scst *scst, const char *driver_name)
 			return NULL;
 		}
 
+		if (spdk_unlikely(sto_hash_add(&scst->driver_lookup_map, &driver->he))) {
+			SPDK_ERRLOG("Failed to index %s driver\n",
+				    driver_name);
+			scst_target_driver_free(driver);
+			return NULL;
+		}
+
 		TAILQ_INSERT_TAIL(&scst->driver_list, driver, list);
 	}
 
@@ -1039,6 +1557,7 @@ scst_put_target_driver(struct scst_target_driver *driver)
 
 	if (ref_cnt == 0) {
 		TAILQ_REMOVE(&scst->driver_list, driver, list);
+		sto_hash_elem_del(&driver->he);
 		scst_target_driver_free(driver);
 	}
 }
@@ -1061,6 +1580,7 @@ scst_add_target(struct scst *scst, const char *driver_name, const char *target_n
 {
 	struct scst_target_driver *driver;
 	struct scst_target *target;
+	int rc;
 
 	if (scst_find_target(scst, driver_name, target_name)) {
 		SPDK_ERRLOG("SCST target %s is already exist\n", target_name);
@@ -1076,9 +1596,16 @@ scst_add_target(struct scst *scst, const char *driver_name, const char *target_n
 	target = scst_target_alloc(driver, target_name);
 	if (spdk_unlikely(!target)) {
 		SPDK_ERRLOG("Failed to alloc %s SCST target\n", target_name);
+		rc = -ENOMEM;
 		goto put_handler;
 	}
 
+	rc = sto_hash_add(&driver->target_lookup_map, &target->he);
+	if (spdk_unlikely(rc)) {
+		SPDK_ERRLOG("Failed to index %s SCST target, rc=%d\n", target_name, rc);
+		goto free_target;
+	}
+
 	TAILQ_INSERT_TAIL(&driver->target_list, target, list);
 
 	SPDK_ERRLOG("SCST target %s driver [%s] was added\n",
@@ -1086,10 +1613,13 @@ scst_add_target(struct scst *scst, const char *driver_name, const char *target_n
 
 	return 0;
 
+free_target:
+	scst_target_free(target);
+
 put_handler:
 	scst_put_target_driver(driver);
 
-	return -ENOMEM;
+	return rc;
 }
 
 int
@@ -1180,6 +1710,34 @@ scst_find_lun(struct scst *scst, const char *driver_name,
 	}
 }
 
+int
+scst_find_free_lun_id(struct scst *scst, const char *driver_name,
+		      const char *target_name, const char *ini_group_name,
+		      uint32_t *lun_id)
+{
+	if (ini_group_name) {
+		struct scst_ini_group *group;
+
+		group = scst_find_ini_group(scst, driver_name, target_name, ini_group_name);
+		if (spdk_unlikely(!group)) {
+			SPDK_ERRLOG("Cann't find SCST ini group %s\n", ini_group_name);
+			return -ENOENT;
+		}
+
+		return scst_lun_table_free_id(&group->lun_table, lun_id);
+	} else {
+		struct scst_target *target;
+
+		target = scst_find_target(scst, driver_name, target_name);
+		if (spdk_unlikely(!target)) {
+			SPDK_ERRLOG("Cann't find SCST target %s\n", target_name);
+			return -ENOENT;
+		}
+
+		return scst_lun_table_free_id(&target->lun_table, lun_id);
+	}
+}
+
 int
 scst_add_lun(struct scst *scst, const char *driver_name,
 	     const char *target_name, const char *ini_group_name,
@@ -57,26 +57,40 @@ struct scst_device_handler {
 	TAILQ_HEAD(, scst_device) device_list;
 	int ref_cnt;
 
+	struct sto_hash_elem he;
 	TAILQ_ENTRY(scst_device_handler) list;
 };
 
+/* SCST takes LUN numbers up to 16383 */
+#define SCST_LUN_ID_MAX	16383
+
 struct scst_lun {
 	uint32_t id;
 
 	struct scst_device *device;
-
-	TAILQ_ENTRY(scst_lun) list;
 };
 
-TAILQ_HEAD(scst_lun_list, scst_lun);
+/*
+ * LUNs indexed by their id, the array grows up to the highest id in use.
+ * The bitmap marks the ids in use, and no id below free_hint is free,
+ * so a free id is found by scanning the bitmap words from the hint.
+ */
+struct scst_lun_table {
+	struct scst_lun **luns;
+	uint64_t *used;
+	uint32_t size;
+	uint32_t nr_luns;
+	uint32_t free_hint;
+};
 
 struct scst_ini_group {
 	const char *name;
 
 	struct scst_target *target;
 
-	struct scst_lun_list lun_list;
+	struct scst_lun_table lun_table;
 
+	struct sto_hash_elem he;
 	TAILQ_ENTRY(scst_ini_group) list;
 };
 
@@ -85,9 +99,12 @@ struct scst_target {
 
 	struct scst_target_driver *driver;
 
-	struct scst_lun_list lun_list;
+	struct scst_lun_table lun_table;
+
 	TAILQ_HEAD(, scst_ini_group) group_list;
+	struct sto_hash group_lookup_map;
 
+	struct sto_hash_elem he;
 	TAILQ_ENTRY(scst_target) list;
 };
 
@@ -97,8 +114,10 @@ struct scst_target_driver {
 	struct scst *scst;
 
 	TAILQ_HEAD(, scst_target) target_list;
+	struct sto_hash target_lookup_map;
 	int ref_cnt;
 
+	struct sto_hash_elem he;
 	TAILQ_ENTRY(scst_target_driver) list;
 };
 
@@ -110,7 +129,12 @@ struct scst {
 	TAILQ_HEAD(, scst_device_handler) handler_list;
 	TAILQ_HEAD(, scst_target_driver) driver_list;
 
+	struct sto_hash handler_lookup_map;
+	struct sto_hash driver_lookup_map;
 	struct sto_hash device_lookup_map;
+
+	/* Locks of the objects being changed, see scst_pipeline_keyed() */
+	struct sto_hash obj_lock_map;
 };
 
 struct scst_device_handler *scst_device_handler_next(struct scst *scst, struct scst_device_handler *handler);
@@ -201,6 +225,51 @@ void scst_destroy(struct scst *scst);
 void scst_pipeline(struct scst *scst, const struct sto_pipeline_properties *properties,
 		   sto_generic_cb cb_fn, void *cb_arg, void *priv);
 
+#define SCST_OP_MAX_DEPS	2
+
+/*
+ * Keys of the objects an op works on. The op holds @key while it runs,
+ * so the ops on the same object execute in the order they came in. The
+ * @deps are the objects it needs to exist: the op queues up on @key
+ * first and then waits for the ops queued on the deps before it runs.
+ */
+struct scst_op_keys {
+	char *key;
+	char *deps[SCST_OP_MAX_DEPS];
+};
+
+void scst_op_keys_deinit(struct scst_op_keys *keys);
+
+static inline char *
+scst_device_key(const char *device_name)
+{
+	return spdk_sprintf_alloc("device/%s", device_name);
+}
+
+static inline char *
+scst_target_key(const char *driver_name, const char *target_name)
+{
+	return spdk_sprintf_alloc("target/%s/%s", driver_name, target_name);
+}
+
+static inline char *
+scst_ini_group_key(const char *driver_name, const char *target_name, const char *ini_group_name)
+{
+	return spdk_sprintf_alloc("ini_group/%s/%s/%s", driver_name, target_name, ini_group_name);
+}
+
+static inline char *
+scst_lun_key(const char *driver_name, const char *target_name,
+	     const char *ini_group_name, uint32_t lun_id)
+{
+	return spdk_sprintf_alloc("lun/%s/%s/%s/%u", driver_name, target_name,
+				  ini_group_name, lun_id);
+}
+
+/* Takes over @keys, they are freed once the op is done */
+void scst_pipeline_keyed(struct scst *scst, const struct sto_pipeline_properties *properties,
+			 struct scst_op_keys *keys, sto_generic_cb cb_fn, void *cb_arg, void *priv);
+
 void scst_read_available_attrs(const char *mgmt_path, const char *prefix,
 			       sto_generic_cb cb_fn, void *cb_arg, char ***available_attrs);
 void scst_available_attrs_print(char **available_attrs);
@@ -230,6 +299,9 @@ int scst_remove_ini_group(struct scst *scst, const char *driver_name,
 struct scst_lun *scst_find_lun(struct scst *scst, const char *driver_name,
 			       const char *target_name, const char *ini_group_name,
 			       uint32_t lun_id);
+int scst_find_free_lun_id(struct scst *scst, const char *driver_name,
+			  const char *target_name, const char *ini_group_name,
+			  uint32_t *lun_id);
 int scst_add_lun(struct scst *scst, const char *driver_name,
 		 const char *target_name, const char *ini_group_name,
 		 const char *device_name, uint32_t lun_id);
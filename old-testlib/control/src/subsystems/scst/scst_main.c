@@ -165,10 +165,21 @@ static const struct sto_pipeline_properties scst_device_open_properties = {
 	},
 };
 
+static void
+device_op_keys_init(struct scst_device_params *params, struct scst_op_keys *keys)
+{
+	keys->key = scst_device_key(params->device_name);
+}
+
 void
 scst_device_open(struct scst_device_params *params, sto_generic_cb cb_fn, void *cb_arg)
 {
-	scst_pipeline(scst_get_instance(), &scst_device_open_properties, cb_fn, cb_arg, params);
+	struct scst_op_keys keys = {};
+
+	device_op_keys_init(params, &keys);
+
+	scst_pipeline_keyed(scst_get_instance(), &scst_device_open_properties, &keys,
+			    cb_fn, cb_arg, params);
 }
 
 static void
@@ -207,7 +218,12 @@ static const struct sto_pipeline_properties scst_device_close_properties = {
 void
 scst_device_close(struct scst_device_params *params, sto_generic_cb cb_fn, void *cb_arg)
 {
-	scst_pipeline(scst_get_instance(), &scst_device_close_properties, cb_fn, cb_arg, params);
+	struct scst_op_keys keys = {};
+
+	device_op_keys_init(params, &keys);
+
+	scst_pipeline_keyed(scst_get_instance(), &scst_device_close_properties, &keys,
+			    cb_fn, cb_arg, params);
 }
 
 void
@@ -344,10 +360,21 @@ static const struct sto_pipeline_properties scst_target_add_properties = {
 	},
 };
 
+static void
+target_op_keys_init(struct scst_target_params *params, struct scst_op_keys *keys)
+{
+	keys->key = scst_target_key(params->driver_name, params->target_name);
+}
+
 void
 scst_target_add(struct scst_target_params *params, sto_generic_cb cb_fn, void *cb_arg)
 {
-	scst_pipeline(scst_get_instance(), &scst_target_add_properties, cb_fn, cb_arg, params);
+	struct scst_op_keys keys = {};
+
+	target_op_keys_init(params, &keys);
+
+	scst_pipeline_keyed(scst_get_instance(), &scst_target_add_properties, &keys,
+			    cb_fn, cb_arg, params);
 }
 
 static void
@@ -386,7 +413,12 @@ static const struct sto_pipeline_properties scst_target_del_properties = {
 void
 scst_target_del(struct scst_target_params *params, sto_generic_cb cb_fn, void *cb_arg)
 {
-	scst_pipeline(scst_get_instance(), &scst_target_del_properties, cb_fn, cb_arg, params);
+	struct scst_op_keys keys = {};
+
+	target_op_keys_init(params, &keys);
+
+	scst_pipeline_keyed(scst_get_instance(), &scst_target_del_properties, &keys,
+			    cb_fn, cb_arg, params);
 }
 
 void
@@ -528,10 +560,31 @@ static const struct sto_pipeline_properties scst_ini_group_add_properties = {
 	},
 };
 
+/* The group lives in the target, so it waits for the ops queued on it */
+static void
+ini_group_op_keys_init(struct scst_ini_group_params *params, struct scst_op_keys *keys)
+{
+	keys->key = scst_ini_group_key(params->driver_name, params->target_name,
+				       params->ini_group_name);
+	if (spdk_unlikely(!keys->key)) {
+		return;
+	}
+
+	keys->deps[0] = scst_target_key(params->driver_name, params->target_name);
+	if (spdk_unlikely(!keys->deps[0])) {
+		scst_op_keys_deinit(keys);
+	}
+}
+
 void
 scst_ini_group_add(struct scst_ini_group_params *params, sto_generic_cb cb_fn, void *cb_arg)
 {
-	scst_pipeline(scst_get_instance(), &scst_ini_group_add_properties, cb_fn, cb_arg, params);
+	struct scst_op_keys keys = {};
+
+	ini_group_op_keys_init(params, &keys);
+
+	scst_pipeline_keyed(scst_get_instance(), &scst_ini_group_add_properties, &keys,
+			    cb_fn, cb_arg, params);
 }
 
 static void
@@ -572,7 +625,12 @@ static const struct sto_pipeline_properties scst_ini_group_del_properties = {
 void
 scst_ini_group_del(struct scst_ini_group_params *params, sto_generic_cb cb_fn, void *cb_arg)
 {
-	scst_pipeline(scst_get_instance(), &scst_ini_group_del_properties, cb_fn, cb_arg, params);
+	struct scst_op_keys keys = {};
+
+	ini_group_op_keys_init(params, &keys);
+
+	scst_pipeline_keyed(scst_get_instance(), &scst_ini_group_del_properties, &keys,
+			    cb_fn, cb_arg, params);
 }
 
 void
@@ -691,52 +749,128 @@ lun_del(struct scst_lun_params *params, sto_generic_cb cb_fn, void *cb_arg)
 	sto_rpc_writefile_args(&args, cb_fn, cb_arg);
 }
 
+/*
+ * The LUN is put in the table before it is written to SCST, so an auto
+ * id picked by another lun_add can't collide with one still in flight.
+ */
 static void
-lun_add_step(struct sto_pipeline *pipe)
+lun_add_cfg_step(struct sto_pipeline *pipe)
 {
 	struct scst_lun_params *params = sto_pipeline_get_priv(pipe);
+	struct scst *scst = scst_get_instance();
+	int rc;
 
-	if (scst_find_lun(scst_get_instance(), params->driver_name, params->target_name,
-			  params->ini_group_name, params->lun_id)) {
+	if (params->lun_id_auto) {
+		rc = scst_find_free_lun_id(scst, params->driver_name, params->target_name,
+					   params->ini_group_name, &params->lun_id);
+		if (spdk_unlikely(rc)) {
+			sto_pipeline_step_next(pipe, rc);
+			return;
+		}
+	} else if (scst_find_lun(scst, params->driver_name, params->target_name,
+				 params->ini_group_name, params->lun_id)) {
 		sto_pipeline_step_next(pipe, -EEXIST);
 		return;
 	}
 
-	lun_add(params, sto_pipeline_step_done, pipe);
+	rc = scst_add_lun(scst, params->driver_name, params->target_name,
+			  params->ini_group_name, params->device_name, params->lun_id);
+
+	sto_pipeline_step_next(pipe, rc);
 }
 
 static void
-lun_add_rollback_step(struct sto_pipeline *pipe)
+lun_add_cfg_rollback_step(struct sto_pipeline *pipe)
 {
 	struct scst_lun_params *params = sto_pipeline_get_priv(pipe);
+	int rc;
 
-	lun_del(params, sto_pipeline_step_done, pipe);
+	rc = scst_remove_lun(scst_get_instance(), params->driver_name, params->target_name,
+			     params->ini_group_name, params->lun_id);
+	assert(!rc);
+
+	sto_pipeline_step_next(pipe, rc);
 }
 
 static void
-lun_add_cfg_step(struct sto_pipeline *pipe)
+lun_add_step(struct sto_pipeline *pipe)
 {
 	struct scst_lun_params *params = sto_pipeline_get_priv(pipe);
-	int rc;
-
-	rc = scst_add_lun(scst_get_instance(), params->driver_name, params->target_name,
-			  params->ini_group_name, params->device_name, params->lun_id);
 
-	sto_pipeline_step_next(pipe, rc);
+	lun_add(params, sto_pipeline_step_done, pipe);
 }
 
 static const struct sto_pipeline_properties scst_lun_add_properties = {
 	.steps = {
-		STO_PL_STEP(lun_add_step, lun_add_rollback_step),
-		STO_PL_STEP(lun_add_cfg_step, NULL),
+		STO_PL_STEP(lun_add_cfg_step, lun_add_cfg_rollback_step),
+		STO_PL_STEP(lun_add_step, NULL),
 		STO_PL_STEP_TERMINATOR(),
 	},
 };
 
+static inline char *
+lun_parent_key(struct scst_lun_params *params)
+{
+	if (params->ini_group_name) {
+		return scst_ini_group_key(params->driver_name, params->target_name,
+					  params->ini_group_name);
+	}
+
+	return scst_target_key(params->driver_name, params->target_name);
+}
+
+/*
+ * A LUN waits for the ops queued on the group (or the target if it has
+ * no group) it is added to, and lun_add also waits for the device, so
+ * it never races with a device_open still in flight. A lun_add with an
+ * auto id has no LUN key yet, so it queues on the group key itself.
+ */
+static void
+lun_op_keys_init(struct scst_lun_params *params, struct scst_op_keys *keys, bool with_device)
+{
+	const char *ini_group_name = params->ini_group_name ? params->ini_group_name : "";
+	int dep_idx = 0;
+
+	if (params->lun_id_auto) {
+		keys->key = lun_parent_key(params);
+	} else {
+		keys->key = scst_lun_key(params->driver_name, params->target_name,
+					 ini_group_name, params->lun_id);
+	}
+
+	if (spdk_unlikely(!keys->key)) {
+		return;
+	}
+
+	if (!params->lun_id_auto) {
+		keys->deps[dep_idx] = lun_parent_key(params);
+		if (spdk_unlikely(!keys->deps[dep_idx++])) {
+			goto out_err;
+		}
+	}
+
+	if (with_device && params->device_name) {
+		keys->deps[dep_idx] = scst_device_key(params->device_name);
+		if (spdk_unlikely(!keys->deps[dep_idx])) {
+			goto out_err;
+		}
+	}
+
+	return;
+
+out_err:
+	scst_op_keys_deinit(keys);
+}
+
 void
 scst_lun_add(struct scst_lun_params *params, sto_generic_cb cb_fn, void *cb_arg)
 {
-	scst_pipeline(scst_get_instance(), &scst_lun_add_properties, cb_fn, cb_arg, params);
+	struct scst_op_keys keys = {};
+
+	lun_op_keys_init(params, &keys, true);
+
+	scst_pipeline_keyed(scst_get_instance(), &scst_lun_add_properties, &keys,
+			    cb_fn, cb_arg, params);
 }
 
 static void
@@ -777,7 +911,12 @@ static const struct sto_pipeline_properties scst_lun_del_properties = {
 void
 scst_lun_del(struct scst_lun_params *params, sto_generic_cb cb_fn, void *cb_arg)
 {
-	scst_pipeline(scst_get_instance(), &scst_lun_del_properties, cb_fn, cb_arg, params);
+	struct scst_op_keys keys = {};
+
+	lun_op_keys_init(params, &keys, false);
+
+	scst_pipeline_keyed(scst_get_instance(), &scst_lun_del_properties, &keys,
+			    cb_fn, cb_arg, params);
 }
 
 static void
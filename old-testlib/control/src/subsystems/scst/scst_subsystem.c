@@ -805,7 +805,7 @@ const struct sto_req_properties scst_ini_group_del_req_properties = {
 };
 
 struct lun_add_ops_params {
-	int lun;
+	char *lun;
 	char *driver;
 	char *target;
 	char *device;
@@ -814,7 +814,7 @@ struct lun_add_ops_params {
 };
 
 static const struct sto_ops_param_dsc lun_add_ops_params_descriptors[] = {
-	STO_OPS_PARAM_INT32(lun, struct lun_add_ops_params, "LUN number"),
+	STO_OPS_PARAM_STR_OPTIONAL(lun, struct lun_add_ops_params, "LUN number, the lowest free one if omitted"),
 	STO_OPS_PARAM_STR(driver, struct lun_add_ops_params, "SCST target driver name"),
 	STO_OPS_PARAM_STR(target, struct lun_add_ops_params, "SCST target name"),
 	STO_OPS_PARAM_STR(device, struct lun_add_ops_params, "SCST device name"),
@@ -831,7 +831,18 @@ lun_add_req_constructor(void *arg1, const void *arg2)
 	struct scst_lun_params *req_params = arg1;
 	struct lun_add_ops_params *ops_params = (void *) arg2;
 
-	req_params->lun_id = ops_params->lun;
+	if (ops_params->lun) {
+		long long lun_id = spdk_strtoll(ops_params->lun, 10);
+
+		if (spdk_unlikely(lun_id < 0 || lun_id > SCST_LUN_ID_MAX)) {
+			SPDK_ERRLOG("Invalid lun `%s`\n", ops_params->lun);
+			return -EINVAL;
+		}
+
+		req_params->lun_id = lun_id;
+	} else {
+		req_params->lun_id_auto = true;
+	}
 
 	req_params->driver_name = ops_params->driver;
 	ops_params->driver = NULL;
@@ -861,13 +872,26 @@ lun_add_req_step(struct sto_pipeline *pipe)
 	scst_lun_add(params, sto_pipeline_step_done, pipe);
 }
 
+static void
+lun_add_req_response(struct sto_req *req, struct spdk_json_write_ctx *w)
+{
+	struct scst_lun_params *params = sto_req_get_params(req);
+
+	spdk_json_write_object_begin(w);
+
+	spdk_json_write_named_string(w, "status", "OK");
+	spdk_json_write_named_uint32(w, "lun", params->lun_id);
+
+	spdk_json_write_object_end(w);
+}
+
 static void lun_del_req_step(struct sto_pipeline *pipe);
 
 const struct sto_req_properties lun_add_req_properties = {
 	.params_size = sizeof(struct scst_lun_params),
 	.params_deinit_fn = scst_lun_params_deinit,
 
-	.response = sto_dummy_req_response,
+	.response = lun_add_req_response,
 	.steps = {
 		STO_PL_STEP(lun_add_req_step, lun_del_req_step),
 		STO_PL_STEP(scst_write_config_step, NULL),
@@ -896,7 +920,7 @@ static int
 lun_del_req_constructor(void *arg1, const void *arg2)
 {
 	struct scst_lun_params *req_params = arg1;
-	struct lun_add_ops_params *ops_params = (void *) arg2;
+	struct lun_del_ops_params *ops_params = (void *) arg2;
 
 	req_params->lun_id = ops_params->lun;
 
@@ -933,11 +957,32 @@ const struct sto_req_properties lun_del_req_properties = {
 	}
 };
 
+struct lun_replace_ops_params {
+	int lun;
+	char *driver;
+	char *target;
+	char *device;
+	char *group;
+	char *attributes;
+};
+
+static const struct sto_ops_param_dsc lun_replace_ops_params_descriptors[] = {
+	STO_OPS_PARAM_INT32(lun, struct lun_replace_ops_params, "LUN number"),
+	STO_OPS_PARAM_STR(driver, struct lun_replace_ops_params, "SCST target driver name"),
+	STO_OPS_PARAM_STR(target, struct lun_replace_ops_params, "SCST target name"),
+	STO_OPS_PARAM_STR(device, struct lun_replace_ops_params, "SCST device name"),
+	STO_OPS_PARAM_STR_OPTIONAL(group, struct lun_replace_ops_params, "SCST group name"),
+	STO_OPS_PARAM_STR_OPTIONAL(attributes, struct lun_replace_ops_params, "SCST device attributes <p=v,...>"),
+};
+
+static const struct sto_ops_params_properties lun_replace_ops_params_properties =
+	STO_OPS_PARAMS_INITIALIZER(lun_replace_ops_params_descriptors, struct lun_replace_ops_params);
+
 static int
 scst_lun_replace_constructor(void *arg1, const void *arg2)
 {
 	struct sto_write_req_params *req_params = arg1;
-	const struct lun_add_ops_params *ops_params = arg2;
+	const struct lun_replace_ops_params *ops_params = arg2;
 	char *data;
 
 	req_params->file = scst_target_lun_mgmt_path(ops_params->driver,
@@ -1181,7 +1226,7 @@ static const struct sto_ops scst_ops[] = {
 	{
 		.name = "lun_replace",
 		.description = "Adds a given device to a group",
-		.params_properties = &lun_add_ops_params_properties,
+		.params_properties = &lun_replace_ops_params_properties,
 		.req_properties = &sto_write_req_properties,
 		.req_params_constructor = scst_lun_replace_constructor,
 	},
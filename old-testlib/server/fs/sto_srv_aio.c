@@ -6,8 +6,13 @@
 #include "sto_exec.h"
 #include "sto_srv_fs.h"
 #include "sto_srv_aio.h"
+#include "sto_srv_uring.h"
+#include "sto_shm.h"
 #include "sto_async.h"
 
+/* Max entries of one parallel multi file req kept in flight at once */
+#define STO_SRV_MULTI_FILE_WINDOW	64
+
 struct sto_srv_writefile_params {
 	char *filepath;
 	int oflag;
@@ -38,10 +43,15 @@ static struct sto_exec_ops srv_writefile_ops = {
 	.exec_done = sto_srv_writefile_exec_done,
 };
 
+/*
+ * "buf" goes last in the decoders so that binary framing callers, which
+ * pass the payload separately, can decode everything but it
+ */
 static struct sto_srv_writefile_req *
-sto_srv_writefile_req_alloc(const struct spdk_json_val *params)
+sto_srv_writefile_req_alloc(const struct spdk_json_val *params, bool with_buf)
 {
 	struct sto_srv_writefile_req *req;
+	size_t num_decoders = SPDK_COUNTOF(sto_srv_writefile_decoders);
 
 	req = calloc(1, sizeof(*req));
 	if (spdk_unlikely(!req)) {
@@ -49,8 +59,12 @@ sto_srv_writefile_req_alloc(const struct spdk_json_val *params)
 		return NULL;
 	}
 
+	if (!with_buf) {
+		num_decoders--;
+	}
+
 	if (spdk_json_decode_object(params, sto_srv_writefile_decoders,
-				    SPDK_COUNTOF(sto_srv_writefile_decoders), &req->params)) {
+				    num_decoders, &req->params)) {
 		printf("server: Cann't decode writefile req params\n");
 		goto free_req;
 	}
@@ -84,16 +98,31 @@ sto_srv_writefile_req_free(struct sto_srv_writefile_req *req)
 static int
 sto_srv_writefile_req_submit(struct sto_srv_writefile_req *req)
 {
+	struct sto_srv_writefile_params *params = &req->params;
+	int rc;
+
+	rc = sto_srv_uring_writefile(params->filepath, params->oflag,
+				     params->buf, strlen(params->buf),
+				     sto_srv_writefile_exec_done, req);
+	if (rc != -ENOTSUP && rc != -EAGAIN) {
+		return rc;
+	}
+
 	return sto_exec(&req->exec_ctx);
 }
 
+static int
+sto_srv_do_writefile(struct sto_srv_writefile_params *params)
+{
+	return sto_write_file(params->filepath, params->oflag, params->buf, strlen(params->buf));
+}
+
 static int
 sto_srv_writefile_exec(void *arg)
 {
 	struct sto_srv_writefile_req *req = arg;
-	struct sto_srv_writefile_params *params = &req->params;
 
-	return sto_write_file(params->filepath, params->oflag, params->buf, strlen(params->buf));
+	return sto_srv_do_writefile(&req->params);
 }
 
 static void
@@ -113,7 +142,7 @@ sto_srv_writefile(const struct spdk_json_val *params,
 	struct sto_srv_writefile_req *req;
 	int rc;
 
-	req = sto_srv_writefile_req_alloc(params);
+	req = sto_srv_writefile_req_alloc(params, true);
 	if (spdk_unlikely(!req)) {
 		printf("server: Failed to alloc memory for writefile req\n");
 		return -ENOMEM;
@@ -135,14 +164,48 @@ free_req:
 	return rc;
 }
 
+int
+sto_srv_writefile_buf(const struct spdk_json_val *params, char *buf,
+		      struct sto_srv_writefile_args *args)
+{
+	struct sto_srv_writefile_req *req;
+	int rc;
+
+	req = sto_srv_writefile_req_alloc(params, false);
+	if (spdk_unlikely(!req)) {
+		printf("server: Failed to alloc memory for writefile req\n");
+		free(buf);
+		return -ENOMEM;
+	}
+
+	req->params.buf = buf;
+
+	sto_srv_writefile_req_init_cb(req, args->cb_fn, args->cb_arg);
+
+	rc = sto_srv_writefile_req_submit(req);
+	if (spdk_unlikely(rc)) {
+		printf("server: Failed to submit writefile req, rc=%d\n", rc);
+		goto free_req;
+	}
+
+	return 0;
+
+free_req:
+	sto_srv_writefile_req_free(req);
+
+	return rc;
+}
+
 struct sto_srv_readfile_params {
 	char *filepath;
 	uint32_t size;
+	bool shm;
 };
 
 static const struct spdk_json_object_decoder sto_srv_readfile_decoders[] = {
 	{"filepath", offsetof(struct sto_srv_readfile_params, filepath), spdk_json_decode_string},
 	{"size", offsetof(struct sto_srv_readfile_params, size), spdk_json_decode_uint32},
+	{"shm", offsetof(struct sto_srv_readfile_params, shm), spdk_json_decode_bool, true},
 };
 
 struct sto_srv_readfile_req {
@@ -208,18 +271,39 @@ sto_srv_readfile_req_free(struct sto_srv_readfile_req *req)
 	free(req);
 }
 
+static void
+sto_srv_readfile_uring_done(void *cb_arg, char *buf, int rc)
+{
+	struct sto_srv_readfile_req *req = cb_arg;
+
+	req->buf = buf;
+
+	sto_srv_readfile_exec_done(req, rc);
+}
+
 static int
 sto_srv_readfile_req_submit(struct sto_srv_readfile_req *req)
 {
+	struct sto_srv_readfile_params *params = &req->params;
+	int rc;
+
+	/* The ring reads into its own buffer, a shm slot is filled from the pool */
+	if (params->shm && sto_shm_enabled()) {
+		return sto_exec(&req->exec_ctx);
+	}
+
+	rc = sto_srv_uring_readfile(params->filepath, params->size,
+				    sto_srv_readfile_uring_done, req);
+	if (rc != -ENOTSUP && rc != -EAGAIN) {
+		return rc;
+	}
+
 	return sto_exec(&req->exec_ctx);
 }
 
 static int
-sto_srv_readfile_exec(void *arg)
+sto_srv_do_readfile(struct sto_srv_readfile_params *params, char **buf)
 {
-	struct sto_srv_readfile_req *req = arg;
-	struct sto_srv_readfile_params *params = &req->params;
-
 	if (!params->size) {
 		struct stat sb;
 
@@ -232,13 +316,31 @@ sto_srv_readfile_exec(void *arg)
 		params->size = sb.st_size;
 	}
 
-	req->buf = calloc(1, params->size);
-	if (spdk_unlikely(!req->buf)) {
+	if (params->shm) {
+		*buf = sto_shm_alloc(params->size + 1);
+		if (*buf) {
+			memset(*buf, 0, params->size + 1);
+			return sto_read_file(params->filepath, *buf, params->size);
+		}
+
+		/* Too big for a slot or none is free, answer inline */
+	}
+
+	*buf = calloc(1, params->size + 1);
+	if (spdk_unlikely(!*buf)) {
 		printf("server: Failed to alloc buf to read: size=%u\n", params->size);
 		return -ENOMEM;
 	}
 
-	return sto_read_file(params->filepath, req->buf, params->size);
+	return sto_read_file(params->filepath, *buf, params->size);
+}
+
+static int
+sto_srv_readfile_exec(void *arg)
+{
+	struct sto_srv_readfile_req *req = arg;
+
+	return sto_srv_do_readfile(&req->params, &req->buf);
 }
 
 static void
@@ -248,6 +350,16 @@ sto_srv_readfile_exec_done(void *arg, int rc)
 	char *buf = !rc ? req->buf : "";
 
 	req->cb_fn(req->cb_arg, buf, rc);
+
+	/* A shm slot belongs to the callback, see sto_srv_readfile_done_t */
+	if (sto_shm_owns(req->buf)) {
+		if (rc) {
+			sto_shm_free(req->buf);
+		}
+
+		req->buf = NULL;
+	}
+
 	sto_srv_readfile_req_free(req);
 }
 
@@ -426,3 +538,459 @@ free_req:
 
 	return rc;
 }
+
+/*
+ * multi_writefile and multi_readfile share everything but the entry
+ * params and the way one entry is run and reported, which is what a
+ * sto_srv_multi_file_type describes.
+ */
+struct sto_srv_multi_file_entry {
+	struct sto_exec_ctx exec_ctx;
+
+	union {
+		struct sto_srv_writefile_params write;
+		struct sto_srv_readfile_params read;
+	} params;
+	char *buf;
+	int rc;
+
+	struct sto_srv_multi_file_req *req;
+};
+
+struct sto_srv_multi_file_type {
+	const char *name;
+
+	const struct spdk_json_object_decoder *decoders;
+	size_t num_decoders;
+
+	int (*entry_do)(struct sto_srv_multi_file_entry *entry);
+	/* Returns -ENOTSUP or -EAGAIN to run the entry in the exec pool */
+	int (*entry_uring)(struct sto_srv_multi_file_entry *entry);
+
+	const char *results_name;
+	void (*entry_json)(struct sto_srv_multi_file_entry *entry, struct spdk_json_write_ctx *w);
+
+	/* The ops keep the exec stats, so a type is never const */
+	struct sto_exec_ops req_ops;
+	struct sto_exec_ops entry_ops;
+};
+
+struct sto_srv_multi_file_params {
+	const struct spdk_json_val *entries;
+	bool parallel;
+};
+
+static int
+sto_srv_multi_file_entries_decode(const struct spdk_json_val *val, void *out)
+{
+	const struct spdk_json_val **entries = out;
+
+	if (val->type != SPDK_JSON_VAL_ARRAY_BEGIN) {
+		return -1;
+	}
+
+	/* Entries are decoded by the req, it knows their type */
+	*entries = val;
+
+	return 0;
+}
+
+static const struct spdk_json_object_decoder sto_srv_multi_file_decoders[] = {
+	{"entries", offsetof(struct sto_srv_multi_file_params, entries), sto_srv_multi_file_entries_decode},
+	{"parallel", offsetof(struct sto_srv_multi_file_params, parallel), spdk_json_decode_bool, true},
+};
+
+struct sto_srv_multi_file_req {
+	struct sto_exec_ctx exec_ctx;
+
+	struct sto_srv_multi_file_type *type;
+
+	struct sto_srv_multi_file_entry *entries;
+	size_t cnt;
+	bool parallel;
+
+	int pending;
+
+	size_t next;
+	int inflight;
+
+	void *cb_arg;
+	sto_srv_multi_file_done_t cb_fn;
+};
+
+static void
+sto_srv_multi_file_entries_free(struct sto_srv_multi_file_req *req)
+{
+	struct sto_srv_multi_file_type *type = req->type;
+	size_t i;
+
+	for (i = 0; i < req->cnt; i++) {
+		struct sto_srv_multi_file_entry *entry = &req->entries[i];
+
+		spdk_json_free_object(type->decoders, type->num_decoders, &entry->params);
+		free(entry->buf);
+	}
+
+	free(req->entries);
+	req->entries = NULL;
+	req->cnt = 0;
+}
+
+static int
+sto_srv_multi_file_entries_decode_all(struct sto_srv_multi_file_req *req,
+				      const struct spdk_json_val *entries)
+{
+	struct sto_srv_multi_file_type *type = req->type;
+	struct spdk_json_val *it;
+
+	/* The number of values inside the array bounds the number of entries */
+	req->entries = calloc(spdk_max(entries->len, 1), sizeof(*req->entries));
+	if (spdk_unlikely(!req->entries)) {
+		printf("server: Failed to alloc %u %s entries\n", entries->len, type->name);
+		return -ENOMEM;
+	}
+
+	for (it = spdk_json_array_first(entries); it; it = spdk_json_next(it)) {
+		struct sto_srv_multi_file_entry *entry = &req->entries[req->cnt++];
+
+		entry->req = req;
+		sto_exec_init_ctx(&entry->exec_ctx, &type->entry_ops, entry);
+
+		if (spdk_json_decode_object(it, type->decoders, type->num_decoders, &entry->params)) {
+			printf("server: Cann't decode %s entry %zu\n", type->name, req->cnt - 1);
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+static void
+sto_srv_multi_file_req_free(struct sto_srv_multi_file_req *req)
+{
+	sto_srv_multi_file_entries_free(req);
+	free(req);
+}
+
+static struct sto_srv_multi_file_req *
+sto_srv_multi_file_req_alloc(struct sto_srv_multi_file_type *type,
+			     const struct spdk_json_val *params)
+{
+	struct sto_srv_multi_file_params req_params = {};
+	struct sto_srv_multi_file_req *req;
+
+	req = calloc(1, sizeof(*req));
+	if (spdk_unlikely(!req)) {
+		printf("server: Cann't allocate memory for %s req\n", type->name);
+		return NULL;
+	}
+
+	req->type = type;
+
+	if (spdk_json_decode_object(params, sto_srv_multi_file_decoders,
+				    SPDK_COUNTOF(sto_srv_multi_file_decoders), &req_params)) {
+		printf("server: Cann't decode %s req params\n", type->name);
+		goto free_req;
+	}
+
+	if (sto_srv_multi_file_entries_decode_all(req, req_params.entries)) {
+		goto free_req;
+	}
+
+	req->parallel = req_params.parallel;
+
+	sto_exec_init_ctx(&req->exec_ctx, &type->req_ops, req);
+
+	return req;
+
+free_req:
+	sto_srv_multi_file_req_free(req);
+
+	return NULL;
+}
+
+static void
+sto_srv_multi_file_req_init_cb(struct sto_srv_multi_file_req *req,
+			       sto_srv_multi_file_done_t cb_fn, void *cb_arg)
+{
+	req->cb_fn = cb_fn;
+	req->cb_arg = cb_arg;
+}
+
+static void
+sto_srv_multi_file_req_put(struct sto_srv_multi_file_req *req)
+{
+	if (--req->pending) {
+		return;
+	}
+
+	req->cb_fn(req->cb_arg, req);
+	sto_srv_multi_file_req_free(req);
+}
+
+static void sto_srv_multi_file_req_submit_window(struct sto_srv_multi_file_req *req);
+
+static int
+sto_srv_multi_file_entry_exec(void *arg)
+{
+	struct sto_srv_multi_file_entry *entry = arg;
+
+	return entry->req->type->entry_do(entry);
+}
+
+static void
+sto_srv_multi_file_entry_exec_done(void *arg, int rc)
+{
+	struct sto_srv_multi_file_entry *entry = arg;
+
+	struct sto_srv_multi_file_req *req = entry->req;
+
+	entry->rc = rc;
+
+	req->inflight--;
+	sto_srv_multi_file_req_submit_window(req);
+
+	sto_srv_multi_file_req_put(req);
+}
+
+static int
+sto_srv_multi_file_entry_submit(struct sto_srv_multi_file_entry *entry)
+{
+	int rc;
+
+	rc = entry->req->type->entry_uring(entry);
+	if (rc != -ENOTSUP && rc != -EAGAIN) {
+		return rc;
+	}
+
+	/* A full exec queue parks the entry instead of failing it */
+	return sto_exec_defer(&entry->exec_ctx);
+}
+
+static int
+sto_srv_multi_file_exec(void *arg)
+{
+	struct sto_srv_multi_file_req *req = arg;
+	size_t i;
+
+	for (i = 0; i < req->cnt; i++) {
+		struct sto_srv_multi_file_entry *entry = &req->entries[i];
+
+		entry->rc = req->type->entry_do(entry);
+	}
+
+	return 0;
+}
+
+static void
+sto_srv_multi_file_exec_done(void *arg, int rc)
+{
+	struct sto_srv_multi_file_req *req = arg;
+
+	sto_srv_multi_file_req_put(req);
+}
+
+static void
+sto_srv_multi_file_req_submit_window(struct sto_srv_multi_file_req *req)
+{
+	int rc;
+
+	while (req->next < req->cnt && req->inflight < STO_SRV_MULTI_FILE_WINDOW) {
+		struct sto_srv_multi_file_entry *entry = &req->entries[req->next++];
+
+		req->inflight++;
+		req->pending++;
+
+		rc = sto_srv_multi_file_entry_submit(entry);
+		if (spdk_likely(!rc)) {
+			continue;
+		}
+
+		req->inflight--;
+		req->pending--;
+
+		printf("server: Failed to submit %s entry %zu, rc=%d\n",
+		       req->type->name, req->next - 1, rc);
+		entry->rc = rc;
+	}
+}
+
+static int
+sto_srv_multi_file_req_submit(struct sto_srv_multi_file_req *req)
+{
+	if (!req->parallel) {
+		req->pending = 1;
+		return sto_exec(&req->exec_ctx);
+	}
+
+	/* Hold an extra reference until the window has been filled */
+	req->pending = 1;
+
+	sto_srv_multi_file_req_submit_window(req);
+
+	sto_srv_multi_file_req_put(req);
+
+	return 0;
+}
+
+static int
+sto_srv_multi_file(struct sto_srv_multi_file_type *type,
+		   const struct spdk_json_val *params,
+		   struct sto_srv_multi_file_args *args)
+{
+	struct sto_srv_multi_file_req *req;
+	int rc;
+
+	req = sto_srv_multi_file_req_alloc(type, params);
+	if (spdk_unlikely(!req)) {
+		printf("server: Failed to alloc memory for %s req\n", type->name);
+		return -ENOMEM;
+	}
+
+	sto_srv_multi_file_req_init_cb(req, args->cb_fn, args->cb_arg);
+
+	rc = sto_srv_multi_file_req_submit(req);
+	if (spdk_unlikely(rc)) {
+		printf("server: Failed to submit %s req, rc=%d\n", type->name, rc);
+		goto free_req;
+	}
+
+	return 0;
+
+free_req:
+	sto_srv_multi_file_req_free(req);
+
+	return rc;
+}
+
+void
+sto_srv_multi_file_info_json(struct sto_srv_multi_file_req *req,
+			     struct spdk_json_write_ctx *w)
+{
+	size_t i;
+
+	spdk_json_write_named_array_begin(w, req->type->results_name);
+
+	for (i = 0; i < req->cnt; i++) {
+		req->type->entry_json(&req->entries[i], w);
+	}
+
+	spdk_json_write_array_end(w);
+}
+
+static int
+sto_srv_multi_writefile_entry_do(struct sto_srv_multi_file_entry *entry)
+{
+	return sto_srv_do_writefile(&entry->params.write);
+}
+
+static int
+sto_srv_multi_writefile_entry_uring(struct sto_srv_multi_file_entry *entry)
+{
+	struct sto_srv_writefile_params *params = &entry->params.write;
+
+	return sto_srv_uring_writefile(params->filepath, params->oflag,
+				       params->buf, strlen(params->buf),
+				       sto_srv_multi_file_entry_exec_done, entry);
+}
+
+static void
+sto_srv_multi_writefile_entry_json(struct sto_srv_multi_file_entry *entry,
+				   struct spdk_json_write_ctx *w)
+{
+	spdk_json_write_int32(w, entry->rc);
+}
+
+static struct sto_srv_multi_file_type sto_srv_multi_writefile_type = {
+	.name = "multi_writefile",
+	.decoders = sto_srv_writefile_decoders,
+	.num_decoders = SPDK_COUNTOF(sto_srv_writefile_decoders),
+	.entry_do = sto_srv_multi_writefile_entry_do,
+	.entry_uring = sto_srv_multi_writefile_entry_uring,
+	.results_name = "returncodes",
+	.entry_json = sto_srv_multi_writefile_entry_json,
+	.req_ops = {
+		.name = "multi_writefile",
+		.exec = sto_srv_multi_file_exec,
+		.exec_done = sto_srv_multi_file_exec_done,
+	},
+	.entry_ops = {
+		.name = "multi_writefile_entry",
+		.exec = sto_srv_multi_file_entry_exec,
+		.exec_done = sto_srv_multi_file_entry_exec_done,
+	},
+};
+
+int
+sto_srv_multi_writefile(const struct spdk_json_val *params,
+			struct sto_srv_multi_file_args *args)
+{
+	return sto_srv_multi_file(&sto_srv_multi_writefile_type, params, args);
+}
+
+static int
+sto_srv_multi_readfile_entry_do(struct sto_srv_multi_file_entry *entry)
+{
+	/* Entries are answered inline, they never go through a shm slot */
+	entry->params.read.shm = false;
+
+	return sto_srv_do_readfile(&entry->params.read, &entry->buf);
+}
+
+static void
+sto_srv_multi_readfile_entry_uring_done(void *cb_arg, char *buf, int rc)
+{
+	struct sto_srv_multi_file_entry *entry = cb_arg;
+
+	entry->buf = buf;
+
+	sto_srv_multi_file_entry_exec_done(entry, rc);
+}
+
+static int
+sto_srv_multi_readfile_entry_uring(struct sto_srv_multi_file_entry *entry)
+{
+	struct sto_srv_readfile_params *params = &entry->params.read;
+
+	return sto_srv_uring_readfile(params->filepath, params->size,
+				      sto_srv_multi_readfile_entry_uring_done, entry);
+}
+
+static void
+sto_srv_multi_readfile_entry_json(struct sto_srv_multi_file_entry *entry,
+				  struct spdk_json_write_ctx *w)
+{
+	spdk_json_write_object_begin(w);
+
+	spdk_json_write_named_int32(w, "returncode", entry->rc);
+	spdk_json_write_named_string(w, "buf", !entry->rc && entry->buf ? entry->buf : "");
+
+	spdk_json_write_object_end(w);
+}
+
+static struct sto_srv_multi_file_type sto_srv_multi_readfile_type = {
+	.name = "multi_readfile",
+	.decoders = sto_srv_readfile_decoders,
+	.num_decoders = SPDK_COUNTOF(sto_srv_readfile_decoders),
+	.entry_do = sto_srv_multi_readfile_entry_do,
+	.entry_uring = sto_srv_multi_readfile_entry_uring,
+	.results_name = "results",
+	.entry_json = sto_srv_multi_readfile_entry_json,
+	.req_ops = {
+		.name = "multi_readfile",
+		.exec = sto_srv_multi_file_exec,
+		.exec_done = sto_srv_multi_file_exec_done,
+	},
+	.entry_ops = {
+		.name = "multi_readfile_entry",
+		.exec = sto_srv_multi_file_entry_exec,
+		.exec_done = sto_srv_multi_file_entry_exec_done,
+	},
+};
+
+int
+sto_srv_multi_readfile(const struct spdk_json_val *params,
+		       struct sto_srv_multi_file_args *args)
+{
+	return sto_srv_multi_file(&sto_srv_multi_readfile_type, params, args);
+}
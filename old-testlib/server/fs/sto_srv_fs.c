@@ -1,72 +1,13 @@
 #include <spdk/stdinc.h>
 #include <spdk/json.h>
 #include <spdk/likely.h>
-#include <spdk/string.h>
+#include <spdk/util.h>
 #include <spdk/queue.h>
 
 #include "sto_srv_fs.h"
 
 struct spdk_json_write_ctx;
 
-struct sto_srv_dirent *
-sto_srv_dirent_alloc(const char *name)
-{
-	struct sto_srv_dirent *dirent;
-
-	dirent = calloc(1, sizeof(*dirent));
-	if (spdk_unlikely(!dirent)) {
-		printf("server: Failed to alloc dirent\n");
-		return NULL;
-	}
-
-	dirent->name = strdup(name);
-	if (spdk_unlikely(!dirent->name)) {
-		printf("server: Failed to alloc dirent name\n");
-		goto free_dirent;
-	}
-
-	return dirent;
-
-free_dirent:
-	free(dirent);
-
-	return NULL;
-}
-
-void
-sto_srv_dirent_free(struct sto_srv_dirent *dirent)
-{
-	free(dirent->name);
-	free(dirent);
-}
-
-int
-sto_srv_dirent_get_stat(struct sto_srv_dirent *dirent, const char *path)
-{
-	struct stat sb;
-	char *full_path;
-	int rc = 0;
-
-	full_path = spdk_sprintf_alloc("%s/%s", path, dirent->name);
-	if (spdk_unlikely(!full_path)) {
-		return -ENOMEM;
-	}
-
-	if (lstat(full_path, &sb) == -1) {
-		printf("server: Failed to get stat for file %s: %s\n",
-		       full_path, strerror(errno));
-		rc = -errno;
-		goto out;
-	}
-
-	dirent->mode = sb.st_mode;
-
-out:
-	free(full_path);
-
-	return rc;
-}
-
 static void
 sto_srv_dirent_info_json(struct sto_srv_dirent *dirent, struct spdk_json_write_ctx *w)
 {
@@ -82,24 +23,42 @@ void
 sto_srv_dirents_init(struct sto_srv_dirents *dirents)
 {
 	TAILQ_INIT(&dirents->dirents);
+
+	sto_arena_init(&dirents->arena, STO_SRV_DIRENTS_ARENA_CHUNK_SIZE);
+
+	dirents->cursor = 0;
+	dirents->eof = true;
 }
 
 void
 sto_srv_dirents_free(struct sto_srv_dirents *dirents)
 {
-	struct sto_srv_dirent *dirent, *tmp;
+	TAILQ_INIT(&dirents->dirents);
+	sto_arena_fini(&dirents->arena);
+}
 
-	TAILQ_FOREACH_SAFE(dirent, &dirents->dirents, list, tmp) {
-		TAILQ_REMOVE(&dirents->dirents, dirent, list);
+int
+sto_srv_dirents_add(struct sto_srv_dirents *dirents, const char *name, size_t name_len, uint32_t mode)
+{
+	struct sto_srv_dirent *dirent;
 
-		sto_srv_dirent_free(dirent);
+	dirent = sto_arena_alloc(&dirents->arena, sizeof(*dirent));
+	if (spdk_unlikely(!dirent)) {
+		printf("server: Failed to alloc dirent\n");
+		return -ENOMEM;
 	}
-}
 
-void
-sto_srv_dirents_add(struct sto_srv_dirents *dirents, struct sto_srv_dirent *dirent)
-{
+	dirent->name = sto_arena_strndup(&dirents->arena, name, name_len);
+	if (spdk_unlikely(!dirent->name)) {
+		printf("server: Failed to alloc dirent name\n");
+		return -ENOMEM;
+	}
+
+	dirent->mode = mode;
+
 	TAILQ_INSERT_TAIL(&dirents->dirents, dirent, list);
+
+	return 0;
 }
 
 void
@@ -115,6 +74,9 @@ sto_srv_dirents_info_json(struct sto_srv_dirents *dirents,
 	}
 
 	spdk_json_write_array_end(w);
+
+	spdk_json_write_named_uint64(w, "cursor", dirents->cursor);
+	spdk_json_write_named_bool(w, "eof", dirents->eof);
 }
 
 static void
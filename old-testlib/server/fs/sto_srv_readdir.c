@@ -3,6 +3,8 @@
 #include <spdk/likely.h>
 #include <spdk/util.h>
 
+#include <sys/syscall.h>
+
 #include "sto_exec.h"
 #include "sto_srv_fs.h"
 #include "sto_srv_readdir.h"
@@ -16,14 +18,28 @@ static struct sto_exec_ops srv_readdir_ops = {
 	.exec_done = sto_srv_readdir_exec_done,
 };
 
+/*
+ * A page is limited to max_entries (0 means the whole directory). The
+ * cursor is the directory offset after the last returned entry, so a
+ * page can be resumed from a fresh open() with no state on the server.
+ *
+ * With type_only the mode carries just the S_IFMT bits taken from d_type,
+ * entries are stat'ed only if the filesystem doesn't report their type.
+ */
 struct sto_srv_readdir_params {
 	char *dirpath;
 	bool skip_hidden;
+	bool type_only;
+	uint64_t cursor;
+	uint32_t max_entries;
 };
 
 static const struct spdk_json_object_decoder sto_srv_readdir_decoders[] = {
 	{"dirpath", offsetof(struct sto_srv_readdir_params, dirpath), spdk_json_decode_string},
 	{"skip_hidden", offsetof(struct sto_srv_readdir_params, skip_hidden), spdk_json_decode_bool},
+	{"type_only", offsetof(struct sto_srv_readdir_params, type_only), spdk_json_decode_bool, true},
+	{"cursor", offsetof(struct sto_srv_readdir_params, cursor), spdk_json_decode_uint64, true},
+	{"max_entries", offsetof(struct sto_srv_readdir_params, max_entries), spdk_json_decode_uint32, true},
 };
 
 struct sto_srv_readdir_req {
@@ -32,6 +48,7 @@ struct sto_srv_readdir_req {
 	struct sto_srv_readdir_params params;
 
 	struct sto_srv_dirents dirents;
+	uint32_t nr_dirents;
 
 	void *cb_arg;
 	sto_srv_readdir_done_t cb_fn;
@@ -49,51 +66,113 @@ sto_srv_readdir_exec_done(void *arg, int rc)
 	sto_srv_readdir_req_free(req);
 }
 
+struct sto_linux_dirent64 {
+	uint64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+#define STO_SRV_READDIR_BUF_SIZE	(32 * 1024)
+
+static int
+sto_srv_readdir_add(struct sto_srv_readdir_req *req, int dirfd, struct sto_linux_dirent64 *entry)
+{
+	struct sto_srv_readdir_params *params = &req->params;
+	uint32_t mode;
+	int rc;
+
+	if (params->skip_hidden && entry->d_name[0] == '.') {
+		return 0;
+	}
+
+	if (params->type_only && entry->d_type != DT_UNKNOWN) {
+		mode = DTTOIF(entry->d_type);
+	} else {
+		struct stat sb;
+
+		if (fstatat(dirfd, entry->d_name, &sb, AT_SYMLINK_NOFOLLOW) == -1) {
+			rc = -errno;
+			printf("server: Failed to get stat for file %s/%s: %s\n",
+			       params->dirpath, entry->d_name, strerror(-rc));
+			return rc;
+		}
+
+		mode = sb.st_mode;
+	}
+
+	rc = sto_srv_dirents_add(&req->dirents, entry->d_name, strlen(entry->d_name), mode);
+	if (spdk_unlikely(rc)) {
+		return rc;
+	}
+
+	req->nr_dirents++;
+
+	return 0;
+}
+
 static int
 sto_srv_readdir_exec(void *arg)
 {
 	struct sto_srv_readdir_req *req = arg;
 	struct sto_srv_readdir_params *params = &req->params;
-	struct dirent *entry;
-	DIR *dir;
-	int rc = 0;
+	char buf[STO_SRV_READDIR_BUF_SIZE] __attribute__((aligned(8)));
+	int fd, rc = 0;
 
-	dir = opendir(params->dirpath);
-	if (spdk_unlikely(!dir)) {
+	fd = open(params->dirpath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (spdk_unlikely(fd == -1)) {
 		printf("server: Failed to open %s dir\n", params->dirpath);
 		return -errno;
 	}
 
-	for (entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
-		struct sto_srv_dirent *dirent;
+	if (params->cursor && lseek(fd, (off_t) params->cursor, SEEK_SET) == -1) {
+		rc = -errno;
+		printf("server: Failed to seek %s dir to %" PRIu64 "\n",
+		       params->dirpath, params->cursor);
+		goto out;
+	}
 
-		if (params->skip_hidden && entry->d_name[0] == '.') {
-			continue;
-		}
+	req->dirents.eof = true;
 
-		dirent = sto_srv_dirent_alloc(entry->d_name);
-		if (spdk_unlikely(!dirent)) {
-			sto_srv_dirents_free(&req->dirents);
-			printf("server: Failed to alloc dirent\n");
-			break;
+	for (;;) {
+		ssize_t nread, pos;
+
+		nread = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+		if (spdk_unlikely(nread == -1)) {
+			rc = -errno;
+			printf("server: Failed to read %s dir\n", params->dirpath);
+			goto out;
 		}
 
-		rc = sto_srv_dirent_get_stat(dirent, params->dirpath);
-		if (spdk_unlikely(rc)) {
-			sto_srv_dirent_free(dirent);
-			sto_srv_dirents_free(&req->dirents);
-			printf("server: Failed to dirent to get stat\n");
+		if (!nread) {
 			break;
 		}
 
-		sto_srv_dirents_add(&req->dirents, dirent);
+		for (pos = 0; pos < nread;) {
+			struct sto_linux_dirent64 *entry = (void *) (buf + pos);
+
+			/* The entry just read is left for the next page, the cursor points to it */
+			if (params->max_entries && req->nr_dirents == params->max_entries) {
+				req->dirents.eof = false;
+				goto out;
+			}
+
+			rc = sto_srv_readdir_add(req, fd, entry);
+			if (spdk_unlikely(rc)) {
+				goto out;
+			}
+
+			req->dirents.cursor = entry->d_off;
+			pos += entry->d_reclen;
+		}
 	}
 
-	rc = closedir(dir);
-	if (spdk_unlikely(rc == -1)) {
+out:
+	close(fd);
+
+	if (spdk_unlikely(rc)) {
 		sto_srv_dirents_free(&req->dirents);
-		printf("server: Failed to close %s dir\n", params->dirpath);
-		rc = -errno;
 	}
 
 	return rc;
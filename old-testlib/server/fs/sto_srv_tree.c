@@ -0,0 +1,395 @@
+#include <spdk/stdinc.h>
+#include <spdk/json.h>
+#include <spdk/likely.h>
+#include <spdk/util.h>
+#include <spdk/string.h>
+#include <spdk/queue.h>
+
+#include "sto_exec.h"
+#include "sto_srv_fs.h"
+#include "sto_srv_tree.h"
+
+struct sto_srv_tree_node {
+	char *name;
+	uint32_t mode;
+	off_t size;
+
+	/* File contents or link target, NULL for directories */
+	char *buf;
+
+	TAILQ_ENTRY(sto_srv_tree_node) list;
+	TAILQ_HEAD(, sto_srv_tree_node) childs;
+};
+
+static int sto_srv_tree_exec(void *arg);
+static void sto_srv_tree_exec_done(void *arg, int rc);
+
+static struct sto_exec_ops srv_tree_ops = {
+	.name = "tree",
+	.exec = sto_srv_tree_exec,
+	.exec_done = sto_srv_tree_exec_done,
+};
+
+struct sto_srv_tree_params {
+	char *dirpath;
+	uint32_t depth;
+	bool only_dirs;
+};
+
+static const struct spdk_json_object_decoder sto_srv_tree_decoders[] = {
+	{"dirpath", offsetof(struct sto_srv_tree_params, dirpath), spdk_json_decode_string},
+	{"depth", offsetof(struct sto_srv_tree_params, depth), spdk_json_decode_uint32},
+	{"only_dirs", offsetof(struct sto_srv_tree_params, only_dirs), spdk_json_decode_bool},
+};
+
+struct sto_srv_tree_req {
+	struct sto_exec_ctx exec_ctx;
+
+	struct sto_srv_tree_params params;
+
+	struct sto_srv_tree_node tree_root;
+
+	void *cb_arg;
+	sto_srv_tree_done_t cb_fn;
+};
+
+static void sto_srv_tree_req_free(struct sto_srv_tree_req *req);
+
+static struct sto_srv_tree_node *
+sto_srv_tree_node_alloc(const char *name, uint32_t mode, off_t size)
+{
+	struct sto_srv_tree_node *node;
+
+	node = calloc(1, sizeof(*node));
+	if (spdk_unlikely(!node)) {
+		printf("server: Failed to alloc tree node\n");
+		return NULL;
+	}
+
+	node->name = strdup(name);
+	if (spdk_unlikely(!node->name)) {
+		printf("server: Failed to alloc tree node name\n");
+		goto free_node;
+	}
+
+	node->mode = mode;
+	node->size = size;
+
+	TAILQ_INIT(&node->childs);
+
+	return node;
+
+free_node:
+	free(node);
+
+	return NULL;
+}
+
+static void
+sto_srv_tree_node_free_childs(struct sto_srv_tree_node *parent)
+{
+	struct sto_srv_tree_node *node, *tmp;
+
+	TAILQ_FOREACH_SAFE(node, &parent->childs, list, tmp) {
+		TAILQ_REMOVE(&parent->childs, node, list);
+
+		sto_srv_tree_node_free_childs(node);
+
+		free(node->name);
+		free(node->buf);
+		free(node);
+	}
+}
+
+static void
+sto_srv_tree_node_info_json(struct sto_srv_tree_node *node, struct spdk_json_write_ctx *w)
+{
+	struct sto_srv_tree_node *child;
+
+	spdk_json_write_object_begin(w);
+
+	spdk_json_write_named_string(w, "name", node->name);
+	spdk_json_write_named_uint32(w, "mode", node->mode);
+
+	if (node->buf) {
+		spdk_json_write_named_string(w, "buf", node->buf);
+	}
+
+	if (S_ISDIR(node->mode) && !TAILQ_EMPTY(&node->childs)) {
+		spdk_json_write_named_array_begin(w, "childs");
+
+		TAILQ_FOREACH(child, &node->childs, list) {
+			sto_srv_tree_node_info_json(child, w);
+		}
+
+		spdk_json_write_array_end(w);
+	}
+
+	spdk_json_write_object_end(w);
+}
+
+void
+sto_srv_tree_info_json(struct sto_srv_tree_node *tree_root, struct spdk_json_write_ctx *w)
+{
+	struct sto_srv_tree_node *node;
+
+	spdk_json_write_named_array_begin(w, "tree");
+
+	TAILQ_FOREACH(node, &tree_root->childs, list) {
+		sto_srv_tree_node_info_json(node, w);
+	}
+
+	spdk_json_write_array_end(w);
+}
+
+static int
+sto_srv_tree_read_file(struct sto_srv_tree_node *node, const char *path)
+{
+	node->buf = calloc(1, node->size + 1);
+	if (spdk_unlikely(!node->buf)) {
+		printf("server: Failed to alloc buf to read: size=%jd\n", (intmax_t) node->size);
+		return -ENOMEM;
+	}
+
+	return sto_read_file(path, node->buf, node->size);
+}
+
+static int
+sto_srv_tree_read_lnk(struct sto_srv_tree_node *node, const char *path)
+{
+	ssize_t size, res;
+
+	size = (node->size ?: PATH_MAX) + 1;
+
+	node->buf = calloc(1, size);
+	if (spdk_unlikely(!node->buf)) {
+		printf("server: Failed to alloc buf to read: size=%zd\n", size);
+		return -ENOMEM;
+	}
+
+	res = readlink(path, node->buf, size - 1);
+	if (spdk_unlikely(res == -1)) {
+		printf("server: Failed to readlink %s\n", path);
+		return -errno;
+	}
+
+	return 0;
+}
+
+static int
+sto_srv_tree_list_dir(struct sto_srv_tree_node *parent, const char *dirpath, bool only_dirs)
+{
+	struct dirent *entry;
+	DIR *dir;
+	int rc = 0;
+
+	dir = opendir(dirpath);
+	if (spdk_unlikely(!dir)) {
+		printf("server: Failed to open %s dir\n", dirpath);
+		return -errno;
+	}
+
+	for (entry = readdir(dir); entry != NULL; entry = readdir(dir)) {
+		struct sto_srv_tree_node *node;
+		struct stat sb;
+
+		if (entry->d_name[0] == '.') {
+			continue;
+		}
+
+		if (fstatat(dirfd(dir), entry->d_name, &sb, AT_SYMLINK_NOFOLLOW) == -1) {
+			printf("server: Failed to get stat for file %s/%s: %s\n",
+			       dirpath, entry->d_name, strerror(errno));
+			rc = -errno;
+			break;
+		}
+
+		if (!S_ISREG(sb.st_mode) && !S_ISDIR(sb.st_mode) && !S_ISLNK(sb.st_mode)) {
+			continue;
+		}
+
+		if (only_dirs && !S_ISDIR(sb.st_mode)) {
+			continue;
+		}
+
+		node = sto_srv_tree_node_alloc(entry->d_name, sb.st_mode, sb.st_size);
+		if (spdk_unlikely(!node)) {
+			rc = -ENOMEM;
+			break;
+		}
+
+		TAILQ_INSERT_TAIL(&parent->childs, node, list);
+	}
+
+	if (spdk_unlikely(closedir(dir) == -1)) {
+		printf("server: Failed to close %s dir\n", dirpath);
+		rc = rc ?: -errno;
+	}
+
+	return rc;
+}
+
+/*
+ * Mirrors the control side per-inode walk: hidden entries are skipped,
+ * directories at @depth are listed but not descended into and inodes
+ * without the owner read bit are left unread.
+ */
+static int
+sto_srv_tree_walk(struct sto_srv_tree_node *parent, const char *dirpath,
+		  uint32_t level, struct sto_srv_tree_params *params)
+{
+	struct sto_srv_tree_node *node;
+	int rc;
+
+	if (params->depth && level == params->depth) {
+		return 0;
+	}
+
+	rc = sto_srv_tree_list_dir(parent, dirpath, params->only_dirs);
+	if (spdk_unlikely(rc)) {
+		return rc;
+	}
+
+	TAILQ_FOREACH(node, &parent->childs, list) {
+		char *path;
+
+		if (!(node->mode & S_IRUSR)) {
+			continue;
+		}
+
+		path = spdk_sprintf_alloc("%s/%s", dirpath, node->name);
+		if (spdk_unlikely(!path)) {
+			return -ENOMEM;
+		}
+
+		switch (node->mode & S_IFMT) {
+		case S_IFREG:
+			rc = sto_srv_tree_read_file(node, path);
+			break;
+		case S_IFLNK:
+			rc = sto_srv_tree_read_lnk(node, path);
+			break;
+		case S_IFDIR:
+			rc = sto_srv_tree_walk(node, path, level + 1, params);
+			break;
+		default:
+			assert(0);
+		}
+
+		free(path);
+
+		if (spdk_unlikely(rc)) {
+			return rc;
+		}
+	}
+
+	return 0;
+}
+
+static void
+sto_srv_tree_exec_done(void *arg, int rc)
+{
+	struct sto_srv_tree_req *req = arg;
+
+	req->cb_fn(req->cb_arg, &req->tree_root, rc);
+
+	sto_srv_tree_req_free(req);
+}
+
+static int
+sto_srv_tree_exec(void *arg)
+{
+	struct sto_srv_tree_req *req = arg;
+	struct sto_srv_tree_params *params = &req->params;
+	int rc;
+
+	rc = sto_srv_tree_walk(&req->tree_root, params->dirpath, 0, params);
+	if (spdk_unlikely(rc)) {
+		printf("server: Failed to walk %s tree, rc=%d\n", params->dirpath, rc);
+		sto_srv_tree_node_free_childs(&req->tree_root);
+	}
+
+	return rc;
+}
+
+static struct sto_srv_tree_req *
+sto_srv_tree_req_alloc(const struct spdk_json_val *params)
+{
+	struct sto_srv_tree_req *req;
+
+	req = calloc(1, sizeof(*req));
+	if (spdk_unlikely(!req)) {
+		printf("server: Cann't allocate memory for tree req\n");
+		return NULL;
+	}
+
+	if (spdk_json_decode_object(params, sto_srv_tree_decoders,
+				    SPDK_COUNTOF(sto_srv_tree_decoders), &req->params)) {
+		printf("server: Cann't decode tree req params\n");
+		goto free_req;
+	}
+
+	sto_exec_init_ctx(&req->exec_ctx, &srv_tree_ops, req);
+
+	req->tree_root.mode = S_IFDIR | S_IRWXU;
+	TAILQ_INIT(&req->tree_root.childs);
+
+	return req;
+
+free_req:
+	free(req);
+
+	return NULL;
+}
+
+static void
+sto_srv_tree_req_init_cb(struct sto_srv_tree_req *req,
+			 sto_srv_tree_done_t cb_fn, void *cb_arg)
+{
+	req->cb_fn = cb_fn;
+	req->cb_arg = cb_arg;
+}
+
+static void
+sto_srv_tree_req_free(struct sto_srv_tree_req *req)
+{
+	spdk_json_free_object(sto_srv_tree_decoders,
+			      SPDK_COUNTOF(sto_srv_tree_decoders), &req->params);
+	sto_srv_tree_node_free_childs(&req->tree_root);
+	free(req);
+}
+
+static int
+sto_srv_tree_req_submit(struct sto_srv_tree_req *req)
+{
+	return sto_exec(&req->exec_ctx);
+}
+
+int
+sto_srv_tree(const struct spdk_json_val *params,
+	     struct sto_srv_tree_args *args)
+{
+	struct sto_srv_tree_req *req;
+	int rc;
+
+	req = sto_srv_tree_req_alloc(params);
+	if (spdk_unlikely(!req)) {
+		printf("server: Failed to alloc memory for tree req\n");
+		return -ENOMEM;
+	}
+
+	sto_srv_tree_req_init_cb(req, args->cb_fn, args->cb_arg);
+
+	rc = sto_srv_tree_req_submit(req);
+	if (spdk_unlikely(rc)) {
+		printf("server: Failed to submit tree, rc=%d\n", rc);
+		goto free_req;
+	}
+
+	return 0;
+
+free_req:
+	sto_srv_tree_req_free(req);
+
+	return rc;
+}
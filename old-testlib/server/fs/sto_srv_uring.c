@@ -0,0 +1,595 @@
+#include <spdk/stdinc.h>
+#include <spdk/likely.h>
+#include <spdk/util.h>
+
+#include "sto_srv_uring.h"
+#include "sto_srv_fs.h"
+
+#ifdef STO_HAVE_URING
+
+#include <liburing.h>
+
+/*
+ * Every file op is one linked chain on the ring:
+ *
+ *	[statx] -> openat (direct) -> read/write (fixed file) -> close (direct)
+ *
+ * The statx stage is only needed when a readfile comes without a size.
+ * The opened file lives in a registered file slot, so the read/write and
+ * close SQEs can refer to it before openat has completed.
+ *
+ * The stage of a CQE is kept in the low bits of its user_data.
+ */
+enum sto_srv_uring_stage {
+	STO_SRV_URING_STAGE_STATX,
+	STO_SRV_URING_STAGE_OPEN,
+	STO_SRV_URING_STAGE_RW,
+	STO_SRV_URING_STAGE_CLOSE,
+	STO_SRV_URING_STAGE_CNT,
+};
+
+#define STO_SRV_URING_STAGE_MASK	0x3ULL
+#define STO_SRV_URING_CHAIN_LEN		3
+#define STO_SRV_URING_CQE_BATCH		64
+
+struct sto_srv_uring_op {
+	int dir;
+
+	char *filepath;
+	int oflag;
+
+	char *buf;
+	size_t size;
+
+	struct statx stx;
+
+	int file_index;
+
+	int pending;
+	int rc;
+
+	void *cb_arg;
+	union {
+		sto_srv_uring_read_done_t read_cb;
+		sto_generic_cb write_cb;
+	};
+};
+
+struct sto_srv_uring {
+	struct io_uring ring;
+
+	int *free_slots;
+	uint32_t nr_free_slots;
+
+	uint32_t nr_inflight;
+	bool initialized;
+};
+
+static struct sto_srv_uring g_sto_srv_uring;
+
+static inline void
+sto_srv_uring_sqe_set_data(struct io_uring_sqe *sqe, struct sto_srv_uring_op *op,
+			   enum sto_srv_uring_stage stage)
+{
+	io_uring_sqe_set_data64(sqe, (uint64_t) (uintptr_t) op | stage);
+}
+
+static inline struct sto_srv_uring_op *
+sto_srv_uring_cqe_op(struct io_uring_cqe *cqe, enum sto_srv_uring_stage *stage)
+{
+	uint64_t data = io_uring_cqe_get_data64(cqe);
+
+	*stage = data & STO_SRV_URING_STAGE_MASK;
+
+	return (struct sto_srv_uring_op *) (uintptr_t) (data & ~STO_SRV_URING_STAGE_MASK);
+}
+
+static struct io_uring_sqe *
+sto_srv_uring_get_sqe(struct sto_srv_uring *uring)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = io_uring_get_sqe(&uring->ring);
+	if (spdk_unlikely(!sqe)) {
+		io_uring_submit(&uring->ring);
+		sqe = io_uring_get_sqe(&uring->ring);
+	}
+
+	return sqe;
+}
+
+static struct sto_srv_uring_op *
+sto_srv_uring_op_alloc(int dir, const char *filepath)
+{
+	struct sto_srv_uring_op *op;
+
+	op = calloc(1, sizeof(*op));
+	if (spdk_unlikely(!op)) {
+		printf("server: Failed to alloc uring op\n");
+		return NULL;
+	}
+
+	op->filepath = strdup(filepath);
+	if (spdk_unlikely(!op->filepath)) {
+		printf("server: Failed to alloc uring op filepath\n");
+		goto free_op;
+	}
+
+	op->dir = dir;
+	op->file_index = -1;
+
+	return op;
+
+free_op:
+	free(op);
+
+	return NULL;
+}
+
+static void
+sto_srv_uring_op_free(struct sto_srv_uring_op *op)
+{
+	free(op->filepath);
+	free(op->buf);
+	free(op);
+}
+
+static int
+sto_srv_uring_get_slot(struct sto_srv_uring *uring)
+{
+	if (spdk_unlikely(!uring->nr_free_slots)) {
+		return -EAGAIN;
+	}
+
+	return uring->free_slots[--uring->nr_free_slots];
+}
+
+static void
+sto_srv_uring_put_slot(struct sto_srv_uring *uring, int file_index)
+{
+	uring->free_slots[uring->nr_free_slots++] = file_index;
+}
+
+static void
+sto_srv_uring_op_complete(struct sto_srv_uring *uring, struct sto_srv_uring_op *op)
+{
+	char *buf;
+
+	if (op->file_index >= 0) {
+		sto_srv_uring_put_slot(uring, op->file_index);
+	}
+
+	uring->nr_inflight--;
+
+	if (op->dir == STO_READ) {
+		buf = NULL;
+
+		if (!op->rc) {
+			buf = op->buf;
+			op->buf = NULL;
+		}
+
+		op->read_cb(op->cb_arg, buf, op->rc);
+	} else {
+		op->write_cb(op->cb_arg, op->rc);
+	}
+
+	sto_srv_uring_op_free(op);
+}
+
+static void
+sto_srv_uring_op_set_rc(struct sto_srv_uring_op *op, int rc)
+{
+	if (!op->rc) {
+		op->rc = rc;
+	}
+}
+
+static int
+sto_srv_uring_submit_chain(struct sto_srv_uring *uring, struct sto_srv_uring_op *op)
+{
+	struct io_uring_sqe *sqe;
+	int flags;
+
+	if (io_uring_sq_space_left(&uring->ring) < STO_SRV_URING_CHAIN_LEN) {
+		io_uring_submit(&uring->ring);
+	}
+
+	if (spdk_unlikely(io_uring_sq_space_left(&uring->ring) < STO_SRV_URING_CHAIN_LEN)) {
+		return -EAGAIN;
+	}
+
+	flags = op->dir == STO_READ ? O_RDONLY : O_WRONLY | op->oflag;
+
+	sqe = sto_srv_uring_get_sqe(uring);
+	io_uring_prep_openat_direct(sqe, AT_FDCWD, op->filepath, flags, 0644, op->file_index);
+	sqe->flags |= IOSQE_IO_LINK;
+	sto_srv_uring_sqe_set_data(sqe, op, STO_SRV_URING_STAGE_OPEN);
+
+	sqe = sto_srv_uring_get_sqe(uring);
+	if (op->dir == STO_READ) {
+		io_uring_prep_read(sqe, op->file_index, op->buf, op->size, 0);
+	} else {
+		io_uring_prep_write(sqe, op->file_index, op->buf, op->size, 0);
+	}
+	/* Close the slot even if the read or write fails */
+	sqe->flags |= IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+	sto_srv_uring_sqe_set_data(sqe, op, STO_SRV_URING_STAGE_RW);
+
+	sqe = sto_srv_uring_get_sqe(uring);
+	io_uring_prep_close_direct(sqe, op->file_index);
+	sto_srv_uring_sqe_set_data(sqe, op, STO_SRV_URING_STAGE_CLOSE);
+
+	op->pending = STO_SRV_URING_CHAIN_LEN;
+
+	return 0;
+}
+
+static int
+sto_srv_uring_submit_statx(struct sto_srv_uring *uring, struct sto_srv_uring_op *op)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = sto_srv_uring_get_sqe(uring);
+	if (spdk_unlikely(!sqe)) {
+		return -EAGAIN;
+	}
+
+	io_uring_prep_statx(sqe, AT_FDCWD, op->filepath, AT_SYMLINK_NOFOLLOW,
+			    STATX_SIZE, &op->stx);
+	sto_srv_uring_sqe_set_data(sqe, op, STO_SRV_URING_STAGE_STATX);
+
+	op->pending = 1;
+
+	return 0;
+}
+
+static int
+sto_srv_uring_readbuf_alloc(struct sto_srv_uring_op *op, size_t size)
+{
+	op->buf = calloc(1, size + 1);
+	if (spdk_unlikely(!op->buf)) {
+		printf("server: Failed to alloc buf to read: size=%zu\n", size);
+		return -ENOMEM;
+	}
+
+	op->size = size;
+
+	return 0;
+}
+
+static void
+sto_srv_uring_statx_done(struct sto_srv_uring *uring, struct sto_srv_uring_op *op, int res)
+{
+	int rc;
+
+	if (spdk_unlikely(res < 0)) {
+		printf("server: Failed to get stat for file %s: %s\n",
+		       op->filepath, strerror(-res));
+		op->rc = res;
+		goto complete;
+	}
+
+	rc = sto_srv_uring_readbuf_alloc(op, op->stx.stx_size);
+	if (spdk_unlikely(rc)) {
+		op->rc = rc;
+		goto complete;
+	}
+
+	rc = sto_srv_uring_submit_chain(uring, op);
+	if (spdk_unlikely(rc)) {
+		op->rc = rc;
+		goto complete;
+	}
+
+	return;
+
+complete:
+	sto_srv_uring_op_complete(uring, op);
+}
+
+static void
+sto_srv_uring_process_cqe(struct sto_srv_uring *uring, struct io_uring_cqe *cqe)
+{
+	enum sto_srv_uring_stage stage;
+	struct sto_srv_uring_op *op;
+	int res = cqe->res;
+
+	op = sto_srv_uring_cqe_op(cqe, &stage);
+
+	op->pending--;
+
+	switch (stage) {
+	case STO_SRV_URING_STAGE_STATX:
+		sto_srv_uring_statx_done(uring, op, res);
+		return;
+	case STO_SRV_URING_STAGE_OPEN:
+		if (spdk_unlikely(res < 0)) {
+			printf("server: Failed to open %s file: %s\n",
+			       op->filepath, strerror(-res));
+			sto_srv_uring_op_set_rc(op, res);
+		}
+		break;
+	case STO_SRV_URING_STAGE_RW:
+		if (spdk_unlikely(res < 0)) {
+			/* Cancelled because openat failed, which is reported already */
+			if (res != -ECANCELED) {
+				printf("server: Failed to %s %s file: %s\n",
+				       op->dir == STO_READ ? "read" : "write",
+				       op->filepath, strerror(-res));
+			}
+			sto_srv_uring_op_set_rc(op, res);
+		} else if (op->dir == STO_WRITE && (size_t) res != op->size) {
+			printf("server: Short write to %s file: %d of %zu\n",
+			       op->filepath, res, op->size);
+			sto_srv_uring_op_set_rc(op, -EIO);
+		}
+		break;
+	case STO_SRV_URING_STAGE_CLOSE:
+		if (spdk_unlikely(res < 0 && res != -ECANCELED && !op->rc)) {
+			printf("Failed to close %s file\n", op->filepath);
+		}
+		break;
+	default:
+		assert(0);
+		break;
+	}
+
+	if (!op->pending) {
+		sto_srv_uring_op_complete(uring, op);
+	}
+}
+
+int
+sto_srv_uring_poll(void)
+{
+	struct sto_srv_uring *uring = &g_sto_srv_uring;
+	struct io_uring_cqe *cqes[STO_SRV_URING_CQE_BATCH];
+	unsigned int cnt, i;
+	int total = 0;
+
+	if (!uring->initialized || !uring->nr_inflight) {
+		return 0;
+	}
+
+	/* One syscall per poll for all the SQEs queued since the last one */
+	io_uring_submit(&uring->ring);
+
+	do {
+		cnt = io_uring_peek_batch_cqe(&uring->ring, cqes, SPDK_COUNTOF(cqes));
+
+		for (i = 0; i < cnt; i++) {
+			sto_srv_uring_process_cqe(uring, cqes[i]);
+		}
+
+		io_uring_cq_advance(&uring->ring, cnt);
+
+		total += cnt;
+	} while (cnt == SPDK_COUNTOF(cqes));
+
+	return total;
+}
+
+static int
+sto_srv_uring_op_start(struct sto_srv_uring *uring, struct sto_srv_uring_op *op, bool need_stat)
+{
+	int rc;
+
+	op->file_index = sto_srv_uring_get_slot(uring);
+	if (spdk_unlikely(op->file_index < 0)) {
+		return op->file_index;
+	}
+
+	rc = need_stat ? sto_srv_uring_submit_statx(uring, op) : sto_srv_uring_submit_chain(uring, op);
+	if (spdk_unlikely(rc)) {
+		sto_srv_uring_put_slot(uring, op->file_index);
+		op->file_index = -1;
+		return rc;
+	}
+
+	uring->nr_inflight++;
+
+	return 0;
+}
+
+int
+sto_srv_uring_readfile(const char *filepath, uint32_t size,
+		       sto_srv_uring_read_done_t cb_fn, void *cb_arg)
+{
+	struct sto_srv_uring *uring = &g_sto_srv_uring;
+	struct sto_srv_uring_op *op;
+	int rc;
+
+	if (!uring->initialized) {
+		return -ENOTSUP;
+	}
+
+	op = sto_srv_uring_op_alloc(STO_READ, filepath);
+	if (spdk_unlikely(!op)) {
+		return -ENOMEM;
+	}
+
+	op->read_cb = cb_fn;
+	op->cb_arg = cb_arg;
+
+	if (size) {
+		rc = sto_srv_uring_readbuf_alloc(op, size);
+		if (spdk_unlikely(rc)) {
+			goto free_op;
+		}
+	}
+
+	rc = sto_srv_uring_op_start(uring, op, !size);
+	if (spdk_unlikely(rc)) {
+		goto free_op;
+	}
+
+	return 0;
+
+free_op:
+	sto_srv_uring_op_free(op);
+
+	return rc;
+}
+
+int
+sto_srv_uring_writefile(const char *filepath, int oflag, const char *buf, size_t size,
+			sto_generic_cb cb_fn, void *cb_arg)
+{
+	struct sto_srv_uring *uring = &g_sto_srv_uring;
+	struct sto_srv_uring_op *op;
+	int rc;
+
+	if (!uring->initialized) {
+		return -ENOTSUP;
+	}
+
+	op = sto_srv_uring_op_alloc(STO_WRITE, filepath);
+	if (spdk_unlikely(!op)) {
+		return -ENOMEM;
+	}
+
+	op->buf = malloc(size);
+	if (spdk_unlikely(!op->buf)) {
+		printf("server: Failed to alloc buf to write: size=%zu\n", size);
+		rc = -ENOMEM;
+		goto free_op;
+	}
+
+	memcpy(op->buf, buf, size);
+
+	op->size = size;
+	op->oflag = oflag;
+	op->write_cb = cb_fn;
+	op->cb_arg = cb_arg;
+
+	rc = sto_srv_uring_op_start(uring, op, false);
+	if (spdk_unlikely(rc)) {
+		goto free_op;
+	}
+
+	return 0;
+
+free_op:
+	sto_srv_uring_op_free(op);
+
+	return rc;
+}
+
+int
+sto_srv_uring_init(uint32_t entries)
+{
+	struct sto_srv_uring *uring = &g_sto_srv_uring;
+	uint32_t i;
+	int rc;
+
+	if (!entries) {
+		return -ENOTSUP;
+	}
+
+	rc = io_uring_queue_init(entries, &uring->ring, 0);
+	if (spdk_unlikely(rc)) {
+		printf("server: io_uring is not available: %s\n", strerror(-rc));
+		return -ENOTSUP;
+	}
+
+	rc = io_uring_register_files_sparse(&uring->ring, entries);
+	if (spdk_unlikely(rc)) {
+		printf("server: Failed to register io_uring file slots: %s\n", strerror(-rc));
+		rc = -ENOTSUP;
+		goto exit_queue;
+	}
+
+	uring->free_slots = calloc(entries, sizeof(*uring->free_slots));
+	if (spdk_unlikely(!uring->free_slots)) {
+		printf("server: Failed to alloc io_uring file slots\n");
+		rc = -ENOMEM;
+		goto exit_queue;
+	}
+
+	for (i = 0; i < entries; i++) {
+		uring->free_slots[i] = entries - i - 1;
+	}
+
+	uring->nr_free_slots = entries;
+	uring->nr_inflight = 0;
+	uring->initialized = true;
+
+	printf("server: io_uring engine started: entries=%u\n", entries);
+
+	return 0;
+
+exit_queue:
+	io_uring_queue_exit(&uring->ring);
+
+	return rc;
+}
+
+void
+sto_srv_uring_fini(void)
+{
+	struct sto_srv_uring *uring = &g_sto_srv_uring;
+
+	if (!uring->initialized) {
+		return;
+	}
+
+	while (uring->nr_inflight) {
+		io_uring_submit_and_wait(&uring->ring, 1);
+		sto_srv_uring_poll();
+	}
+
+	io_uring_queue_exit(&uring->ring);
+
+	free(uring->free_slots);
+	uring->free_slots = NULL;
+
+	uring->initialized = false;
+}
+
+bool
+sto_srv_uring_enabled(void)
+{
+	return g_sto_srv_uring.initialized;
+}
+
+#else /* STO_HAVE_URING */
+
+int
+sto_srv_uring_init(uint32_t entries)
+{
+	return -ENOTSUP;
+}
+
+void
+sto_srv_uring_fini(void)
+{
+}
+
+bool
+sto_srv_uring_enabled(void)
+{
+	return false;
+}
+
+int
+sto_srv_uring_poll(void)
+{
+	return 0;
+}
+
+int
+sto_srv_uring_readfile(const char *filepath, uint32_t size,
+		       sto_srv_uring_read_done_t cb_fn, void *cb_arg)
+{
+	return -ENOTSUP;
+}
+
+int
+sto_srv_uring_writefile(const char *filepath, int oflag, const char *buf, size_t size,
+			sto_generic_cb cb_fn, void *cb_arg)
+{
+	return -ENOTSUP;
+}
+
+#endif /* STO_HAVE_URING */
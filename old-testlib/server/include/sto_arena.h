@@ -0,0 +1,34 @@
+#ifndef _STO_ARENA_H_
+#define _STO_ARENA_H_
+
+#include <stdarg.h>
+#include <stddef.h>
+
+/*
+ * Bump allocator for data that dies all at once, like a tree snapshot or
+ * a page of dirents. Memory comes zeroed out of large chunks and there is
+ * no way to give a single allocation back, only every chunk at once.
+ *
+ * An arena is either embedded and set up with sto_arena_init(), or lives
+ * in its own first chunk with sto_arena_create().
+ */
+struct sto_arena_chunk;
+
+struct sto_arena {
+	struct sto_arena_chunk *chunks;
+	size_t chunk_used;
+	size_t chunk_size;
+};
+
+void sto_arena_init(struct sto_arena *arena, size_t chunk_size);
+void sto_arena_fini(struct sto_arena *arena);
+
+struct sto_arena *sto_arena_create(size_t chunk_size);
+void sto_arena_destroy(struct sto_arena *arena);
+
+void *sto_arena_alloc(struct sto_arena *arena, size_t size);
+char *sto_arena_strndup(struct sto_arena *arena, const char *s, size_t len);
+char *sto_arena_strdup(struct sto_arena *arena, const char *s);
+char *sto_arena_vsprintf(struct sto_arena *arena, const char *fmt, va_list args);
+
+#endif /* _STO_ARENA_H_ */
@@ -0,0 +1,102 @@
+#ifndef _STO_BIN_H_
+#define _STO_BIN_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+/*
+ * Compact binary framing shared by the control and the server.
+ *
+ * Every frame is a fixed header followed by @params_len bytes of JSON
+ * params (the same object the JSON-RPC method takes, minus the payload)
+ * and @payload_len raw bytes. Responses echo @id and @opcode, carry the
+ * returncode in @status and put the file contents in the payload, so
+ * nothing has to be JSON-escaped on the way.
+ *
+ * The client opens the connection with a HELLO frame whose payload is
+ * sto_bin_opcode_table_str(). The server answers with status 0 only if
+ * its table is identical, otherwise the client keeps using JSON-RPC.
+ */
+
+#define STO_LOCAL_SERVER_BIN_ADDR "/var/tmp/sto_server_bin.sock"
+
+#define STO_BIN_MAGIC		0x53544f42	/* "STOB" */
+#define STO_BIN_VERSION		1
+
+/* Frames above this are treated as a protocol error */
+#define STO_BIN_MAX_FRAME_SIZE	(64 * 1024 * 1024)
+
+enum sto_bin_opcode {
+	STO_BIN_OP_HELLO,
+	STO_BIN_OP_WRITEFILE,
+	STO_BIN_OP_READFILE,
+	STO_BIN_OP_READLINK,
+	STO_BIN_OP_CNT,
+};
+
+struct sto_bin_hdr {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t opcode;
+	uint32_t id;
+	int32_t status;
+	uint32_t params_len;
+	uint32_t payload_len;
+} __attribute__((packed));
+
+/* Mirrors the names the opcodes have as JSON-RPC methods, checked when the server starts */
+static const char *const sto_bin_opcode_names[STO_BIN_OP_CNT] = {
+	[STO_BIN_OP_HELLO] = "hello",
+	[STO_BIN_OP_WRITEFILE] = "writefile",
+	[STO_BIN_OP_READFILE] = "readfile",
+	[STO_BIN_OP_READLINK] = "readlink",
+};
+
+#define STO_BIN_OPCODE_TABLE_MAX_LEN 256
+
+static inline int
+sto_bin_opcode_table_str(char *buf, size_t size)
+{
+	size_t off = 0;
+	int i;
+
+	for (i = 0; i < STO_BIN_OP_CNT; i++) {
+		size_t len = strlen(sto_bin_opcode_names[i]);
+
+		if (off + len + 1 >= size) {
+			return -1;
+		}
+
+		memcpy(buf + off, sto_bin_opcode_names[i], len);
+		off += len;
+		buf[off++] = ',';
+	}
+
+	buf[off] = '\0';
+
+	return off;
+}
+
+static inline void
+sto_bin_hdr_init(struct sto_bin_hdr *hdr, uint16_t opcode, uint32_t id, int32_t status,
+		 uint32_t params_len, uint32_t payload_len)
+{
+	hdr->magic = STO_BIN_MAGIC;
+	hdr->version = STO_BIN_VERSION;
+	hdr->opcode = opcode;
+	hdr->id = id;
+	hdr->status = status;
+	hdr->params_len = params_len;
+	hdr->payload_len = payload_len;
+}
+
+static inline bool
+sto_bin_hdr_valid(const struct sto_bin_hdr *hdr)
+{
+	return hdr->magic == STO_BIN_MAGIC && hdr->version == STO_BIN_VERSION &&
+	       hdr->opcode < STO_BIN_OP_CNT &&
+	       (uint64_t) hdr->params_len + hdr->payload_len <= STO_BIN_MAX_FRAME_SIZE;
+}
+
+#endif /* _STO_BIN_H_ */
@@ -1,24 +1,73 @@
 #ifndef _STO_EXEC_H_
 #define _STO_EXEC_H_
 
-#include <pthread.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+#include <spdk/queue.h>
+
+#define STO_EXEC_DEFAULT_WORKERS	8
+#define STO_EXEC_DEFAULT_QUEUE_SIZE	1024
+
+struct sto_exec_opts {
+	uint32_t nr_workers;
+	uint32_t queue_size;
+};
+
+void sto_exec_opts_init(struct sto_exec_opts *opts);
+
+/*
+ * Counters are updated from the submitting thread and from the workers,
+ * so every field is atomic. Times are in nanoseconds.
+ */
+struct sto_exec_stats {
+	atomic_uint_fast64_t submitted;
+	atomic_uint_fast64_t rejected;
+	atomic_uint_fast64_t completed;
+	atomic_uint_fast64_t failed;
+
+	atomic_uint_fast64_t queue_depth;
+	atomic_uint_fast64_t max_queue_depth;
+
+	atomic_uint_fast64_t total_wait_ns;
+	atomic_uint_fast64_t max_wait_ns;
+	atomic_uint_fast64_t total_exec_ns;
+	atomic_uint_fast64_t max_exec_ns;
+};
 
 struct sto_exec_ops {
 	const char *name;
 
 	int (*exec)(void *arg);
 	void (*exec_done)(void *arg, int rc);
+
+	struct sto_exec_stats stats;
 };
 
 struct sto_exec_ctx {
-	pthread_t thread;
-
 	struct sto_exec_ops *ops;
 	void *priv;
+
+	uint64_t submit_ns;
+	int rc;
+
+	TAILQ_ENTRY(sto_exec_ctx) deferred;
 };
 
+int sto_exec_init(const struct sto_exec_opts *opts);
+void sto_exec_fini(void);
+
+int sto_exec_poll(void);
+
 void sto_exec_init_ctx(struct sto_exec_ctx *exec_ctx, struct sto_exec_ops *ops, void *priv);
 
 int sto_exec(struct sto_exec_ctx *exec_ctx);
 
+/*
+ * Like sto_exec(), but a full queue does not fail the request: it is
+ * parked and pushed again by sto_exec_poll() once the workers have
+ * taken something off the queue. Only the server thread may call it.
+ */
+int sto_exec_defer(struct sto_exec_ctx *exec_ctx);
+
 #endif /* _STO_EXEC_H_ */
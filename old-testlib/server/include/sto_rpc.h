@@ -3,11 +3,25 @@
 
 #include <spdk/jsonrpc.h>
 
-typedef void (*sto_rpc_method_handler)(struct spdk_jsonrpc_request *request,
+/*
+ * A JSON-RPC request together with what rpc_get_stats needs to account
+ * the call. It lives until the method answers through one of the calls
+ * below, which also release it.
+ */
+struct sto_rpc_request;
+
+typedef void (*sto_rpc_method_handler)(struct sto_rpc_request *request,
 				       const struct spdk_json_val *params);
 
 void sto_rpc_register_method(const char *method, sto_rpc_method_handler func);
 
+struct spdk_json_write_ctx *sto_rpc_begin_result(struct sto_rpc_request *request);
+void sto_rpc_end_result(struct sto_rpc_request *request, struct spdk_json_write_ctx *w);
+void sto_rpc_send_error_response(struct sto_rpc_request *request, int error_code,
+				 const char *msg);
+
+void sto_rpc_stats_info_json(struct spdk_json_write_ctx *w);
+
 #define STO_RPC_REGISTER(method, func)					\
 static void __attribute__((constructor(1000))) rpc_register_##func(void)\
 {									\
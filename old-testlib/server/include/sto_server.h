@@ -1,9 +1,24 @@
 #ifndef _STO_SERVER_H_
 #define _STO_SERVER_H_
 
+#include "sto_exec.h"
+
 #define STO_LOCAL_SERVER_ADDR "/var/tmp/sto_server.sock"
 
-int sto_server_start(void);
+struct sto_server_opts {
+	struct sto_exec_opts exec_opts;
+
+	/* Size of the io_uring engine for file ops, 0 disables it */
+	uint32_t uring_entries;
+
+	/* Shared memory slots for file payloads, 0 slots disables the channel */
+	uint32_t shm_slot_size;
+	uint32_t shm_nr_slots;
+};
+
+void sto_server_opts_init(struct sto_server_opts *opts);
+
+int sto_server_start(const struct sto_server_opts *opts);
 void sto_server_fini(void);
 
 #endif /* _STO_SERVER_H_ */
@@ -0,0 +1,44 @@
+#ifndef _STO_SHM_H_
+#define _STO_SHM_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Shared memory payload channel between the control and the server.
+ *
+ * The region is a memfd mapped MAP_SHARED before the server is forked,
+ * so both processes see it at the same address. It is cut into fixed
+ * size slots: the server allocates a slot, reads a file straight into
+ * it and answers with the slot offset and length over the socket. The
+ * control side then owns the slot and releases it with sto_shm_free().
+ */
+
+#define STO_SHM_DEFAULT_SLOT_SIZE	(64 * 1024)
+#define STO_SHM_DEFAULT_NR_SLOTS	0
+
+/*
+ * A slot still busy after this long is assumed to belong to a response
+ * the control side never got, and may be reused. It is well above the
+ * time any reader holds a slot, which only lasts while it is copied out
+ * or handed to a readfile view callback.
+ */
+#define STO_SHM_SLOT_LEASE_SEC		60
+
+int sto_shm_init(uint32_t slot_size, uint32_t nr_slots);
+void sto_shm_fini(void);
+
+bool sto_shm_enabled(void);
+
+/* Returns NULL if @size does not fit a slot or all slots are busy */
+void *sto_shm_alloc(size_t size);
+void sto_shm_free(void *ptr);
+
+bool sto_shm_owns(const void *ptr);
+uint64_t sto_shm_offset(const void *ptr);
+
+/* Validates an offset and length received from the peer */
+void *sto_shm_ptr(uint64_t off, uint64_t len);
+
+#endif /* _STO_SHM_H_ */
@@ -4,6 +4,7 @@
 #include "sto_async.h"
 
 struct spdk_json_val;
+struct spdk_json_write_ctx;
 
 struct sto_srv_writefile_args {
 	void *cb_arg;
@@ -12,7 +13,15 @@ struct sto_srv_writefile_args {
 
 int sto_srv_writefile(const struct spdk_json_val *params,
 		      struct sto_srv_writefile_args *args);
-
+/* Takes @buf, a NUL-terminated payload that is not part of @params */
+int sto_srv_writefile_buf(const struct spdk_json_val *params, char *buf,
+			  struct sto_srv_writefile_args *args);
+
+/*
+ * With "shm" in the params @buf may be a shm slot (sto_shm_owns()).
+ * The callback then owns it: either hand it over to the client or
+ * release it with sto_shm_free().
+ */
 typedef void (*sto_srv_readfile_done_t)(void *cb_arg, char *buf, int rc);
 
 struct sto_srv_readfile_args {
@@ -33,4 +42,21 @@ struct sto_srv_readlink_args {
 int sto_srv_readlink(const struct spdk_json_val *params,
 		     struct sto_srv_readlink_args *args);
 
+struct sto_srv_multi_file_req;
+
+typedef void (*sto_srv_multi_file_done_t)(void *cb_arg, struct sto_srv_multi_file_req *req);
+
+struct sto_srv_multi_file_args {
+	void *cb_arg;
+	sto_srv_multi_file_done_t cb_fn;
+};
+
+int sto_srv_multi_writefile(const struct spdk_json_val *params,
+			    struct sto_srv_multi_file_args *args);
+int sto_srv_multi_readfile(const struct spdk_json_val *params,
+			   struct sto_srv_multi_file_args *args);
+/* Writes the per-entry results of either req */
+void sto_srv_multi_file_info_json(struct sto_srv_multi_file_req *req,
+				  struct spdk_json_write_ctx *w);
+
 #endif /* _STO_SRV_AIO_H_ */
@@ -0,0 +1,15 @@
+#ifndef _STO_SRV_BIN_H_
+#define _STO_SRV_BIN_H_
+
+/*
+ * Listener for the binary framing described in sto_bin.h. It runs next
+ * to the JSON-RPC server on the same thread and is polled from the
+ * accept loop. The sockets sit in an epoll set, a poll only reads from
+ * and accepts on the ones that are ready.
+ */
+int sto_srv_bin_init(const char *addr);
+void sto_srv_bin_fini(void);
+
+int sto_srv_bin_poll(void);
+
+#endif /* _STO_SRV_BIN_H_ */
@@ -3,6 +3,8 @@
 
 #include <spdk/queue.h>
 
+#include "sto_arena.h"
+
 /* generic data direction definitions */
 #define STO_READ	0
 #define STO_WRITE	1
@@ -16,8 +18,16 @@ struct sto_srv_dirent {
 	TAILQ_ENTRY(sto_srv_dirent) list;
 };
 
+#define STO_SRV_DIRENTS_ARENA_CHUNK_SIZE	(16 * 1024)
+
+/* The dirents and their names live in the arena */
 struct sto_srv_dirents {
 	TAILQ_HEAD(, sto_srv_dirent) dirents;
+	struct sto_arena arena;
+
+	/* Where the next page starts, see sto_srv_readdir() */
+	uint64_t cursor;
+	bool eof;
 };
 
 void sto_choker_on(void);
@@ -29,13 +39,9 @@ int sto_read(int fd, void *data, size_t size);
 int sto_write_file(const char *filepath, int oflag, void *data, size_t size);
 int sto_read_file(const char *filepath, void *data, size_t size);
 
-struct sto_srv_dirent *sto_srv_dirent_alloc(const char *name);
-void sto_srv_dirent_free(struct sto_srv_dirent *dirent);
-int sto_srv_dirent_get_stat(struct sto_srv_dirent *dirent, const char *path);
-
 void sto_srv_dirents_init(struct sto_srv_dirents *dirents);
 void sto_srv_dirents_free(struct sto_srv_dirents *dirents);
-void sto_srv_dirents_add(struct sto_srv_dirents *dirents, struct sto_srv_dirent *dirent);
+int sto_srv_dirents_add(struct sto_srv_dirents *dirents, const char *name, size_t name_len, uint32_t mode);
 void sto_srv_dirents_info_json(struct sto_srv_dirents *dirents, struct spdk_json_write_ctx *w);
 
 #endif /* _STO_SRV_FS_H_ */
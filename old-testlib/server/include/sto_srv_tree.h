@@ -0,0 +1,20 @@
+#ifndef _STO_SRV_TREE_H_
+#define _STO_SRV_TREE_H_
+
+struct spdk_json_val;
+struct spdk_json_write_ctx;
+struct sto_srv_tree_node;
+
+typedef void (*sto_srv_tree_done_t)(void *cb_arg, struct sto_srv_tree_node *tree_root, int rc);
+
+struct sto_srv_tree_args {
+	void *cb_arg;
+	sto_srv_tree_done_t cb_fn;
+};
+
+int sto_srv_tree(const struct spdk_json_val *params,
+		 struct sto_srv_tree_args *args);
+
+void sto_srv_tree_info_json(struct sto_srv_tree_node *tree_root, struct spdk_json_write_ctx *w);
+
+#endif /* _STO_SRV_TREE_H_ */
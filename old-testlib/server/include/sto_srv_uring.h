@@ -0,0 +1,32 @@
+#ifndef _STO_SRV_URING_H_
+#define _STO_SRV_URING_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sto_async.h"
+
+#define STO_SRV_URING_DEFAULT_ENTRIES 256
+
+typedef void (*sto_srv_uring_read_done_t)(void *cb_arg, char *buf, int rc);
+
+/*
+ * Returns -ENOTSUP if the server was built without io_uring or the ring
+ * could not be set up, and -EAGAIN if the ring has no free file slots.
+ * In both cases the caller is expected to fall back to sto_exec().
+ */
+int sto_srv_uring_init(uint32_t entries);
+void sto_srv_uring_fini(void);
+
+bool sto_srv_uring_enabled(void);
+
+int sto_srv_uring_poll(void);
+
+/* On success the callback owns @buf, a NUL-terminated copy of the file */
+int sto_srv_uring_readfile(const char *filepath, uint32_t size,
+			   sto_srv_uring_read_done_t cb_fn, void *cb_arg);
+int sto_srv_uring_writefile(const char *filepath, int oflag, const char *buf, size_t size,
+			    sto_generic_cb cb_fn, void *cb_arg);
+
+#endif /* _STO_SRV_URING_H_ */
@@ -0,0 +1,175 @@
+#include <spdk/stdinc.h>
+#include <spdk/likely.h>
+#include <spdk/util.h>
+
+#include "sto_arena.h"
+
+#define STO_ARENA_ALIGN	16
+
+struct sto_arena_chunk {
+	struct sto_arena_chunk *next;
+	size_t size;
+	char data[] __attribute__((aligned(STO_ARENA_ALIGN)));
+};
+
+static struct sto_arena_chunk *
+sto_arena_chunk_alloc(size_t chunk_size, size_t size)
+{
+	struct sto_arena_chunk *chunk;
+
+	chunk_size = spdk_max(size, chunk_size - sizeof(*chunk));
+
+	chunk = calloc(1, sizeof(*chunk) + chunk_size);
+	if (spdk_unlikely(!chunk)) {
+		printf("server: Failed to alloc arena chunk: size=%zu\n", chunk_size);
+		return NULL;
+	}
+
+	chunk->size = chunk_size;
+
+	return chunk;
+}
+
+static void
+sto_arena_chunks_free(struct sto_arena_chunk *chunk)
+{
+	struct sto_arena_chunk *next;
+
+	for (; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+}
+
+void
+sto_arena_init(struct sto_arena *arena, size_t chunk_size)
+{
+	arena->chunks = NULL;
+	arena->chunk_used = 0;
+	arena->chunk_size = chunk_size;
+}
+
+void
+sto_arena_fini(struct sto_arena *arena)
+{
+	sto_arena_chunks_free(arena->chunks);
+
+	arena->chunks = NULL;
+	arena->chunk_used = 0;
+}
+
+struct sto_arena *
+sto_arena_create(size_t chunk_size)
+{
+	struct sto_arena_chunk *chunk;
+	struct sto_arena *arena;
+
+	chunk = sto_arena_chunk_alloc(chunk_size, sizeof(*arena));
+	if (spdk_unlikely(!chunk)) {
+		return NULL;
+	}
+
+	arena = (struct sto_arena *) chunk->data;
+
+	arena->chunks = chunk;
+	arena->chunk_used = SPDK_ALIGN_CEIL(sizeof(*arena), STO_ARENA_ALIGN);
+	arena->chunk_size = chunk_size;
+
+	return arena;
+}
+
+void
+sto_arena_destroy(struct sto_arena *arena)
+{
+	if (!arena) {
+		return;
+	}
+
+	/* One of the chunks holds the arena, so it isn't touched past here */
+	sto_arena_chunks_free(arena->chunks);
+}
+
+void *
+sto_arena_alloc(struct sto_arena *arena, size_t size)
+{
+	struct sto_arena_chunk *chunk = arena->chunks;
+
+	size = SPDK_ALIGN_CEIL(size, STO_ARENA_ALIGN);
+
+	if (spdk_unlikely(!chunk || chunk->size - arena->chunk_used < size)) {
+		struct sto_arena_chunk *new_chunk;
+
+		new_chunk = sto_arena_chunk_alloc(arena->chunk_size, size);
+		if (spdk_unlikely(!new_chunk)) {
+			return NULL;
+		}
+
+		/*
+		 * An oversized allocation gets a chunk of its own behind
+		 * the current one, so the room left in it isn't wasted
+		 */
+		if (chunk && new_chunk->size - size < chunk->size - arena->chunk_used) {
+			new_chunk->next = chunk->next;
+			chunk->next = new_chunk;
+
+			return new_chunk->data;
+		}
+
+		new_chunk->next = chunk;
+		arena->chunks = new_chunk;
+		arena->chunk_used = 0;
+
+		chunk = new_chunk;
+	}
+
+	arena->chunk_used += size;
+
+	return chunk->data + arena->chunk_used - size;
+}
+
+char *
+sto_arena_strndup(struct sto_arena *arena, const char *s, size_t len)
+{
+	char *str;
+
+	str = sto_arena_alloc(arena, len + 1);
+	if (spdk_unlikely(!str)) {
+		return NULL;
+	}
+
+	memcpy(str, s, len);
+	str[len] = '\0';
+
+	return str;
+}
+
+char *
+sto_arena_strdup(struct sto_arena *arena, const char *s)
+{
+	return sto_arena_strndup(arena, s, strlen(s));
+}
+
+char *
+sto_arena_vsprintf(struct sto_arena *arena, const char *fmt, va_list args)
+{
+	va_list args_copy;
+	char *str;
+	int len;
+
+	va_copy(args_copy, args);
+	len = vsnprintf(NULL, 0, fmt, args_copy);
+	va_end(args_copy);
+
+	if (spdk_unlikely(len < 0)) {
+		return NULL;
+	}
+
+	str = sto_arena_alloc(arena, len + 1);
+	if (spdk_unlikely(!str)) {
+		return NULL;
+	}
+
+	vsnprintf(str, len + 1, fmt, args);
+
+	return str;
+}
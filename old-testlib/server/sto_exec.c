@@ -1,7 +1,273 @@
 #include "sto_exec.h"
 
+#include <semaphore.h>
+#include <sched.h>
+
 #include <spdk/stdinc.h>
 #include <spdk/likely.h>
+#include <spdk/util.h>
+
+#define STO_EXEC_CACHE_LINE_SIZE 64
+
+/*
+ * Bounded MPMC queue (D. Vyukov). Every slot carries a sequence number
+ * which tells producers and consumers whether the slot is free to be
+ * filled or ready to be taken, so neither side needs a lock.
+ */
+struct sto_exec_queue_slot {
+	atomic_size_t seq;
+	struct sto_exec_ctx *exec_ctx;
+};
+
+struct sto_exec_queue {
+	struct sto_exec_queue_slot *slots;
+	size_t mask;
+
+	_Alignas(STO_EXEC_CACHE_LINE_SIZE) atomic_size_t enqueue_pos;
+	_Alignas(STO_EXEC_CACHE_LINE_SIZE) atomic_size_t dequeue_pos;
+};
+
+/*
+ * Completion ring between a single worker (producer) and the server
+ * thread (consumer). Finished requests go back through it, so that
+ * exec_done() always runs on the thread that owns the JSON-RPC server.
+ */
+struct sto_exec_cpl_ring {
+	struct sto_exec_ctx **ring;
+	size_t mask;
+
+	_Alignas(STO_EXEC_CACHE_LINE_SIZE) atomic_size_t head;
+	_Alignas(STO_EXEC_CACHE_LINE_SIZE) atomic_size_t tail;
+};
+
+#define STO_EXEC_CPL_BATCH 32
+
+struct sto_exec_pool;
+
+struct sto_exec_worker {
+	pthread_t thread;
+	atomic_bool exited;
+
+	struct sto_exec_pool *pool;
+	struct sto_exec_cpl_ring cpl_ring;
+};
+
+struct sto_exec_pool {
+	struct sto_exec_queue queue;
+
+	/* Counts queued requests plus stop tokens posted by sto_exec_fini() */
+	sem_t sem;
+	atomic_bool stop;
+
+	struct sto_exec_worker *workers;
+	uint32_t nr_workers;
+
+	/* Requests waiting for a room in the queue, see sto_exec_defer() */
+	TAILQ_HEAD(, sto_exec_ctx) deferred;
+
+	bool initialized;
+};
+
+static struct sto_exec_pool g_sto_exec_pool;
+
+static uint64_t
+sto_exec_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+sto_exec_stat_max(atomic_uint_fast64_t *max, uint64_t val)
+{
+	uint_fast64_t cur = atomic_load_explicit(max, memory_order_relaxed);
+
+	while (cur < val &&
+	       !atomic_compare_exchange_weak_explicit(max, &cur, val,
+						      memory_order_relaxed,
+						      memory_order_relaxed));
+}
+
+static void
+sto_exec_stat_add(atomic_uint_fast64_t *stat, uint64_t val)
+{
+	atomic_fetch_add_explicit(stat, val, memory_order_relaxed);
+}
+
+static int
+sto_exec_queue_init(struct sto_exec_queue *queue, uint32_t size)
+{
+	size_t i;
+
+	size = spdk_align32pow2(size);
+
+	queue->slots = calloc(size, sizeof(*queue->slots));
+	if (spdk_unlikely(!queue->slots)) {
+		printf("server: Failed to alloc exec queue with %u slots\n", size);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < size; i++) {
+		atomic_init(&queue->slots[i].seq, i);
+	}
+
+	queue->mask = size - 1;
+
+	atomic_init(&queue->enqueue_pos, 0);
+	atomic_init(&queue->dequeue_pos, 0);
+
+	return 0;
+}
+
+static void
+sto_exec_queue_destroy(struct sto_exec_queue *queue)
+{
+	free(queue->slots);
+	queue->slots = NULL;
+}
+
+static bool
+sto_exec_queue_push(struct sto_exec_queue *queue, struct sto_exec_ctx *exec_ctx)
+{
+	struct sto_exec_queue_slot *slot;
+	size_t pos, seq;
+	intptr_t diff;
+
+	pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+
+	for (;;) {
+		slot = &queue->slots[pos & queue->mask];
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		diff = (intptr_t) seq - (intptr_t) pos;
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&queue->enqueue_pos, &pos, pos + 1,
+								  memory_order_relaxed,
+								  memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			/* Queue is full */
+			return false;
+		} else {
+			pos = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
+		}
+	}
+
+	slot->exec_ctx = exec_ctx;
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+	return true;
+}
+
+static struct sto_exec_ctx *
+sto_exec_queue_pop(struct sto_exec_queue *queue)
+{
+	struct sto_exec_queue_slot *slot;
+	struct sto_exec_ctx *exec_ctx;
+	size_t pos, seq;
+	intptr_t diff;
+
+	pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+
+	for (;;) {
+		slot = &queue->slots[pos & queue->mask];
+		seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+		diff = (intptr_t) seq - (intptr_t) (pos + 1);
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(&queue->dequeue_pos, &pos, pos + 1,
+								  memory_order_relaxed,
+								  memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) {
+			/* Queue is empty or the producer has not published the slot yet */
+			return NULL;
+		} else {
+			pos = atomic_load_explicit(&queue->dequeue_pos, memory_order_relaxed);
+		}
+	}
+
+	exec_ctx = slot->exec_ctx;
+	atomic_store_explicit(&slot->seq, pos + queue->mask + 1, memory_order_release);
+
+	return exec_ctx;
+}
+
+static int
+sto_exec_cpl_ring_init(struct sto_exec_cpl_ring *cpl_ring, uint32_t size)
+{
+	size = spdk_align32pow2(size);
+
+	cpl_ring->ring = calloc(size, sizeof(*cpl_ring->ring));
+	if (spdk_unlikely(!cpl_ring->ring)) {
+		printf("server: Failed to alloc exec completion ring with %u slots\n", size);
+		return -ENOMEM;
+	}
+
+	cpl_ring->mask = size - 1;
+
+	atomic_init(&cpl_ring->head, 0);
+	atomic_init(&cpl_ring->tail, 0);
+
+	return 0;
+}
+
+static void
+sto_exec_cpl_ring_destroy(struct sto_exec_cpl_ring *cpl_ring)
+{
+	free(cpl_ring->ring);
+	cpl_ring->ring = NULL;
+}
+
+static bool
+sto_exec_cpl_ring_push(struct sto_exec_cpl_ring *cpl_ring, struct sto_exec_ctx *exec_ctx)
+{
+	size_t tail, head;
+
+	tail = atomic_load_explicit(&cpl_ring->tail, memory_order_relaxed);
+	head = atomic_load_explicit(&cpl_ring->head, memory_order_acquire);
+
+	if (spdk_unlikely(tail - head > cpl_ring->mask)) {
+		return false;
+	}
+
+	cpl_ring->ring[tail & cpl_ring->mask] = exec_ctx;
+	atomic_store_explicit(&cpl_ring->tail, tail + 1, memory_order_release);
+
+	return true;
+}
+
+static size_t
+sto_exec_cpl_ring_pop_bulk(struct sto_exec_cpl_ring *cpl_ring,
+			   struct sto_exec_ctx **exec_ctxs, size_t max)
+{
+	size_t head, tail, cnt, i;
+
+	head = atomic_load_explicit(&cpl_ring->head, memory_order_relaxed);
+	tail = atomic_load_explicit(&cpl_ring->tail, memory_order_acquire);
+
+	cnt = spdk_min(tail - head, max);
+
+	for (i = 0; i < cnt; i++) {
+		exec_ctxs[i] = cpl_ring->ring[(head + i) & cpl_ring->mask];
+	}
+
+	atomic_store_explicit(&cpl_ring->head, head + cnt, memory_order_release);
+
+	return cnt;
+}
+
+void
+sto_exec_opts_init(struct sto_exec_opts *opts)
+{
+	opts->nr_workers = STO_EXEC_DEFAULT_WORKERS;
+	opts->queue_size = STO_EXEC_DEFAULT_QUEUE_SIZE;
+}
 
 void
 sto_exec_init_ctx(struct sto_exec_ctx *exec_ctx, struct sto_exec_ops *ops, void *priv)
@@ -10,47 +276,378 @@ sto_exec_init_ctx(struct sto_exec_ctx *exec_ctx, struct sto_exec_ops *ops, void
 	exec_ctx->priv = priv;
 }
 
-static void *
-sto_local_exec(void *arg)
+static void
+sto_local_exec(struct sto_exec_worker *worker, struct sto_exec_ctx *exec_ctx)
 {
-	struct sto_exec_ctx *exec_ctx = arg;
-	struct sto_exec_ops *ops;
+	struct sto_exec_ops *ops = exec_ctx->ops;
+	struct sto_exec_stats *stats = &ops->stats;
+	uint64_t start_ns, wait_ns, exec_ns;
 	int rc;
 
-	ops = exec_ctx->ops;
+	start_ns = sto_exec_now_ns();
+
+	atomic_fetch_sub_explicit(&stats->queue_depth, 1, memory_order_relaxed);
+
+	wait_ns = start_ns - exec_ctx->submit_ns;
+	sto_exec_stat_add(&stats->total_wait_ns, wait_ns);
+	sto_exec_stat_max(&stats->max_wait_ns, wait_ns);
 
 	rc = ops->exec(exec_ctx->priv);
 	if (spdk_unlikely(rc)) {
 		printf("%s->exec() failed, rc=%d\n", ops->name, rc);
+		sto_exec_stat_add(&stats->failed, 1);
 	}
 
-	ops->exec_done(exec_ctx->priv, rc);
+	exec_ns = sto_exec_now_ns() - start_ns;
+	sto_exec_stat_add(&stats->total_exec_ns, exec_ns);
+	sto_exec_stat_max(&stats->max_exec_ns, exec_ns);
+
+	sto_exec_stat_add(&stats->completed, 1);
 
-	return (void *) 0;
+	exec_ctx->rc = rc;
+
+	/* The server thread drains the ring on every poll, so just wait for a room */
+	while (!sto_exec_cpl_ring_push(&worker->cpl_ring, exec_ctx)) {
+		sched_yield();
+	}
 }
 
-int
-sto_exec(struct sto_exec_ctx *exec_ctx)
+static void *
+sto_exec_worker_fn(void *arg)
 {
-	pthread_attr_t attr;
+	struct sto_exec_worker *worker = arg;
+	struct sto_exec_pool *pool = worker->pool;
+	struct sto_exec_ctx *exec_ctx;
+
+	for (;;) {
+		while (sem_wait(&pool->sem) == -1 && errno == EINTR);
+
+		/*
+		 * Every post means either a queued request or a stop token.
+		 * The pop may still miss a request whose producer has not
+		 * published the slot yet, so retry until it shows up.
+		 */
+		while (!(exec_ctx = sto_exec_queue_pop(&pool->queue))) {
+			if (atomic_load(&pool->stop)) {
+				atomic_store(&worker->exited, true);
+				return NULL;
+			}
+
+			sched_yield();
+		}
+
+		sto_local_exec(worker, exec_ctx);
+	}
+
+	return NULL;
+}
+
+static int
+sto_exec_start_workers(struct sto_exec_pool *pool, uint32_t nr_workers, uint32_t ring_size)
+{
+	struct sto_exec_worker *worker;
+	sigset_t set, oldset;
+	uint32_t i;
 	int rc = 0;
 
-	rc = pthread_attr_init(&attr);
+	pool->workers = calloc(nr_workers, sizeof(*pool->workers));
+	if (spdk_unlikely(!pool->workers)) {
+		printf("server: Failed to alloc %u exec workers\n", nr_workers);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < nr_workers; i++) {
+		worker = &pool->workers[i];
+
+		worker->pool = pool;
+		atomic_init(&worker->exited, false);
+
+		rc = sto_exec_cpl_ring_init(&worker->cpl_ring, ring_size);
+		if (spdk_unlikely(rc)) {
+			goto free_rings;
+		}
+	}
+
+	/* Leave SIGINT and SIGTERM to the server thread */
+	sigemptyset(&set);
+	sigaddset(&set, SIGINT);
+	sigaddset(&set, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &set, &oldset);
+
+	for (i = 0; i < nr_workers; i++) {
+		worker = &pool->workers[i];
+
+		rc = pthread_create(&worker->thread, NULL, sto_exec_worker_fn, worker);
+		if (spdk_unlikely(rc)) {
+			printf("server: Failed to create exec worker %u, rc=%d\n", i, rc);
+			rc = -rc;
+			break;
+		}
+
+		pool->nr_workers++;
+	}
+
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+
+	/* Rings of the workers never started are not seen by stop_workers() */
+	for (i = pool->nr_workers; i < nr_workers; i++) {
+		sto_exec_cpl_ring_destroy(&pool->workers[i].cpl_ring);
+	}
+
+	return rc;
+
+free_rings:
+	while (i--) {
+		sto_exec_cpl_ring_destroy(&pool->workers[i].cpl_ring);
+	}
+
+	free(pool->workers);
+	pool->workers = NULL;
+
+	return rc;
+}
+
+static void
+sto_exec_stop_workers(struct sto_exec_pool *pool)
+{
+	uint32_t i;
+
+	atomic_store(&pool->stop, true);
+
+	for (i = 0; i < pool->nr_workers; i++) {
+		sem_post(&pool->sem);
+	}
+
+	/*
+	 * A worker may be waiting for a room in its full completion ring,
+	 * so keep draining the rings until every worker has exited.
+	 */
+	for (i = 0; i < pool->nr_workers; i++) {
+		struct sto_exec_worker *worker = &pool->workers[i];
+
+		while (!atomic_load(&worker->exited)) {
+			if (!sto_exec_poll()) {
+				sched_yield();
+			}
+		}
+
+		pthread_join(worker->thread, NULL);
+	}
+
+	/* Workers are gone, complete whatever they left in the rings */
+	while (sto_exec_poll() > 0) {
+		;
+	}
+
+	for (i = 0; i < pool->nr_workers; i++) {
+		sto_exec_cpl_ring_destroy(&pool->workers[i].cpl_ring);
+	}
+
+	free(pool->workers);
+	pool->workers = NULL;
+	pool->nr_workers = 0;
+}
+
+int
+sto_exec_init(const struct sto_exec_opts *opts)
+{
+	struct sto_exec_pool *pool = &g_sto_exec_pool;
+	int rc;
+
+	if (pool->initialized) {
+		printf("server: Exec pool has already been initialized\n");
+		return -EINVAL;
+	}
+
+	if (spdk_unlikely(!opts->nr_workers || !opts->queue_size)) {
+		printf("server: Invalid exec pool opts: nr_workers=%u, queue_size=%u\n",
+		       opts->nr_workers, opts->queue_size);
+		return -EINVAL;
+	}
+
+	rc = sto_exec_queue_init(&pool->queue, opts->queue_size);
 	if (spdk_unlikely(rc)) {
-		printf("pthread_attr_init() failed, rc=%d\n", rc);
 		return rc;
 	}
 
-	rc = pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	rc = sem_init(&pool->sem, 0, 0);
+	if (spdk_unlikely(rc == -1)) {
+		printf("server: Failed to init exec pool semaphore: %s\n",
+		       strerror(errno));
+		rc = -errno;
+		goto destroy_queue;
+	}
+
+	atomic_init(&pool->stop, false);
+	TAILQ_INIT(&pool->deferred);
+
+	rc = sto_exec_start_workers(pool, opts->nr_workers, opts->queue_size);
+	if (spdk_unlikely(rc)) {
+		goto stop_workers;
+	}
+
+	pool->initialized = true;
+
+	printf("server: Exec pool started: nr_workers=%u, queue_size=%zu\n",
+	       pool->nr_workers, pool->queue.mask + 1);
+
+	return 0;
+
+stop_workers:
+	sto_exec_stop_workers(pool);
+	sem_destroy(&pool->sem);
+
+destroy_queue:
+	sto_exec_queue_destroy(&pool->queue);
+
+	return rc;
+}
+
+void
+sto_exec_fini(void)
+{
+	struct sto_exec_pool *pool = &g_sto_exec_pool;
+	struct sto_exec_ctx *exec_ctx;
+
+	if (!pool->initialized) {
+		return;
+	}
+
+	sto_exec_stop_workers(pool);
+
+	/* Nothing is left to run what is still waiting for the queue */
+	while ((exec_ctx = TAILQ_FIRST(&pool->deferred))) {
+		TAILQ_REMOVE(&pool->deferred, exec_ctx, deferred);
+		exec_ctx->ops->exec_done(exec_ctx->priv, -ECANCELED);
+	}
+
+	sem_destroy(&pool->sem);
+	sto_exec_queue_destroy(&pool->queue);
+
+	pool->initialized = false;
+}
+
+static bool
+sto_exec_push(struct sto_exec_pool *pool, struct sto_exec_ctx *exec_ctx)
+{
+	struct sto_exec_stats *stats = &exec_ctx->ops->stats;
+	uint64_t depth;
+
+	exec_ctx->submit_ns = sto_exec_now_ns();
+
+	depth = atomic_fetch_add_explicit(&stats->queue_depth, 1, memory_order_relaxed) + 1;
+
+	if (spdk_unlikely(!sto_exec_queue_push(&pool->queue, exec_ctx))) {
+		atomic_fetch_sub_explicit(&stats->queue_depth, 1, memory_order_relaxed);
+		return false;
+	}
+
+	sto_exec_stat_add(&stats->submitted, 1);
+	sto_exec_stat_max(&stats->max_queue_depth, depth);
+
+	sem_post(&pool->sem);
+
+	return true;
+}
+
+static void
+sto_exec_push_deferred(struct sto_exec_pool *pool)
+{
+	struct sto_exec_ctx *exec_ctx;
+
+	if (atomic_load(&pool->stop)) {
+		return;
+	}
+
+	while ((exec_ctx = TAILQ_FIRST(&pool->deferred))) {
+		if (!sto_exec_push(pool, exec_ctx)) {
+			break;
+		}
+
+		TAILQ_REMOVE(&pool->deferred, exec_ctx, deferred);
+	}
+}
+
+int
+sto_exec_poll(void)
+{
+	struct sto_exec_pool *pool = &g_sto_exec_pool;
+	struct sto_exec_ctx *exec_ctxs[STO_EXEC_CPL_BATCH];
+	size_t cnt, i;
+	uint32_t w;
+	int total = 0;
+
+	for (w = 0; w < pool->nr_workers; w++) {
+		struct sto_exec_cpl_ring *cpl_ring = &pool->workers[w].cpl_ring;
+
+		cnt = sto_exec_cpl_ring_pop_bulk(cpl_ring, exec_ctxs, SPDK_COUNTOF(exec_ctxs));
+
+		for (i = 0; i < cnt; i++) {
+			struct sto_exec_ctx *exec_ctx = exec_ctxs[i];
+
+			exec_ctx->ops->exec_done(exec_ctx->priv, exec_ctx->rc);
+		}
+
+		total += cnt;
+	}
+
+	sto_exec_push_deferred(pool);
+
+	return total;
+}
+
+static int
+sto_exec_check(struct sto_exec_pool *pool, struct sto_exec_ctx *exec_ctx)
+{
+	if (spdk_unlikely(!pool->initialized)) {
+		printf("server: Exec pool has not been initialized\n");
+		return -ENODEV;
+	}
+
+	/* No worker may be left to pick it up */
+	if (spdk_unlikely(atomic_load(&pool->stop))) {
+		printf("server: Exec pool is stopping, reject %s\n", exec_ctx->ops->name);
+		return -ENODEV;
+	}
+
+	return 0;
+}
+
+int
+sto_exec(struct sto_exec_ctx *exec_ctx)
+{
+	struct sto_exec_pool *pool = &g_sto_exec_pool;
+	int rc;
+
+	rc = sto_exec_check(pool, exec_ctx);
 	if (spdk_unlikely(rc)) {
-		printf("Failed to set detach state to the thread, rc=%d\n", rc);
 		return rc;
 	}
 
-	rc = pthread_create(&exec_ctx->thread, &attr, sto_local_exec, exec_ctx);
+	if (spdk_unlikely(!sto_exec_push(pool, exec_ctx))) {
+		sto_exec_stat_add(&exec_ctx->ops->stats.rejected, 1);
+		printf("server: Exec queue is full, reject %s\n", exec_ctx->ops->name);
+		return -EAGAIN;
+	}
+
+	return 0;
+}
+
+int
+sto_exec_defer(struct sto_exec_ctx *exec_ctx)
+{
+	struct sto_exec_pool *pool = &g_sto_exec_pool;
+	int rc;
+
+	rc = sto_exec_check(pool, exec_ctx);
 	if (spdk_unlikely(rc)) {
-		printf("Failed to create processing exec thread, rc=%d\n", rc);
+		return rc;
 	}
 
-	return rc;
+	/* Keep the order, nothing overtakes a request already parked */
+	if (!TAILQ_EMPTY(&pool->deferred) || !sto_exec_push(pool, exec_ctx)) {
+		TAILQ_INSERT_TAIL(&pool->deferred, exec_ctx, deferred);
+	}
+
+	return 0;
 }
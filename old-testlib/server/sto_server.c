@@ -11,6 +11,11 @@
 #include <spdk/json.h>
 
 #include "sto_rpc.h"
+#include "sto_exec.h"
+#include "sto_srv_uring.h"
+#include "sto_srv_bin.h"
+#include "sto_shm.h"
+#include "sto_bin.h"
 
 struct spdk_jsonrpc_request;
 
@@ -24,6 +29,8 @@ struct sto_server {
 	char lock_path[UNIX_PATH_MAX + sizeof(".lock")];
 	int lock_fd;
 
+	struct sto_server_opts opts;
+
 	struct {
 		struct sockaddr_un listen_addr_unix;
 		struct spdk_jsonrpc_server *s;
@@ -32,30 +39,98 @@ struct sto_server {
 
 struct sto_rpc_method {
 	const char *name;
+	size_t name_len;
+	uint32_t hash;
+
 	sto_rpc_method_handler func;
+
+	/* Only touched from the server thread, so no atomics */
+	uint64_t calls;
+	uint64_t errors;
+	uint64_t total_ns;
+	uint64_t max_ns;
+
 	SLIST_ENTRY(sto_rpc_method) slist;
 };
 
+/*
+ * Open addressing with linear probing, kept at most half full.
+ * Methods are only added by constructors before the server starts,
+ * so the table never shrinks and lookups need no locking.
+ */
+struct sto_rpc_method_table {
+	struct sto_rpc_method **slots;
+	uint32_t size;
+	uint32_t cnt;
+};
+
+#define STO_RPC_METHOD_TABLE_MIN_SIZE	64
+
+struct sto_rpc_request {
+	struct spdk_jsonrpc_request *jsonrpc;
+	struct sto_rpc_method *method;
+	uint64_t start_ns;
+
+	SLIST_ENTRY(sto_rpc_request) slist;
+};
+
 static struct sto_server g_sto_server;
 static bool g_server_is_running;
 
 static SLIST_HEAD(, sto_rpc_method) g_rpc_methods = SLIST_HEAD_INITIALIZER(g_rpc_methods);
+static struct sto_rpc_method_table g_rpc_method_table;
 static bool g_rpcs_correct = true;
 
+/*
+ * Answered requests are kept here and handed out again, so a call does
+ * not go through malloc() once the server has seen its peak load.
+ * Only touched from the server thread.
+ */
+static SLIST_HEAD(, sto_rpc_request) g_rpc_request_cache =
+	SLIST_HEAD_INITIALIZER(g_rpc_request_cache);
 
-static bool
-sto_rpc_verify_methods(void)
+static uint64_t
+sto_rpc_now_ns(void)
 {
-	return g_rpcs_correct;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* FNV-1a, the JSON method name is not NUL-terminated */
+static uint32_t
+sto_rpc_method_hash(const char *name, size_t len)
+{
+	uint32_t hash = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= (uint8_t) name[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
 }
 
 static struct sto_rpc_method *
-_get_rpc_method(const struct spdk_json_val *method)
+sto_rpc_method_table_lookup(const char *name, size_t len)
 {
-	struct sto_rpc_method *m;
+	struct sto_rpc_method_table *table = &g_rpc_method_table;
+	uint32_t hash, mask, i;
 
-	SLIST_FOREACH(m, &g_rpc_methods, slist) {
-		if (spdk_json_strequal(method, m->name)) {
+	if (spdk_unlikely(!table->size)) {
+		return NULL;
+	}
+
+	hash = sto_rpc_method_hash(name, len);
+	mask = table->size - 1;
+
+	for (i = hash & mask; table->slots[i]; i = (i + 1) & mask) {
+		struct sto_rpc_method *m = table->slots[i];
+
+		if (m->hash == hash && m->name_len == len && !memcmp(m->name, name, len)) {
 			return m;
 		}
 	}
@@ -63,16 +138,87 @@ _get_rpc_method(const struct spdk_json_val *method)
 	return NULL;
 }
 
+static void
+sto_rpc_method_table_insert(struct sto_rpc_method **slots, uint32_t size,
+			    struct sto_rpc_method *m)
+{
+	uint32_t mask = size - 1, i;
+
+	for (i = m->hash & mask; slots[i]; i = (i + 1) & mask);
+
+	slots[i] = m;
+}
+
+static int
+sto_rpc_method_table_add(struct sto_rpc_method *m)
+{
+	struct sto_rpc_method_table *table = &g_rpc_method_table;
+
+	if ((table->cnt + 1) * 2 > table->size) {
+		uint32_t new_size = table->size ? table->size * 2 : STO_RPC_METHOD_TABLE_MIN_SIZE;
+		struct sto_rpc_method **new_slots;
+		uint32_t i;
+
+		new_slots = calloc(new_size, sizeof(*new_slots));
+		if (spdk_unlikely(!new_slots)) {
+			return -ENOMEM;
+		}
+
+		for (i = 0; i < table->size; i++) {
+			if (table->slots[i]) {
+				sto_rpc_method_table_insert(new_slots, new_size, table->slots[i]);
+			}
+		}
+
+		free(table->slots);
+
+		table->slots = new_slots;
+		table->size = new_size;
+	}
+
+	sto_rpc_method_table_insert(table->slots, table->size, m);
+	table->cnt++;
+
+	return 0;
+}
+
+static struct sto_rpc_method *
+_get_rpc_method(const struct spdk_json_val *method)
+{
+	return sto_rpc_method_table_lookup(method->start, method->len);
+}
+
 static struct sto_rpc_method *
 _get_rpc_method_raw(const char *method)
 {
-	struct spdk_json_val method_val;
+	return sto_rpc_method_table_lookup(method, strlen(method));
+}
 
-	method_val.type = SPDK_JSON_VAL_STRING;
-	method_val.len = strlen(method);
-	method_val.start = (char *)method;
+/*
+ * Every binary opcode but HELLO is a shortcut for the JSON-RPC method
+ * of the same name, so a name without a registered method means the
+ * opcode table in sto_bin.h went out of sync.
+ */
+static bool
+sto_rpc_verify_bin_opcodes(void)
+{
+	int i;
 
-	return _get_rpc_method(&method_val);
+	for (i = STO_BIN_OP_HELLO + 1; i < STO_BIN_OP_CNT; i++) {
+		if (!sto_bin_opcode_names[i] || !_get_rpc_method_raw(sto_bin_opcode_names[i])) {
+			printf("Binary opcode %d (%s) has no RPC method registered\n",
+			       i, sto_bin_opcode_names[i] ? : "unnamed");
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static bool
+sto_rpc_verify_methods(void)
+{
+	return g_rpcs_correct && sto_rpc_verify_bin_opcodes();
 }
 
 void
@@ -93,24 +239,141 @@ sto_rpc_register_method(const char *method, sto_rpc_method_handler func)
 	m->name = strdup(method);
 	assert(m->name != NULL);
 
+	m->name_len = strlen(m->name);
+	m->hash = sto_rpc_method_hash(m->name, m->name_len);
+
 	m->func = func;
 
-	/* TODO: use a hash table or sorted list */
+	if (sto_rpc_method_table_add(m)) {
+		printf("failed to add RPC %s to the method table\n", method);
+		g_rpcs_correct = false;
+		return;
+	}
+
 	SLIST_INSERT_HEAD(&g_rpc_methods, m, slist);
 }
 
+static struct sto_rpc_request *
+sto_rpc_request_get(struct spdk_jsonrpc_request *jsonrpc, struct sto_rpc_method *m)
+{
+	struct sto_rpc_request *request;
+
+	request = SLIST_FIRST(&g_rpc_request_cache);
+	if (request) {
+		SLIST_REMOVE_HEAD(&g_rpc_request_cache, slist);
+	} else {
+		request = malloc(sizeof(*request));
+		if (spdk_unlikely(!request)) {
+			return NULL;
+		}
+	}
+
+	request->jsonrpc = jsonrpc;
+	request->method = m;
+	request->start_ns = sto_rpc_now_ns();
+
+	m->calls++;
+
+	return request;
+}
+
+static void
+sto_rpc_request_put(struct sto_rpc_request *request, bool failed)
+{
+	struct sto_rpc_method *m = request->method;
+	uint64_t ns;
+
+	ns = sto_rpc_now_ns() - request->start_ns;
+
+	m->total_ns += ns;
+	if (ns > m->max_ns) {
+		m->max_ns = ns;
+	}
+
+	if (failed) {
+		m->errors++;
+	}
+
+	SLIST_INSERT_HEAD(&g_rpc_request_cache, request, slist);
+}
+
+static void
+sto_rpc_request_cache_free(void)
+{
+	struct sto_rpc_request *request;
+
+	while ((request = SLIST_FIRST(&g_rpc_request_cache))) {
+		SLIST_REMOVE_HEAD(&g_rpc_request_cache, slist);
+		free(request);
+	}
+}
+
+struct spdk_json_write_ctx *
+sto_rpc_begin_result(struct sto_rpc_request *request)
+{
+	return spdk_jsonrpc_begin_result(request->jsonrpc);
+}
+
+void
+sto_rpc_end_result(struct sto_rpc_request *request, struct spdk_json_write_ctx *w)
+{
+	struct spdk_jsonrpc_request *jsonrpc = request->jsonrpc;
+
+	sto_rpc_request_put(request, false);
+	spdk_jsonrpc_end_result(jsonrpc, w);
+}
+
+void
+sto_rpc_send_error_response(struct sto_rpc_request *request, int error_code, const char *msg)
+{
+	struct spdk_jsonrpc_request *jsonrpc = request->jsonrpc;
+
+	sto_rpc_request_put(request, true);
+	spdk_jsonrpc_send_error_response(jsonrpc, error_code, msg);
+}
+
+void
+sto_rpc_stats_info_json(struct spdk_json_write_ctx *w)
+{
+	struct sto_rpc_method *m;
+
+	spdk_json_write_named_array_begin(w, "methods");
+
+	SLIST_FOREACH(m, &g_rpc_methods, slist) {
+		spdk_json_write_object_begin(w);
+
+		spdk_json_write_named_string(w, "name", m->name);
+		spdk_json_write_named_uint64(w, "calls", m->calls);
+		spdk_json_write_named_uint64(w, "errors", m->errors);
+		spdk_json_write_named_uint64(w, "total_latency_ns", m->total_ns);
+		spdk_json_write_named_uint64(w, "max_latency_ns", m->max_ns);
+
+		spdk_json_write_object_end(w);
+	}
+
+	spdk_json_write_array_end(w);
+}
+
 static void
-sto_jsonrpc_handler(struct spdk_jsonrpc_request *request,
+sto_jsonrpc_handler(struct spdk_jsonrpc_request *jsonrpc,
 		    const struct spdk_json_val *method,
 		    const struct spdk_json_val *params)
 {
+	struct sto_rpc_request *request;
 	struct sto_rpc_method *m;
 
 	assert(method != NULL);
 
 	m = _get_rpc_method(method);
 	if (m == NULL) {
-		spdk_jsonrpc_send_error_response(request, SPDK_JSONRPC_ERROR_METHOD_NOT_FOUND, "Method not found");
+		spdk_jsonrpc_send_error_response(jsonrpc, SPDK_JSONRPC_ERROR_METHOD_NOT_FOUND, "Method not found");
+		return;
+	}
+
+	request = sto_rpc_request_get(jsonrpc, m);
+	if (spdk_unlikely(!request)) {
+		spdk_jsonrpc_send_error_response(jsonrpc, SPDK_JSONRPC_ERROR_INTERNAL_ERROR,
+						 strerror(ENOMEM));
 		return;
 	}
 
@@ -221,6 +484,10 @@ sto_server_accept_loop(struct sto_server *s)
 
 	while (g_server_is_running) {
 		rc = spdk_jsonrpc_server_poll(s->s);
+
+		sto_exec_poll();
+		sto_srv_uring_poll();
+		sto_srv_bin_poll();
 	}
 
 	return rc;
@@ -282,31 +549,75 @@ sto_server_run(struct sto_server *s)
 		return rc;
 	}
 
+	rc = sto_exec_init(&s->opts.exec_opts);
+	if (spdk_unlikely(rc)) {
+		printf("Failed to init exec pool: %d\n", rc);
+		return rc;
+	}
+
+	rc = sto_srv_uring_init(s->opts.uring_entries);
+	if (rc) {
+		printf("io_uring engine is disabled, fall back to exec pool: %d\n", rc);
+	}
+
 	rc = sto_server_listen(s);
 	if (spdk_unlikely(rc)) {
 		printf("Failed to start listen: %d\n", rc);
-		return rc;
+		goto exec_fini;
+	}
+
+	rc = sto_srv_bin_init(STO_LOCAL_SERVER_BIN_ADDR);
+	if (rc) {
+		printf("Binary framing is disabled, clients stay on JSON-RPC: %d\n", rc);
 	}
 
 	rc = sto_server_accept_loop(s);
 
+	/* Let in-flight requests answer while the server is still alive */
+	sto_srv_uring_fini();
+	sto_exec_fini();
+	sto_srv_bin_fini();
+
 	spdk_server_close(s);
 
+	sto_rpc_request_cache_free();
+
+	return rc;
+
+exec_fini:
+	sto_srv_uring_fini();
+	sto_exec_fini();
+
 	return rc;
 }
 
 static void
-sto_server_init(struct sto_server *s)
+sto_server_init(struct sto_server *s, const struct sto_server_opts *opts)
 {
 	memset(s, 0, sizeof(*s));
 
+	s->opts = *opts;
+
 	s->listen_addr = STO_LOCAL_SERVER_ADDR;
 	s->lock_path[0] = '\0';
 	s->lock_fd = -1;
 }
 
+void
+sto_server_opts_init(struct sto_server_opts *opts)
+{
+	memset(opts, 0, sizeof(*opts));
+
+	sto_exec_opts_init(&opts->exec_opts);
+
+	opts->uring_entries = STO_SRV_URING_DEFAULT_ENTRIES;
+
+	opts->shm_slot_size = STO_SHM_DEFAULT_SLOT_SIZE;
+	opts->shm_nr_slots = STO_SHM_DEFAULT_NR_SLOTS;
+}
+
 int
-sto_server_start(void)
+sto_server_start(const struct sto_server_opts *opts)
 {
 	pid_t pid;
 	int rc = 0;
@@ -328,12 +639,20 @@ sto_server_start(void)
 		return -EINVAL;
 	}
 
-	sto_server_init(&g_sto_server);
+	sto_server_init(&g_sto_server, opts);
+
+	/* Must be mapped before fork() so both sides share it */
+	rc = sto_shm_init(opts->shm_slot_size, opts->shm_nr_slots);
+	if (rc && rc != -ENOTSUP) {
+		printf("Shared memory channel is disabled, payloads go over the socket: %d\n", rc);
+	}
 
 	pid = fork();
 	if (pid == -1) {
 		printf("Failed to fork: %s\n", spdk_strerror(errno));
-		return -errno;
+		rc = -errno;
+		sto_shm_fini();
+		return rc;
 	}
 
 	/* Child */
@@ -372,6 +691,8 @@ sto_server_fini(void)
 
 	rc = waitpid(g_sto_server.pid, &status, 0);
 
+	sto_shm_fini();
+
 	g_sto_server.initialized = false;
 
 	printf("STO server end fini\n");
@@ -0,0 +1,225 @@
+#include <spdk/stdinc.h>
+#include <spdk/likely.h>
+#include <spdk/util.h>
+
+#include "sto_shm.h"
+
+#define STO_SHM_MAGIC	0x53544f4d	/* "STOM" */
+
+/* A free slot has no busy stamp */
+#define STO_SHM_SLOT_FREE	0
+
+/*
+ * Lives at the start of the mapping. The slot busy stamps are the only
+ * thing both processes write, so they are updated with atomics; the hint
+ * just spreads allocations and may be stale.
+ *
+ * A busy slot holds the CLOCK_MONOTONIC second it was taken at, which
+ * is the same clock in both processes. A response that never reaches
+ * the control side (the connection dropped or the request timed out)
+ * leaves its slot busy with nobody knowing the offset, so a slot busy
+ * for longer than STO_SHM_SLOT_LEASE_SEC is taken over by the next
+ * allocation.
+ */
+struct sto_shm_hdr {
+	uint32_t magic;
+	uint32_t slot_size;
+	uint32_t nr_slots;
+	uint32_t alloc_hint;
+	uint64_t slot_busy[];
+};
+
+struct sto_shm {
+	struct sto_shm_hdr *hdr;
+	size_t size;
+
+	char *data;
+	size_t data_size;
+};
+
+static struct sto_shm g_sto_shm;
+
+static uint64_t
+sto_shm_now_sec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	/* Never hand out the free stamp */
+	return spdk_max((uint64_t) ts.tv_sec, 1);
+}
+
+int
+sto_shm_init(uint32_t slot_size, uint32_t nr_slots)
+{
+	struct sto_shm *shm = &g_sto_shm;
+	size_t hdr_size, page_size;
+	void *addr;
+	int fd, rc = 0;
+
+	if (!slot_size || !nr_slots) {
+		return -ENOTSUP;
+	}
+
+	if (shm->hdr) {
+		printf("shm: Shared memory channel has already been initialized\n");
+		return -EEXIST;
+	}
+
+	page_size = sysconf(_SC_PAGESIZE);
+
+	hdr_size = SPDK_ALIGN_CEIL(sizeof(struct sto_shm_hdr) + nr_slots * sizeof(uint64_t), page_size);
+	slot_size = SPDK_ALIGN_CEIL(slot_size, page_size);
+
+	shm->data_size = (size_t) slot_size * nr_slots;
+	shm->size = hdr_size + shm->data_size;
+
+	fd = memfd_create("sto_shm", MFD_CLOEXEC);
+	if (spdk_unlikely(fd == -1)) {
+		printf("shm: Failed to create memfd: %s\n", strerror(errno));
+		return -errno;
+	}
+
+	if (spdk_unlikely(ftruncate(fd, shm->size) == -1)) {
+		printf("shm: Failed to resize memfd to %zu: %s\n", shm->size, strerror(errno));
+		rc = -errno;
+		goto out;
+	}
+
+	addr = mmap(NULL, shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (spdk_unlikely(addr == MAP_FAILED)) {
+		printf("shm: Failed to map memfd: %s\n", strerror(errno));
+		rc = -errno;
+		goto out;
+	}
+
+	shm->hdr = addr;
+	shm->data = (char *) addr + hdr_size;
+
+	/* The memfd is zero filled, so every slot starts out free */
+	shm->hdr->magic = STO_SHM_MAGIC;
+	shm->hdr->slot_size = slot_size;
+	shm->hdr->nr_slots = nr_slots;
+
+out:
+	/* The mapping keeps the memfd alive */
+	close(fd);
+
+	return rc;
+}
+
+void
+sto_shm_fini(void)
+{
+	struct sto_shm *shm = &g_sto_shm;
+
+	if (!shm->hdr) {
+		return;
+	}
+
+	munmap(shm->hdr, shm->size);
+
+	memset(shm, 0, sizeof(*shm));
+}
+
+bool
+sto_shm_enabled(void)
+{
+	return g_sto_shm.hdr != NULL;
+}
+
+void *
+sto_shm_alloc(size_t size)
+{
+	struct sto_shm_hdr *hdr = g_sto_shm.hdr;
+	uint32_t i, hint;
+	uint64_t now;
+
+	if (!hdr || size > hdr->slot_size) {
+		return NULL;
+	}
+
+	now = sto_shm_now_sec();
+	hint = __atomic_load_n(&hdr->alloc_hint, __ATOMIC_RELAXED);
+
+	for (i = 0; i < hdr->nr_slots; i++) {
+		uint32_t idx = (hint + i) % hdr->nr_slots;
+		uint64_t busy = __atomic_load_n(&hdr->slot_busy[idx], __ATOMIC_RELAXED);
+
+		if (busy != STO_SHM_SLOT_FREE && now - busy < STO_SHM_SLOT_LEASE_SEC) {
+			continue;
+		}
+
+		if (__atomic_compare_exchange_n(&hdr->slot_busy[idx], &busy, now,
+						false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			if (spdk_unlikely(busy != STO_SHM_SLOT_FREE)) {
+				printf("shm: Reclaimed slot %u busy for %" PRIu64 " sec\n",
+				       idx, now - busy);
+			}
+
+			__atomic_store_n(&hdr->alloc_hint, idx + 1, __ATOMIC_RELAXED);
+			return g_sto_shm.data + (size_t) idx * hdr->slot_size;
+		}
+	}
+
+	return NULL;
+}
+
+bool
+sto_shm_owns(const void *ptr)
+{
+	const char *p = ptr;
+
+	return g_sto_shm.hdr && p >= g_sto_shm.data &&
+	       p < g_sto_shm.data + g_sto_shm.data_size;
+}
+
+uint64_t
+sto_shm_offset(const void *ptr)
+{
+	assert(sto_shm_owns(ptr));
+
+	return (const char *) ptr - g_sto_shm.data;
+}
+
+void
+sto_shm_free(void *ptr)
+{
+	struct sto_shm_hdr *hdr = g_sto_shm.hdr;
+	uint64_t idx;
+
+	if (spdk_unlikely(!sto_shm_owns(ptr))) {
+		printf("shm: Attempt to free %p that is not a shm slot\n", ptr);
+		assert(0);
+		return;
+	}
+
+	idx = sto_shm_offset(ptr) / hdr->slot_size;
+
+	__atomic_store_n(&hdr->slot_busy[idx], STO_SHM_SLOT_FREE, __ATOMIC_RELEASE);
+}
+
+void *
+sto_shm_ptr(uint64_t off, uint64_t len)
+{
+	struct sto_shm_hdr *hdr = g_sto_shm.hdr;
+
+	if (spdk_unlikely(!hdr)) {
+		return NULL;
+	}
+
+	if (spdk_unlikely(off % hdr->slot_size || off >= g_sto_shm.data_size ||
+			  len >= hdr->slot_size)) {
+		printf("shm: Invalid slot reference: off=%" PRIu64 " len=%" PRIu64 "\n", off, len);
+		return NULL;
+	}
+
+	if (spdk_unlikely(__atomic_load_n(&hdr->slot_busy[off / hdr->slot_size],
+					  __ATOMIC_ACQUIRE) == STO_SHM_SLOT_FREE)) {
+		printf("shm: Slot at off=%" PRIu64 " is not busy\n", off);
+		return NULL;
+	}
+
+	return g_sto_shm.data + off;
+}
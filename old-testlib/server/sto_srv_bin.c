@@ -0,0 +1,735 @@
+#include "sto_srv_bin.h"
+
+#include <spdk/stdinc.h>
+#include <spdk/json.h>
+#include <spdk/likely.h>
+#include <spdk/queue.h>
+#include <spdk/util.h>
+
+#include <sys/epoll.h>
+
+#include "sto_bin.h"
+#include "sto_srv_aio.h"
+#include "sto_shm.h"
+
+#define STO_SRV_BIN_MAX_CONNS		64
+#define STO_SRV_BIN_MAX_EVENTS		16
+#define STO_SRV_BIN_RX_MIN_SIZE		4096
+#define STO_SRV_BIN_RX_MAX_IDLE_SIZE	(1024 * 1024)
+
+struct sto_srv_bin_tx {
+	char *buf;
+	size_t len;
+	size_t off;
+
+	TAILQ_ENTRY(sto_srv_bin_tx) list;
+};
+
+struct sto_srv_bin_conn {
+	int fd;
+
+	/* Epoll events the fd is registered for, EPOLLOUT only while tx is pending */
+	uint32_t events;
+
+	/* One reference for the socket and one per in-flight request */
+	uint32_t refcnt;
+
+	char *rx_buf;
+	size_t rx_len;
+	size_t rx_size;
+
+	TAILQ_HEAD(, sto_srv_bin_tx) tx_list;
+	TAILQ_ENTRY(sto_srv_bin_conn) list;
+};
+
+struct sto_srv_bin_req {
+	struct sto_srv_bin_conn *conn;
+
+	uint16_t opcode;
+	uint32_t id;
+};
+
+/*
+ * The listener and every connection are registered with @epfd, so a
+ * poll costs one epoll_wait() and only touches the fds that are ready.
+ * The listener is registered with a NULL data pointer.
+ */
+struct sto_srv_bin {
+	int listen_fd;
+	int epfd;
+	struct sockaddr_un addr;
+
+	uint32_t nr_conns;
+	TAILQ_HEAD(, sto_srv_bin_conn) conns;
+};
+
+static struct sto_srv_bin g_sto_srv_bin = {
+	.listen_fd = -1,
+	.epfd = -1,
+};
+
+static void
+sto_srv_bin_conn_put(struct sto_srv_bin_conn *conn)
+{
+	struct sto_srv_bin_tx *tx, *tmp;
+
+	assert(conn->refcnt > 0);
+	if (--conn->refcnt) {
+		return;
+	}
+
+	TAILQ_FOREACH_SAFE(tx, &conn->tx_list, list, tmp) {
+		TAILQ_REMOVE(&conn->tx_list, tx, list);
+		free(tx->buf);
+		free(tx);
+	}
+
+	free(conn->rx_buf);
+	free(conn);
+}
+
+static void
+sto_srv_bin_conn_close(struct sto_srv_bin_conn *conn)
+{
+	struct sto_srv_bin *bin = &g_sto_srv_bin;
+
+	if (conn->fd == -1) {
+		return;
+	}
+
+	epoll_ctl(bin->epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+
+	close(conn->fd);
+	conn->fd = -1;
+
+	TAILQ_REMOVE(&bin->conns, conn, list);
+	bin->nr_conns--;
+
+	/* Requests still in flight keep it alive and drop their replies */
+	sto_srv_bin_conn_put(conn);
+}
+
+static int
+sto_srv_bin_conn_flush(struct sto_srv_bin_conn *conn)
+{
+	struct sto_srv_bin_tx *tx;
+
+	while ((tx = TAILQ_FIRST(&conn->tx_list)) != NULL) {
+		ssize_t ret;
+
+		ret = send(conn->fd, tx->buf + tx->off, tx->len - tx->off, MSG_NOSIGNAL);
+		if (ret == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				return 0;
+			}
+
+			return -errno;
+		}
+
+		tx->off += ret;
+		if (tx->off < tx->len) {
+			continue;
+		}
+
+		TAILQ_REMOVE(&conn->tx_list, tx, list);
+		free(tx->buf);
+		free(tx);
+	}
+
+	return 0;
+}
+
+static int
+sto_srv_bin_conn_update_events(struct sto_srv_bin_conn *conn)
+{
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.ptr = conn,
+	};
+
+	if (!TAILQ_EMPTY(&conn->tx_list)) {
+		ev.events |= EPOLLOUT;
+	}
+
+	if (ev.events == conn->events) {
+		return 0;
+	}
+
+	if (spdk_unlikely(epoll_ctl(g_sto_srv_bin.epfd, EPOLL_CTL_MOD, conn->fd, &ev) == -1)) {
+		return -errno;
+	}
+
+	conn->events = ev.events;
+
+	return 0;
+}
+
+static void
+sto_srv_bin_send(struct sto_srv_bin_conn *conn, uint16_t opcode, uint32_t id,
+		 int status, const char *payload, uint32_t payload_len)
+{
+	struct sto_srv_bin_tx *tx;
+	struct sto_bin_hdr hdr;
+
+	if (conn->fd == -1) {
+		return;
+	}
+
+	tx = calloc(1, sizeof(*tx));
+	if (spdk_unlikely(!tx)) {
+		goto out_err;
+	}
+
+	tx->len = sizeof(hdr) + payload_len;
+
+	tx->buf = malloc(tx->len);
+	if (spdk_unlikely(!tx->buf)) {
+		free(tx);
+		goto out_err;
+	}
+
+	sto_bin_hdr_init(&hdr, opcode, id, status, 0, payload_len);
+
+	memcpy(tx->buf, &hdr, sizeof(hdr));
+	if (payload_len) {
+		memcpy(tx->buf + sizeof(hdr), payload, payload_len);
+	}
+
+	TAILQ_INSERT_TAIL(&conn->tx_list, tx, list);
+
+	if (spdk_unlikely(sto_srv_bin_conn_flush(conn) || sto_srv_bin_conn_update_events(conn))) {
+		printf("server: Failed to send binary frame, close the connection\n");
+		sto_srv_bin_conn_close(conn);
+	}
+
+	return;
+
+out_err:
+	/* The client cannot match the reply anymore, drop the connection */
+	printf("server: Failed to alloc binary frame: size=%u\n", payload_len);
+	sto_srv_bin_conn_close(conn);
+}
+
+static struct sto_srv_bin_req *
+sto_srv_bin_req_alloc(struct sto_srv_bin_conn *conn, const struct sto_bin_hdr *hdr)
+{
+	struct sto_srv_bin_req *req;
+
+	req = calloc(1, sizeof(*req));
+	if (spdk_unlikely(!req)) {
+		printf("server: Cann't allocate memory for binary req\n");
+		return NULL;
+	}
+
+	req->conn = conn;
+	req->opcode = hdr->opcode;
+	req->id = hdr->id;
+
+	conn->refcnt++;
+
+	return req;
+}
+
+static void
+sto_srv_bin_req_free(struct sto_srv_bin_req *req)
+{
+	sto_srv_bin_conn_put(req->conn);
+	free(req);
+}
+
+static void
+sto_srv_bin_req_done(struct sto_srv_bin_req *req, int rc, const char *payload)
+{
+	uint32_t payload_len = !rc && payload ? strlen(payload) : 0;
+
+	sto_srv_bin_send(req->conn, req->opcode, req->id, rc, payload, payload_len);
+	sto_srv_bin_req_free(req);
+}
+
+static void
+sto_srv_bin_writefile_done(void *cb_arg, int rc)
+{
+	sto_srv_bin_req_done(cb_arg, rc, NULL);
+}
+
+static void
+sto_srv_bin_read_done(void *cb_arg, char *buf, int rc)
+{
+	sto_srv_bin_req_done(cb_arg, rc, buf);
+
+	/* The payload has been copied into the frame */
+	if (sto_shm_owns(buf)) {
+		sto_shm_free(buf);
+	}
+}
+
+static struct spdk_json_val *
+sto_srv_bin_parse_params(char *json, size_t size)
+{
+	struct spdk_json_val *values;
+	void *end;
+	ssize_t rc;
+
+	rc = spdk_json_parse(json, size, NULL, 0, &end, 0);
+	if (spdk_unlikely(rc <= 0)) {
+		printf("server: Failed to count binary req params, rc=%zd\n", rc);
+		return NULL;
+	}
+
+	values = calloc(rc, sizeof(*values));
+	if (spdk_unlikely(!values)) {
+		printf("server: Failed to alloc json values: cnt=%zd\n", rc);
+		return NULL;
+	}
+
+	if (spdk_json_parse(json, size, values, rc, &end,
+			    SPDK_JSON_PARSE_FLAG_DECODE_IN_PLACE) != rc) {
+		printf("server: Failed to parse binary req params\n");
+		free(values);
+		return NULL;
+	}
+
+	return values;
+}
+
+static int
+sto_srv_bin_hello(struct sto_srv_bin_conn *conn, const struct sto_bin_hdr *hdr,
+		  const char *payload)
+{
+	char table[STO_BIN_OPCODE_TABLE_MAX_LEN];
+	int len, status = 0;
+
+	len = sto_bin_opcode_table_str(table, sizeof(table));
+
+	if (len < 0 || (uint32_t) len != hdr->payload_len || memcmp(table, payload, len)) {
+		printf("server: Binary framing opcode table mismatch\n");
+		status = -EPROTO;
+	}
+
+	sto_srv_bin_send(conn, hdr->opcode, hdr->id, status, NULL, 0);
+
+	return 0;
+}
+
+static int
+sto_srv_bin_submit(struct sto_srv_bin_req *req, const struct spdk_json_val *params,
+		   const char *payload, uint32_t payload_len)
+{
+	switch (req->opcode) {
+	case STO_BIN_OP_WRITEFILE: {
+		struct sto_srv_writefile_args args = {
+			.cb_arg = req,
+			.cb_fn = sto_srv_bin_writefile_done,
+		};
+		char *buf;
+
+		buf = malloc(payload_len + 1);
+		if (spdk_unlikely(!buf)) {
+			return -ENOMEM;
+		}
+
+		memcpy(buf, payload, payload_len);
+		buf[payload_len] = '\0';
+
+		return sto_srv_writefile_buf(params, buf, &args);
+	}
+	case STO_BIN_OP_READFILE: {
+		struct sto_srv_readfile_args args = {
+			.cb_arg = req,
+			.cb_fn = sto_srv_bin_read_done,
+		};
+
+		return sto_srv_readfile(params, &args);
+	}
+	case STO_BIN_OP_READLINK: {
+		struct sto_srv_readlink_args args = {
+			.cb_arg = req,
+			.cb_fn = sto_srv_bin_read_done,
+		};
+
+		return sto_srv_readlink(params, &args);
+	}
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static int
+sto_srv_bin_handle_frame(struct sto_srv_bin_conn *conn, const struct sto_bin_hdr *hdr,
+			 char *data)
+{
+	struct sto_srv_bin_req *req;
+	struct spdk_json_val *params;
+	char *payload = data + hdr->params_len;
+	int rc;
+
+	if (hdr->opcode == STO_BIN_OP_HELLO) {
+		return sto_srv_bin_hello(conn, hdr, payload);
+	}
+
+	req = sto_srv_bin_req_alloc(conn, hdr);
+	if (spdk_unlikely(!req)) {
+		sto_srv_bin_send(conn, hdr->opcode, hdr->id, -ENOMEM, NULL, 0);
+		return 0;
+	}
+
+	params = sto_srv_bin_parse_params(data, hdr->params_len);
+	if (spdk_unlikely(!params)) {
+		rc = -EINVAL;
+		goto out_err;
+	}
+
+	/* Params are decoded synchronously, the values are not needed afterwards */
+	rc = sto_srv_bin_submit(req, params, payload, hdr->payload_len);
+
+	free(params);
+
+	if (spdk_unlikely(rc)) {
+		goto out_err;
+	}
+
+	return 0;
+
+out_err:
+	sto_srv_bin_req_done(req, rc, NULL);
+
+	return 0;
+}
+
+static int
+sto_srv_bin_conn_process(struct sto_srv_bin_conn *conn)
+{
+	size_t off = 0;
+	int rc = 0;
+
+	while (conn->rx_len - off >= sizeof(struct sto_bin_hdr)) {
+		struct sto_bin_hdr hdr;
+		size_t frame_len;
+
+		memcpy(&hdr, conn->rx_buf + off, sizeof(hdr));
+
+		if (spdk_unlikely(!sto_bin_hdr_valid(&hdr))) {
+			printf("server: Got invalid binary frame header\n");
+			return -EPROTO;
+		}
+
+		frame_len = sizeof(hdr) + hdr.params_len + hdr.payload_len;
+		if (conn->rx_len - off < frame_len) {
+			break;
+		}
+
+		rc = sto_srv_bin_handle_frame(conn, &hdr, conn->rx_buf + off + sizeof(hdr));
+		if (spdk_unlikely(rc) || conn->fd == -1) {
+			return rc ?: -ECONNRESET;
+		}
+
+		off += frame_len;
+	}
+
+	if (off) {
+		memmove(conn->rx_buf, conn->rx_buf + off, conn->rx_len - off);
+		conn->rx_len -= off;
+	}
+
+	/* Do not keep a buffer sized for one huge write around forever */
+	if (!conn->rx_len && conn->rx_size > STO_SRV_BIN_RX_MAX_IDLE_SIZE) {
+		free(conn->rx_buf);
+		conn->rx_buf = NULL;
+		conn->rx_size = 0;
+	}
+
+	return 0;
+}
+
+static int
+sto_srv_bin_conn_rx_reserve(struct sto_srv_bin_conn *conn)
+{
+	size_t need = STO_SRV_BIN_RX_MIN_SIZE;
+	char *rx_buf;
+
+	/* Make room for the whole frame once its header has arrived */
+	if (conn->rx_len >= sizeof(struct sto_bin_hdr)) {
+		struct sto_bin_hdr hdr;
+
+		memcpy(&hdr, conn->rx_buf, sizeof(hdr));
+		need = spdk_max(need, sizeof(hdr) + hdr.params_len + hdr.payload_len);
+	}
+
+	if (conn->rx_size - conn->rx_len >= STO_SRV_BIN_RX_MIN_SIZE / 2 && conn->rx_size >= need) {
+		return 0;
+	}
+
+	need = spdk_max(need, conn->rx_size * 2);
+
+	rx_buf = realloc(conn->rx_buf, need);
+	if (spdk_unlikely(!rx_buf)) {
+		return -ENOMEM;
+	}
+
+	conn->rx_buf = rx_buf;
+	conn->rx_size = need;
+
+	return 0;
+}
+
+static int
+sto_srv_bin_conn_read(struct sto_srv_bin_conn *conn)
+{
+	int rc;
+
+	for (;;) {
+		ssize_t ret;
+
+		rc = sto_srv_bin_conn_rx_reserve(conn);
+		if (spdk_unlikely(rc)) {
+			return rc;
+		}
+
+		ret = read(conn->fd, conn->rx_buf + conn->rx_len, conn->rx_size - conn->rx_len);
+		if (ret == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+
+			return -errno;
+		}
+
+		if (!ret) {
+			return -ECONNRESET;
+		}
+
+		conn->rx_len += ret;
+
+		rc = sto_srv_bin_conn_process(conn);
+		if (spdk_unlikely(rc)) {
+			return rc;
+		}
+	}
+
+	return 0;
+}
+
+static int
+sto_srv_bin_conn_event(struct sto_srv_bin_conn *conn, uint32_t events)
+{
+	int rc;
+
+	/* A hangup or an error shows up as a failed read */
+	if (events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+		rc = sto_srv_bin_conn_read(conn);
+		if (rc) {
+			return rc;
+		}
+	}
+
+	rc = sto_srv_bin_conn_flush(conn);
+	if (spdk_unlikely(rc)) {
+		return rc;
+	}
+
+	return sto_srv_bin_conn_update_events(conn);
+}
+
+static void
+sto_srv_bin_accept(struct sto_srv_bin *bin)
+{
+	for (;;) {
+		struct sto_srv_bin_conn *conn;
+		struct epoll_event ev;
+		int fd;
+
+		fd = accept4(bin->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == -1) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+				printf("server: Failed to accept binary conn: %s\n", strerror(errno));
+			}
+
+			return;
+		}
+
+		if (bin->nr_conns == STO_SRV_BIN_MAX_CONNS) {
+			printf("server: Too many binary conns, reject\n");
+			close(fd);
+			continue;
+		}
+
+		conn = calloc(1, sizeof(*conn));
+		if (spdk_unlikely(!conn)) {
+			printf("server: Cann't allocate memory for binary conn\n");
+			close(fd);
+			continue;
+		}
+
+		conn->fd = fd;
+		conn->refcnt = 1;
+		conn->events = EPOLLIN;
+		TAILQ_INIT(&conn->tx_list);
+
+		ev.events = conn->events;
+		ev.data.ptr = conn;
+
+		if (spdk_unlikely(epoll_ctl(bin->epfd, EPOLL_CTL_ADD, fd, &ev) == -1)) {
+			printf("server: Failed to watch binary conn: %s\n", strerror(errno));
+			close(fd);
+			free(conn);
+			continue;
+		}
+
+		TAILQ_INSERT_TAIL(&bin->conns, conn, list);
+		bin->nr_conns++;
+	}
+}
+
+int
+sto_srv_bin_poll(void)
+{
+	struct sto_srv_bin *bin = &g_sto_srv_bin;
+	struct epoll_event events[STO_SRV_BIN_MAX_EVENTS];
+	int i, cnt, rc;
+
+	if (bin->listen_fd == -1) {
+		return 0;
+	}
+
+	cnt = epoll_wait(bin->epfd, events, SPDK_COUNTOF(events), 0);
+	if (cnt <= 0) {
+		return 0;
+	}
+
+	/* Replies sent while handling one event may close another connection */
+	for (i = 0; i < cnt; i++) {
+		struct sto_srv_bin_conn *conn = events[i].data.ptr;
+
+		if (conn) {
+			conn->refcnt++;
+		}
+	}
+
+	for (i = 0; i < cnt; i++) {
+		struct sto_srv_bin_conn *conn = events[i].data.ptr;
+
+		if (!conn) {
+			sto_srv_bin_accept(bin);
+			continue;
+		}
+
+		if (conn->fd == -1) {
+			continue;
+		}
+
+		rc = sto_srv_bin_conn_event(conn, events[i].events);
+		if (rc) {
+			if (rc != -ECONNRESET) {
+				printf("server: Binary conn failed, rc=%d\n", rc);
+			}
+
+			sto_srv_bin_conn_close(conn);
+		}
+	}
+
+	for (i = 0; i < cnt; i++) {
+		struct sto_srv_bin_conn *conn = events[i].data.ptr;
+
+		if (conn) {
+			sto_srv_bin_conn_put(conn);
+		}
+	}
+
+	return cnt;
+}
+
+int
+sto_srv_bin_init(const char *addr)
+{
+	struct sto_srv_bin *bin = &g_sto_srv_bin;
+	struct epoll_event ev = {
+		.events = EPOLLIN,
+		.data.ptr = NULL,
+	};
+	int fd, rc;
+
+	TAILQ_INIT(&bin->conns);
+
+	memset(&bin->addr, 0, sizeof(bin->addr));
+	bin->addr.sun_family = AF_UNIX;
+
+	rc = snprintf(bin->addr.sun_path, sizeof(bin->addr.sun_path), "%s", addr);
+	if (rc < 0 || (size_t) rc >= sizeof(bin->addr.sun_path)) {
+		printf("server: Binary listen address %s is too long\n", addr);
+		bin->addr.sun_path[0] = '\0';
+		return -EINVAL;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd == -1) {
+		printf("server: Failed to create binary socket: %s\n", strerror(errno));
+		return -errno;
+	}
+
+	/* The JSON-RPC listener lock already protects us from another server */
+	unlink(bin->addr.sun_path);
+
+	if (bind(fd, (struct sockaddr *) &bin->addr, sizeof(bin->addr)) == -1 ||
+	    listen(fd, STO_SRV_BIN_MAX_CONNS) == -1) {
+		printf("server: Failed to listen on %s: %s\n", addr, strerror(errno));
+		rc = -errno;
+		close(fd);
+		bin->addr.sun_path[0] = '\0';
+		return rc;
+	}
+
+	bin->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (bin->epfd == -1 || epoll_ctl(bin->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		printf("server: Failed to set up epoll for %s: %s\n", addr, strerror(errno));
+		rc = -errno;
+		goto out_err;
+	}
+
+	bin->listen_fd = fd;
+
+	return 0;
+
+out_err:
+	if (bin->epfd != -1) {
+		close(bin->epfd);
+		bin->epfd = -1;
+	}
+
+	close(fd);
+	unlink(bin->addr.sun_path);
+	bin->addr.sun_path[0] = '\0';
+
+	return rc;
+}
+
+void
+sto_srv_bin_fini(void)
+{
+	struct sto_srv_bin *bin = &g_sto_srv_bin;
+	struct sto_srv_bin_conn *conn, *tmp;
+
+	if (bin->listen_fd == -1) {
+		return;
+	}
+
+	TAILQ_FOREACH_SAFE(conn, &bin->conns, list, tmp) {
+		sto_srv_bin_conn_close(conn);
+	}
+
+	close(bin->listen_fd);
+	bin->listen_fd = -1;
+
+	close(bin->epfd);
+	bin->epfd = -1;
+
+	unlink(bin->addr.sun_path);
+	bin->addr.sun_path[0] = '\0';
+}
@@ -7,17 +7,17 @@
 #include "sto_srv_fs.h"
 #include "sto_srv_aio.h"
 #include "sto_srv_readdir.h"
+#include "sto_srv_tree.h"
 #include "sto_srv_subprocess.h"
-
-struct spdk_jsonrpc_request;
+#include "sto_shm.h"
 
 static void
 sto_srv_writefile_rpc_done(void *priv, int rc)
 {
-	struct spdk_jsonrpc_request *request = priv;
+	struct sto_rpc_request *request = priv;
 	struct spdk_json_write_ctx *w;
 
-	w = spdk_jsonrpc_begin_result(request);
+	w = sto_rpc_begin_result(request);
 
 	spdk_json_write_object_begin(w);
 
@@ -25,11 +25,11 @@ sto_srv_writefile_rpc_done(void *priv, int rc)
 
 	spdk_json_write_object_end(w);
 
-	spdk_jsonrpc_end_result(request, w);
+	sto_rpc_end_result(request, w);
 }
 
 static void
-sto_srv_writefile_rpc(struct spdk_jsonrpc_request *request,
+sto_srv_writefile_rpc(struct sto_rpc_request *request,
 		      const struct spdk_json_val *params)
 {
 	struct sto_srv_writefile_args args = {
@@ -40,7 +40,7 @@ sto_srv_writefile_rpc(struct spdk_jsonrpc_request *request,
 
 	rc = sto_srv_writefile(params, &args);
 	if (spdk_unlikely(rc)) {
-		spdk_jsonrpc_send_error_response(request, rc, strerror(-rc));
+		sto_rpc_send_error_response(request, rc, strerror(-rc));
 		goto out;
 	}
 
@@ -52,23 +52,30 @@ STO_RPC_REGISTER("writefile", sto_srv_writefile_rpc)
 static void
 sto_srv_readfile_rpc_done(void *priv, char *buf, int rc)
 {
-	struct spdk_jsonrpc_request *request = priv;
+	struct sto_rpc_request *request = priv;
 	struct spdk_json_write_ctx *w;
 
-	w = spdk_jsonrpc_begin_result(request);
+	w = sto_rpc_begin_result(request);
 
 	spdk_json_write_object_begin(w);
 
 	spdk_json_write_named_int32(w, "returncode", rc);
-	spdk_json_write_named_string(w, "buf", buf);
+
+	/* The slot is handed over, the control side releases it */
+	if (sto_shm_owns(buf)) {
+		spdk_json_write_named_uint64(w, "shm_off", sto_shm_offset(buf));
+		spdk_json_write_named_uint64(w, "shm_len", strlen(buf));
+	} else {
+		spdk_json_write_named_string(w, "buf", buf);
+	}
 
 	spdk_json_write_object_end(w);
 
-	spdk_jsonrpc_end_result(request, w);
+	sto_rpc_end_result(request, w);
 }
 
 static void
-sto_srv_readfile_rpc(struct spdk_jsonrpc_request *request,
+sto_srv_readfile_rpc(struct sto_rpc_request *request,
 		     const struct spdk_json_val *params)
 {
 	struct sto_srv_readfile_args args = {
@@ -79,7 +86,7 @@ sto_srv_readfile_rpc(struct spdk_jsonrpc_request *request,
 
 	rc = sto_srv_readfile(params, &args);
 	if (spdk_unlikely(rc)) {
-		spdk_jsonrpc_send_error_response(request, rc, strerror(-rc));
+		sto_rpc_send_error_response(request, rc, strerror(-rc));
 		goto out;
 	}
 
@@ -91,10 +98,10 @@ STO_RPC_REGISTER("readfile", sto_srv_readfile_rpc)
 static void
 sto_srv_readlink_rpc_done(void *priv, char *buf, int rc)
 {
-	struct spdk_jsonrpc_request *request = priv;
+	struct sto_rpc_request *request = priv;
 	struct spdk_json_write_ctx *w;
 
-	w = spdk_jsonrpc_begin_result(request);
+	w = sto_rpc_begin_result(request);
 
 	spdk_json_write_object_begin(w);
 
@@ -103,11 +110,11 @@ sto_srv_readlink_rpc_done(void *priv, char *buf, int rc)
 
 	spdk_json_write_object_end(w);
 
-	spdk_jsonrpc_end_result(request, w);
+	sto_rpc_end_result(request, w);
 }
 
 static void
-sto_srv_readlink_rpc(struct spdk_jsonrpc_request *request,
+sto_srv_readlink_rpc(struct sto_rpc_request *request,
 		     const struct spdk_json_val *params)
 {
 	struct sto_srv_readlink_args args = {
@@ -118,7 +125,7 @@ sto_srv_readlink_rpc(struct spdk_jsonrpc_request *request,
 
 	rc = sto_srv_readlink(params, &args);
 	if (spdk_unlikely(rc)) {
-		spdk_jsonrpc_send_error_response(request, rc, strerror(-rc));
+		sto_rpc_send_error_response(request, rc, strerror(-rc));
 		goto out;
 	}
 
@@ -127,13 +134,72 @@ out:
 }
 STO_RPC_REGISTER("readlink", sto_srv_readlink_rpc)
 
+static void
+sto_srv_multi_file_rpc_done(void *priv, struct sto_srv_multi_file_req *req)
+{
+	struct sto_rpc_request *request = priv;
+	struct spdk_json_write_ctx *w;
+
+	w = sto_rpc_begin_result(request);
+
+	spdk_json_write_object_begin(w);
+
+	sto_srv_multi_file_info_json(req, w);
+
+	spdk_json_write_object_end(w);
+
+	sto_rpc_end_result(request, w);
+}
+
+static void
+sto_srv_multi_writefile_rpc(struct sto_rpc_request *request,
+			    const struct spdk_json_val *params)
+{
+	struct sto_srv_multi_file_args args = {
+		.cb_arg = request,
+		.cb_fn = sto_srv_multi_file_rpc_done,
+	};
+	int rc;
+
+	rc = sto_srv_multi_writefile(params, &args);
+	if (spdk_unlikely(rc)) {
+		sto_rpc_send_error_response(request, rc, strerror(-rc));
+		goto out;
+	}
+
+out:
+	return;
+}
+STO_RPC_REGISTER("multi_writefile", sto_srv_multi_writefile_rpc)
+
+static void
+sto_srv_multi_readfile_rpc(struct sto_rpc_request *request,
+			   const struct spdk_json_val *params)
+{
+	struct sto_srv_multi_file_args args = {
+		.cb_arg = request,
+		.cb_fn = sto_srv_multi_file_rpc_done,
+	};
+	int rc;
+
+	rc = sto_srv_multi_readfile(params, &args);
+	if (spdk_unlikely(rc)) {
+		sto_rpc_send_error_response(request, rc, strerror(-rc));
+		goto out;
+	}
+
+out:
+	return;
+}
+STO_RPC_REGISTER("multi_readfile", sto_srv_multi_readfile_rpc)
+
 static void
 sto_srv_readdir_rpc_done(void *priv, struct sto_srv_dirents *dirents, int rc)
 {
-	struct spdk_jsonrpc_request *request = priv;
+	struct sto_rpc_request *request = priv;
 	struct spdk_json_write_ctx *w;
 
-	w = spdk_jsonrpc_begin_result(request);
+	w = sto_rpc_begin_result(request);
 
 	spdk_json_write_object_begin(w);
 
@@ -142,11 +208,11 @@ sto_srv_readdir_rpc_done(void *priv, struct sto_srv_dirents *dirents, int rc)
 
 	spdk_json_write_object_end(w);
 
-	spdk_jsonrpc_end_result(request, w);
+	sto_rpc_end_result(request, w);
 }
 
 static void
-sto_srv_readdir_rpc(struct spdk_jsonrpc_request *request,
+sto_srv_readdir_rpc(struct sto_rpc_request *request,
 		    const struct spdk_json_val *params)
 {
 	struct sto_srv_readdir_args args = {
@@ -157,7 +223,7 @@ sto_srv_readdir_rpc(struct spdk_jsonrpc_request *request,
 
 	rc = sto_srv_readdir(params, &args);
 	if (spdk_unlikely(rc)) {
-		spdk_jsonrpc_send_error_response(request, rc, strerror(-rc));
+		sto_rpc_send_error_response(request, rc, strerror(-rc));
 		goto out;
 	}
 
@@ -166,13 +232,52 @@ out:
 }
 STO_RPC_REGISTER("readdir", sto_srv_readdir_rpc)
 
+static void
+sto_srv_tree_rpc_done(void *priv, struct sto_srv_tree_node *tree_root, int rc)
+{
+	struct sto_rpc_request *request = priv;
+	struct spdk_json_write_ctx *w;
+
+	w = sto_rpc_begin_result(request);
+
+	spdk_json_write_object_begin(w);
+
+	spdk_json_write_named_int32(w, "returncode", rc);
+	sto_srv_tree_info_json(tree_root, w);
+
+	spdk_json_write_object_end(w);
+
+	sto_rpc_end_result(request, w);
+}
+
+static void
+sto_srv_tree_rpc(struct sto_rpc_request *request,
+		 const struct spdk_json_val *params)
+{
+	struct sto_srv_tree_args args = {
+		.cb_arg = request,
+		.cb_fn = sto_srv_tree_rpc_done,
+	};
+	int rc;
+
+	rc = sto_srv_tree(params, &args);
+	if (spdk_unlikely(rc)) {
+		sto_rpc_send_error_response(request, rc, strerror(-rc));
+		goto out;
+	}
+
+out:
+	return;
+}
+STO_RPC_REGISTER("tree", sto_srv_tree_rpc)
+
 static void
 sto_srv_subprocess_rpc_done(void *priv, char *output, int rc)
 {
-	struct spdk_jsonrpc_request *request = priv;
+	struct sto_rpc_request *request = priv;
 	struct spdk_json_write_ctx *w;
 
-	w = spdk_jsonrpc_begin_result(request);
+	w = sto_rpc_begin_result(request);
 
 	spdk_json_write_object_begin(w);
 
@@ -184,11 +289,11 @@ sto_srv_subprocess_rpc_done(void *priv, char *output, int rc)
 
 	spdk_json_write_object_end(w);
 
-	spdk_jsonrpc_end_result(request, w);
+	sto_rpc_end_result(request, w);
 }
 
 static void
-sto_srv_subprocess_rpc(struct spdk_jsonrpc_request *request,
+sto_srv_subprocess_rpc(struct sto_rpc_request *request,
 		       const struct spdk_json_val *params)
 {
 	struct sto_srv_subprocess_args args = {
@@ -199,7 +304,7 @@ sto_srv_subprocess_rpc(struct spdk_jsonrpc_request *request,
 
 	rc = sto_srv_subprocess(params, &args);
 	if (spdk_unlikely(rc)) {
-		spdk_jsonrpc_send_error_response(request, rc, strerror(-rc));
+		sto_rpc_send_error_response(request, rc, strerror(-rc));
 		goto out;
 	}
 
@@ -207,3 +312,21 @@ out:
 	return;
 }
 STO_RPC_REGISTER("subprocess", sto_srv_subprocess_rpc)
+
+static void
+sto_srv_rpc_get_stats(struct sto_rpc_request *request,
+		      const struct spdk_json_val *params)
+{
+	struct spdk_json_write_ctx *w;
+
+	w = sto_rpc_begin_result(request);
+
+	spdk_json_write_object_begin(w);
+
+	sto_rpc_stats_info_json(w);
+
+	spdk_json_write_object_end(w);
+
+	sto_rpc_end_result(request, w);
+}
+STO_RPC_REGISTER("rpc_get_stats", sto_srv_rpc_get_stats)